@@ -0,0 +1,200 @@
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "app_acquire.h"
+static const char *TAG = "APP_ACQUIRE";
+
+#define ACQUIRE_CHANNELS            2
+#define ACQUIRE_READ_ATTEMPTS       4
+#define ACQUIRE_BUTTERWORTH_Q       0.7071f
+
+/* ESP32 ADC digital controller output, type 1 */
+#define ACQUIRE_WORD_CHANNEL(w)     ((w) >> 12)
+#define ACQUIRE_WORD_DATA(w)        ((w) & 0xfff)
+
+typedef struct {
+    app_acquire_channel_t cfg;
+    app_median5_t median;
+    app_biquad_t biquad;
+    bool primed;                /* Median started from the first sample */
+    bool filtered;              /* Biquad started from the first output */
+    int32_t sum;                /* De-spiked samples of the output being decimated */
+    uint32_t summed;
+    float *out;                 /* The channel's array in the block */
+    size_t n;                   /* Outputs in the block */
+    size_t done;                /* Of those filtered and scaled */
+} acquire_chan_t;
+
+struct app_acquire {
+    app_acquire_cfg_t cfg;
+    app_biquad_coef_t coef;
+    uint32_t decimation;        /* Raw samples per output */
+    float mean_scale;           /* 1 / decimation */
+    acquire_chan_t chan[ACQUIRE_CHANNELS];     /* Pressure, flow */
+    app_acquire_block_t block;
+    size_t paired;              /* Outputs of the block both channels have, counted and published */
+    uint32_t latest_seq;        /* Odd while latest is written */
+    float latest[ACQUIRE_CHANNELS];
+    app_acquire_stats_t stats;
+};
+
+app_acquire_t *app_acquire_new(const app_acquire_cfg_t *config)
+{
+    if (config->rate_hz == 0 || config->raw_rate_hz % config->rate_hz != 0) {
+        ESP_LOGE(TAG, "Raw rate %u Hz is not a multiple of %u Hz", config->raw_rate_hz, config->rate_hz);
+        return NULL;
+    }
+    if (config->max_raw == 0 || config->cutoff_hz * 2 >= (float)config->rate_hz) {
+        ESP_LOGE(TAG, "Invalid configuration");
+        return NULL;
+    }
+    app_acquire_t *acq = calloc(1, sizeof(app_acquire_t));
+    if (acq == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        return NULL;
+    }
+    acq->cfg = *config;
+    acq->decimation = config->raw_rate_hz / config->rate_hz;
+    acq->mean_scale = 1.0f / acq->decimation;
+    app_biquad_lowpass(&acq->coef, (float)config->rate_hz, config->cutoff_hz, ACQUIRE_BUTTERWORTH_Q);
+    acq->chan[0].cfg = config->pressure;
+    acq->chan[0].out = acq->block.pressure;
+    acq->chan[1].cfg = config->flow;
+    acq->chan[1].out = acq->block.flow;
+    return acq;
+}
+
+void app_acquire_delete(app_acquire_t *acq)
+{
+    free(acq);
+}
+
+/* Filter and scale the channel's outputs not done yet, in place in the block */
+static void _acquire_filter(app_acquire_t *acq, acquire_chan_t *chan)
+{
+    float *out = chan->out + chan->done;
+    size_t n = chan->n - chan->done;
+    if (n == 0) {
+        return;
+    }
+    if (!chan->filtered) {
+        app_biquad_init(&chan->biquad, &acq->coef, out[0]);
+        chan->filtered = true;
+    }
+    app_biquad(&chan->biquad, &acq->coef, out, n);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (out[i] - chan->cfg.offset) * chan->cfg.scale;
+    }
+    chan->done = chan->n;
+}
+
+/* Count the outputs both channels have now and make the newest pair the control loop's */
+static void _acquire_pair(app_acquire_t *acq)
+{
+    acquire_chan_t *pressure = &acq->chan[0], *flow = &acq->chan[1];
+    size_t paired = pressure->done < flow->done ? pressure->done : flow->done;
+    if (paired == acq->paired) {
+        return;
+    }
+    acq->stats.outputs += paired - acq->paired;
+    acq->paired = paired;
+    uint32_t seq = acq->latest_seq;
+    __atomic_store_n(&acq->latest_seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    acq->latest[0] = acq->block.pressure[paired - 1];
+    acq->latest[1] = acq->block.flow[paired - 1];
+    __atomic_store_n(&acq->latest_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Both channels filled the block: finish it, hand it over and start the next in its place */
+static void _acquire_block(app_acquire_t *acq)
+{
+    for (int c = 0; c < ACQUIRE_CHANNELS; c++) {
+        _acquire_filter(acq, &acq->chan[c]);
+    }
+    _acquire_pair(acq);
+    if (acq->cfg.on_block) {
+        acq->cfg.on_block(&acq->block, acq->cfg.arg);
+    }
+    acq->block.seq++;
+    acq->stats.blocks++;
+    acq->paired = 0;
+    for (int c = 0; c < ACQUIRE_CHANNELS; c++) {
+        acq->chan[c].n = acq->chan[c].done = 0;
+    }
+}
+
+esp_err_t app_acquire_process(app_acquire_t *acq, const uint16_t *raw, size_t n)
+{
+    if (n > acq->cfg.max_raw) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    int64_t start = esp_timer_get_time();
+    acquire_chan_t *pressure = &acq->chan[0], *flow = &acq->chan[1];
+    uint32_t factor = acq->decimation;
+
+    /* Each word de-spiked and summed as it comes, every factor-th sum a mean in the block */
+    for (size_t i = 0; i < n; i++) {
+        uint8_t channel = ACQUIRE_WORD_CHANNEL(raw[i]);
+        acquire_chan_t *chan = channel == pressure->cfg.channel ? pressure :
+                               channel == flow->cfg.channel ? flow : NULL;
+        if (chan == NULL) {
+            acq->stats.unknown++;
+            continue;
+        }
+        int32_t x = ACQUIRE_WORD_DATA(raw[i]);
+        if (!chan->primed) {
+            app_median5_init(&chan->median, x);
+            chan->primed = true;
+        }
+        chan->sum += app_median5_step(&chan->median, x);
+        if (++chan->summed < factor) {
+            continue;
+        }
+        if (chan->n == APP_ACQUIRE_BLOCK_SAMPLES) {
+            /* A whole block ahead of the other channel */
+            acq->stats.dropped += factor;
+        } else {
+            chan->out[chan->n++] = chan->sum * acq->mean_scale;
+        }
+        chan->sum = 0;
+        chan->summed = 0;
+        if (pressure->n == APP_ACQUIRE_BLOCK_SAMPLES && flow->n == APP_ACQUIRE_BLOCK_SAMPLES) {
+            _acquire_block(acq);
+        }
+    }
+    acq->stats.raw += n;
+
+    for (int c = 0; c < ACQUIRE_CHANNELS; c++) {
+        _acquire_filter(acq, &acq->chan[c]);
+    }
+    _acquire_pair(acq);
+    acq->stats.process_time_us += esp_timer_get_time() - start;
+    return ESP_OK;
+}
+
+void app_acquire_control_read(app_control_input_t *in, void *arg)
+{
+    app_acquire_t *acq = arg;
+    for (int attempt = 0; attempt < ACQUIRE_READ_ATTEMPTS; attempt++) {
+        uint32_t seq = __atomic_load_n(&acq->latest_seq, __ATOMIC_ACQUIRE);
+        in->pressure = acq->latest[0];
+        in->flow = acq->latest[1];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (!(seq & 1) && __atomic_load_n(&acq->latest_seq, __ATOMIC_RELAXED) == seq) {
+            return;
+        }
+    }
+    /* Torn every time: the writer comes by once a buffer, keep the last copy */
+}
+
+void app_acquire_get_stats(app_acquire_t *acq, app_acquire_stats_t *stats)
+{
+    *stats = acq->stats;
+}
+
+void app_acquire_overflow(app_acquire_t *acq)
+{
+    acq->stats.overflows++;
+}
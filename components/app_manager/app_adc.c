@@ -0,0 +1,126 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "esp_log.h"
+#include "esp_idf_version.h"
+#include "driver/i2s.h"
+#include "driver/adc.h"
+#include "app_acquire.h"
+static const char *TAG = "APP_ADC";
+
+/*
+ * The ESP32 routes ADC1 through I2S0 for DMA. The digital controller
+ * alternates between the two channels of its pattern table and tags every
+ * 16 bit word with the channel, app_acquire sorts them out.
+ */
+#define ADC_I2S_PORT                I2S_NUM_0
+#define ADC_ATTEN                   ADC_ATTEN_DB_11
+#define ADC_CHANNELS                2
+/* Outputs per DMA buffer: small buffers keep the control loop's input fresh */
+#define ADC_OUTPUTS_PER_BUF         2
+#define ADC_DMA_BUF_COUNT           8
+#define ADC_EVENT_QUEUE_LEN         8
+
+typedef struct {
+    app_acquire_t *acq;
+    QueueHandle_t events;
+    size_t buf_words;
+} adc_task_arg_t;
+
+static adc_task_arg_t s_adc;
+
+static void _adc_task(void *pv)
+{
+    adc_task_arg_t *adc = pv;
+    uint16_t *buf = malloc(adc->buf_words * sizeof(uint16_t));
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        vTaskDelete(NULL);
+        return;
+    }
+    while (true) {
+        size_t bytes = 0;
+        if (i2s_read(ADC_I2S_PORT, buf, adc->buf_words * sizeof(uint16_t), &bytes, portMAX_DELAY) != ESP_OK) {
+            continue;
+        }
+        app_acquire_process(adc->acq, buf, bytes / sizeof(uint16_t));
+
+        i2s_event_t event;
+        while (xQueueReceive(adc->events, &event, 0) == pdTRUE) {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+            if (event.type == I2S_EVENT_RX_Q_OVF) {
+                app_acquire_overflow(adc->acq);
+            }
+#endif
+            if (event.type == I2S_EVENT_DMA_ERROR) {
+                ESP_LOGW(TAG, "DMA error");
+            }
+        }
+    }
+}
+
+esp_err_t app_adc_start(app_acquire_t *acq, const app_acquire_cfg_t *config, int priority, int core)
+{
+    if (s_adc.acq) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_adc.buf_words = ADC_OUTPUTS_PER_BUF * (config->raw_rate_hz / config->rate_hz) * ADC_CHANNELS;
+    if (s_adc.buf_words > config->max_raw) {
+        ESP_LOGE(TAG, "A DMA buffer of %u words exceeds max_raw", s_adc.buf_words);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    i2s_config_t i2s_cfg = {
+        .mode = I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN,
+        .sample_rate = config->raw_rate_hz * ADC_CHANNELS,
+        .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+        .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
+        .communication_format = I2S_COMM_FORMAT_STAND_I2S,
+        .intr_alloc_flags = 0,
+        .dma_buf_count = ADC_DMA_BUF_COUNT,
+        .dma_buf_len = s_adc.buf_words,
+        .use_apll = false,
+    };
+    esp_err_t ret = i2s_driver_install(ADC_I2S_PORT, &i2s_cfg, ADC_EVENT_QUEUE_LEN, &s_adc.events);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "i2s_driver_install failed (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+    adc1_config_width(ADC_WIDTH_BIT_12);
+    adc1_config_channel_atten(config->pressure.channel, ADC_ATTEN);
+    adc1_config_channel_atten(config->flow.channel, ADC_ATTEN);
+    i2s_set_adc_mode(ADC_UNIT_1, config->pressure.channel);
+
+    adc_digi_pattern_table_t pattern[ADC_CHANNELS] = {
+        { .atten = ADC_ATTEN, .bit_width = ADC_WIDTH_BIT_12, .channel = config->pressure.channel },
+        { .atten = ADC_ATTEN, .bit_width = ADC_WIDTH_BIT_12, .channel = config->flow.channel },
+    };
+    adc_digi_config_t digi_cfg = {
+        .conv_limit_en = false,
+        .adc1_pattern_len = ADC_CHANNELS,
+        .adc1_pattern = pattern,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_FORMAT_12BIT,
+    };
+    ret = adc_digi_controller_config(&digi_cfg);
+    if (ret == ESP_OK) {
+        ret = i2s_adc_enable(ADC_I2S_PORT);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "ADC setup failed (%s)", esp_err_to_name(ret));
+        goto _adc_start_fail;
+    }
+    s_adc.acq = acq;
+    if (xTaskCreatePinnedToCore(_adc_task, "adc_task", 3 * 1024, &s_adc, priority, NULL, core) != pdPASS) {
+        ESP_LOGE(TAG, "error creating adc task");
+        s_adc.acq = NULL;
+        ret = ESP_FAIL;
+        goto _adc_start_fail;
+    }
+    ESP_LOGI(TAG, "ADC1 channels %d and %d at %u Hz each, %u words per DMA buffer", config->pressure.channel,
+             config->flow.channel, config->raw_rate_hz, s_adc.buf_words);
+    return ESP_OK;
+
+_adc_start_fail:
+    i2s_driver_uninstall(ADC_I2S_PORT);
+    return ret;
+}
@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "app_arena.h"
+
+#define ARENA_ALIGN             8
+#define ARENA_ALIGN_UP(x)       (((x) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static void *_arena_alloc(void *allocator_data, size_t size)
+{
+    app_arena_t *arena = allocator_data;
+    size_t aligned = ARENA_ALIGN_UP(size);
+    if (aligned > arena->size - arena->used) {
+        arena->overflows++;
+        return NULL;
+    }
+    void *ptr = arena->buf + arena->used;
+    arena->used += aligned;
+    if (arena->used > arena->high_water) {
+        arena->high_water = arena->used;
+    }
+    return ptr;
+}
+
+static void _arena_free(void *allocator_data, void *pointer)
+{
+    (void)allocator_data;
+    (void)pointer;
+    /* Released all at once by app_arena_reset() */
+}
+
+esp_err_t app_arena_init(app_arena_t *arena, size_t size)
+{
+    memset(arena, 0, sizeof(app_arena_t));
+    arena->size = ARENA_ALIGN_UP(size);
+    arena->buf = malloc(arena->size);
+    if (arena->buf == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    arena->allocator.alloc = _arena_alloc;
+    arena->allocator.free = _arena_free;
+    arena->allocator.allocator_data = arena;
+    return ESP_OK;
+}
+
+void app_arena_deinit(app_arena_t *arena)
+{
+    free(arena->buf);
+    arena->buf = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+void app_arena_reset(app_arena_t *arena)
+{
+    arena->used = 0;
+}
@@ -0,0 +1,396 @@
+#include <stdlib.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "app_control.h"
+#include "app_signal.h"
+#if defined(__XTENSA__)
+#include <xtensa/hal.h>
+#endif
+static const char *TAG = "APP_CONTROL";
+
+/* CPU cycle counter, the host build's time stamp counter */
+#if defined(__XTENSA__)
+#define CONTROL_CYCLES()            ((uint32_t)xthal_get_ccount())
+#elif defined(__x86_64__) || defined(__i386__)
+#define CONTROL_CYCLES()            ((uint32_t)__builtin_ia32_rdtsc())
+#else
+#define CONTROL_CYCLES()            0u
+#endif
+
+/* Inspiratory flow, inlet opening per L/min of error */
+#define CONTROL_FLOW_KP             0.01f
+#define CONTROL_FLOW_KI             0.4f
+/* Pressure, opening per cmH2O of error */
+#define CONTROL_PRESSURE_KP         0.2f
+#define CONTROL_PRESSURE_KI         4.0f
+/* Inlet opening during expiration, the bias flow a patient effort shows in */
+#define CONTROL_BIAS_INLET          0.05f
+/* No VAC trigger this early in expiration */
+#define CONTROL_TRIGGER_REFRACTORY_US   300000
+#define CONTROL_TEST_TIMEOUT_US     5000000
+/* Start of the test hold left out, the pressure settles when the inlet closes */
+#define CONTROL_TEST_SETTLE_US      200000
+#define CONTROL_TEST_VENTED         1.0f
+
+
+static void _phase(app_control_state_t *st, app_control_phase_t phase)
+{
+    st->phase = phase;
+    st->phase_us = 0;
+    st->integral = 0;
+}
+
+static void _inspire(app_control_state_t *st)
+{
+    if (st->breaths) {
+        st->last_breath_ms = st->breath_us / 1000;
+    }
+    st->breaths++;
+    st->breath_us = 0;
+    st->volume_ml = 0;
+    _phase(st, APP_CONTROL_PHASE_INSPIRATION);
+}
+
+static void _expire(app_control_state_t *st)
+{
+    st->last_tidal_ml = st->volume_ml;
+    st->last_in_time_ms = st->breath_us / 1000;
+    _phase(st, APP_CONTROL_PHASE_EXPIRATION);
+}
+
+/* Kernels every mode's step is built from, inlined so each step is compiled on its own */
+#define CONTROL_KERNEL              static inline __attribute__((always_inline))
+
+/* Net volume since the breath started, what is left of it after inspiration */
+CONTROL_KERNEL void _integrate_volume(app_control_state_t *st, const app_control_input_t *in)
+{
+    app_integrate(&st->volume_ml, in->flow, st->flow_scale);
+    if (st->volume_ml < 0) {
+        st->volume_ml = 0;
+    }
+}
+
+CONTROL_KERNEL void _advance(app_control_state_t *st)
+{
+    st->phase_us += st->period_us;
+    st->breath_us += st->period_us;
+}
+
+/* Expiration of CMV and VAC: hold peep with the outlet over a small bias flow */
+CONTROL_KERNEL void _peep(app_control_state_t *st, const app_control_input_t *in, app_control_output_t *out)
+{
+    out->inlet = CONTROL_BIAS_INLET;
+    out->outlet = app_pi(&st->integral, in->pressure - st->set.peep, CONTROL_PRESSURE_KP, st->pressure_ki_dt, 0, 1);
+}
+
+/* CMV, and VAC with `vac`: a constant in each step, so the trigger is compiled in or left out */
+CONTROL_KERNEL void _mandatory(app_control_state_t *st, const app_control_input_t *in, app_control_output_t *out,
+                               const bool vac)
+{
+    _integrate_volume(st, in);
+    switch (st->phase) {
+        case APP_CONTROL_PHASE_INSPIRATION:
+            out->inlet = app_pi(&st->integral, st->target_lpm - in->flow, CONTROL_FLOW_KP, st->flow_ki_dt, 0, 1);
+            out->outlet = 0;
+            if (in->pressure > st->set.max_pressure || st->breath_us >= st->in_time_us) {
+                _expire(st);
+            } else if (st->volume_ml >= st->set.tidal_ml) {
+                _phase(st, APP_CONTROL_PHASE_HOLD);
+            }
+            break;
+        case APP_CONTROL_PHASE_HOLD:
+            out->inlet = 0;
+            out->outlet = 0;
+            if (in->pressure > st->set.max_pressure || st->breath_us >= st->in_time_us) {
+                _expire(st);
+            }
+            break;
+        default:
+            _peep(st, in, out);
+            if (st->breath_us >= st->breath_period_us) {
+                _inspire(st);
+            } else if (vac && st->phase_us >= CONTROL_TRIGGER_REFRACTORY_US && in->flow > st->set.trigger_lpm) {
+                st->triggered++;
+                _inspire(st);
+            }
+            break;
+    }
+    _advance(st);
+}
+
+static void _step_cmv(app_control_state_t *st, const app_control_input_t *in, app_control_output_t *out)
+{
+    _mandatory(st, in, out, false);
+}
+
+static void _step_vac(app_control_state_t *st, const app_control_input_t *in, app_control_output_t *out)
+{
+    _mandatory(st, in, out, true);
+}
+
+static void _step_cpap(app_control_state_t *st, const app_control_input_t *in, app_control_output_t *out)
+{
+    _integrate_volume(st, in);
+    /* One controller for both valves: above 0 the inlet opens, below it the outlet */
+    float u = app_pi(&st->integral, st->set.cpap - in->pressure, CONTROL_PRESSURE_KP, st->pressure_ki_dt, -1, 1);
+    out->inlet = u > 0 ? u : 0;
+    out->outlet = u < 0 ? -u : 0;
+    /* Breaths are only measured, from the direction of the flow */
+    float integral = st->integral;
+    if (st->phase != APP_CONTROL_PHASE_INSPIRATION && in->flow > st->set.trigger_lpm) {
+        _inspire(st);
+    } else if (st->phase == APP_CONTROL_PHASE_INSPIRATION && in->flow < -st->set.trigger_lpm) {
+        _expire(st);
+    }
+    st->integral = integral;
+    _advance(st);
+}
+
+/* No patient on the circuit, no volume to count */
+static void _step_test(app_control_state_t *st, const app_control_input_t *in, app_control_output_t *out)
+{
+    switch (st->phase) {
+        case APP_CONTROL_PHASE_TEST_PRESSURIZE:
+            out->inlet = 1;
+            out->outlet = 0;
+            if (in->pressure >= st->set.test_pressure) {
+                _phase(st, APP_CONTROL_PHASE_TEST_HOLD);
+            } else if (st->phase_us >= CONTROL_TEST_TIMEOUT_US) {
+                ESP_LOGW(TAG, "Test: %.1f cmH2O not reached", (double)st->set.test_pressure);
+                st->test = APP_CONTROL_TEST_FAIL;
+                _phase(st, APP_CONTROL_PHASE_TEST_VENT);
+            }
+            break;
+        case APP_CONTROL_PHASE_TEST_HOLD:
+            out->inlet = 0;
+            out->outlet = 0;
+            if (st->phase_us >= CONTROL_TEST_SETTLE_US && st->phase_us < CONTROL_TEST_SETTLE_US + st->period_us) {
+                st->test_start = in->pressure;
+            } else if (st->phase_us >= st->test_end_us) {
+                st->test = st->test_start - in->pressure <= st->set.test_max_leak ? APP_CONTROL_TEST_PASS :
+                           APP_CONTROL_TEST_FAIL;
+                _phase(st, APP_CONTROL_PHASE_TEST_VENT);
+            }
+            break;
+        case APP_CONTROL_PHASE_TEST_VENT:
+            out->inlet = 0;
+            out->outlet = 1;
+            if (in->pressure < CONTROL_TEST_VENTED) {
+                _phase(st, APP_CONTROL_PHASE_TEST_DONE);
+            }
+            break;
+        default:
+            out->inlet = 0;
+            out->outlet = 1;
+            break;
+    }
+    _advance(st);
+}
+
+void app_control_init(app_control_state_t *st, WorkingMode mode, const app_control_settings_t *set,
+                      uint32_t period_us)
+{
+    float dt = period_us * 1e-6f;
+    *st = (app_control_state_t) {
+        .mode = mode,
+        .set = *set,
+        .period_us = period_us,
+        .flow_scale = period_us * (1000.0f / 60 / 1e6f),
+        .flow_ki_dt = CONTROL_FLOW_KI * dt,
+        .pressure_ki_dt = CONTROL_PRESSURE_KI * dt,
+        .target_lpm = set->tidal_ml * 60.0f / set->in_time_ms,
+        .in_time_us = set->in_time_ms * 1000,
+        .breath_period_us = 60000000 / set->rate_bpm,
+        .test_end_us = CONTROL_TEST_SETTLE_US + set->test_hold_ms * 1000,
+    };
+    switch (mode) {
+        case WORKING_MODE__TEST:
+            st->step = _step_test;
+            _phase(st, APP_CONTROL_PHASE_TEST_PRESSURIZE);
+            break;
+        case WORKING_MODE__CPAP:
+            st->step = _step_cpap;
+            _phase(st, APP_CONTROL_PHASE_EXPIRATION);
+            break;
+        case WORKING_MODE__VAC:
+            st->step = _step_vac;
+            _inspire(st);
+            break;
+        default:
+            st->step = _step_cmv;
+            _inspire(st);
+            break;
+    }
+}
+
+void app_control_step(app_control_state_t *st, const app_control_input_t *in, app_control_output_t *out)
+{
+    st->step(st, in, out);
+}
+
+uint32_t app_control_hist_limit(int bin)
+{
+    return bin == 0 ? 0 : (1u << bin) - 1;
+}
+
+static inline void _hist_add(app_control_hist_t *hist, int64_t us)
+{
+    uint32_t v = us > 0 ? (us < UINT32_MAX ? (uint32_t)us : UINT32_MAX) : 0;
+    int bin = v ? 32 - __builtin_clz(v) : 0;
+    hist->bins[bin < APP_CONTROL_HIST_BINS ? bin : APP_CONTROL_HIST_BINS - 1]++;
+    if (v > hist->max_us) {
+        hist->max_us = v;
+    }
+}
+
+struct app_control {
+    app_control_state_t state;
+    app_control_settings_t settings;
+    app_control_read_fn read;
+    app_control_write_fn write;
+    void *arg;
+    TickType_t period;
+    volatile WorkingMode mode;  /* Requested, picked up at the start of a period */
+    volatile bool run;
+    QueueHandle_t done_queue;   /* Signalled by the task when it exits */
+    app_control_stats_t stats;
+};
+
+static void _control_task(void *pv)
+{
+    app_control_t *ctl = pv;
+    uint32_t period_us = ctl->period * portTICK_PERIOD_MS * 1000;
+    TickType_t wake = xTaskGetTickCount();
+    int64_t due = 0;
+    while (ctl->run) {
+        vTaskDelayUntil(&wake, ctl->period);
+        int64_t start = esp_timer_get_time();
+        /* Due times count from the first wake-up, not from the tick the first period began at */
+        due = due ? due + period_us : start;
+        _hist_add(&ctl->stats.jitter, start - due);
+
+        WorkingMode mode = ctl->mode;
+        app_control_cycles_t *cycles = &ctl->stats.step[ctl->state.mode];
+        if (mode != ctl->state.mode) {
+            ESP_LOGI(TAG, "Mode %d -> %d, step %u cycles mean, %u max", ctl->state.mode, mode,
+                     cycles->steps ? (uint32_t)(cycles->cycles / cycles->steps) : 0, cycles->max_cycles);
+            app_control_init(&ctl->state, mode, &ctl->settings, period_us);
+            ctl->stats.mode_changes++;
+            cycles = &ctl->stats.step[mode];
+        }
+        app_control_input_t in = { 0 };
+        app_control_output_t out;
+        if (ctl->read) {
+            ctl->read(&in, ctl->arg);
+        }
+        uint32_t c0 = CONTROL_CYCLES();
+        ctl->state.step(&ctl->state, &in, &out);
+        uint32_t step_cycles = CONTROL_CYCLES() - c0;
+        cycles->steps++;
+        cycles->cycles += step_cycles;
+        if (step_cycles > cycles->max_cycles) {
+            cycles->max_cycles = step_cycles;
+        }
+        if (ctl->write) {
+            ctl->write(&out, ctl->arg);
+        }
+
+        int64_t end = esp_timer_get_time();
+        _hist_add(&ctl->stats.exec, end - start);
+        if (end > due + period_us) {
+            ctl->stats.overruns++;
+        }
+        ctl->stats.periods++;
+    }
+    /* Leave the patient circuit vented */
+    app_control_output_t safe = { .inlet = 0, .outlet = 1 };
+    if (ctl->write) {
+        ctl->write(&safe, ctl->arg);
+    }
+    bool done = true;
+    xQueueSend(ctl->done_queue, &done, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+app_control_t *app_control_start(const app_control_cfg_t *config)
+{
+    if (config->rate_hz == 0 || configTICK_RATE_HZ % config->rate_hz != 0) {
+        ESP_LOGE(TAG, "Rate %u Hz does not divide the tick rate", config->rate_hz);
+        return NULL;
+    }
+    app_control_t *ctl = calloc(1, sizeof(app_control_t));
+    if (ctl == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        return NULL;
+    }
+    ctl->done_queue = xQueueCreate(1, sizeof(bool));
+    if (ctl->done_queue == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        goto _control_start_fail;
+    }
+    ctl->settings = config->settings;
+    ctl->read = config->read;
+    ctl->write = config->write;
+    ctl->arg = config->arg;
+    ctl->period = configTICK_RATE_HZ / config->rate_hz;
+    ctl->mode = config->mode;
+    app_control_init(&ctl->state, config->mode, &ctl->settings, ctl->period * portTICK_PERIOD_MS * 1000);
+    ctl->run = true;
+    if (xTaskCreatePinnedToCore(_control_task, "control_task", 3 * 1024, ctl, config->priority, NULL,
+                                config->core) != pdPASS) {
+        ESP_LOGE(TAG, "error creating control task");
+        goto _control_start_fail;
+    }
+    return ctl;
+
+_control_start_fail:
+    if (ctl->done_queue) {
+        vQueueDelete(ctl->done_queue);
+    }
+    free(ctl);
+    return NULL;
+}
+
+void app_control_stop(app_control_t *ctl)
+{
+    if (ctl == NULL) {
+        return;
+    }
+    ctl->run = false;
+    bool done;
+    xQueueReceive(ctl->done_queue, &done, portMAX_DELAY);
+    vQueueDelete(ctl->done_queue);
+    free(ctl);
+}
+
+esp_err_t app_control_set_mode(app_control_t *ctl, WorkingMode mode)
+{
+    if (mode < WORKING_MODE__CMV || mode > WORKING_MODE__TEST) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ctl->mode = mode;
+    return ESP_OK;
+}
+
+WorkingMode app_control_get_mode(app_control_t *ctl)
+{
+    return ctl->mode;
+}
+
+void app_control_get_stats(app_control_t *ctl, app_control_stats_t *stats)
+{
+    *stats = ctl->stats;
+}
+
+void app_control_sample(app_sample_t *sample, void *arg)
+{
+    app_control_t *ctl = arg;
+    uint32_t breath_ms = ctl->state.last_breath_ms;
+    sample->volume = ctl->state.volume_ml;
+    sample->frequency = breath_ms ? (60000 + breath_ms / 2) / breath_ms : 0;
+    sample->breath_in_time = ctl->state.last_in_time_ms / 1000.0f;
+}
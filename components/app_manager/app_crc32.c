@@ -0,0 +1,63 @@
+#include "app_crc32.h"
+
+#ifdef ESP_PLATFORM
+#include "esp32/rom/crc.h"
+
+uint32_t app_crc32_update(uint32_t crc, const void *data, size_t len)
+{
+    return crc32_le(crc, data, len);
+}
+
+#else
+
+#define CRC32_POLY      0xedb88320
+
+static uint32_t s_crc_table[8][256];
+static int s_crc_table_ready;
+
+static void _crc32_init_table(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+        }
+        s_crc_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            s_crc_table[t][i] = (s_crc_table[t - 1][i] >> 8) ^ s_crc_table[0][s_crc_table[t - 1][i] & 0xff];
+        }
+    }
+    s_crc_table_ready = 1;
+}
+
+/* Slicing-by-8, little endian hosts */
+uint32_t app_crc32_update(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    if (!s_crc_table_ready) {
+        _crc32_init_table();
+    }
+    crc = ~crc;
+    while (len > 0 && ((uintptr_t)p & 7)) {
+        crc = (crc >> 8) ^ s_crc_table[0][(crc ^ *p++) & 0xff];
+        len--;
+    }
+    while (len >= 8) {
+        uint32_t lo = *(const uint32_t *)p ^ crc;
+        uint32_t hi = *(const uint32_t *)(p + 4);
+        crc = s_crc_table[7][lo & 0xff] ^ s_crc_table[6][(lo >> 8) & 0xff] ^
+              s_crc_table[5][(lo >> 16) & 0xff] ^ s_crc_table[4][lo >> 24] ^
+              s_crc_table[3][hi & 0xff] ^ s_crc_table[2][(hi >> 8) & 0xff] ^
+              s_crc_table[1][(hi >> 16) & 0xff] ^ s_crc_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ s_crc_table[0][(crc ^ *p++) & 0xff];
+    }
+    return ~crc;
+}
+
+#endif
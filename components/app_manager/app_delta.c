@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "app_delta.h"
+#include "app_crc32.h"
+static const char *TAG = "APP_DELTA";
+
+#define DELTA_OUT_SIZE      256
+
+typedef enum {
+    DELTA_CTRL,
+    DELTA_DIFF,
+    DELTA_EXTRA,
+} delta_state_t;
+
+struct app_delta {
+    const esp_partition_t *source;
+    uint32_t source_size;
+    uint8_t *cache;             /* source[cache_offset, cache_offset + cache_len) */
+    size_t cache_size;
+    uint32_t cache_offset;
+    uint32_t cache_len;
+    delta_state_t state;
+    int field;                  /* Control field being parsed: diff_len, extra_len, seek */
+    uint32_t ctrl[3];
+    int shift;
+    uint32_t remaining;         /* Bytes left of the diff or extra part */
+    int64_t pos;                /* Source position */
+    uint8_t out[DELTA_OUT_SIZE];
+};
+
+app_delta_t *app_delta_new(size_t cache_size)
+{
+    app_delta_t *delta = calloc(1, sizeof(app_delta_t));
+    if (delta == NULL) {
+        return NULL;
+    }
+    delta->cache_size = cache_size;
+    delta->cache = malloc(cache_size);
+    if (delta->cache == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        free(delta);
+        return NULL;
+    }
+    return delta;
+}
+
+void app_delta_delete(app_delta_t *delta)
+{
+    if (delta) {
+        free(delta->cache);
+        free(delta);
+    }
+}
+
+/* Make source[pos] the start of the cache unless it is cached already, returns the bytes available */
+static size_t _delta_source(app_delta_t *delta, uint32_t pos, const uint8_t **src)
+{
+    if (pos < delta->cache_offset || pos >= delta->cache_offset + delta->cache_len) {
+        uint32_t len = delta->source_size - pos;
+        if (len > delta->cache_size) {
+            len = delta->cache_size;
+        }
+        delta->cache_len = 0;
+        if (esp_partition_read(delta->source, pos, delta->cache, len) != ESP_OK) {
+            ESP_LOGE(TAG, "Error reading source at %d", pos);
+            return 0;
+        }
+        delta->cache_offset = pos;
+        delta->cache_len = len;
+    }
+    *src = delta->cache + (pos - delta->cache_offset);
+    return delta->cache_offset + delta->cache_len - pos;
+}
+
+esp_err_t app_delta_reset(app_delta_t *delta, const esp_partition_t *source, uint32_t source_size, uint32_t source_crc)
+{
+    if (source == NULL || source_size > source->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    delta->source = source;
+    delta->source_size = source_size;
+    delta->cache_offset = 0;
+    delta->cache_len = 0;
+    uint32_t crc = 0;
+    for (uint32_t pos = 0; pos < source_size;) {
+        const uint8_t *src;
+        size_t n = _delta_source(delta, pos, &src);
+        if (n == 0) {
+            return ESP_FAIL;
+        }
+        crc = app_crc32_update(crc, src, n);
+        pos += n;
+    }
+    if (crc != source_crc) {
+        ESP_LOGE(TAG, "Patch is for another image, source CRC-32 %08x, expected %08x", crc, source_crc);
+        return ESP_ERR_INVALID_CRC;
+    }
+    delta->state = DELTA_CTRL;
+    delta->field = 0;
+    delta->shift = 0;
+    delta->ctrl[0] = 0;
+    delta->pos = 0;
+    return ESP_OK;
+}
+
+/* The diff part of the record is done, go on with its extra part or the next record */
+static void _delta_next(app_delta_t *delta)
+{
+    if (delta->state == DELTA_DIFF && delta->ctrl[1] > 0) {
+        delta->state = DELTA_EXTRA;
+        delta->remaining = delta->ctrl[1];
+        return;
+    }
+    int32_t seek = (delta->ctrl[2] >> 1) ^ -(int32_t)(delta->ctrl[2] & 1);
+    delta->pos += seek;
+    delta->state = DELTA_CTRL;
+    delta->field = 0;
+    delta->shift = 0;
+    delta->ctrl[0] = 0;
+}
+
+esp_err_t app_delta_apply(app_delta_t *delta, const uint8_t *in, size_t len, app_delta_write_fn write, void *arg)
+{
+    const uint8_t *end = in + len;
+    esp_err_t err = ESP_OK;
+
+    while (in < end && err == ESP_OK) {
+        switch (delta->state) {
+            case DELTA_CTRL: {
+                uint8_t b = *in++;
+                if (delta->shift > 28) {
+                    ESP_LOGE(TAG, "Bad varint");
+                    return ESP_ERR_INVALID_ARG;
+                }
+                delta->ctrl[delta->field] |= (uint32_t)(b & 0x7f) << delta->shift;
+                delta->shift += 7;
+                if (b & 0x80) {
+                    break;
+                }
+                delta->shift = 0;
+                if (++delta->field < 3) {
+                    delta->ctrl[delta->field] = 0;
+                    break;
+                }
+                delta->state = DELTA_DIFF;
+                delta->remaining = delta->ctrl[0];
+                if (delta->remaining == 0) {
+                    _delta_next(delta);
+                }
+                break;
+            }
+            case DELTA_DIFF: {
+                size_t n = end - in;
+                n = n < delta->remaining ? n : delta->remaining;
+                n = n < DELTA_OUT_SIZE ? n : DELTA_OUT_SIZE;
+                if (delta->pos < 0 || delta->pos + n > delta->source_size) {
+                    ESP_LOGE(TAG, "Patch reads source at %lld, past its end", (long long)delta->pos);
+                    return ESP_ERR_INVALID_ARG;
+                }
+                const uint8_t *src;
+                size_t avail = _delta_source(delta, delta->pos, &src);
+                if (avail == 0) {
+                    return ESP_FAIL;
+                }
+                n = n < avail ? n : avail;
+                for (size_t i = 0; i < n; i++) {
+                    delta->out[i] = src[i] + in[i];
+                }
+                err = write(arg, delta->out, n);
+                in += n;
+                delta->pos += n;
+                delta->remaining -= n;
+                if (delta->remaining == 0) {
+                    _delta_next(delta);
+                }
+                break;
+            }
+            case DELTA_EXTRA: {
+                size_t n = end - in;
+                n = n < delta->remaining ? n : delta->remaining;
+                err = write(arg, in, n);
+                in += n;
+                delta->remaining -= n;
+                if (delta->remaining == 0) {
+                    _delta_next(delta);
+                }
+                break;
+            }
+        }
+    }
+    return err;
+}
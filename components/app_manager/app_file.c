@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include "esp_log.h"
+#include "app_manager.h"
+#include "app_file_writer.h"
+#include "app_crc32.h"
+#include "openvent.pb-c.h"
+static const char *TAG = "APP_FILE";
+
+#ifndef CONFIG_FILE_UPLOAD_ACK_INTERVAL
+#define CONFIG_FILE_UPLOAD_ACK_INTERVAL     4
+#endif
+#ifndef CONFIG_FILE_WRITER_BUFFER_SIZE
+#define CONFIG_FILE_WRITER_BUFFER_SIZE      2048
+#endif
+#ifndef CONFIG_FILE_WRITER_BUFFER_COUNT
+#define CONFIG_FILE_WRITER_BUFFER_COUNT     3
+#endif
+#ifndef CONFIG_FILE_READER_BUFFER_COUNT
+#define CONFIG_FILE_READER_BUFFER_COUNT     3
+#endif
+
+/* Read chunks never exceed the largest frame */
+#define FILE_READER_CHUNK_SIZE              APP_MANAGER_DEFAULT_FRAME_LIMIT
+
+#define MEM_CHECK(mem) if (mem == NULL) { ESP_LOGE(TAG, "Memory exhaused"); return ESP_ERR_NO_MEM; }
+
+#define UPLOAD_STATE_MAGIC      0x4c505556  /* "VUPL" */
+#define UPLOAD_STATE_SUFFIX     ".up"
+
+/*
+ * Upload in progress. What is on flash survives a reboot: the file itself
+ * holds the committed bytes and a small "<file>.up" state file, written
+ * once when the upload starts and removed when it completes, records the
+ * expected size.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t file_size;
+} app_file_upload_state_t;
+
+typedef struct {
+    bool open;
+    char *file_name;
+    uint32_t file_size;
+    uint32_t next_offset;       /* Bytes handed to the writer, the only offset accepted next */
+    uint32_t crc;               /* CRC-32 of the file once it is complete */
+    uint32_t unacked;           /* Chunks received since the last acknowledgement */
+    bool gap;                   /* A chunk went missing, dropping until it is resent */
+} app_file_upload_t;
+
+/* Shared by all uploads, created with the first one */
+static app_file_writer_t *g_writer;
+/* Shared by all reads, created with the first one */
+static app_file_reader_t *g_reader;
+
+static void _app_file_state_path(char *path, size_t size, const char *file_name)
+{
+    snprintf(path, size, "%s" UPLOAD_STATE_SUFFIX, file_name);
+}
+
+static esp_err_t _app_file_close(app_file_upload_t *upload, uint32_t *crc)
+{
+    esp_err_t err = ESP_OK;
+    if (upload->open) {
+        err = app_file_writer_close(g_writer, crc);
+        upload->open = false;
+    }
+    return err;
+}
+
+/* The upload is over, it can no longer be resumed; `remove_file` deletes the data too */
+static void _app_file_finish(app_file_upload_t *upload, bool remove_file)
+{
+    char path[128];
+    _app_file_close(upload, NULL);
+    if (upload->file_name) {
+        _app_file_state_path(path, sizeof(path), upload->file_name);
+        unlink(path);
+        if (remove_file) {
+            unlink(upload->file_name);
+            free(upload->file_name);
+            upload->file_name = NULL;
+        }
+    }
+}
+
+static void _app_file_reset(app_file_upload_t *upload, uint32_t file_size, uint32_t offset)
+{
+    upload->open = true;
+    upload->file_size = file_size;
+    upload->next_offset = offset;
+    upload->unacked = 0;
+    upload->gap = false;
+}
+
+static bool _app_file_is(app_file_upload_t *upload, FileData *file_data)
+{
+    return upload->file_name && file_data->file_name &&
+           strcmp(upload->file_name, file_data->file_name) == 0 &&
+           upload->file_size == file_data->file_size;
+}
+
+/*
+ * A chunk of the file just completed sent again, its ack was lost: nothing to
+ * write. Offset 0 is only taken for one when it carries the file's checksum,
+ * else it starts the file over; the client sends every chunk again then.
+ */
+static bool _app_file_resent(app_file_upload_t *upload, FileData *file_data, bool same_file)
+{
+    if (!same_file || upload->open || upload->next_offset < upload->file_size ||
+            file_data->offset + file_data->data.len > upload->next_offset) {
+        return false;
+    }
+    if (file_data->offset == 0) {
+        return file_data->checksum != 0 && file_data->checksum == upload->crc;
+    }
+    return file_data->checksum == 0 || file_data->checksum == upload->crc;
+}
+
+static esp_err_t _app_file_start(app_file_upload_t *upload, FileData *file_data)
+{
+    char path[128];
+    _app_file_close(upload, NULL);
+    free(upload->file_name);
+    upload->file_name = strdup(file_data->file_name);
+    MEM_CHECK(upload->file_name);
+    ESP_LOGI(TAG, "Opening file %s", file_data->file_name);
+    if (app_file_writer_open(g_writer, file_data->file_name) != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening file %s", file_data->file_name);
+        return ESP_FAIL;
+    }
+    _app_file_state_path(path, sizeof(path), file_data->file_name);
+    app_file_upload_state_t state = {
+        .magic = UPLOAD_STATE_MAGIC,
+        .file_size = file_data->file_size,
+    };
+    FILE *f = fopen(path, "w");
+    if (f == NULL || fwrite(&state, sizeof(state), 1, f) != 1) {
+        /* The upload still works, it just cannot be resumed after a reboot */
+        ESP_LOGW(TAG, "Error writing %s", path);
+    }
+    if (f) {
+        fclose(f);
+    }
+    _app_file_reset(upload, file_data->file_size, 0);
+    return ESP_OK;
+}
+
+/* Pick up an upload interrupted by a reboot from what is on flash */
+static esp_err_t _app_file_resume(app_file_upload_t *upload, FileData *file_data)
+{
+    char path[128];
+    app_file_upload_state_t state;
+    _app_file_state_path(path, sizeof(path), file_data->file_name);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    bool valid = fread(&state, sizeof(state), 1, f) == 1 && state.magic == UPLOAD_STATE_MAGIC &&
+                 state.file_size == file_data->file_size;
+    fclose(f);
+    if (!valid) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    /* Everything in the file is committed, the CRC has to be rebuilt once */
+    f = fopen(file_data->file_name, "r");
+    if (f == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint8_t *buf = malloc(CONFIG_FILE_WRITER_BUFFER_SIZE);
+    if (buf == NULL) {
+        fclose(f);
+        return ESP_ERR_NO_MEM;
+    }
+    uint32_t crc = 0, committed = 0;
+    size_t n;
+    while ((n = fread(buf, 1, CONFIG_FILE_WRITER_BUFFER_SIZE, f)) > 0) {
+        crc = app_crc32_update(crc, buf, n);
+        committed += n;
+    }
+    free(buf);
+    fclose(f);
+    if (committed > state.file_size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    _app_file_close(upload, NULL);
+    free(upload->file_name);
+    upload->file_name = strdup(file_data->file_name);
+    MEM_CHECK(upload->file_name);
+    if (app_file_writer_resume(g_writer, file_data->file_name, committed, crc) != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening file %s", file_data->file_name);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Resuming %s at %d/%d", file_data->file_name, committed, state.file_size);
+    _app_file_reset(upload, state.file_size, committed);
+    return ESP_OK;
+}
+
+static esp_err_t _app_file_ack(app_file_upload_t *upload, FileData *file_data, VentResponse *resp, Status status)
+{
+    FileData ack = FILE_DATA__INIT;
+    ack.file_name = file_data->file_name;
+    ack.file_size = upload->file_size;
+    ack.offset = upload->next_offset;
+    upload->unacked = 0;
+    resp->status = status;
+    resp->read_file_response = &ack;
+    return app_manager_response(resp);
+}
+
+esp_err_t app_manager_file_handle(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    FileData *file_data = req->write_file_request;
+    app_file_upload_t *upload = *ctx;
+    /* Lock-step clients wait for every chunk, pipelined ones get cumulative acks */
+    bool every_chunk = !app_manager_request_tagged();
+
+    resp->status = STATUS__Fail;
+
+    if (file_data == NULL) {
+        return app_manager_response(resp);
+    }
+    if (upload == NULL) {
+        upload = calloc(1, sizeof(app_file_upload_t));
+        MEM_CHECK(upload);
+        *ctx = upload;
+    }
+    if (g_writer == NULL) {
+        g_writer = app_file_writer_new(CONFIG_FILE_WRITER_BUFFER_SIZE, CONFIG_FILE_WRITER_BUFFER_COUNT);
+        MEM_CHECK(g_writer);
+    }
+
+    /* Nothing past the size declared, and the end cannot wrap */
+    if (file_data->offset > file_data->file_size || file_data->data.len > file_data->file_size - file_data->offset) {
+        ESP_LOGE(TAG, "Chunk at %u of %u bytes past the end %u", file_data->offset, (unsigned)file_data->data.len,
+                 file_data->file_size);
+        return app_manager_response(resp);
+    }
+    bool same_file = _app_file_is(upload, file_data);
+    uint32_t end = file_data->offset + file_data->data.len;
+    if (file_data->data.len == 0 && file_data->file_size > 0 && file_data->file_name) {
+        /* Resume query: answer with the offset to continue from, 0 when there is nothing to resume */
+        bool known = same_file && (upload->open || upload->next_offset >= upload->file_size);
+        if (known || _app_file_resume(upload, file_data) == ESP_OK) {
+            return _app_file_ack(upload, file_data, resp, STATUS__Success);
+        }
+        FileData ack = FILE_DATA__INIT;
+        ack.file_name = file_data->file_name;
+        ack.file_size = file_data->file_size;
+        resp->status = STATUS__Success;
+        resp->read_file_response = &ack;
+        return app_manager_response(resp);
+    }
+    bool resent = _app_file_resent(upload, file_data, same_file);
+    if (file_data->offset == 0 && file_data->file_name && !(same_file && upload->open) && !resent) {
+        if (_app_file_start(upload, file_data) != ESP_OK) {
+            _app_file_finish(upload, false);
+            return app_manager_response(resp);
+        }
+    }
+    if (!upload->open) {
+        if (resent) {
+            return _app_file_ack(upload, file_data, resp, STATUS__Success);
+        }
+        return app_manager_response(resp);
+    }
+
+    upload->unacked++;
+    if (file_data->offset > upload->next_offset) {
+        bool new_gap = !upload->gap;
+        upload->gap = true;
+        ESP_LOGW(TAG, "Expected offset %d, got %d", upload->next_offset, file_data->offset);
+        if (every_chunk || new_gap || upload->unacked >= CONFIG_FILE_UPLOAD_ACK_INTERVAL) {
+            return _app_file_ack(upload, file_data, resp, STATUS__Fail);
+        }
+        return ESP_OK;
+    }
+    upload->gap = false;
+
+    /* Retransmitted bytes are already written, keep only what is new */
+    if (end > upload->file_size) {
+        ESP_LOGE(TAG, "Chunk ends at %u, past %s (%u bytes)", end, upload->file_name, upload->file_size);
+        return _app_file_ack(upload, file_data, resp, STATUS__Fail);
+    } else if (end > upload->next_offset) {
+        const uint8_t *data = file_data->data.data + (upload->next_offset - file_data->offset);
+        size_t len = end - upload->next_offset;
+        ESP_LOGD(TAG, "Writing %d/%d, memfree=%d", end, upload->file_size, esp_get_free_heap_size());
+        if (app_file_writer_write(g_writer, data, len) != ESP_OK) {
+            ESP_LOGE(TAG, "Error writing file %s", upload->file_name);
+            _app_file_close(upload, NULL);
+            return _app_file_ack(upload, file_data, resp, STATUS__Fail);
+        }
+        upload->next_offset = end;
+    } else {
+        ESP_LOGD(TAG, "Duplicate chunk at %d", file_data->offset);
+    }
+    bool last = upload->next_offset >= upload->file_size;
+    if (last) {
+        /* Only the final ack waits for the data to be on flash */
+        uint32_t crc;
+        if (_app_file_close(upload, &crc) != ESP_OK) {
+            ESP_LOGE(TAG, "Error writing file %s", upload->file_name);
+            return _app_file_ack(upload, file_data, resp, STATUS__Fail);
+        }
+        /* checksum is the CRC-32 of the whole file, 0 when the client does not send one */
+        if (file_data->checksum != 0 && file_data->checksum != crc) {
+            ESP_LOGE(TAG, "Checksum mismatch %s: %08x, expected %08x", upload->file_name, crc, file_data->checksum);
+            /* Nothing of it is kept, the client has to start over */
+            _app_file_finish(upload, true);
+            upload->next_offset = 0;
+            return _app_file_ack(upload, file_data, resp, STATUS__Fail);
+        }
+        ESP_LOGI(TAG, "Write file finish %s", upload->file_name);
+        upload->crc = crc;
+        _app_file_finish(upload, false);
+    }
+    if (every_chunk || last || upload->unacked >= CONFIG_FILE_UPLOAD_ACK_INTERVAL) {
+        return _app_file_ack(upload, file_data, resp, STATUS__Success);
+    }
+    return ESP_OK;
+}
+
+esp_err_t app_manager_file_read_handle(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    (void)ctx;
+    FileData *file_data = req->read_file_request;
+    resp->status = STATUS__Fail;
+
+    if (file_data == NULL || file_data->file_name == NULL || file_data->file_name[0] == '\0') {
+        return app_manager_response(resp);
+    }
+    if (g_reader == NULL) {
+        g_reader = app_file_reader_new(FILE_READER_CHUNK_SIZE, CONFIG_FILE_READER_BUFFER_COUNT);
+        MEM_CHECK(g_reader);
+    }
+
+    /* Sized for the largest offset and file_size, so every chunk of a file is the same length */
+    FileData chunk = FILE_DATA__INIT;
+    chunk.file_name = file_data->file_name;
+    chunk.offset = UINT32_MAX;
+    chunk.file_size = UINT32_MAX;
+    resp->read_file_response = &chunk;
+    size_t len = app_manager_response_room(resp);
+    resp->read_file_response = NULL;
+    chunk.offset = file_data->offset;
+
+    const uint8_t *data;
+    size_t data_len;
+    esp_err_t err = app_file_reader_get(g_reader, file_data->file_name, file_data->offset, len,
+                                        &data, &data_len, &chunk.file_size);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error reading file %s at %d", file_data->file_name, file_data->offset);
+        return app_manager_response(resp);
+    }
+    chunk.data.data = (uint8_t *)data;
+    chunk.data.len = data_len;
+    resp->status = STATUS__Success;
+    resp->read_file_response = &chunk;
+    return app_manager_response(resp);
+}
+
+esp_err_t app_manager_get_file_read_stats(app_file_reader_stats_t *stats)
+{
+    if (g_reader == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    app_file_reader_get_stats(g_reader, stats);
+    return ESP_OK;
+}
+
+esp_err_t app_manager_get_file_stats(app_file_writer_stats_t *stats)
+{
+    if (g_writer == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    app_file_writer_get_stats(g_writer, stats);
+    return ESP_OK;
+}
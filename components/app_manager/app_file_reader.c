@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "app_file_reader.h"
+static const char *TAG = "APP_FILE_READER";
+
+#define READER_PATH_MAX         64
+#define READER_CMD_CLOSE        -1
+#define READER_CMD_EXIT         -2
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_PENDING,               /* Queued to the reader task */
+    SLOT_READY,
+} reader_slot_state_t;
+
+typedef struct {
+    uint8_t *buf;
+    reader_slot_state_t state;
+    uint32_t gen;               /* Stream the read belongs to, stale ones are dropped */
+    uint32_t offset;
+    int result;                 /* Bytes read or -1, set by the reader task */
+} reader_slot_t;
+
+typedef struct {
+    int slot;                   /* Slot to read into, or READER_CMD_* */
+    uint32_t offset;
+    size_t len;
+    char path[READER_PATH_MAX];
+} reader_cmd_t;
+
+struct app_file_reader {
+    QueueHandle_t cmd_queue;    /* reader_cmd_t, to the reader task */
+    QueueHandle_t done_queue;   /* int slot index, back from the reader task */
+    uint8_t *mem;
+    reader_slot_t *slots;
+    size_t chunk_size;
+    int buffer_count;
+    char path[READER_PATH_MAX]; /* Stream being served */
+    size_t len;
+    uint32_t gen;
+    uint32_t file_size;
+    uint32_t next_offset;       /* Next offset to read ahead */
+    int served;                 /* Slot handed out by the last app_file_reader_get(), or -1 */
+    app_file_reader_stats_t stats;
+};
+
+static void _reader_task(void *arg)
+{
+    app_file_reader_t *reader = arg;
+    char path[READER_PATH_MAX] = "";
+    FILE *file = NULL;
+    reader_cmd_t cmd;
+
+    while (xQueueReceive(reader->cmd_queue, &cmd, portMAX_DELAY) == pdTRUE) {
+        if (cmd.slot == READER_CMD_EXIT) {
+            break;
+        }
+        if (cmd.slot == READER_CMD_CLOSE || strcmp(cmd.path, path) != 0) {
+            if (file) {
+                fclose(file);
+                file = NULL;
+            }
+            path[0] = '\0';
+            if (cmd.slot == READER_CMD_CLOSE) {
+                continue;
+            }
+        }
+        if (file == NULL) {
+            file = fopen(cmd.path, "r");
+            if (file) {
+                /* Chunks go straight into the slot buffer */
+                setvbuf(file, NULL, _IONBF, 0);
+                strcpy(path, cmd.path);
+            } else {
+                ESP_LOGE(TAG, "Error opening file %s", cmd.path);
+            }
+        }
+        reader_slot_t *slot = &reader->slots[cmd.slot];
+        int64_t start = esp_timer_get_time();
+        if (file == NULL || fseek(file, cmd.offset, SEEK_SET) != 0) {
+            slot->result = -1;
+        } else {
+            slot->result = fread(slot->buf, 1, cmd.len, file);
+            if (ferror(file)) {
+                clearerr(file);
+                slot->result = -1;
+            } else {
+                reader->stats.bytes_read += slot->result;
+            }
+        }
+        reader->stats.read_time_us += esp_timer_get_time() - start;
+        xQueueSend(reader->done_queue, &cmd.slot, portMAX_DELAY);
+    }
+    if (file) {
+        fclose(file);
+    }
+    /* Tell app_file_reader_delete() we are gone */
+    xQueueSend(reader->done_queue, &cmd.slot, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+/* Take finished reads from the reader task, waiting up to `ticks` for the first one */
+static void _reader_collect(app_file_reader_t *reader, TickType_t ticks)
+{
+    int index;
+    while (xQueueReceive(reader->done_queue, &index, ticks) == pdTRUE) {
+        reader_slot_t *slot = &reader->slots[index];
+        slot->state = slot->gen == reader->gen ? SLOT_READY : SLOT_FREE;
+        ticks = 0;
+    }
+}
+
+/* Queue reads of the next chunks into every free slot */
+static void _reader_schedule(app_file_reader_t *reader)
+{
+    for (int i = 0; i < reader->buffer_count && reader->next_offset < reader->file_size; i++) {
+        reader_slot_t *slot = &reader->slots[i];
+        if (slot->state != SLOT_FREE) {
+            continue;
+        }
+        reader_cmd_t cmd = {
+            .slot = i,
+            .offset = reader->next_offset,
+            .len = reader->len,
+        };
+        strcpy(cmd.path, reader->path);
+        slot->state = SLOT_PENDING;
+        slot->gen = reader->gen;
+        slot->offset = reader->next_offset;
+        xQueueSend(reader->cmd_queue, &cmd, portMAX_DELAY);
+        reader->next_offset += reader->len;
+    }
+}
+
+static reader_slot_t *_reader_find(app_file_reader_t *reader, uint32_t offset)
+{
+    for (int i = 0; i < reader->buffer_count; i++) {
+        reader_slot_t *slot = &reader->slots[i];
+        if (slot->state != SLOT_FREE && slot->gen == reader->gen && slot->offset == offset) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/* Forget the current stream, reads still in flight are dropped when they come back */
+static void _reader_reset(app_file_reader_t *reader)
+{
+    reader->gen++;
+    reader->path[0] = '\0';
+    for (int i = 0; i < reader->buffer_count; i++) {
+        if (reader->slots[i].state == SLOT_READY) {
+            reader->slots[i].state = SLOT_FREE;
+        }
+    }
+    reader_cmd_t cmd = { .slot = READER_CMD_CLOSE };
+    xQueueSend(reader->cmd_queue, &cmd, portMAX_DELAY);
+}
+
+static bool _reader_has_free(app_file_reader_t *reader)
+{
+    for (int i = 0; i < reader->buffer_count; i++) {
+        if (reader->slots[i].state == SLOT_FREE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+app_file_reader_t *app_file_reader_new(size_t chunk_size, int buffer_count)
+{
+    app_file_reader_t *reader = calloc(1, sizeof(app_file_reader_t));
+    if (reader == NULL) {
+        return NULL;
+    }
+    reader->chunk_size = chunk_size;
+    reader->buffer_count = buffer_count;
+    reader->served = -1;
+    reader->mem = malloc(chunk_size * buffer_count);
+    reader->slots = calloc(buffer_count, sizeof(reader_slot_t));
+    /* Room for a read per slot plus a close for every stream restart in between */
+    reader->cmd_queue = xQueueCreate(2 * buffer_count + 2, sizeof(reader_cmd_t));
+    reader->done_queue = xQueueCreate(buffer_count + 1, sizeof(int));
+    if (reader->mem == NULL || reader->slots == NULL || reader->cmd_queue == NULL || reader->done_queue == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        goto _reader_new_fail;
+    }
+    for (int i = 0; i < buffer_count; i++) {
+        reader->slots[i].buf = reader->mem + i * chunk_size;
+    }
+    if (xTaskCreate(_reader_task, "file_reader_task", 3 * 1024, reader, 4, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "error creating file reader task");
+        goto _reader_new_fail;
+    }
+    return reader;
+
+_reader_new_fail:
+    if (reader->cmd_queue) {
+        vQueueDelete(reader->cmd_queue);
+    }
+    if (reader->done_queue) {
+        vQueueDelete(reader->done_queue);
+    }
+    free(reader->slots);
+    free(reader->mem);
+    free(reader);
+    return NULL;
+}
+
+void app_file_reader_delete(app_file_reader_t *reader)
+{
+    if (reader == NULL) {
+        return;
+    }
+    reader_cmd_t cmd = { .slot = READER_CMD_EXIT };
+    xQueueSend(reader->cmd_queue, &cmd, portMAX_DELAY);
+    /* Everything still queued is answered before the exit */
+    int index;
+    do {
+        xQueueReceive(reader->done_queue, &index, portMAX_DELAY);
+    } while (index != READER_CMD_EXIT);
+    vQueueDelete(reader->cmd_queue);
+    vQueueDelete(reader->done_queue);
+    free(reader->slots);
+    free(reader->mem);
+    free(reader);
+}
+
+esp_err_t app_file_reader_get(app_file_reader_t *reader, const char *path, uint32_t offset, size_t len,
+                              const uint8_t **data, size_t *data_len, uint32_t *file_size)
+{
+    if (strlen(path) >= READER_PATH_MAX || len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (len > reader->chunk_size) {
+        len = reader->chunk_size;
+    }
+    if (reader->served >= 0) {
+        reader->slots[reader->served].state = SLOT_FREE;
+        reader->served = -1;
+    }
+    _reader_collect(reader, 0);
+
+    bool same_stream = strcmp(path, reader->path) == 0 && len == reader->len;
+    reader_slot_t *slot = same_stream ? _reader_find(reader, offset) : NULL;
+    if (slot) {
+        reader->stats.hits++;
+    } else if (!same_stream || offset < reader->file_size) {
+        /* Not read ahead: start a new stream at this offset */
+        struct stat st;
+        _reader_reset(reader);
+        if (stat(path, &st) != 0) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        strcpy(reader->path, path);
+        reader->len = len;
+        reader->file_size = st.st_size;
+        reader->next_offset = offset;
+        while (!_reader_has_free(reader)) {
+            _reader_collect(reader, portMAX_DELAY);
+        }
+        _reader_schedule(reader);
+        slot = _reader_find(reader, offset);
+    }
+    *file_size = reader->file_size;
+    if (slot == NULL) {
+        /* At or past the end */
+        *data = NULL;
+        *data_len = 0;
+        return ESP_OK;
+    }
+
+    if (slot->state == SLOT_PENDING) {
+        int64_t start = esp_timer_get_time();
+        while (slot->state == SLOT_PENDING) {
+            _reader_collect(reader, portMAX_DELAY);
+        }
+        reader->stats.wait_time_us += esp_timer_get_time() - start;
+    }
+    if (slot->result < 0) {
+        slot->state = SLOT_FREE;
+        _reader_reset(reader);
+        return ESP_FAIL;
+    }
+    *data = slot->buf;
+    *data_len = slot->result;
+    reader->served = slot - reader->slots;
+    reader->stats.chunks++;
+    _reader_schedule(reader);
+    return ESP_OK;
+}
+
+void app_file_reader_close(app_file_reader_t *reader)
+{
+    if (reader->served >= 0) {
+        reader->slots[reader->served].state = SLOT_FREE;
+        reader->served = -1;
+    }
+    _reader_reset(reader);
+}
+
+void app_file_reader_get_stats(app_file_reader_t *reader, app_file_reader_stats_t *stats)
+{
+    *stats = reader->stats;
+}
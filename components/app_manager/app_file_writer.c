@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "app_file_writer.h"
+#include "app_crc32.h"
+static const char *TAG = "APP_FILE_WRITER";
+
+typedef enum {
+    WRITER_OP_WRITE,
+    WRITER_OP_CLOSE,            /* Write what is in the buffer, then fclose() */
+    WRITER_OP_EXIT,
+} writer_op_t;
+
+typedef struct {
+    writer_op_t op;
+    FILE *file;
+    uint8_t *buf;
+    size_t len;
+} writer_cmd_t;
+
+struct app_file_writer {
+    QueueHandle_t cmd_queue;    /* writer_cmd_t, to the writer task */
+    QueueHandle_t free_queue;   /* uint8_t *, buffers the caller may fill */
+    uint8_t *mem;
+    size_t buffer_size;
+    int buffer_count;
+    FILE *file;
+    uint8_t *fill;              /* Buffer being filled by the caller */
+    size_t fill_len;
+    size_t fill_limit;          /* Submit the buffer at this length, keeps writes block aligned */
+    volatile esp_err_t error;
+    uint32_t crc;               /* CRC-32 of the open file, updated by the writer task */
+    app_file_writer_stats_t stats;
+};
+
+static void _writer_task(void *arg)
+{
+    app_file_writer_t *writer = arg;
+    writer_cmd_t cmd;
+
+    while (xQueueReceive(writer->cmd_queue, &cmd, portMAX_DELAY) == pdTRUE) {
+        if (cmd.op == WRITER_OP_EXIT) {
+            break;
+        }
+        int64_t start = esp_timer_get_time();
+        if (cmd.len > 0 && writer->error == ESP_OK) {
+            writer->crc = app_crc32_update(writer->crc, cmd.buf, cmd.len);
+            if (fwrite(cmd.buf, 1, cmd.len, cmd.file) != cmd.len) {
+                ESP_LOGE(TAG, "Error writing %u bytes", (unsigned)cmd.len);
+                writer->error = ESP_FAIL;
+            } else {
+                writer->stats.bytes_written += cmd.len;
+                writer->stats.writes++;
+            }
+        }
+        if (cmd.op == WRITER_OP_CLOSE && fclose(cmd.file) != 0) {
+            ESP_LOGE(TAG, "Error closing file");
+            writer->error = ESP_FAIL;
+        }
+        writer->stats.write_time_us += esp_timer_get_time() - start;
+        xQueueSend(writer->free_queue, &cmd.buf, portMAX_DELAY);
+    }
+    /* Tell app_file_writer_delete() we are gone */
+    xQueueSend(writer->free_queue, &cmd.buf, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+/* Take a free buffer, waiting for the writer task if there is none */
+static uint8_t *_writer_take(app_file_writer_t *writer)
+{
+    uint8_t *buf;
+    if (xQueueReceive(writer->free_queue, &buf, 0) == pdTRUE) {
+        return buf;
+    }
+    int64_t start = esp_timer_get_time();
+    xQueueReceive(writer->free_queue, &buf, portMAX_DELAY);
+    writer->stats.stalls++;
+    writer->stats.stall_time_us += esp_timer_get_time() - start;
+    return buf;
+}
+
+static void _writer_submit(app_file_writer_t *writer, writer_op_t op)
+{
+    writer_cmd_t cmd = {
+        .op = op,
+        .file = writer->file,
+        .buf = writer->fill,
+        .len = writer->fill_len,
+    };
+    /* The queue holds every buffer, this never blocks */
+    xQueueSend(writer->cmd_queue, &cmd, portMAX_DELAY);
+    writer->fill = NULL;
+    writer->fill_len = 0;
+    writer->fill_limit = writer->buffer_size;
+}
+
+app_file_writer_t *app_file_writer_new(size_t buffer_size, int buffer_count)
+{
+    app_file_writer_t *writer = calloc(1, sizeof(app_file_writer_t));
+    if (writer == NULL) {
+        return NULL;
+    }
+    writer->buffer_size = buffer_size;
+    writer->buffer_count = buffer_count;
+    writer->mem = malloc(buffer_size * buffer_count);
+    /* One more slot for WRITER_OP_EXIT */
+    writer->cmd_queue = xQueueCreate(buffer_count + 1, sizeof(writer_cmd_t));
+    writer->free_queue = xQueueCreate(buffer_count, sizeof(uint8_t *));
+    if (writer->mem == NULL || writer->cmd_queue == NULL || writer->free_queue == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        goto _writer_new_fail;
+    }
+    for (int i = 1; i < buffer_count; i++) {
+        uint8_t *buf = writer->mem + i * buffer_size;
+        xQueueSend(writer->free_queue, &buf, 0);
+    }
+    writer->fill = writer->mem;
+    writer->fill_limit = buffer_size;
+    if (xTaskCreate(_writer_task, "file_writer_task", 3 * 1024, writer, 4, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "error creating file writer task");
+        goto _writer_new_fail;
+    }
+    return writer;
+
+_writer_new_fail:
+    if (writer->cmd_queue) {
+        vQueueDelete(writer->cmd_queue);
+    }
+    if (writer->free_queue) {
+        vQueueDelete(writer->free_queue);
+    }
+    free(writer->mem);
+    free(writer);
+    return NULL;
+}
+
+void app_file_writer_delete(app_file_writer_t *writer)
+{
+    if (writer == NULL) {
+        return;
+    }
+    app_file_writer_close(writer, NULL);
+    writer_cmd_t cmd = { .op = WRITER_OP_EXIT, .buf = writer->fill };
+    xQueueSend(writer->cmd_queue, &cmd, portMAX_DELAY);
+    for (int i = 0; i < writer->buffer_count; i++) {
+        uint8_t *buf;
+        xQueueReceive(writer->free_queue, &buf, portMAX_DELAY);
+    }
+    vQueueDelete(writer->cmd_queue);
+    vQueueDelete(writer->free_queue);
+    free(writer->mem);
+    free(writer);
+}
+
+static esp_err_t _writer_open(app_file_writer_t *writer, const char *path, const char *mode)
+{
+    if (writer->file) {
+        app_file_writer_close(writer, NULL);
+    }
+    /* The writer task is idle now, the file can be opened from here */
+    writer->file = fopen(path, mode);
+    if (writer->file == NULL) {
+        return ESP_FAIL;
+    }
+    /* Buffers are already block sized, skip the stdio buffer and its copy */
+    setvbuf(writer->file, NULL, _IONBF, 0);
+    writer->error = ESP_OK;
+    writer->crc = 0;
+    return ESP_OK;
+}
+
+esp_err_t app_file_writer_open(app_file_writer_t *writer, const char *path)
+{
+    return _writer_open(writer, path, "w");
+}
+
+esp_err_t app_file_writer_resume(app_file_writer_t *writer, const char *path, uint32_t offset, uint32_t crc)
+{
+    esp_err_t err = _writer_open(writer, path, "a");
+    if (err != ESP_OK) {
+        return err;
+    }
+    writer->crc = crc;
+    /* Only fill up to the next block boundary first */
+    writer->fill_limit = writer->buffer_size - offset % writer->buffer_size;
+    return ESP_OK;
+}
+
+esp_err_t app_file_writer_write(app_file_writer_t *writer, const void *data, size_t len)
+{
+    const uint8_t *src = data;
+    if (writer->file == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (writer->error != ESP_OK) {
+        return writer->error;
+    }
+    while (len > 0) {
+        size_t n = writer->fill_limit - writer->fill_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(writer->fill + writer->fill_len, src, n);
+        writer->fill_len += n;
+        src += n;
+        len -= n;
+        if (writer->fill_len == writer->fill_limit) {
+            _writer_submit(writer, WRITER_OP_WRITE);
+            writer->fill = _writer_take(writer);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t app_file_writer_close(app_file_writer_t *writer, uint32_t *crc)
+{
+    if (writer->file == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _writer_submit(writer, WRITER_OP_CLOSE);
+    writer->file = NULL;
+
+    /* All buffers back means everything up to the fclose() is done */
+    uint8_t *bufs[writer->buffer_count];
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < writer->buffer_count; i++) {
+        xQueueReceive(writer->free_queue, &bufs[i], portMAX_DELAY);
+    }
+    writer->stats.stalls++;
+    writer->stats.stall_time_us += esp_timer_get_time() - start;
+    writer->fill = bufs[0];
+    for (int i = 1; i < writer->buffer_count; i++) {
+        xQueueSend(writer->free_queue, &bufs[i], 0);
+    }
+    if (crc) {
+        *crc = writer->crc;
+    }
+    return writer->error;
+}
+
+esp_err_t app_file_writer_status(app_file_writer_t *writer)
+{
+    return writer->error;
+}
+
+void app_file_writer_get_stats(app_file_writer_t *writer, app_file_writer_stats_t *stats)
+{
+    *stats = writer->stats;
+}
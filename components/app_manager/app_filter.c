@@ -0,0 +1,108 @@
+#include <math.h>
+
+#include "app_filter.h"
+
+#define FILTER_PI               3.14159265f
+
+static inline void _sort2(int32_t *a, int32_t *b)
+{
+    int32_t lo = *a < *b ? *a : *b;
+    *b = *a < *b ? *b : *a;
+    *a = lo;
+}
+
+/* Seven compare-exchanges, the middle one of five */
+static inline int32_t _median5(int32_t a, int32_t b, int32_t c, int32_t d, int32_t e)
+{
+    _sort2(&a, &b);
+    _sort2(&d, &e);
+    _sort2(&a, &d);
+    _sort2(&b, &e);
+    _sort2(&b, &c);
+    _sort2(&c, &d);
+    _sort2(&b, &c);
+    return c;
+}
+
+void app_median5_init(app_median5_t *m, int32_t x)
+{
+    for (int i = 0; i < 4; i++) {
+        m->prev[i] = x;
+    }
+}
+
+void app_median5(app_median5_t *m, int32_t *buf, size_t n)
+{
+    int32_t p0 = m->prev[0], p1 = m->prev[1], p2 = m->prev[2], p3 = m->prev[3];
+    for (size_t i = 0; i < n; i++) {
+        int32_t x = buf[i];
+        buf[i] = _median5(p0, p1, p2, p3, x);
+        p0 = p1;
+        p1 = p2;
+        p2 = p3;
+        p3 = x;
+    }
+    m->prev[0] = p0;
+    m->prev[1] = p1;
+    m->prev[2] = p2;
+    m->prev[3] = p3;
+}
+
+int32_t app_median5_step(app_median5_t *m, int32_t x)
+{
+    int32_t y = _median5(m->prev[0], m->prev[1], m->prev[2], m->prev[3], x);
+    m->prev[0] = m->prev[1];
+    m->prev[1] = m->prev[2];
+    m->prev[2] = m->prev[3];
+    m->prev[3] = x;
+    return y;
+}
+
+size_t app_decimate(const int32_t *in, size_t n, uint32_t factor, float *out)
+{
+    float scale = 1.0f / factor;
+    size_t outputs = n / factor;
+    for (size_t i = 0; i < outputs; i++) {
+        int32_t sum = 0;
+        for (uint32_t k = 0; k < factor; k++) {
+            sum += *in++;
+        }
+        out[i] = sum * scale;
+    }
+    return outputs;
+}
+
+void app_biquad_lowpass(app_biquad_coef_t *coef, float rate_hz, float cutoff_hz, float q)
+{
+    /* RBJ audio EQ cookbook */
+    float w0 = 2 * FILTER_PI * cutoff_hz / rate_hz;
+    float cos_w0 = cosf(w0);
+    float alpha = sinf(w0) / (2 * q);
+    float a0 = 1 + alpha;
+    coef->b0 = (1 - cos_w0) / 2 / a0;
+    coef->b1 = (1 - cos_w0) / a0;
+    coef->b2 = coef->b0;
+    coef->a1 = -2 * cos_w0 / a0;
+    coef->a2 = (1 - alpha) / a0;
+}
+
+void app_biquad_init(app_biquad_t *bq, const app_biquad_coef_t *coef, float x)
+{
+    float y = x * (coef->b0 + coef->b1 + coef->b2) / (1 + coef->a1 + coef->a2);
+    bq->z2 = coef->b2 * x - coef->a2 * y;
+    bq->z1 = y - coef->b0 * x;
+}
+
+void app_biquad(app_biquad_t *bq, const app_biquad_coef_t *coef, float *buf, size_t n)
+{
+    float z1 = bq->z1, z2 = bq->z2;
+    for (size_t i = 0; i < n; i++) {
+        float x = buf[i];
+        float y = coef->b0 * x + z1;
+        z1 = coef->b1 * x - coef->a1 * y + z2;
+        z2 = coef->b2 * x - coef->a2 * y;
+        buf[i] = y;
+    }
+    bq->z1 = z1;
+    bq->z2 = z2;
+}
@@ -0,0 +1,370 @@
+#include <string.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+#include "esp_log.h"
+#include "app_manager.h"
+#include "app_ota.h"
+#include "app_lzss.h"
+#include "app_delta.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "openvent.pb-c.h"
+static const char *TAG = "APP_FIRMWARE";
+
+#ifndef CONFIG_FILE_UPLOAD_ACK_INTERVAL
+#define CONFIG_FILE_UPLOAD_ACK_INTERVAL     4
+#endif
+#ifndef CONFIG_OTA_BUFFER_COUNT
+#define CONFIG_OTA_BUFFER_COUNT             2
+#endif
+#ifndef CONFIG_OTA_ERASE_AHEAD
+#define CONFIG_OTA_ERASE_AHEAD              4
+#endif
+#ifndef CONFIG_OTA_LZSS_MAX_WINDOW_BITS
+#define CONFIG_OTA_LZSS_MAX_WINDOW_BITS     12
+#endif
+#ifndef CONFIG_OTA_DELTA_CACHE_SIZE
+#define CONFIG_OTA_DELTA_CACHE_SIZE         4096
+#endif
+
+/* esp_image_header_t and esp_image_segment_header_t */
+#define FW_IMAGE_MAGIC              0xe9
+#define FW_IMAGE_HEADER_LEN         24
+#define FW_IMAGE_SEGMENT_HEADER_LEN 8
+#define FW_IMAGE_MAX_SEGMENTS       16
+#define FW_IMAGE_HASH_APPENDED      23
+#define FW_IMAGE_DIGEST_LEN         32
+
+#define MEM_CHECK(mem) if (mem == NULL) { ESP_LOGE(TAG, "Memory exhaused"); return ESP_ERR_NO_MEM; }
+
+/* Firmware update in progress, there is only ever one */
+typedef struct {
+    bool open;
+    bool done;                  /* Written and verified, boots next time */
+    bool compressed;            /* Stream goes through g_lzss */
+    bool delta;                 /* Stream is a patch for g_delta, after decompression */
+    uint32_t image_size;        /* Bytes in the stream, unless it is a plain image not the size written */
+    uint32_t next_offset;       /* Stream bytes consumed, the only offset accepted next */
+    uint32_t checksum;          /* Of the image once done, 0 when the client sent none */
+    uint32_t unacked;
+    bool gap;
+} app_firmware_update_t;
+
+static app_ota_t *g_ota;
+/* Created with the first compressed image */
+static app_lzss_t *g_lzss;
+/* Created with the first delta image */
+static app_delta_t *g_delta;
+static app_firmware_update_t g_update;
+/* Partition mapped for ReadFirmwareRequest, kept for the chunks that follow */
+static const esp_partition_t *g_read_partition;
+static const uint8_t *g_read_map;
+static spi_flash_mmap_handle_t g_read_handle;
+
+static uint32_t _app_firmware_u32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static esp_err_t _app_firmware_image(void *arg, const uint8_t *data, size_t len)
+{
+    (void)arg;
+    return app_ota_write(g_ota, data, len);
+}
+
+/* Decompressed stream: a patch when the image is a delta, the image itself otherwise */
+static esp_err_t _app_firmware_inflated(void *arg, const uint8_t *data, size_t len)
+{
+    (void)arg;
+    if (g_update.delta) {
+        return app_delta_apply(g_delta, data, len, _app_firmware_image, NULL);
+    }
+    return app_ota_write(g_ota, data, len);
+}
+
+static esp_err_t _app_firmware_consume(const uint8_t *data, size_t len)
+{
+    if (g_update.compressed) {
+        return app_lzss_decode(g_lzss, data, len, _app_firmware_inflated, NULL);
+    }
+    return _app_firmware_inflated(NULL, data, len);
+}
+
+static esp_err_t _app_firmware_lzss_start(int window_bits, int lookahead_bits)
+{
+    if (g_lzss == NULL) {
+        g_lzss = app_lzss_new(CONFIG_OTA_LZSS_MAX_WINDOW_BITS);
+        MEM_CHECK(g_lzss);
+    }
+    g_update.compressed = true;
+    return app_lzss_reset(g_lzss, window_bits, lookahead_bits);
+}
+
+static esp_err_t _app_firmware_begin(app_firmware_update_t *update, FileData *fw)
+{
+    const uint8_t *hdr = fw->data.data;
+    uint32_t magic = fw->data.len >= 4 ? _app_firmware_u32(hdr) : 0;
+    uint32_t image_size = fw->file_size;
+    esp_err_t err = ESP_OK;
+
+    memset(update, 0, sizeof(*update));
+    if (magic == APP_MANAGER_FW_LZSS_MAGIC) {
+        if (fw->data.len < APP_MANAGER_FW_LZSS_HDR_LEN) {
+            ESP_LOGE(TAG, "Compressed image header split");
+            return ESP_ERR_INVALID_SIZE;
+        }
+        err = _app_firmware_lzss_start(hdr[4], hdr[5]);
+        image_size = _app_firmware_u32(hdr + 8);
+        /* The header is consumed here, the bitstream starts after it */
+        update->next_offset = APP_MANAGER_FW_LZSS_HDR_LEN;
+        ESP_LOGI(TAG, "Compressed image, %d bytes inflate to %d", fw->file_size, image_size);
+    } else if (magic == APP_MANAGER_FW_DELTA_MAGIC) {
+        if (fw->data.len < APP_MANAGER_FW_DELTA_HDR_LEN) {
+            ESP_LOGE(TAG, "Delta image header split");
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if (g_delta == NULL) {
+            g_delta = app_delta_new(CONFIG_OTA_DELTA_CACHE_SIZE);
+            MEM_CHECK(g_delta);
+        }
+        image_size = _app_firmware_u32(hdr + 4);
+        err = app_delta_reset(g_delta, esp_ota_get_running_partition(),
+                              _app_firmware_u32(hdr + 8), _app_firmware_u32(hdr + 12));
+        if (err == ESP_OK && hdr[16] != 0) {
+            err = _app_firmware_lzss_start(hdr[16], hdr[17]);
+        }
+        update->delta = true;
+        update->next_offset = APP_MANAGER_FW_DELTA_HDR_LEN;
+        ESP_LOGI(TAG, "Delta image, %d bytes patch the running image to %d", fw->file_size, image_size);
+    }
+    if (err == ESP_OK) {
+        err = app_ota_begin(g_ota, image_size);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    update->open = true;
+    update->image_size = fw->file_size;
+    return ESP_OK;
+}
+
+static esp_err_t _app_firmware_ack(FileData *fw, VentResponse *resp, Status status, uint32_t offset)
+{
+    FileData ack = FILE_DATA__INIT;
+    ack.file_name = fw->file_name;
+    ack.file_size = fw->file_size;
+    ack.offset = offset;
+    g_update.unacked = 0;
+    resp->status = status;
+    resp->read_firmware_response = &ack;
+    return app_manager_response(resp);
+}
+
+esp_err_t app_manager_firmware_handle(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    (void)ctx;
+    FileData *fw = req->write_firmware_request;
+    app_firmware_update_t *update = &g_update;
+    bool every_chunk = !app_manager_request_tagged();
+
+    resp->status = STATUS__Fail;
+
+    if (fw == NULL || fw->file_size == 0) {
+        return app_manager_response(resp);
+    }
+    if (g_ota == NULL) {
+        g_ota = app_ota_new(CONFIG_OTA_BUFFER_COUNT, CONFIG_OTA_ERASE_AHEAD);
+        MEM_CHECK(g_ota);
+    }
+
+    bool same_image = update->image_size == fw->file_size && (update->open || update->done);
+    uint32_t end = fw->offset + fw->data.len;
+    if (fw->data.len == 0) {
+        /* Resume query, an image is only resumable while this boot lasts */
+        return _app_firmware_ack(fw, resp, STATUS__Success, same_image ? update->next_offset : 0);
+    }
+    /* Retransmission after the image was completed, e.g. the last ack was lost; offset 0 needs its checksum */
+    bool resent = same_image && update->done && end <= update->next_offset &&
+                  (fw->offset != 0 ? fw->checksum == 0 || fw->checksum == update->checksum :
+                   fw->checksum != 0 && fw->checksum == update->checksum);
+    if (fw->offset == 0 && !(same_image && update->open) && !resent) {
+        if (_app_firmware_begin(update, fw) != ESP_OK) {
+            update->next_offset = 0;
+            return _app_firmware_ack(fw, resp, STATUS__Fail, 0);
+        }
+        same_image = true;
+    }
+    if (!update->open) {
+        if (resent) {
+            return _app_firmware_ack(fw, resp, STATUS__Success, update->next_offset);
+        }
+        return _app_firmware_ack(fw, resp, STATUS__Fail, 0);
+    }
+
+    update->unacked++;
+    if (fw->offset > update->next_offset) {
+        bool new_gap = !update->gap;
+        update->gap = true;
+        ESP_LOGW(TAG, "Expected offset %d, got %d", update->next_offset, fw->offset);
+        if (every_chunk || new_gap || update->unacked >= CONFIG_FILE_UPLOAD_ACK_INTERVAL) {
+            return _app_firmware_ack(fw, resp, STATUS__Fail, update->next_offset);
+        }
+        return ESP_OK;
+    }
+    update->gap = false;
+
+    if (end > update->next_offset) {
+        const uint8_t *data = fw->data.data + (update->next_offset - fw->offset);
+        size_t len = end - update->next_offset;
+        esp_err_t err = ESP_ERR_INVALID_SIZE;
+        if (end <= update->image_size) {
+            err = _app_firmware_consume(data, len);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Error writing firmware at %d", update->next_offset);
+            app_ota_abort(g_ota);
+            update->open = false;
+            return _app_firmware_ack(fw, resp, STATUS__Fail, 0);
+        }
+        update->next_offset = end;
+    }
+    bool last = update->next_offset >= update->image_size;
+    if (last) {
+        update->open = false;
+        /* checksum is the CRC-32 of the whole image, 0 when the client does not send one */
+        esp_err_t err = app_ota_end(g_ota, fw->checksum);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Firmware rejected (%s)", esp_err_to_name(err));
+            update->next_offset = 0;
+            return _app_firmware_ack(fw, resp, STATUS__Fail, 0);
+        }
+        update->done = true;
+        update->checksum = fw->checksum;
+        ESP_LOGI(TAG, "Firmware update of %d bytes done, applies on the next boot", update->image_size);
+    }
+    if (every_chunk || last || update->unacked >= CONFIG_FILE_UPLOAD_ACK_INTERVAL) {
+        return _app_firmware_ack(fw, resp, STATUS__Success, update->next_offset);
+    }
+    return ESP_OK;
+}
+
+/*
+ * Length of the app image at the start of `map`, as esptool lays it out:
+ * header, segments, checksum byte padded to 16 bytes, appended SHA-256.
+ * 0 when it does not look like an image.
+ */
+static uint32_t _app_firmware_image_len(const uint8_t *map, uint32_t size)
+{
+    if (size < FW_IMAGE_HEADER_LEN || map[0] != FW_IMAGE_MAGIC || map[1] > FW_IMAGE_MAX_SEGMENTS) {
+        return 0;
+    }
+    uint32_t pos = FW_IMAGE_HEADER_LEN;
+    for (int i = 0; i < map[1]; i++) {
+        if (size - pos < FW_IMAGE_SEGMENT_HEADER_LEN) {
+            return 0;
+        }
+        uint32_t len = _app_firmware_u32(map + pos + 4);
+        pos += FW_IMAGE_SEGMENT_HEADER_LEN;
+        if (len > size - pos) {
+            return 0;
+        }
+        pos += len;
+    }
+    pos = (pos + 1 + 15) & ~15;
+    if (map[FW_IMAGE_HASH_APPENDED] == 1) {
+        pos += FW_IMAGE_DIGEST_LEN;
+    }
+    return pos <= size ? pos : 0;
+}
+
+static esp_err_t _app_firmware_map(const esp_partition_t *partition)
+{
+    if (partition == g_read_partition) {
+        return ESP_OK;
+    }
+    if (g_read_partition) {
+        spi_flash_munmap(g_read_handle);
+        g_read_partition = NULL;
+    }
+    const void *map;
+    esp_err_t err = esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &map, &g_read_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error mapping %s (%s)", partition->label, esp_err_to_name(err));
+        return err;
+    }
+    g_read_map = map;
+    g_read_partition = partition;
+    return ESP_OK;
+}
+
+esp_err_t app_manager_firmware_read_handle(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    (void)ctx;
+    FileData *fw = req->read_firmware_request;
+    resp->status = STATUS__Fail;
+
+    if (fw == NULL) {
+        return app_manager_response(resp);
+    }
+    const esp_partition_t *partition = esp_ota_get_running_partition();
+    if (fw->file_name && fw->file_name[0]) {
+        partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, fw->file_name);
+    }
+    if (partition == NULL || _app_firmware_map(partition) != ESP_OK) {
+        return app_manager_response(resp);
+    }
+    uint32_t image_len = _app_firmware_image_len(g_read_map, partition->size);
+    if (image_len == 0) {
+        ESP_LOGW(TAG, "No app image in %s, reading all of it", partition->label);
+        image_len = partition->size;
+    }
+
+    FileData chunk = FILE_DATA__INIT;
+    chunk.file_name = (char *)partition->label;
+    if (fw->data.len == strlen(APP_MANAGER_FW_READ_SHA256) &&
+            memcmp(fw->data.data, APP_MANAGER_FW_READ_SHA256, fw->data.len) == 0) {
+        uint8_t sha[FW_IMAGE_DIGEST_LEN];
+        int64_t start = esp_timer_get_time();
+        mbedtls_sha256_context sha_ctx;
+        mbedtls_sha256_init(&sha_ctx);
+        mbedtls_sha256_starts_ret(&sha_ctx, 0);
+        mbedtls_sha256_update_ret(&sha_ctx, g_read_map, image_len);
+        mbedtls_sha256_finish_ret(&sha_ctx, sha);
+        mbedtls_sha256_free(&sha_ctx);
+        ESP_LOGI(TAG, "SHA-256 of %d bytes of %s in %d ms", image_len, partition->label,
+                 (int)((esp_timer_get_time() - start) / 1000));
+        chunk.file_size = image_len;
+        chunk.data.data = sha;
+        chunk.data.len = sizeof(sha);
+        resp->status = STATUS__Success;
+        resp->read_firmware_response = &chunk;
+        return app_manager_response(resp);
+    }
+
+    /* Sized for the largest offset and file_size, so every chunk is the same length */
+    chunk.offset = UINT32_MAX;
+    chunk.file_size = UINT32_MAX;
+    resp->read_firmware_response = &chunk;
+    size_t len = app_manager_response_room(resp);
+    chunk.offset = fw->offset;
+    chunk.file_size = image_len;
+    if (fw->offset < image_len) {
+        /* Straight out of the mapping, the only copy is packing the response */
+        chunk.data.data = (uint8_t *)g_read_map + fw->offset;
+        chunk.data.len = image_len - fw->offset < len ? image_len - fw->offset : len;
+    }
+    resp->status = STATUS__Success;
+    return app_manager_response(resp);
+}
+
+esp_err_t app_manager_get_ota_stats(app_ota_stats_t *stats)
+{
+    if (g_ota == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    app_ota_get_stats(g_ota, stats);
+    return ESP_OK;
+}
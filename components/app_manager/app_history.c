@@ -0,0 +1,329 @@
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "app_history.h"
+static const char *TAG = "APP_HISTORY";
+
+#define HISTORY_CHANNELS        2
+#define HISTORY_READ_ATTEMPTS   4
+/* Stored per unit, in 16 bits */
+#define HISTORY_SCALE           100.0f
+#define HISTORY_MAX_FACTOR      65536
+
+typedef struct {
+    int16_t min;
+    int16_t max;
+    int16_t mean;
+} history_stat_t;
+
+typedef struct {
+    history_stat_t ch[HISTORY_CHANNELS];    /* Pressure, flow */
+} history_bucket_t;
+
+typedef struct {
+    int16_t ch[HISTORY_CHANNELS];
+} history_raw_t;
+
+/*
+ * 64-bit count written by one task and read by any without tearing: `lo`
+ * is the low word, `mid` the high word as of when `lo` last reached 2^31
+ * (~0 before), which tells a reader the high word from the top bit of `lo`.
+ */
+typedef struct {
+    uint32_t lo;
+    uint32_t mid;
+} history_count_t;
+
+typedef struct {
+    uint32_t factor;
+    uint32_t ratio;             /* Buckets of the tier before in one of this */
+    uint32_t capacity;
+    history_count_t head;       /* Buckets closed, written by the writer only */
+    history_count_t writing;    /* head + 1 from before a slot is overwritten until head catches up */
+    uint32_t next;              /* Slot of head */
+    /* Open bucket, writer only */
+    uint32_t folded;
+    int16_t min[HISTORY_CHANNELS];
+    int16_t max[HISTORY_CHANNELS];
+    int32_t sum[HISTORY_CHANNELS];      /* Of the raw samples */
+    void *slots;                /* history_raw_t in tier 0, history_bucket_t above */
+} history_tier_t;
+
+struct app_history {
+    uint32_t rate_hz;
+    size_t tiers;
+    history_tier_t tier[APP_HISTORY_MAX_TIERS];
+};
+
+app_history_t *app_history_new(const app_history_cfg_t *config)
+{
+    bool valid = config->rate_hz && config->tiers && config->tiers <= APP_HISTORY_MAX_TIERS &&
+                 config->tier[0].factor == 1;
+    for (size_t k = 0; valid && k < config->tiers; k++) {
+        const app_history_tier_cfg_t *t = &config->tier[k];
+        valid = t->capacity && t->factor <= HISTORY_MAX_FACTOR &&
+                (k == 0 || (t->factor > config->tier[k - 1].factor && t->factor % config->tier[k - 1].factor == 0));
+    }
+    if (!valid) {
+        ESP_LOGE(TAG, "Invalid configuration");
+        return NULL;
+    }
+    app_history_t *hist = calloc(1, sizeof(app_history_t));
+    if (hist == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        return NULL;
+    }
+    hist->rate_hz = config->rate_hz;
+    hist->tiers = config->tiers;
+    size_t bytes = 0;
+    for (size_t k = 0; k < config->tiers; k++) {
+        history_tier_t *t = &hist->tier[k];
+        t->factor = config->tier[k].factor;
+        t->ratio = k ? t->factor / config->tier[k - 1].factor : 1;
+        t->capacity = config->tier[k].capacity;
+        t->head.mid = t->writing.mid = UINT32_MAX;
+        size_t size = t->capacity * (k ? sizeof(history_bucket_t) : sizeof(history_raw_t));
+        t->slots = malloc(size);
+        if (t->slots == NULL) {
+            ESP_LOGE(TAG, "Memory exhaused");
+            app_history_delete(hist);
+            return NULL;
+        }
+        bytes += size;
+    }
+    ESP_LOGI(TAG, "%u tiers in %u bytes", (unsigned)hist->tiers, (unsigned)bytes);
+    return hist;
+}
+
+void app_history_delete(app_history_t *hist)
+{
+    if (hist == NULL) {
+        return;
+    }
+    for (size_t k = 0; k < hist->tiers; k++) {
+        free(hist->tier[k].slots);
+    }
+    free(hist);
+}
+
+static inline int16_t _quantize(float v)
+{
+    float q = v * HISTORY_SCALE + (v >= 0 ? 0.5f : -0.5f);
+    return q >= 32767 ? 32767 : q <= -32767 ? -32767 : (int16_t)q;
+}
+
+static inline uint64_t _count_load(const history_count_t *c)
+{
+    uint32_t lo = __atomic_load_n(&c->lo, __ATOMIC_ACQUIRE);
+    uint32_t mid = __atomic_load_n(&c->mid, __ATOMIC_RELAXED);
+    return (uint64_t)(lo & 0x80000000u ? mid : mid + 1) << 32 | lo;
+}
+
+/* Writer side, one up at a time */
+static inline void _count_store(history_count_t *c, uint64_t v)
+{
+    if ((uint32_t)v == 0x80000000u) {
+        __atomic_store_n(&c->mid, (uint32_t)(v >> 32), __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&c->lo, (uint32_t)v, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t _to_ms(const app_history_t *hist, uint64_t sample)
+{
+    return sample * 1000 / hist->rate_hz;
+}
+
+static inline uint64_t _oldest(const history_tier_t *t, uint64_t head)
+{
+    return head > t->capacity ? head - t->capacity : 0;
+}
+
+/* Mark the slot of the next bucket taken, the reader sees its old content as gone */
+static inline void *_slot_begin(history_tier_t *t, size_t size)
+{
+    _count_store(&t->writing, _count_load(&t->head) + 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return (uint8_t *)t->slots + t->next * size;
+}
+
+static inline void _slot_end(history_tier_t *t)
+{
+    if (++t->next == t->capacity) {
+        t->next = 0;
+    }
+    _count_store(&t->head, _count_load(&t->head) + 1);
+}
+
+/* Fold a closed bucket of tier k - 1 (`sum` of its raw samples) into the open one of tier k, and so on up */
+static void _fold(app_history_t *hist, size_t k, history_stat_t *in, int32_t *sum)
+{
+    for (; k < hist->tiers; k++) {
+        history_tier_t *t = &hist->tier[k];
+        for (int c = 0; c < HISTORY_CHANNELS; c++) {
+            if (t->folded == 0 || in[c].min < t->min[c]) {
+                t->min[c] = in[c].min;
+            }
+            if (t->folded == 0 || in[c].max > t->max[c]) {
+                t->max[c] = in[c].max;
+            }
+            t->sum[c] = (t->folded ? t->sum[c] : 0) + sum[c];
+        }
+        if (++t->folded < t->ratio) {
+            return;
+        }
+        t->folded = 0;
+        history_bucket_t *b = _slot_begin(t, sizeof(history_bucket_t));
+        for (int c = 0; c < HISTORY_CHANNELS; c++) {
+            int32_t half = t->sum[c] >= 0 ? (int32_t)t->factor / 2 : -(int32_t)t->factor / 2;
+            in[c] = (history_stat_t) {
+                .min = t->min[c],
+                .max = t->max[c],
+                .mean = (int16_t)((t->sum[c] + half) / (int32_t)t->factor),
+            };
+            b->ch[c] = in[c];
+            sum[c] = t->sum[c];
+        }
+        _slot_end(t);
+    }
+}
+
+void app_history_add(app_history_t *hist, float pressure, float flow)
+{
+    history_tier_t *raw = &hist->tier[0];
+    history_raw_t *slot = _slot_begin(raw, sizeof(history_raw_t));
+    slot->ch[0] = _quantize(pressure);
+    slot->ch[1] = _quantize(flow);
+    history_stat_t in[HISTORY_CHANNELS] = {
+        { slot->ch[0], slot->ch[0], slot->ch[0] },
+        { slot->ch[1], slot->ch[1], slot->ch[1] },
+    };
+    int32_t sum[HISTORY_CHANNELS] = { slot->ch[0], slot->ch[1] };
+    _slot_end(raw);
+    _fold(hist, 1, in, sum);
+}
+
+void app_history_acquire_block(const app_acquire_block_t *block, void *arg)
+{
+    app_history_t *hist = arg;
+    for (int i = 0; i < APP_ACQUIRE_BLOCK_SAMPLES; i++) {
+        app_history_add(hist, block->pressure[i], block->flow[i]);
+    }
+}
+
+static inline void _load(const history_tier_t *t, bool raw, uint32_t slot, history_bucket_t *b)
+{
+    if (raw) {
+        const history_raw_t *r = &((const history_raw_t *)t->slots)[slot];
+        for (int c = 0; c < HISTORY_CHANNELS; c++) {
+            b->ch[c] = (history_stat_t) { r->ch[c], r->ch[c], r->ch[c] };
+        }
+    } else {
+        *b = ((const history_bucket_t *)t->slots)[slot];
+    }
+}
+
+static inline void _to_stat(app_history_stat_t *out, int32_t min, int32_t max, int32_t mean_sum, uint32_t n)
+{
+    out->min = min * (1.0f / HISTORY_SCALE);
+    out->max = max * (1.0f / HISTORY_SCALE);
+    out->mean = (float)mean_sum / n * (1.0f / HISTORY_SCALE);
+}
+
+/* Buckets [b0, b1) of tier k, `merge` to a point */
+static size_t _copy(app_history_t *hist, size_t k, uint64_t b0, uint64_t b1, uint32_t merge,
+                    app_history_point_t *out)
+{
+    const history_tier_t *t = &hist->tier[k];
+    uint32_t slot = b0 % t->capacity;
+    size_t n = 0;
+    for (uint64_t i = b0; i < b1; i += merge, n++) {
+        uint64_t end = b1 - i > merge ? i + merge : b1;
+        int32_t min[HISTORY_CHANNELS] = { INT32_MAX, INT32_MAX }, max[HISTORY_CHANNELS] = { INT32_MIN, INT32_MIN };
+        int32_t mean[HISTORY_CHANNELS] = { 0 };
+        for (uint64_t j = i; j < end; j++) {
+            history_bucket_t b;
+            _load(t, k == 0, slot, &b);
+            if (++slot == t->capacity) {
+                slot = 0;
+            }
+            for (int c = 0; c < HISTORY_CHANNELS; c++) {
+                min[c] = b.ch[c].min < min[c] ? b.ch[c].min : min[c];
+                max[c] = b.ch[c].max > max[c] ? b.ch[c].max : max[c];
+                mean[c] += b.ch[c].mean;
+            }
+        }
+        out[n].timestamp = (uint32_t)_to_ms(hist, i * t->factor);
+        out[n].span_ms = (uint32_t)(_to_ms(hist, end * t->factor) - _to_ms(hist, i * t->factor));
+        _to_stat(&out[n].pressure, min[0], max[0], mean[0], end - i);
+        _to_stat(&out[n].flow, min[1], max[1], mean[1], end - i);
+    }
+    return n;
+}
+
+size_t app_history_query(app_history_t *hist, uint32_t from_ms, uint32_t to_ms, app_history_point_t *out,
+                         size_t max)
+{
+    if (max == 0 || (int32_t)(to_ms - from_ms) <= 0) {
+        return 0;
+    }
+    /* The range as it was within 2^31 ms of the newest sample */
+    uint64_t end = _to_ms(hist, _count_load(&hist->tier[0].head));
+    int32_t back = (int32_t)((uint32_t)end - from_ms);
+    uint64_t from = back > 0 && (uint64_t)back > end ? 0 : end - back;
+    uint64_t to = from + (uint32_t)(to_ms - from_ms);
+    uint64_t s0 = from * hist->rate_hz / 1000;
+    uint64_t s1 = (to * hist->rate_hz + 999) / 1000;
+    if (s1 <= s0) {
+        return 0;
+    }
+
+    for (int attempt = 0; attempt < HISTORY_READ_ATTEMPTS; attempt++) {
+        size_t k;
+        uint64_t b0 = 0, b1 = 0;
+        /*
+         * The finest tier that holds the start and does not need as many
+         * buckets merged per point as the next tier has in one, else the
+         * coarsest: at most max * ratio buckets are read below that one.
+         */
+        for (k = 0; k < hist->tiers; k++) {
+            const history_tier_t *t = &hist->tier[k];
+            uint64_t head = _count_load(&t->head);
+            uint64_t oldest = _oldest(t, head);
+            b0 = s0 / t->factor;
+            b1 = (s1 - 1) / t->factor + 1;
+            b1 = b1 < head ? b1 : head;
+            if (k == hist->tiers - 1) {
+                b0 = b0 > oldest ? b0 : oldest;
+                break;
+            }
+            if (b0 >= oldest && (b1 <= b0 || b1 - b0 <= max * (hist->tier[k + 1].ratio - 1))) {
+                break;
+            }
+        }
+        if (b1 <= b0) {
+            return 0;
+        }
+        uint32_t merge = (b1 - b0 + max - 1) / max;
+        size_t n = _copy(hist, k, b0, b1, merge, out);
+
+        /* Nothing copied may have been overwritten meanwhile */
+        const history_tier_t *t = &hist->tier[k];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (b0 >= _oldest(t, _count_load(&t->writing))) {
+            return n;
+        }
+    }
+    return 0;
+}
+
+void app_history_span(app_history_t *hist, uint32_t *oldest_ms, uint32_t *end_ms)
+{
+    uint64_t oldest = UINT64_MAX;
+    for (size_t k = 0; k < hist->tiers; k++) {
+        const history_tier_t *t = &hist->tier[k];
+        uint64_t s = _oldest(t, _count_load(&t->head)) * t->factor;
+        oldest = s < oldest ? s : oldest;
+    }
+    *oldest_ms = (uint32_t)_to_ms(hist, oldest);
+    *end_ms = (uint32_t)_to_ms(hist, _count_load(&hist->tier[0].head));
+}
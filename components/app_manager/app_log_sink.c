@@ -0,0 +1,315 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "esp_log.h"
+#include "app_log_sink.h"
+#include "app_record_log.h"
+static const char *TAG = "APP_LOG_SINK";
+
+#define LOG_SINK_PATH_MAX       48
+
+typedef struct {
+    uint32_t seq;               /* Position the slot is free for, that + 1 once it holds the line */
+    uint32_t len;
+    char line[APP_LOG_SINK_LINE_MAX];
+} log_slot_t;
+
+typedef struct {
+    char path[LOG_SINK_PATH_MAX];
+} log_sink_file_t;
+
+typedef struct {
+    uint32_t mask;
+    uint32_t head;              /* Slots taken, by any producer */
+    uint32_t tail;              /* Slots drained, by the task only */
+    bool console;
+    size_t max_file_size;
+    TickType_t poll;
+    TickType_t flush;
+    vprintf_like_t orig;
+    volatile bool run;
+    QueueHandle_t file_queue;
+    QueueHandle_t done_queue;
+    FILE *file;
+    char *file_buf;
+    size_t file_buf_size;
+    long file_size;
+    bool file_dirty;            /* Lines in file_buf since file_dirty_since */
+    TickType_t file_dirty_since;
+    log_sink_file_t file_path;
+    app_log_sink_stats_t stats;
+    log_slot_t *slots;
+} log_sink_t;
+
+static log_sink_t *g_sink;
+/* Producers inside _sink_vprintf(), counted before they look at g_sink so stopping can wait for them */
+static uint32_t g_writers;
+static vprintf_like_t g_orig;
+
+static int _sink_vprintf(const char *format, va_list args)
+{
+    __atomic_fetch_add(&g_writers, 1, __ATOMIC_SEQ_CST);
+    log_sink_t *sink = __atomic_load_n(&g_sink, __ATOMIC_SEQ_CST);
+    if (sink == NULL) {
+        /* Stopped after this call was routed here */
+        __atomic_fetch_sub(&g_writers, 1, __ATOMIC_RELEASE);
+        return g_orig(format, args);
+    }
+    uint32_t pos = __atomic_load_n(&sink->head, __ATOMIC_RELAXED);
+    log_slot_t *slot;
+    for (;;) {
+        slot = &sink->slots[pos & sink->mask];
+        int32_t diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&sink->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* Still holds the line from a lap ago */
+            __atomic_fetch_add(&sink->stats.dropped, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_sub(&g_writers, 1, __ATOMIC_RELEASE);
+            return 0;
+        } else {
+            pos = __atomic_load_n(&sink->head, __ATOMIC_RELAXED);
+        }
+    }
+    int len = vsnprintf(slot->line, sizeof(slot->line), format, args);
+    if (len < 0) {
+        len = 0;
+    } else if (len >= (int)sizeof(slot->line)) {
+        len = sizeof(slot->line) - 1;
+        slot->line[len - 1] = '\n';
+        __atomic_fetch_add(&sink->stats.truncated, 1, __ATOMIC_RELAXED);
+    }
+    slot->len = len;
+    __atomic_fetch_add(&sink->stats.lines, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&g_writers, 1, __ATOMIC_RELEASE);
+    return len;
+}
+
+/* Through the replaced vprintf, which takes a format */
+static void _console_print(log_sink_t *sink, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    sink->orig(format, args);
+    va_end(args);
+}
+
+static void _file_open(log_sink_t *sink)
+{
+    if (sink->file) {
+        fclose(sink->file);
+        sink->file = NULL;
+    }
+    if (sink->file_path.path[0] == '\0') {
+        return;
+    }
+    sink->file = fopen(sink->file_path.path, "a");
+    if (sink->file == NULL) {
+        /* Not to the ring: this task would be writing its own lines */
+        _console_print(sink, "%s: cannot open %s\n", TAG, sink->file_path.path);
+        return;
+    }
+    /* Full buffers only: SPIFFS is written whole pages at a time */
+    setvbuf(sink->file, sink->file_buf, _IOFBF, sink->file_buf_size);
+    fseek(sink->file, 0, SEEK_END);
+    sink->file_size = ftell(sink->file);
+}
+
+static void _file_write(log_sink_t *sink, const char *line, size_t len)
+{
+    if (sink->file && sink->file_size + (long)len > (long)sink->max_file_size) {
+        char old[LOG_SINK_PATH_MAX + 4];
+        fclose(sink->file);
+        sink->file = NULL;
+        snprintf(old, sizeof(old), "%s.old", sink->file_path.path);
+        remove(old);
+        rename(sink->file_path.path, old);
+        _file_open(sink);
+    }
+    if (sink->file == NULL || fwrite(line, 1, len, sink->file) != len) {
+        sink->stats.file_errors++;
+        return;
+    }
+    sink->file_size += len;
+}
+
+/* Every line ready in order, stopping at a slot still being written; how many */
+static uint32_t _drain(log_sink_t *sink)
+{
+    uint32_t n = 0;
+    uint32_t queued = __atomic_load_n(&sink->head, __ATOMIC_RELAXED) - sink->tail;
+    if (queued > sink->stats.max_queued) {
+        sink->stats.max_queued = queued;
+    }
+    for (;;) {
+        log_slot_t *slot = &sink->slots[sink->tail & sink->mask];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != sink->tail + 1) {
+            break;
+        }
+        if (sink->console) {
+            _console_print(sink, "%.*s", (int)slot->len, slot->line);
+        }
+        if (sink->file_path.path[0]) {
+            _file_write(sink, slot->line, slot->len);
+        }
+        __atomic_store_n(&slot->seq, sink->tail + sink->mask + 1, __ATOMIC_RELEASE);
+        sink->tail++;
+        n++;
+    }
+    sink->stats.written += n;
+    return n;
+}
+
+static void _log_sink_task(void *pv)
+{
+    log_sink_t *sink = pv;
+    while (sink->run) {
+        if (xQueueReceive(sink->file_queue, &sink->file_path, sink->poll) == pdTRUE) {
+            sink->file_dirty = false;
+            _file_open(sink);
+        }
+        if (_drain(sink) && sink->file && !sink->file_dirty) {
+            sink->file_dirty = true;
+            sink->file_dirty_since = xTaskGetTickCount();
+        }
+        if (sink->file_dirty && xTaskGetTickCount() - sink->file_dirty_since >= sink->flush) {
+            fflush(sink->file);
+            sink->file_dirty = false;
+        }
+    }
+    /* g_sink is NULL: producers still inside finish their lines, later ones go to the replaced vprintf */
+    while (__atomic_load_n(&g_writers, __ATOMIC_SEQ_CST)) {
+        vTaskDelay(1);
+    }
+    _drain(sink);
+    if (sink->file) {
+        fclose(sink->file);
+    }
+    bool done = true;
+    xQueueSend(sink->done_queue, &done, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+esp_err_t app_log_sink_start(const app_log_sink_cfg_t *config)
+{
+    if (g_sink) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (config->path && strlen(config->path) >= LOG_SINK_PATH_MAX) {
+        ESP_LOGE(TAG, "Path too long");
+        return ESP_ERR_INVALID_ARG;
+    }
+    log_sink_t *sink = calloc(1, sizeof(log_sink_t));
+    if (sink == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        return ESP_ERR_NO_MEM;
+    }
+    size_t slots = 2;
+    while (slots < config->slots) {
+        slots <<= 1;
+    }
+    sink->slots = malloc(slots * sizeof(log_slot_t));
+    sink->file_buf_size = (config->file_buffer + APP_RECORD_LOG_PAGE - 1) / APP_RECORD_LOG_PAGE * APP_RECORD_LOG_PAGE;
+    sink->file_buf_size = sink->file_buf_size ? sink->file_buf_size : APP_RECORD_LOG_PAGE;
+    sink->file_buf = malloc(sink->file_buf_size);
+    sink->file_queue = xQueueCreate(1, sizeof(log_sink_file_t));
+    sink->done_queue = xQueueCreate(1, sizeof(bool));
+    if (sink->slots == NULL || sink->file_buf == NULL || sink->file_queue == NULL || sink->done_queue == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        goto _log_sink_start_fail;
+    }
+    for (uint32_t i = 0; i < slots; i++) {
+        sink->slots[i].seq = i;
+    }
+    sink->mask = slots - 1;
+    sink->console = config->console;
+    sink->max_file_size = config->max_file_size;
+    sink->poll = pdMS_TO_TICKS(config->poll_ms) ? pdMS_TO_TICKS(config->poll_ms) : 1;
+    sink->flush = pdMS_TO_TICKS(config->flush_ms);
+    sink->run = true;
+    /* Lines from here on wait in the ring for the task */
+    g_sink = sink;
+    sink->orig = esp_log_set_vprintf(_sink_vprintf);
+    g_orig = sink->orig;
+    if (config->path) {
+        strcpy(sink->file_path.path, config->path);
+        _file_open(sink);
+    }
+    if (xTaskCreatePinnedToCore(_log_sink_task, "log_sink_task", 3 * 1024, sink, config->priority, NULL,
+                                config->core) != pdPASS) {
+        esp_log_set_vprintf(sink->orig);
+        __atomic_store_n(&g_sink, NULL, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&g_writers, __ATOMIC_SEQ_CST)) {
+            vTaskDelay(1);
+        }
+        ESP_LOGE(TAG, "error creating log sink task");
+        goto _log_sink_start_fail;
+    }
+    ESP_LOGI(TAG, "%u lines of %d bytes", (unsigned)slots, APP_LOG_SINK_LINE_MAX);
+    return ESP_OK;
+
+_log_sink_start_fail:
+    if (sink->file) {
+        fclose(sink->file);
+    }
+    if (sink->file_queue) {
+        vQueueDelete(sink->file_queue);
+    }
+    if (sink->done_queue) {
+        vQueueDelete(sink->done_queue);
+    }
+    free(sink->file_buf);
+    free(sink->slots);
+    free(sink);
+    return ESP_FAIL;
+}
+
+void app_log_sink_stop(void)
+{
+    log_sink_t *sink = g_sink;
+    if (sink == NULL) {
+        return;
+    }
+    esp_log_set_vprintf(sink->orig);
+    __atomic_store_n(&g_sink, NULL, __ATOMIC_SEQ_CST);
+    sink->run = false;
+    bool done;
+    xQueueReceive(sink->done_queue, &done, portMAX_DELAY);
+    vQueueDelete(sink->done_queue);
+    vQueueDelete(sink->file_queue);
+    free(sink->file_buf);
+    free(sink->slots);
+    free(sink);
+}
+
+esp_err_t app_log_sink_set_file(const char *path)
+{
+    log_sink_file_t file = { { 0 } };
+    if (g_sink == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (path && strlen(path) >= sizeof(file.path)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (path) {
+        strcpy(file.path, path);
+    }
+    return xQueueSend(g_sink->file_queue, &file, portMAX_DELAY) == pdTRUE ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t app_log_sink_get_stats(app_log_sink_stats_t *stats)
+{
+    if (g_sink == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *stats = g_sink->stats;
+    return ESP_OK;
+}
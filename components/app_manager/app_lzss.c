@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "app_lzss.h"
+static const char *TAG = "APP_LZSS";
+
+typedef enum {
+    LZSS_TAG,
+    LZSS_LITERAL,
+    LZSS_INDEX,
+    LZSS_COUNT,
+} lzss_state_t;
+
+struct app_lzss {
+    uint8_t *window;
+    uint32_t max_size;
+    uint32_t mask;
+    uint8_t window_bits;
+    uint8_t lookahead_bits;
+    lzss_state_t state;
+    uint32_t bits;              /* Unread input bits, right aligned */
+    int nbits;
+    uint32_t index;             /* Distance of the back-reference being decoded */
+    uint32_t head;              /* Total bytes decoded, the window position is head & mask */
+    uint32_t flushed;           /* Bytes already given to the write callback */
+};
+
+app_lzss_t *app_lzss_new(int max_window_bits)
+{
+    if (max_window_bits < APP_LZSS_MIN_WINDOW_BITS || max_window_bits > APP_LZSS_MAX_WINDOW_BITS) {
+        return NULL;
+    }
+    app_lzss_t *lzss = calloc(1, sizeof(app_lzss_t));
+    if (lzss == NULL) {
+        return NULL;
+    }
+    lzss->max_size = 1 << max_window_bits;
+    lzss->window = malloc(lzss->max_size);
+    if (lzss->window == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        free(lzss);
+        return NULL;
+    }
+    return lzss;
+}
+
+void app_lzss_delete(app_lzss_t *lzss)
+{
+    if (lzss) {
+        free(lzss->window);
+        free(lzss);
+    }
+}
+
+esp_err_t app_lzss_reset(app_lzss_t *lzss, int window_bits, int lookahead_bits)
+{
+    if (window_bits < APP_LZSS_MIN_WINDOW_BITS || (1U << window_bits) > lzss->max_size ||
+            lookahead_bits < 3 || lookahead_bits >= window_bits) {
+        ESP_LOGE(TAG, "Unsupported window %d/%d", window_bits, lookahead_bits);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    lzss->window_bits = window_bits;
+    lzss->lookahead_bits = lookahead_bits;
+    lzss->mask = (1 << window_bits) - 1;
+    lzss->state = LZSS_TAG;
+    lzss->bits = 0;
+    lzss->nbits = 0;
+    lzss->head = 0;
+    lzss->flushed = 0;
+    /* References before the start of the stream read zeros, as in heatshrink */
+    memset(lzss->window, 0, lzss->mask + 1);
+    return ESP_OK;
+}
+
+uint32_t app_lzss_total_out(app_lzss_t *lzss)
+{
+    return lzss->head;
+}
+
+/* Hand everything decoded since the last flush to `write`, it never spans the window end */
+static esp_err_t _lzss_flush(app_lzss_t *lzss, app_lzss_write_fn write, void *arg)
+{
+    uint32_t len = lzss->head - lzss->flushed;
+    if (len == 0) {
+        return ESP_OK;
+    }
+    esp_err_t err = write(arg, lzss->window + (lzss->flushed & lzss->mask), len);
+    lzss->flushed = lzss->head;
+    return err;
+}
+
+#define LZSS_PUT(lzss, c, err) do {                                     \
+        (lzss)->window[(lzss)->head & (lzss)->mask] = (c);              \
+        if ((++(lzss)->head & (lzss)->mask) == 0) {                     \
+            err = _lzss_flush(lzss, write, arg);                        \
+        }                                                               \
+    } while (0)
+
+esp_err_t app_lzss_decode(app_lzss_t *lzss, const uint8_t *in, size_t len, app_lzss_write_fn write, void *arg)
+{
+    const uint8_t *end = in + len;
+    esp_err_t err = ESP_OK;
+    /* Fields are never wider than 16 bits, so a 24-bit refill is always enough */
+    while (err == ESP_OK) {
+        while (lzss->nbits <= 16 && in < end) {
+            lzss->bits = (lzss->bits << 8) | *in++;
+            lzss->nbits += 8;
+        }
+        int need;
+        switch (lzss->state) {
+            case LZSS_TAG:
+                need = 1;
+                break;
+            case LZSS_LITERAL:
+                need = 8;
+                break;
+            case LZSS_INDEX:
+                need = lzss->window_bits;
+                break;
+            default:
+                need = lzss->lookahead_bits;
+                break;
+        }
+        if (lzss->nbits < need) {
+            break;
+        }
+        lzss->nbits -= need;
+        uint32_t field = (lzss->bits >> lzss->nbits) & ((1 << need) - 1);
+        switch (lzss->state) {
+            case LZSS_TAG:
+                lzss->state = field ? LZSS_LITERAL : LZSS_INDEX;
+                break;
+            case LZSS_LITERAL:
+                LZSS_PUT(lzss, field, err);
+                lzss->state = LZSS_TAG;
+                break;
+            case LZSS_INDEX:
+                lzss->index = field + 1;
+                lzss->state = LZSS_COUNT;
+                break;
+            case LZSS_COUNT:
+                for (uint32_t i = 0; i <= field && err == ESP_OK; i++) {
+                    uint8_t c = lzss->window[(lzss->head - lzss->index) & lzss->mask];
+                    LZSS_PUT(lzss, c, err);
+                }
+                lzss->state = LZSS_TAG;
+                break;
+        }
+    }
+    if (err == ESP_OK) {
+        err = _lzss_flush(lzss, write, arg);
+    }
+    return err;
+}
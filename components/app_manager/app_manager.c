@@ -3,10 +3,12 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/queue.h>
 #include "esp_vfs_dev.h"
 #include "esp_spiffs.h"
 #include "esp_log.h"
 #include "app_manager.h"
+#include "app_arena.h"
 #include "openvent.pb-c.h"
 static const char *TAG = "APP_MANAGER";
 
@@ -18,69 +20,109 @@ typedef struct {
     bool run;
     RingbufHandle_t input_rb;
     RingbufHandle_t output_rb;
+    QueueHandle_t push_queue;   /* app_manager_frame_t, pushed without a request */
     char *access_key;
     app_manager_event_handler event_handler;
     void *ctx;
+    app_arena_t arena;
+    bool cur_tagged;            /* Request being handled came in a sequence-tagged frame */
+    uint16_t cur_seq;
+    bool cur_responded;
+    uint32_t requests;
+    uint32_t unpack_errors;
+    uint32_t pushes;
+    uint32_t push_drops;
 } app_manager_data;
 
 static app_manager_data *g_manager;
+/* Set by the transport, which may come up before or after the manager */
+static size_t g_frame_limit = APP_MANAGER_DEFAULT_FRAME_LIMIT;
+
+/* Pack `resp` into a frame buffer the receiver will own */
+static esp_err_t _app_manager_frame(VentResponse *resp, bool tagged, uint16_t seq, app_manager_frame_t *frame)
+{
+    size_t packed_len = vent_response__get_packed_size(resp);
+    size_t hdr_len = 0;
+    frame->tagged = tagged;
+    if (frame->tagged) {
+        /* Laid out as a complete one-entry pipelined reply, so it can still be handed over as is */
+        hdr_len = APP_MANAGER_TAG_REPLY_HDR_LEN + APP_MANAGER_TAG_ENTRY_HDR_LEN;
+    }
+    frame->len = hdr_len + packed_len;
+    /* Packed once into its final buffer, the receiver of the frame takes ownership */
+    frame->data = (uint8_t *) malloc(frame->len ? frame->len : 1);
+    MEM_CHECK(frame->data);
+    if (frame->tagged) {
+        uint8_t *hdr = frame->data;
+        hdr[0] = APP_MANAGER_TAG_MARKER;
+        hdr[1] = 0;                                 /* reply flags */
+        hdr[2] = 1;                                 /* entry count */
+        hdr[3] = seq & 0xff;
+        hdr[4] = seq >> 8;
+        hdr[5] = packed_len & 0xff;
+        hdr[6] = packed_len >> 8;
+    }
+    vent_response__pack(resp, frame->data + hdr_len);
+    return ESP_OK;
+}
 
 esp_err_t app_manager_response(VentResponse *resp)
 {
-    size_t outlen = vent_response__get_packed_size(resp);
-    uint8_t *outbuf = (uint8_t *) malloc(outlen);
-    if (outbuf == NULL) {
-        ESP_LOGE(TAG, "Memory exhaused");
-        return ESP_FAIL;
+    app_manager_frame_t frame;
+    if (_app_manager_frame(resp, g_manager->cur_tagged, g_manager->cur_seq, &frame) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
     }
-    vent_response__pack(resp, outbuf);
-    if (xRingbufferSend(g_manager->output_rb, outbuf, outlen, 10000 / portTICK_RATE_MS) != pdPASS) {
+    if (xRingbufferSend(g_manager->output_rb, &frame, sizeof(frame), 10000 / portTICK_RATE_MS) != pdPASS) {
         ESP_LOGE(TAG, "Error response data");
-        free(outbuf);
+        free(frame.data);
         return ESP_FAIL;
     }
-    free(outbuf);
+    g_manager->cur_responded = true;
     return ESP_OK;
 }
 
-esp_err_t app_manager_file_handle(void **ctx, VentRequest *req, VentResponse *resp)
+esp_err_t app_manager_push(VentResponse *resp)
 {
-    FileData *file_data = req->write_firmware_request;
-    FILE *file = *ctx;
-    ESP_LOGI(TAG, "Ctx = %x", (int)*ctx);
-
-    resp->status = STATUS__Fail;
+    app_manager_frame_t frame, oldest;
+    if (_app_manager_frame(resp, true, APP_MANAGER_TAG_SEQ_PUSH, &frame) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    /* Only ever this side adds, so once the oldest is out there is room */
+    if (xQueueSend(g_manager->push_queue, &frame, 0) != pdPASS) {
+        if (xQueueReceive(g_manager->push_queue, &oldest, 0) == pdPASS) {
+            free(oldest.data);
+            g_manager->push_drops++;
+        }
+        xQueueSend(g_manager->push_queue, &frame, 0);
+    }
+    g_manager->pushes++;
+    return ESP_OK;
+}
 
-    if (file_data == NULL) {
-        return app_manager_response(resp);
+void app_manager_push_flush(void)
+{
+    app_manager_frame_t frame;
+    while (xQueueReceive(g_manager->push_queue, &frame, 0) == pdPASS) {
+        free(frame.data);
     }
-    if (file_data->offset == 0 && file_data->file_name) {
+}
 
-        if (file) {
-            fclose(file);
-            file = NULL;
-            *ctx = NULL;
-        }
-        ESP_LOGI(TAG, "Opening file %s", file_data->file_name);
-        file = fopen(file_data->file_name, "w");
-        if (file == NULL) {
-            ESP_LOGE(TAG, "Error opening file %s", file_data->file_name);
-            return app_manager_response(resp);
-        }
-        *ctx = file;
-    }
-    if (file_data->data.len > 0 && file) {
-        ESP_LOGI(TAG, "Writing %d/%d, memfree=%d", file_data->offset + file_data->data.len, file_data->file_size, esp_get_free_heap_size());
-        fwrite(file_data->data.data, sizeof(uint8_t), file_data->data.len, file);
-        if (file_data->offset + file_data->data.len >= file_data->file_size) {
-            fclose(file);
-            file = NULL;
-            *ctx = NULL;
-            ESP_LOGI(TAG, "Write file finish %s", file_data->file_name);
-        }
+bool app_manager_request_tagged(void)
+{
+    return g_manager->cur_tagged;
+}
+
+/* Tell the transport a tagged request is done even though it got no response */
+static void _app_manager_complete(void)
+{
+    app_manager_frame_t frame = {
+        .data = NULL,
+        .len = 0,
+        .tagged = true,
+    };
+    if (xRingbufferSend(g_manager->output_rb, &frame, sizeof(frame), 10000 / portTICK_RATE_MS) != pdPASS) {
+        ESP_LOGE(TAG, "Error response data");
     }
-    resp->status = STATUS__Success;
-    return app_manager_response(resp);
 }
 
 static esp_err_t _app_process_data(VentRequest *req)
@@ -101,6 +143,7 @@ static esp_err_t _app_process_data(VentRequest *req)
 
 static void _app_manager_task(void *pv)
 {
+    (void)pv;
     uint8_t *data;
     size_t data_size;
     while (g_manager->run) {
@@ -108,16 +151,36 @@ static void _app_manager_task(void *pv)
         if (data == NULL) {
             continue;
         }
-        ESP_LOGI(TAG, "Receiving %d bytes", data_size);
-        VentRequest *req = vent_request__unpack(NULL, data_size, data);
+        ESP_LOGI(TAG, "Receiving %u bytes", (unsigned)data_size);
+        g_manager->requests++;
+        g_manager->cur_responded = false;
+        const uint8_t *packed = data;
+        size_t packed_len = data_size;
+        g_manager->cur_tagged = data_size >= APP_MANAGER_TAG_REQ_HDR_LEN && data[0] == APP_MANAGER_TAG_MARKER;
+        if (g_manager->cur_tagged) {
+            g_manager->cur_seq = data[1] | (data[2] << 8);
+            packed += APP_MANAGER_TAG_REQ_HDR_LEN;
+            packed_len -= APP_MANAGER_TAG_REQ_HDR_LEN;
+        }
+        VentRequest *req = vent_request__unpack(app_arena_allocator(&g_manager->arena), packed_len, packed);
         vRingbufferReturnItem(g_manager->input_rb, data);
 
         if (req == NULL) {
             ESP_LOGE(TAG, "Error unpack data");
+            g_manager->unpack_errors++;
+            app_arena_reset(&g_manager->arena);
+            /* Still answer, a pipelined client is holding a window slot for it */
+            VentResponse resp = VENT_RESPONSE__INIT;
+            resp.status = STATUS__Fail;
+            app_manager_response(&resp);
             continue;
         }
         _app_process_data(req);
-        vent_request__free_unpacked(req, NULL);
+        if (g_manager->cur_tagged && !g_manager->cur_responded) {
+            _app_manager_complete();
+        }
+        /* Everything unpacked lives in the arena, drop it all at once */
+        app_arena_reset(&g_manager->arena);
 
     }
     vTaskDelete(NULL);
@@ -132,6 +195,15 @@ esp_err_t app_manager_init(app_manager_cfg_t *config)
     MEM_CHECK_ACT(g_manager->input_rb, goto _app_manager_init_fail);
     g_manager->output_rb = xRingbufferCreate(config->output_rb_size, RINGBUF_TYPE_NOSPLIT);
     MEM_CHECK_ACT(g_manager->output_rb, goto _app_manager_init_fail);
+    g_manager->push_queue = xQueueCreate(config->push_queue_len ? config->push_queue_len : 4,
+                                         sizeof(app_manager_frame_t));
+    MEM_CHECK_ACT(g_manager->push_queue, goto _app_manager_init_fail);
+    /* An unpacked request is at most the largest ring item plus the message structs */
+    size_t arena_size = config->arena_size ? config->arena_size : config->input_rb_size / 2 + 1024;
+    if (app_arena_init(&g_manager->arena, arena_size) != ESP_OK) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        goto _app_manager_init_fail;
+    }
 
     g_manager->run = true;
     g_manager->event_handler = config->event_handler;
@@ -149,6 +221,12 @@ _app_manager_init_fail:
     if (g_manager && g_manager->output_rb) {
         vRingbufferDelete(g_manager->output_rb);
     }
+    if (g_manager && g_manager->push_queue) {
+        vQueueDelete(g_manager->push_queue);
+    }
+    if (g_manager) {
+        app_arena_deinit(&g_manager->arena);
+    }
     free(g_manager);
     return ESP_FAIL;
 }
@@ -162,3 +240,53 @@ RingbufHandle_t app_manager_get_output_rb()
 {
     return g_manager->output_rb;
 }
+
+QueueHandle_t app_manager_get_push_queue(void)
+{
+    return g_manager ? g_manager->push_queue : NULL;
+}
+
+void app_manager_set_frame_limit(size_t limit)
+{
+    g_frame_limit = limit;
+}
+
+size_t app_manager_get_frame_limit(void)
+{
+    return g_frame_limit;
+}
+
+static size_t _app_manager_room(VentResponse *resp, bool tagged)
+{
+    /* Everything but the data, plus its field tag and up to 3 bytes of length */
+    size_t overhead = vent_response__get_packed_size(resp) + 4;
+    if (tagged) {
+        overhead += APP_MANAGER_TAG_REPLY_HDR_LEN + APP_MANAGER_TAG_ENTRY_HDR_LEN;
+    }
+    return g_frame_limit > overhead ? g_frame_limit - overhead : 0;
+}
+
+size_t app_manager_response_room(VentResponse *resp)
+{
+    return _app_manager_room(resp, g_manager->cur_tagged);
+}
+
+size_t app_manager_push_room(VentResponse *resp)
+{
+    return _app_manager_room(resp, true);
+}
+
+esp_err_t app_manager_get_stats(app_manager_stats_t *stats)
+{
+    if (g_manager == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    stats->requests = g_manager->requests;
+    stats->unpack_errors = g_manager->unpack_errors;
+    stats->arena_size = g_manager->arena.size;
+    stats->arena_high_water = g_manager->arena.high_water;
+    stats->arena_overflows = g_manager->arena.overflows;
+    stats->pushes = g_manager->pushes;
+    stats->push_drops = g_manager->push_drops;
+    return ESP_OK;
+}
@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "mbedtls/sha256.h"
+#include "app_ota.h"
+#include "app_crc32.h"
+static const char *TAG = "APP_OTA";
+
+#define OTA_SECTOR_SIZE             SPI_FLASH_SEC_SIZE
+#define OTA_ALIGN_UP(x)             (((x) + OTA_SECTOR_SIZE - 1) & ~(uint32_t)(OTA_SECTOR_SIZE - 1))
+#define OTA_IMAGE_MAGIC             0xe9    /* ESP_IMAGE_HEADER_MAGIC */
+#define OTA_HASH_APPENDED_OFFSET    23      /* offsetof(esp_image_header_t, hash_appended) */
+#define OTA_DIGEST_LEN              32
+
+typedef enum {
+    OTA_OP_BEGIN,
+    OTA_OP_WRITE,
+    OTA_OP_END,                 /* Write what is in the buffer, then verify */
+    OTA_OP_ABORT,
+    OTA_OP_EXIT,
+} ota_op_t;
+
+typedef struct {
+    ota_op_t op;
+    uint8_t *buf;
+    size_t len;
+    const esp_partition_t *partition;
+    uint32_t image_size;
+    uint32_t crc;               /* END: expected CRC-32 of the image, 0 = not checked */
+} ota_cmd_t;
+
+struct app_ota {
+    QueueHandle_t cmd_queue;    /* ota_cmd_t, to the OTA task */
+    QueueHandle_t free_queue;   /* uint8_t *, buffers the caller may fill */
+    uint8_t *mem;
+    int buffer_count;
+    int erase_ahead;
+    /* Caller side */
+    bool active;
+    uint8_t *fill;
+    size_t fill_len;
+    uint32_t received;
+    int64_t begin_us;
+    /* OTA task side */
+    const esp_partition_t *partition;
+    uint32_t image_size;
+    uint32_t written;
+    uint32_t erased;
+    bool hash_appended;
+    mbedtls_sha256_context sha;
+    uint8_t digest[OTA_DIGEST_LEN];     /* Appended to the image, collected as it goes by */
+    uint32_t crc;
+    volatile esp_err_t error;
+    app_ota_stats_t stats;
+};
+
+static bool _ota_erase_pending(app_ota_t *ota)
+{
+    if (ota->partition == NULL || ota->error != ESP_OK) {
+        return false;
+    }
+    uint32_t limit = ota->written + ota->erase_ahead * OTA_SECTOR_SIZE;
+    uint32_t end = OTA_ALIGN_UP(ota->image_size);
+    return ota->erased < (limit < end ? limit : end);
+}
+
+static esp_err_t _ota_erase_next(app_ota_t *ota)
+{
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = esp_partition_erase_range(ota->partition, ota->erased, OTA_SECTOR_SIZE);
+    ota->stats.erase_time_us += esp_timer_get_time() - start;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error erasing sector at %d (%s)", ota->erased, esp_err_to_name(err));
+        ota->error = err;
+        return err;
+    }
+    ota->erased += OTA_SECTOR_SIZE;
+    return ESP_OK;
+}
+
+/* Hash the part of [written, written + len) covered by the digest, keep the rest as the digest */
+static void _ota_hash(app_ota_t *ota, const uint8_t *buf, size_t len)
+{
+    if (ota->written == 0) {
+        ota->hash_appended = len > OTA_HASH_APPENDED_OFFSET && buf[OTA_HASH_APPENDED_OFFSET] == 1 &&
+                             ota->image_size > OTA_DIGEST_LEN;
+    }
+    uint32_t hashed_end = ota->image_size - (ota->hash_appended ? OTA_DIGEST_LEN : 0);
+    uint32_t pos = ota->written;
+    size_t hashed = pos < hashed_end ? hashed_end - pos : 0;
+    if (hashed > len) {
+        hashed = len;
+    }
+    mbedtls_sha256_update_ret(&ota->sha, buf, hashed);
+    for (size_t i = hashed; i < len; i++) {
+        ota->digest[pos + i - hashed_end] = buf[i];
+    }
+}
+
+static void _ota_write(app_ota_t *ota, const uint8_t *buf, size_t len)
+{
+    if (ota->written + len > ota->image_size) {
+        ESP_LOGE(TAG, "Image larger than %d bytes", ota->image_size);
+        ota->error = ESP_ERR_INVALID_SIZE;
+        return;
+    }
+    while (ota->erased < ota->written + len) {
+        if (_ota_erase_next(ota) != ESP_OK) {
+            return;
+        }
+        ota->stats.erased_inline++;
+    }
+    int64_t start = esp_timer_get_time();
+    _ota_hash(ota, buf, len);
+    ota->crc = app_crc32_update(ota->crc, buf, len);
+    int64_t hashed = esp_timer_get_time();
+    esp_err_t err = esp_partition_write(ota->partition, ota->written, buf, len);
+    ota->stats.hash_time_us += hashed - start;
+    ota->stats.write_time_us += esp_timer_get_time() - hashed;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error writing at %d (%s)", ota->written, esp_err_to_name(err));
+        ota->error = err;
+        return;
+    }
+    ota->written += len;
+    ota->stats.bytes_written += len;
+}
+
+static void _ota_finish(app_ota_t *ota, uint32_t crc)
+{
+    uint8_t sha[OTA_DIGEST_LEN];
+    mbedtls_sha256_finish_ret(&ota->sha, sha);
+    if (ota->error == ESP_OK && ota->written != ota->image_size) {
+        ESP_LOGE(TAG, "Image incomplete, %d/%d", ota->written, ota->image_size);
+        ota->error = ESP_ERR_INVALID_SIZE;
+    }
+    if (ota->error == ESP_OK && crc != 0 && crc != ota->crc) {
+        ESP_LOGE(TAG, "Image CRC-32 %08x, expected %08x", ota->crc, crc);
+        ota->error = ESP_ERR_INVALID_CRC;
+    }
+    if (ota->error == ESP_OK && ota->hash_appended && memcmp(sha, ota->digest, OTA_DIGEST_LEN) != 0) {
+        ESP_LOGE(TAG, "Image SHA-256 mismatch");
+        ota->error = ESP_ERR_INVALID_CRC;
+    }
+    if (ota->error == ESP_OK) {
+        char hex[2 * OTA_DIGEST_LEN + 1];
+        for (int i = 0; i < OTA_DIGEST_LEN; i++) {
+            sprintf(hex + 2 * i, "%02x", sha[i]);
+        }
+        ESP_LOGI(TAG, "Image SHA-256 %s", hex);
+        /* Verifies the image header and segments once more on target */
+        esp_err_t err = esp_ota_set_boot_partition(ota->partition);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Error setting boot partition (%s)", esp_err_to_name(err));
+            ota->error = err;
+        } else {
+            ESP_LOGI(TAG, "Image written to %s, boots next time", ota->partition->label);
+        }
+    }
+    mbedtls_sha256_free(&ota->sha);
+    ota->partition = NULL;
+}
+
+static void _ota_task(void *arg)
+{
+    app_ota_t *ota = arg;
+    ota_cmd_t cmd;
+
+    for (;;) {
+        /* Idle time goes into erasing ahead of the write pointer */
+        TickType_t wait = _ota_erase_pending(ota) ? 0 : portMAX_DELAY;
+        if (xQueueReceive(ota->cmd_queue, &cmd, wait) != pdTRUE) {
+            if (_ota_erase_next(ota) == ESP_OK) {
+                ota->stats.erased_ahead++;
+            }
+            continue;
+        }
+        if (cmd.op == OTA_OP_EXIT) {
+            break;
+        }
+        switch (cmd.op) {
+            case OTA_OP_BEGIN:
+                ota->partition = cmd.partition;
+                ota->image_size = cmd.image_size;
+                ota->written = 0;
+                ota->erased = 0;
+                ota->crc = 0;
+                mbedtls_sha256_init(&ota->sha);
+                mbedtls_sha256_starts_ret(&ota->sha, 0);
+                break;
+            case OTA_OP_WRITE:
+            case OTA_OP_END:
+                if (cmd.len > 0 && ota->partition && ota->error == ESP_OK) {
+                    _ota_write(ota, cmd.buf, cmd.len);
+                }
+                if (cmd.op == OTA_OP_END && ota->partition) {
+                    _ota_finish(ota, cmd.crc);
+                }
+                xQueueSend(ota->free_queue, &cmd.buf, portMAX_DELAY);
+                break;
+            case OTA_OP_ABORT:
+                if (ota->partition) {
+                    mbedtls_sha256_free(&ota->sha);
+                    ota->partition = NULL;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    /* Tell app_ota_delete() we are gone */
+    xQueueSend(ota->free_queue, &cmd.buf, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+static uint8_t *_ota_take(app_ota_t *ota)
+{
+    uint8_t *buf;
+    if (xQueueReceive(ota->free_queue, &buf, 0) == pdTRUE) {
+        return buf;
+    }
+    int64_t start = esp_timer_get_time();
+    xQueueReceive(ota->free_queue, &buf, portMAX_DELAY);
+    ota->stats.stalls++;
+    ota->stats.stall_time_us += esp_timer_get_time() - start;
+    return buf;
+}
+
+/* Wait until the OTA task has given back every buffer but the one being filled */
+static void _ota_sync(app_ota_t *ota)
+{
+    uint8_t *bufs[ota->buffer_count];
+    int held = ota->fill ? 1 : 0;
+    for (int i = held; i < ota->buffer_count; i++) {
+        xQueueReceive(ota->free_queue, &bufs[i], portMAX_DELAY);
+    }
+    if (ota->fill == NULL) {
+        ota->fill = bufs[0];
+    }
+    for (int i = 1; i < ota->buffer_count; i++) {
+        xQueueSend(ota->free_queue, &bufs[i], 0);
+    }
+}
+
+static void _ota_send(app_ota_t *ota, ota_op_t op, uint32_t crc)
+{
+    ota_cmd_t cmd = {
+        .op = op,
+        .buf = ota->fill,
+        .len = ota->fill_len,
+        .crc = crc,
+    };
+    /* The queue holds every buffer plus the control commands, this never blocks for long */
+    xQueueSend(ota->cmd_queue, &cmd, portMAX_DELAY);
+    ota->fill = NULL;
+    ota->fill_len = 0;
+}
+
+app_ota_t *app_ota_new(int buffer_count, int erase_ahead)
+{
+    app_ota_t *ota = calloc(1, sizeof(app_ota_t));
+    if (ota == NULL) {
+        return NULL;
+    }
+    ota->buffer_count = buffer_count;
+    ota->erase_ahead = erase_ahead;
+    ota->mem = malloc(OTA_SECTOR_SIZE * buffer_count);
+    ota->cmd_queue = xQueueCreate(buffer_count + 3, sizeof(ota_cmd_t));
+    ota->free_queue = xQueueCreate(buffer_count, sizeof(uint8_t *));
+    if (ota->mem == NULL || ota->cmd_queue == NULL || ota->free_queue == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        goto _ota_new_fail;
+    }
+    for (int i = 1; i < buffer_count; i++) {
+        uint8_t *buf = ota->mem + i * OTA_SECTOR_SIZE;
+        xQueueSend(ota->free_queue, &buf, 0);
+    }
+    ota->fill = ota->mem;
+    if (xTaskCreate(_ota_task, "ota_task", 4 * 1024, ota, 4, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "error creating ota task");
+        goto _ota_new_fail;
+    }
+    return ota;
+
+_ota_new_fail:
+    if (ota->cmd_queue) {
+        vQueueDelete(ota->cmd_queue);
+    }
+    if (ota->free_queue) {
+        vQueueDelete(ota->free_queue);
+    }
+    free(ota->mem);
+    free(ota);
+    return NULL;
+}
+
+void app_ota_delete(app_ota_t *ota)
+{
+    if (ota == NULL) {
+        return;
+    }
+    app_ota_abort(ota);
+    ota_cmd_t cmd = { .op = OTA_OP_EXIT, .buf = ota->fill };
+    xQueueSend(ota->cmd_queue, &cmd, portMAX_DELAY);
+    for (int i = 0; i < ota->buffer_count; i++) {
+        uint8_t *buf;
+        xQueueReceive(ota->free_queue, &buf, portMAX_DELAY);
+    }
+    vQueueDelete(ota->cmd_queue);
+    vQueueDelete(ota->free_queue);
+    free(ota->mem);
+    free(ota);
+}
+
+esp_err_t app_ota_begin(app_ota_t *ota, uint32_t image_size)
+{
+    app_ota_abort(ota);
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "No OTA partition");
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (image_size == 0 || image_size > partition->size) {
+        ESP_LOGE(TAG, "Image of %d bytes does not fit %s", image_size, partition->label);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    /* Nothing of a previous image is in flight after this */
+    _ota_sync(ota);
+    memset(&ota->stats, 0, sizeof(ota->stats));
+    ota->stats.image_size = image_size;
+    ota->error = ESP_OK;
+    ota->received = 0;
+    ota->active = true;
+    ota->begin_us = esp_timer_get_time();
+    ota_cmd_t cmd = {
+        .op = OTA_OP_BEGIN,
+        .partition = partition,
+        .image_size = image_size,
+    };
+    xQueueSend(ota->cmd_queue, &cmd, portMAX_DELAY);
+    ESP_LOGI(TAG, "Writing %d bytes to %s", image_size, partition->label);
+    return ESP_OK;
+}
+
+esp_err_t app_ota_write(app_ota_t *ota, const void *data, size_t len)
+{
+    const uint8_t *src = data;
+    if (!ota->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (ota->error != ESP_OK) {
+        return ota->error;
+    }
+    /* Refuse anything that is not an app image right away, not a sector later */
+    if (ota->received == 0 && len > 0 && src[0] != OTA_IMAGE_MAGIC) {
+        ESP_LOGE(TAG, "Not an app image, magic %02x", src[0]);
+        ota->error = ESP_ERR_INVALID_ARG;
+        return ota->error;
+    }
+    ota->received += len;
+    while (len > 0) {
+        size_t n = OTA_SECTOR_SIZE - ota->fill_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(ota->fill + ota->fill_len, src, n);
+        ota->fill_len += n;
+        src += n;
+        len -= n;
+        if (ota->fill_len == OTA_SECTOR_SIZE) {
+            _ota_send(ota, OTA_OP_WRITE, 0);
+            ota->fill = _ota_take(ota);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t app_ota_end(app_ota_t *ota, uint32_t crc)
+{
+    if (!ota->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _ota_send(ota, OTA_OP_END, crc);
+    ota->active = false;
+    int64_t start = esp_timer_get_time();
+    _ota_sync(ota);
+    ota->stats.stalls++;
+    ota->stats.stall_time_us += esp_timer_get_time() - start;
+    ota->stats.image_time_us = esp_timer_get_time() - ota->begin_us;
+    return ota->error;
+}
+
+void app_ota_abort(app_ota_t *ota)
+{
+    if (!ota->active) {
+        return;
+    }
+    ota_cmd_t cmd = { .op = OTA_OP_ABORT };
+    xQueueSend(ota->cmd_queue, &cmd, portMAX_DELAY);
+    ota->fill_len = 0;
+    ota->active = false;
+}
+
+esp_err_t app_ota_status(app_ota_t *ota)
+{
+    return ota->error;
+}
+
+void app_ota_get_stats(app_ota_t *ota, app_ota_stats_t *stats)
+{
+    *stats = ota->stats;
+}
@@ -0,0 +1,630 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "app_record_log.h"
+#include "app_crc32.h"
+static const char *TAG = "APP_RECORD_LOG";
+
+#define LOG_MAGIC               0x31474c56      /* "VLG1" */
+#define LOG_INDEX_MAGIC         0x31584956      /* "VIX1" */
+#define LOG_HEADER_SIZE         12
+#define LOG_RECORD_HEAD         6               /* len, type, timestamp */
+#define LOG_PATH_MAX            64
+/* Of the path given, room left for the segment and index file suffixes */
+#define LOG_BASE_MAX            (LOG_PATH_MAX - 11)
+#define LOG_INDEX_MIN_CAP       64
+
+typedef struct {
+    uint32_t magic;
+    uint32_t segment;
+    uint32_t last_timestamp;    /* Newest in the segments before */
+} log_header_t;
+
+/* Index file of a segment: this, `count` entries of timestamp and offset, CRC-32 of all before */
+typedef struct {
+    uint32_t magic;
+    uint32_t segment;
+    uint32_t count;
+} log_index_header_t;
+
+typedef struct {
+    uint32_t timestamp;
+    uint32_t segment;
+    uint32_t offset;
+} log_index_t;
+
+struct app_record_log {
+    app_record_log_cfg_t cfg;
+    char path[LOG_BASE_MAX];
+    uint32_t first;             /* Oldest segment */
+    uint32_t last;              /* Segment appended to */
+    FILE *file;
+    size_t seg_bytes;           /* Of the last segment, written and batched */
+    size_t seg_written;         /* Of the last segment, written */
+    uint32_t seg_records;       /* In the last segment */
+    log_index_t *index;         /* Every index_every-th record of each segment, oldest first */
+    size_t index_len;
+    size_t index_cap;
+    uint8_t *batch;
+    size_t batch_len;
+    uint32_t batch_records;
+    uint32_t last_timestamp;
+    app_record_log_stats_t stats;
+};
+
+struct app_record_reader {
+    app_record_log_t *log;
+    uint32_t segment;
+    FILE *file;
+    long offset;                /* Of the next record in `file` */
+    uint32_t bytes;
+};
+
+static void _segment_name(const app_record_log_t *log, uint32_t segment, char *name)
+{
+    snprintf(name, LOG_PATH_MAX, "%s.%08x", log->path, segment);
+}
+
+static FILE *_segment_open(const app_record_log_t *log, uint32_t segment, log_header_t *header)
+{
+    char name[LOG_PATH_MAX];
+    _segment_name(log, segment, name);
+    FILE *f = fopen(name, "rb");
+    if (f && (fread(header, sizeof(*header), 1, f) != 1 || header->magic != LOG_MAGIC ||
+              header->segment != segment)) {
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+static void _index_name(const app_record_log_t *log, uint32_t segment, char *name)
+{
+    snprintf(name, LOG_PATH_MAX, "%s.%08x.i", log->path, segment);
+}
+
+static void _index_add(app_record_log_t *log, uint32_t timestamp, uint32_t segment, uint32_t offset)
+{
+    if (log->index_len == log->index_cap) {
+        size_t cap = log->index_cap ? log->index_cap * 2 : LOG_INDEX_MIN_CAP;
+        log_index_t *index = realloc(log->index, cap * sizeof(log_index_t));
+        if (index == NULL) {
+            /* Sparser from here, queries scan a little more */
+            return;
+        }
+        log->index = index;
+        log->index_cap = cap;
+    }
+    log->index[log->index_len++] = (log_index_t) { timestamp, segment, offset };
+}
+
+/* Entries of the segments deleted */
+static void _index_drop(app_record_log_t *log)
+{
+    size_t n = 0;
+    while (n < log->index_len && log->index[n].segment < log->first) {
+        n++;
+    }
+    if (n == 0) {
+        /* Also while the index is empty and not yet allocated */
+        return;
+    }
+    memmove(log->index, log->index + n, (log->index_len - n) * sizeof(log_index_t));
+    log->index_len -= n;
+}
+
+/* The entries of `segment`, the newest in the index, to its index file */
+static void _index_save(app_record_log_t *log, uint32_t segment)
+{
+    size_t n = 0;
+    while (n < log->index_len && log->index[log->index_len - 1 - n].segment == segment) {
+        n++;
+    }
+    const log_index_t *entries = log->index + log->index_len - n;
+    size_t size = sizeof(log_index_header_t) + n * 2 * sizeof(uint32_t) + sizeof(uint32_t);
+    uint32_t *buf = malloc(size);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        return;
+    }
+    buf[0] = LOG_INDEX_MAGIC;
+    buf[1] = segment;
+    buf[2] = n;
+    for (size_t i = 0; i < n; i++) {
+        buf[3 + 2 * i] = entries[i].timestamp;
+        buf[4 + 2 * i] = entries[i].offset;
+    }
+    buf[3 + 2 * n] = app_crc32_update(0, buf, size - sizeof(uint32_t));
+
+    char name[LOG_PATH_MAX];
+    _index_name(log, segment, name);
+    FILE *f = fopen(name, "wb");
+    if (f == NULL || fwrite(buf, 1, size, f) != size) {
+        ESP_LOGE(TAG, "Error writing %s", name);
+    }
+    if (f) {
+        fclose(f);
+    }
+    free(buf);
+}
+
+/* The entries of `segment` from its index file, false if there is none or it is damaged */
+static bool _index_load(app_record_log_t *log, uint32_t segment)
+{
+    char name[LOG_PATH_MAX];
+    _index_name(log, segment, name);
+    FILE *f = fopen(name, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    log_index_header_t header;
+    uint32_t *buf = NULL;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 && header.magic == LOG_INDEX_MAGIC &&
+              header.segment == segment && header.count <= log->cfg.segment_size / APP_RECORD_LOG_OVERHEAD;
+    if (ok) {
+        size_t size = sizeof(header) + header.count * 2 * sizeof(uint32_t) + sizeof(uint32_t);
+        buf = malloc(size);
+        ok = buf && fread((uint8_t *)buf + sizeof(header), 1, size - sizeof(header), f) == size - sizeof(header);
+        if (ok) {
+            memcpy(buf, &header, sizeof(header));
+            ok = app_crc32_update(0, buf, size - sizeof(uint32_t)) == buf[3 + 2 * header.count];
+        }
+    }
+    fclose(f);
+    for (uint32_t i = 0; ok && i < header.count; i++) {
+        _index_add(log, buf[3 + 2 * i], segment, buf[4 + 2 * i]);
+    }
+    free(buf);
+    return ok;
+}
+
+/*
+ * The next record of `f`: ESP_ERR_NOT_FOUND at the end of the file,
+ * ESP_ERR_INVALID_CRC for a torn or damaged record. `size` gets what was read.
+ */
+static esp_err_t _record_read(FILE *f, app_record_t *record, size_t *size)
+{
+    uint8_t buf[LOG_RECORD_HEAD + APP_RECORD_LOG_MAX_PAYLOAD + sizeof(uint32_t)];
+    size_t n = fread(buf, 1, LOG_RECORD_HEAD, f);
+    *size = n;
+    if (n == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (n < LOG_RECORD_HEAD) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    size_t rest = buf[0] + sizeof(uint32_t);
+    n = fread(buf + LOG_RECORD_HEAD, 1, rest, f);
+    *size += n;
+    uint32_t crc;
+    memcpy(&crc, buf + LOG_RECORD_HEAD + buf[0], sizeof(crc));
+    if (n < rest || app_crc32_update(0, buf, LOG_RECORD_HEAD + buf[0]) != crc) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    record->len = buf[0];
+    record->type = buf[1];
+    memcpy(&record->timestamp, buf + 2, sizeof(record->timestamp));
+    memcpy(record->payload, buf + LOG_RECORD_HEAD, record->len);
+    return ESP_OK;
+}
+
+static esp_err_t _batch_write(app_record_log_t *log)
+{
+    if (log->batch_len == 0) {
+        return ESP_OK;
+    }
+    esp_err_t ret = ESP_OK;
+    int64_t start = esp_timer_get_time();
+    if (log->file == NULL || fwrite(log->batch, 1, log->batch_len, log->file) != log->batch_len) {
+        ESP_LOGE(TAG, "Error writing %u bytes", (unsigned)log->batch_len);
+        log->stats.dropped += log->batch_records;
+        ret = ESP_FAIL;
+    } else {
+        /* Out of the SPIFFS cache too */
+        fsync(fileno(log->file));
+        log->stats.bytes += log->batch_len;
+        log->stats.writes++;
+    }
+    log->stats.write_time_us += esp_timer_get_time() - start;
+    log->seg_written += log->batch_len;
+    log->batch_len = 0;
+    log->batch_records = 0;
+    return ret;
+}
+
+/* Into the batch, writing every one that fills up; a batch ends on a page boundary of the file */
+static void _batch_put(app_record_log_t *log, const uint8_t *data, size_t len)
+{
+    while (len) {
+        size_t limit = log->cfg.batch_size;
+        if (limit >= APP_RECORD_LOG_PAGE) {
+            limit -= log->seg_written % APP_RECORD_LOG_PAGE;
+        }
+        size_t n = limit - log->batch_len;
+        n = n < len ? n : len;
+        memcpy(log->batch + log->batch_len, data, n);
+        log->batch_len += n;
+        data += n;
+        len -= n;
+        if (log->batch_len == limit) {
+            _batch_write(log);
+        }
+    }
+}
+
+/* Start `segment` after writing out what is left for the one before, then drop the oldest ones over the limit */
+static void _segment_start(app_record_log_t *log, uint32_t segment)
+{
+    char name[LOG_PATH_MAX];
+    _batch_write(log);
+    if (log->file) {
+        fclose(log->file);
+    }
+    if (segment != log->last) {
+        _index_save(log, log->last);
+    }
+    /* The header goes out at once, a segment on flash always has one */
+    log_header_t header = { LOG_MAGIC, segment, log->last_timestamp };
+    _segment_name(log, segment, name);
+    log->file = fopen(name, "wb");
+    if (log->file) {
+        setvbuf(log->file, NULL, _IONBF, 0);
+    }
+    if (log->file == NULL || fwrite(&header, sizeof(header), 1, log->file) != 1) {
+        ESP_LOGE(TAG, "Error creating %s", name);
+    } else {
+        fsync(fileno(log->file));
+        log->stats.bytes += sizeof(header);
+        log->stats.writes++;
+    }
+    log->last = segment;
+    log->stats.segments++;
+    log->seg_bytes = sizeof(header);
+    log->seg_written = sizeof(header);
+    log->seg_records = 0;
+
+    while (log->last - log->first + 1 > log->cfg.max_segments) {
+        _segment_name(log, log->first, name);
+        unlink(name);
+        _index_name(log, log->first++, name);
+        unlink(name);
+        log->stats.deleted++;
+    }
+    _index_drop(log);
+}
+
+/* Oldest and newest segment present, false if there is none */
+static bool _segments_find(app_record_log_t *log, uint32_t *first, uint32_t *last)
+{
+    char dir[LOG_PATH_MAX];
+    const char *slash = strrchr(log->path, '/');
+    const char *base = slash ? slash + 1 : log->path;
+    size_t base_len = strlen(base);
+    snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - log->path) : 1, slash ? log->path : ".");
+
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return false;
+    }
+    bool found = false;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        const char *name = entry->d_name;
+        char *end;
+        if (strncmp(name, base, base_len) != 0 || name[base_len] != '.' || strlen(name + base_len + 1) != 8) {
+            continue;
+        }
+        uint32_t segment = strtoul(name + base_len + 1, &end, 16);
+        if (*end != '\0') {
+            continue;
+        }
+        *first = !found || segment < *first ? segment : *first;
+        *last = !found || segment > *last ? segment : *last;
+        found = true;
+    }
+    closedir(d);
+    return found;
+}
+
+/*
+ * Read `segment` up to its first bad record, indexing it as it goes. `valid`
+ * gets the bytes up to there, `end` the file size; true if the segment
+ * ends there.
+ */
+static bool _segment_scan(app_record_log_t *log, uint32_t segment, size_t *valid, long *end)
+{
+    log_header_t header;
+    FILE *f = _segment_open(log, segment, &header);
+    if (f == NULL) {
+        *valid = 0;
+        *end = 0;
+        return false;
+    }
+    log->last_timestamp = header.last_timestamp;
+    log->seg_records = 0;
+    *valid = sizeof(header);
+    size_t size;
+    app_record_t record;
+    esp_err_t ret;
+    while ((ret = _record_read(f, &record, &size)) == ESP_OK) {
+        if (log->seg_records++ % log->cfg.index_every == 0) {
+            _index_add(log, record.timestamp, segment, *valid);
+        }
+        *valid += size;
+        log->last_timestamp = record.timestamp;
+    }
+    fseek(f, 0, SEEK_END);
+    *end = ftell(f);
+    fclose(f);
+    return ret == ESP_ERR_NOT_FOUND;
+}
+
+/* Read the tail segment up to its first bad record, true if it ends there and can be appended to */
+static bool _tail_recover(app_record_log_t *log)
+{
+    size_t valid;
+    long end;
+    bool clean = _segment_scan(log, log->last, &valid, &end);
+    log->stats.recovered = log->seg_records;
+    log->stats.recovery_bytes = end;
+    log->stats.torn = end - valid;
+    log->seg_bytes = valid;
+    log->seg_written = valid;
+    return clean;
+}
+
+app_record_log_t *app_record_log_open(const app_record_log_cfg_t *config)
+{
+    if (config->path == NULL || strlen(config->path) >= LOG_BASE_MAX || config->max_segments < 2 ||
+            config->batch_size == 0 ||
+            config->segment_size < LOG_HEADER_SIZE + APP_RECORD_LOG_OVERHEAD + APP_RECORD_LOG_MAX_PAYLOAD) {
+        ESP_LOGE(TAG, "Invalid configuration");
+        return NULL;
+    }
+    app_record_log_t *log = calloc(1, sizeof(app_record_log_t));
+    if (log == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        return NULL;
+    }
+    log->batch = malloc(config->batch_size);
+    if (log->batch == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        free(log);
+        return NULL;
+    }
+    log->cfg = *config;
+    strcpy(log->path, config->path);
+    log->cfg.path = log->path;
+    if (log->cfg.index_every == 0) {
+        log->cfg.index_every = APP_RECORD_LOG_INDEX_EVERY;
+    }
+
+    int64_t start = esp_timer_get_time();
+    bool found = _segments_find(log, &log->first, &log->last);
+    for (uint32_t s = log->first; found && s < log->last; s++) {
+        if (!_index_load(log, s)) {
+            /* Reset before the index file was written */
+            size_t valid;
+            long end;
+            _segment_scan(log, s, &valid, &end);
+            log->stats.index_scanned++;
+        }
+    }
+    if (!found) {
+        log->first = 0;
+        _segment_start(log, 0);
+    } else if (_tail_recover(log)) {
+        char name[LOG_PATH_MAX];
+        _segment_name(log, log->last, name);
+        log->file = fopen(name, "ab");
+        if (log->file) {
+            setvbuf(log->file, NULL, _IONBF, 0);
+        }
+    } else {
+        /* A torn tail stays as it is, readers stop at its first bad record */
+        if (log->index_len && log->index[log->index_len - 1].timestamp > log->last_timestamp) {
+            /* Not even its header made it: the newest indexed is as close as it gets */
+            log->last_timestamp = log->index[log->index_len - 1].timestamp;
+        }
+        _segment_start(log, log->last + 1);
+    }
+    log->stats.recovery_time_us = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "%s: segments %u..%u, %u records in the tail, %u bytes torn, %u index entries", log->path,
+             log->first, log->last, log->stats.recovered, log->stats.torn, (unsigned)log->index_len);
+    return log;
+}
+
+void app_record_log_close(app_record_log_t *log)
+{
+    if (log == NULL) {
+        return;
+    }
+    _batch_write(log);
+    if (log->file) {
+        fclose(log->file);
+    }
+    free(log->batch);
+    free(log->index);
+    free(log);
+}
+
+esp_err_t app_record_log_append(app_record_log_t *log, uint8_t type, uint32_t timestamp, const void *payload,
+                                size_t len)
+{
+    if (len > APP_RECORD_LOG_MAX_PAYLOAD) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (timestamp < log->last_timestamp) {
+        ESP_LOGE(TAG, "Timestamp %u before %u", timestamp, log->last_timestamp);
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t size = APP_RECORD_LOG_OVERHEAD + len;
+    if (log->seg_bytes + size > log->cfg.segment_size) {
+        _segment_start(log, log->last + 1);
+    }
+    if (log->file == NULL) {
+        log->stats.dropped++;
+        return ESP_FAIL;
+    }
+    uint8_t buf[APP_RECORD_LOG_OVERHEAD + APP_RECORD_LOG_MAX_PAYLOAD];
+    buf[0] = len;
+    buf[1] = type;
+    memcpy(buf + 2, &timestamp, sizeof(timestamp));
+    memcpy(buf + LOG_RECORD_HEAD, payload, len);
+    uint32_t crc = app_crc32_update(0, buf, LOG_RECORD_HEAD + len);
+    memcpy(buf + LOG_RECORD_HEAD + len, &crc, sizeof(crc));
+
+    if (log->seg_records++ % log->cfg.index_every == 0) {
+        _index_add(log, timestamp, log->last, log->seg_bytes);
+    }
+    log->batch_records++;
+    log->seg_bytes += size;
+    log->last_timestamp = timestamp;
+    log->stats.records++;
+    _batch_put(log, buf, size);
+    return ESP_OK;
+}
+
+esp_err_t app_record_log_flush(app_record_log_t *log)
+{
+    return _batch_write(log);
+}
+
+void app_record_log_get_stats(app_record_log_t *log, app_record_log_stats_t *stats)
+{
+    *stats = log->stats;
+    stats->index_entries = log->index_len;
+}
+
+uint32_t app_record_log_last_timestamp(app_record_log_t *log)
+{
+    return log->last_timestamp;
+}
+
+app_record_reader_t *app_record_reader_new(app_record_log_t *log)
+{
+    app_record_reader_t *reader = calloc(1, sizeof(app_record_reader_t));
+    if (reader == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        return NULL;
+    }
+    reader->log = log;
+    reader->segment = log->first;
+    return reader;
+}
+
+void app_record_reader_delete(app_record_reader_t *reader)
+{
+    if (reader == NULL) {
+        return;
+    }
+    if (reader->file) {
+        fclose(reader->file);
+    }
+    free(reader);
+}
+
+/* Open `segment` at `offset`, 0 for its first record; the reader moves on to the next if it is gone */
+static void _reader_open(app_record_reader_t *reader, uint32_t segment, long offset)
+{
+    log_header_t header;
+    if (reader->file) {
+        fclose(reader->file);
+    }
+    reader->segment = segment;
+    reader->file = _segment_open(reader->log, segment, &header);
+    reader->offset = offset ? offset : (long)sizeof(header);
+    if (reader->file) {
+        reader->bytes += sizeof(header);
+        if (offset) {
+            fseek(reader->file, offset, SEEK_SET);
+        }
+    }
+}
+
+/* The next record and in `at` where it starts in reader->segment */
+static esp_err_t _reader_next(app_record_reader_t *reader, app_record_t *record, long *at)
+{
+    app_record_log_t *log = reader->log;
+    if (reader->segment < log->first) {
+        /* Deleted under us */
+        _reader_open(reader, log->first, 0);
+    }
+    while (reader->segment <= log->last) {
+        if (reader->file == NULL) {
+            _reader_open(reader, reader->segment, 0);
+            if (reader->file == NULL) {
+                reader->segment++;
+                continue;
+            }
+        }
+        size_t size;
+        esp_err_t ret = _record_read(reader->file, record, &size);
+        reader->bytes += size;
+        if (ret == ESP_OK) {
+            *at = reader->offset;
+            reader->offset += size;
+            return ESP_OK;
+        }
+        if (reader->segment == log->last) {
+            /* The end for now, more may be appended */
+            clearerr(reader->file);
+            fseek(reader->file, reader->offset, SEEK_SET);
+            return ESP_ERR_NOT_FOUND;
+        }
+        fclose(reader->file);
+        reader->file = NULL;
+        reader->segment++;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t app_record_reader_next(app_record_reader_t *reader, app_record_t *record)
+{
+    long at;
+    return _reader_next(reader, record, &at);
+}
+
+esp_err_t app_record_reader_seek(app_record_reader_t *reader, uint32_t timestamp)
+{
+    app_record_log_t *log = reader->log;
+    /* The last entry before `timestamp`: the first record at or after it is no further than index_every on */
+    size_t lo = 0, hi = log->index_len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (log->index[mid].timestamp < timestamp) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        _reader_open(reader, log->first, 0);
+    } else {
+        _reader_open(reader, log->index[lo - 1].segment, log->index[lo - 1].offset);
+    }
+
+    app_record_t record;
+    long at;
+    esp_err_t ret;
+    while ((ret = _reader_next(reader, &record, &at)) == ESP_OK) {
+        if (record.timestamp >= timestamp) {
+            /* Read again by the next app_record_reader_next() */
+            fseek(reader->file, at, SEEK_SET);
+            reader->offset = at;
+            return ESP_OK;
+        }
+    }
+    return ret;
+}
+
+uint32_t app_record_reader_bytes(app_record_reader_t *reader)
+{
+    return reader->bytes;
+}
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "app_sample_ring.h"
+static const char *TAG = "APP_SAMPLE_RING";
+
+#define RING_READ_ATTEMPTS      4
+
+typedef struct {
+    uint32_t seq;               /* Index of the sample in the slot, another value while it is written */
+    app_sample_t sample;
+} ring_slot_t;
+
+struct app_sample_ring {
+    uint32_t mask;
+    uint32_t head;              /* Samples pushed, written by the producer only */
+    uint32_t filled;            /* Slots holding a sample, at most mask + 1 */
+    uint32_t evicted;           /* Timestamp of the last sample overwritten */
+    ring_slot_t slots[];
+};
+
+/* Never the index of a sample that can be in slot i & mask, marks a slot being written */
+#define RING_SEQ_BUSY(ring, i)  ((i) + ((ring)->mask + 1) / 2)
+
+app_sample_ring_t *app_sample_ring_new(size_t size)
+{
+    size_t slots = 2;
+    while (slots < size) {
+        slots <<= 1;
+    }
+    app_sample_ring_t *ring = calloc(1, sizeof(app_sample_ring_t) + slots * sizeof(ring_slot_t));
+    if (ring == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        return NULL;
+    }
+    ring->mask = slots - 1;
+    for (uint32_t i = 0; i < slots; i++) {
+        ring->slots[i].seq = RING_SEQ_BUSY(ring, i);
+    }
+    return ring;
+}
+
+void app_sample_ring_delete(app_sample_ring_t *ring)
+{
+    free(ring);
+}
+
+void app_sample_ring_push(app_sample_ring_t *ring, const app_sample_t *sample)
+{
+    uint32_t i = ring->head;
+    ring_slot_t *slot = &ring->slots[i & ring->mask];
+    if (ring->filled > ring->mask) {
+        __atomic_store_n(&ring->evicted, slot->sample.timestamp, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&slot->seq, RING_SEQ_BUSY(ring, i), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->sample = *sample;
+    __atomic_store_n(&slot->seq, i, __ATOMIC_RELEASE);
+    if (ring->filled <= ring->mask) {
+        __atomic_store_n(&ring->filled, ring->filled + 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&ring->head, i + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy sample i, false if the slot no longer (or not yet) holds it */
+static bool _ring_load(app_sample_ring_t *ring, uint32_t i, app_sample_t *out)
+{
+    ring_slot_t *slot = &ring->slots[i & ring->mask];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != i) {
+        return false;
+    }
+    *out = slot->sample;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == i;
+}
+
+size_t app_sample_ring_read(app_sample_ring_t *ring, uint32_t since, app_sample_t *out, size_t max, bool *lost)
+{
+    *lost = false;
+    for (int attempt = 0; attempt < RING_READ_ATTEMPTS; attempt++) {
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t filled = __atomic_load_n(&ring->filled, __ATOMIC_RELAXED);
+        uint32_t evicted = __atomic_load_n(&ring->evicted, __ATOMIC_RELAXED);
+        uint32_t lo = head - filled, hi = head;
+        bool torn = false;
+
+        /* First sample after `since`, timestamps increase with the index */
+        while (since && lo != hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (!_ring_load(ring, mid, out)) {
+                torn = true;
+                break;
+            }
+            if ((int32_t)(out->timestamp - since) > 0) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        if (torn) {
+            /* The producer lapped the oldest samples while searching */
+            continue;
+        }
+        *lost = since && filled > ring->mask && lo == head - filled && (int32_t)(evicted - since) > 0;
+        size_t n = 0;
+        while (n < max && lo + n != head && _ring_load(ring, lo + n, &out[n])) {
+            n++;
+        }
+        if (n == 0 && lo != head && max) {
+            continue;
+        }
+        return n;
+    }
+    return 0;
+}
+
+bool app_sample_ring_newest(app_sample_ring_t *ring, app_sample_t *out)
+{
+    for (int attempt = 0; attempt < RING_READ_ATTEMPTS; attempt++) {
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ring->filled, __ATOMIC_RELAXED) == 0) {
+            return false;
+        }
+        if (_ring_load(ring, head - 1, out)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t app_sample_ring_count(app_sample_ring_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,108 @@
+#include <stdlib.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "app_sampler.h"
+static const char *TAG = "APP_SAMPLER";
+
+struct app_sampler {
+    app_sample_ring_t *ring;
+    app_sampler_read_fn read;
+    void *arg;
+    TickType_t period;
+    volatile bool run;
+    QueueHandle_t done_queue;   /* Signalled by the task when it exits */
+    app_sampler_stats_t stats;
+};
+
+static void _sampler_task(void *pv)
+{
+    app_sampler_t *sampler = pv;
+    TickType_t wake = xTaskGetTickCount();
+    while (sampler->run) {
+        vTaskDelayUntil(&wake, sampler->period);
+        app_sample_t sample = { 0 };
+        if (sampler->read) {
+            int64_t start = esp_timer_get_time();
+            sampler->read(&sample, sampler->arg);
+            sampler->stats.read_time_us += esp_timer_get_time() - start;
+        }
+        sample.timestamp = wake * portTICK_PERIOD_MS;
+        app_sample_ring_push(sampler->ring, &sample);
+        sampler->stats.samples++;
+        if (xTaskGetTickCount() - wake >= sampler->period) {
+            sampler->stats.late++;
+        }
+    }
+    bool done = true;
+    xQueueSend(sampler->done_queue, &done, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+app_sampler_t *app_sampler_start(const app_sampler_cfg_t *config)
+{
+    if (config->rate_hz == 0 || configTICK_RATE_HZ % config->rate_hz != 0) {
+        ESP_LOGE(TAG, "Rate %u Hz does not divide the tick rate", config->rate_hz);
+        return NULL;
+    }
+    app_sampler_t *sampler = calloc(1, sizeof(app_sampler_t));
+    if (sampler == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        return NULL;
+    }
+    sampler->ring = app_sample_ring_new(config->ring_size);
+    sampler->done_queue = xQueueCreate(1, sizeof(bool));
+    if (sampler->ring == NULL || sampler->done_queue == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        goto _sampler_start_fail;
+    }
+    sampler->read = config->read;
+    sampler->arg = config->arg;
+    sampler->period = configTICK_RATE_HZ / config->rate_hz;
+    sampler->run = true;
+    if (xTaskCreatePinnedToCore(_sampler_task, "sampler_task", 3 * 1024, sampler, config->priority, NULL,
+                                config->core) != pdPASS) {
+        ESP_LOGE(TAG, "error creating sampler task");
+        goto _sampler_start_fail;
+    }
+    return sampler;
+
+_sampler_start_fail:
+    if (sampler->done_queue) {
+        vQueueDelete(sampler->done_queue);
+    }
+    app_sample_ring_delete(sampler->ring);
+    free(sampler);
+    return NULL;
+}
+
+void app_sampler_stop(app_sampler_t *sampler)
+{
+    if (sampler == NULL) {
+        return;
+    }
+    sampler->run = false;
+    bool done;
+    xQueueReceive(sampler->done_queue, &done, portMAX_DELAY);
+    vQueueDelete(sampler->done_queue);
+    app_sample_ring_delete(sampler->ring);
+    free(sampler);
+}
+
+app_sample_ring_t *app_sampler_get_ring(app_sampler_t *sampler)
+{
+    return sampler->ring;
+}
+
+uint32_t app_sampler_get_period_ms(app_sampler_t *sampler)
+{
+    return sampler->period * portTICK_PERIOD_MS;
+}
+
+void app_sampler_get_stats(app_sampler_t *sampler, app_sampler_stats_t *stats)
+{
+    *stats = sampler->stats;
+}
@@ -0,0 +1,118 @@
+#include <stdint.h>
+
+#include "app_vent_batch.h"
+
+#define BATCH_COLUMNS           3
+#define BATCH_MAX_HDR_LEN       (1 + 5 + 1)
+
+static inline uint32_t _in_time_ms(const app_sample_t *s)
+{
+    float ms = s->breath_in_time * 1000;
+    return ms > 0 ? (uint32_t)(ms + 0.5f) : 0;
+}
+
+static inline uint32_t _column(const app_sample_t *s, int col)
+{
+    switch (col) {
+        case 0:
+            return s->volume;
+        case 1:
+            return s->frequency;
+        default:
+            return _in_time_ms(s);
+    }
+}
+
+static inline uint32_t _zigzag(uint32_t from, uint32_t to)
+{
+    int32_t delta = (int32_t)(to - from);
+    return ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+}
+
+static inline size_t _varint_len(uint32_t v)
+{
+    size_t len = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        len++;
+    }
+    return len;
+}
+
+static inline uint8_t *_varint_put(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+size_t app_vent_batch_encode(const app_sample_t *samples, size_t count, uint8_t *out, size_t out_len,
+                             size_t *encoded)
+{
+    *encoded = 0;
+    if (count == 0) {
+        return 0;
+    }
+    /* How many fit: a column costs nothing for as long as it stays constant */
+    size_t len = BATCH_MAX_HDR_LEN + _varint_len(samples[0].timestamp);
+    size_t col_len[BATCH_COLUMNS] = { 0 };
+    for (int col = 0; col < BATCH_COLUMNS; col++) {
+        len += _varint_len(_column(&samples[0], col));
+    }
+    if (len > out_len) {
+        return 0;
+    }
+    uint8_t constant = (1 << BATCH_COLUMNS) - 1;
+    size_t n = 1;
+    for (; n < count; n++) {
+        const app_sample_t *prev = &samples[n - 1], *cur = &samples[n];
+        size_t next_len = len + _varint_len(cur->timestamp - prev->timestamp);
+        uint8_t next_constant = constant;
+        size_t zz_len[BATCH_COLUMNS];
+        for (int col = 0; col < BATCH_COLUMNS; col++) {
+            uint32_t zz = _zigzag(_column(prev, col), _column(cur, col));
+            zz_len[col] = _varint_len(zz);
+            if (zz) {
+                next_constant &= ~(1 << col);
+            }
+            if (!(next_constant & (1 << col))) {
+                /* The zero deltas a constant column skipped so far now have to be written */
+                next_len += (constant & (1 << col) ? col_len[col] : 0) + zz_len[col];
+            }
+        }
+        if (next_len > out_len) {
+            break;
+        }
+        for (int col = 0; col < BATCH_COLUMNS; col++) {
+            col_len[col] += zz_len[col];
+        }
+        len = next_len;
+        constant = next_constant;
+    }
+
+    uint8_t *p = out;
+    *p++ = APP_VENT_BATCH_VERSION;
+    p = _varint_put(p, n);
+    *p++ = constant;
+    p = _varint_put(p, samples[0].timestamp);
+    for (size_t i = 1; i < n; i++) {
+        p = _varint_put(p, samples[i].timestamp - samples[i - 1].timestamp);
+    }
+    for (int col = 0; col < BATCH_COLUMNS; col++) {
+        uint32_t prev = _column(&samples[0], col);
+        p = _varint_put(p, prev);
+        if (constant & (1 << col)) {
+            continue;
+        }
+        for (size_t i = 1; i < n; i++) {
+            uint32_t cur = _column(&samples[i], col);
+            p = _varint_put(p, _zigzag(prev, cur));
+            prev = cur;
+        }
+    }
+    *encoded = n;
+    return p - out;
+}
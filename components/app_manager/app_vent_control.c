@@ -0,0 +1,76 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_log.h"
+#include "app_manager.h"
+#include "app_control.h"
+#include "openvent.pb-c.h"
+static const char *TAG = "APP_VENT_CONTROL";
+
+#ifndef CONFIG_VENT_CONTROL_RATE_HZ
+#define CONFIG_VENT_CONTROL_RATE_HZ         1000
+#endif
+
+/* Above everything else the app runs, on the core BLE does not use */
+#define VENT_CONTROL_PRIORITY               10
+#if CONFIG_FREERTOS_UNICORE
+#define VENT_CONTROL_CORE                   0
+#else
+#define VENT_CONTROL_CORE                   1
+#endif
+
+static app_control_t *g_control;
+
+esp_err_t app_manager_control_start(app_control_read_fn read, app_control_write_fn write, void *arg)
+{
+    if (g_control) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    app_control_cfg_t cfg = {
+        .rate_hz = CONFIG_VENT_CONTROL_RATE_HZ,
+        .mode = WORKING_MODE__CMV,
+        .settings = APP_CONTROL_SETTINGS_DEFAULT,
+        .read = read,
+        .write = write,
+        .arg = arg,
+        .priority = VENT_CONTROL_PRIORITY,
+        .core = VENT_CONTROL_CORE,
+    };
+    g_control = app_control_start(&cfg);
+    if (g_control == NULL) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Control loop at %d Hz on core %d", CONFIG_VENT_CONTROL_RATE_HZ, VENT_CONTROL_CORE);
+    return ESP_OK;
+}
+
+app_control_t *app_manager_get_control(void)
+{
+    return g_control;
+}
+
+esp_err_t app_manager_vent_config_handle(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    (void)ctx;
+    VentConfig *config = req->vent_config_request;
+    if (g_control == NULL || config == NULL) {
+        ESP_LOGE(TAG, "%s", g_control ? "No vent_config_request" : "Control loop not started");
+        resp->status = STATUS__Fail;
+        return app_manager_response(resp);
+    }
+    if (app_control_set_mode(g_control, config->mode) != ESP_OK) {
+        ESP_LOGE(TAG, "Unknown mode %d", config->mode);
+        resp->status = STATUS__Fail;
+        return app_manager_response(resp);
+    }
+    resp->status = STATUS__Success;
+    return app_manager_response(resp);
+}
+
+esp_err_t app_manager_get_control_stats(app_control_stats_t *stats)
+{
+    if (g_control == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    app_control_get_stats(g_control, stats);
+    return ESP_OK;
+}
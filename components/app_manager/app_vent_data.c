@@ -0,0 +1,271 @@
+#include <string.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "esp_log.h"
+#include "app_manager.h"
+#include "app_sampler.h"
+#include "app_vent_batch.h"
+#include "openvent.pb-c.h"
+static const char *TAG = "APP_VENT_DATA";
+
+#ifndef CONFIG_VENT_DATA_RATE_HZ
+#define CONFIG_VENT_DATA_RATE_HZ            1000
+#endif
+#ifndef CONFIG_VENT_DATA_RING_SIZE
+#define CONFIG_VENT_DATA_RING_SIZE          1024
+#endif
+
+/* More than fit a frame, even with every field at its smallest */
+#define VENT_DATA_MAX_BATCH                 64
+#define VENT_DATA_MAX_COMPACT               256
+#define VENT_DATA_SAMPLER_PRIORITY          6
+#define VENT_DATA_PUSH_PRIORITY             3
+
+/* Subscription, as sent to the push task */
+typedef struct {
+    uint32_t interval_ms;       /* 0 = none */
+    uint32_t decimation;
+    uint32_t cursor;
+    bool compact;
+} vent_data_sub_t;
+
+/* Samples and the messages built from them, one set per task */
+typedef struct {
+    app_sample_t samples[VENT_DATA_MAX_COMPACT];
+    VentData data[VENT_DATA_MAX_BATCH];
+    VentData *data_ptrs[VENT_DATA_MAX_BATCH];
+    uint8_t batch[APP_MANAGER_DEFAULT_FRAME_LIMIT];
+} vent_data_buf_t;
+
+static app_sampler_t *g_sampler;
+static QueueHandle_t g_sub_queue;       /* vent_data_sub_t, to the push task */
+static vent_data_buf_t g_request_buf;   /* Manager task */
+static vent_data_buf_t g_push_buf;      /* Push task */
+
+/*
+ * Put as many of `samples` as fit a frame into `resp`: as
+ * vent_data_response, or compact in read_file_response with offset the
+ * timestamp of the last one (`since` when there is none). Returns how many.
+ */
+static size_t _vent_data_fill(vent_data_buf_t *buf, const app_sample_t *samples, size_t count, uint32_t since,
+                              bool compact, bool push, VentResponse *resp, FileData *file_data)
+{
+    size_t n;
+    if (compact) {
+        /* Room with offset and file_size at their largest */
+        file_data->offset = UINT32_MAX;
+        file_data->file_size = VENT_DATA_MAX_COMPACT;
+        resp->read_file_response = file_data;
+        size_t room = push ? app_manager_push_room(resp) : app_manager_response_room(resp);
+        file_data->data.len = app_vent_batch_encode(samples, count, buf->batch,
+                                                    room < sizeof(buf->batch) ? room : sizeof(buf->batch), &n);
+        file_data->data.data = buf->batch;
+        file_data->file_size = n;
+        file_data->offset = n ? samples[n - 1].timestamp : since;
+        return n;
+    }
+    size_t room = push ? app_manager_push_room(resp) : app_manager_response_room(resp);
+    for (n = 0; n < count && n < VENT_DATA_MAX_BATCH; n++) {
+        VentData *data = &buf->data[n];
+        vent_data__init(data);
+        data->timestamp = samples[n].timestamp;
+        data->breath_circulating_volumn = samples[n].volume;
+        data->breathing_frequency = samples[n].frequency;
+        data->breath_in_time = (double)samples[n].breath_in_time;
+        /* Field tag and a one byte length */
+        size_t len = vent_data__get_packed_size(data) + 2;
+        if (len > room) {
+            break;
+        }
+        room -= len;
+        buf->data_ptrs[n] = data;
+    }
+    resp->n_vent_data_response = n;
+    resp->vent_data_response = buf->data_ptrs;
+    return n;
+}
+
+/* Push everything sampled since the cursor, every decimation-th sample */
+static void _vent_data_push(vent_data_sub_t *sub)
+{
+    vent_data_buf_t *buf = &g_push_buf;
+    app_sample_ring_t *ring = app_sampler_get_ring(g_sampler);
+    uint32_t period_ms = app_sampler_get_period_ms(g_sampler);
+    size_t count;
+    do {
+        bool lost;
+        count = app_sample_ring_read(ring, sub->cursor, buf->samples, VENT_DATA_MAX_COMPACT, &lost);
+        if (count == 0) {
+            break;
+        }
+        sub->cursor = buf->samples[count - 1].timestamp;
+        size_t kept = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (buf->samples[i].timestamp / period_ms % sub->decimation == 0) {
+                buf->samples[kept++] = buf->samples[i];
+            }
+        }
+        for (size_t sent = 0; sent < kept;) {
+            VentResponse resp = VENT_RESPONSE__INIT;
+            FileData file_data = FILE_DATA__INIT;
+            size_t n = _vent_data_fill(buf, buf->samples + sent, kept - sent, sub->cursor, sub->compact, true,
+                                       &resp, &file_data);
+            if (n == 0) {
+                break;
+            }
+            resp.status = STATUS__Success;
+            app_manager_push(&resp);
+            sent += n;
+        }
+    } while (count == VENT_DATA_MAX_COMPACT);
+}
+
+static void _vent_data_push_task(void *pv)
+{
+    (void)pv;
+    vent_data_sub_t sub = { 0 };
+    TickType_t wake = 0;
+    while (true) {
+        TickType_t wait = portMAX_DELAY;
+        if (sub.interval_ms) {
+            TickType_t now = xTaskGetTickCount();
+            wait = (int32_t)(wake - now) > 0 ? wake - now : 0;
+        }
+        vent_data_sub_t next;
+        if (xQueueReceive(g_sub_queue, &next, wait) == pdTRUE) {
+            sub = next;
+            wake = xTaskGetTickCount() + pdMS_TO_TICKS(sub.interval_ms);
+            continue;
+        }
+        /* Fixed cadence, a late push does not shift the following ones */
+        wake += pdMS_TO_TICKS(sub.interval_ms);
+        _vent_data_push(&sub);
+    }
+}
+
+esp_err_t app_manager_vent_data_start(app_sampler_read_fn read, void *arg)
+{
+    if (g_sampler) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    app_sampler_cfg_t cfg = {
+        .rate_hz = CONFIG_VENT_DATA_RATE_HZ,
+        .ring_size = CONFIG_VENT_DATA_RING_SIZE,
+        .read = read,
+        .arg = arg,
+        .priority = VENT_DATA_SAMPLER_PRIORITY,
+        .core = tskNO_AFFINITY,
+    };
+    g_sub_queue = xQueueCreate(2, sizeof(vent_data_sub_t));
+    if (g_sub_queue == NULL) {
+        ESP_LOGE(TAG, "Memory exhaused");
+        return ESP_ERR_NO_MEM;
+    }
+    g_sampler = app_sampler_start(&cfg);
+    if (g_sampler == NULL) {
+        goto _vent_data_start_fail;
+    }
+    if (xTaskCreate(_vent_data_push_task, "vent_push_task", 3 * 1024, NULL, VENT_DATA_PUSH_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "error creating push task");
+        goto _vent_data_start_fail;
+    }
+    ESP_LOGI(TAG, "Sampling at %d Hz, %d samples kept", CONFIG_VENT_DATA_RATE_HZ, CONFIG_VENT_DATA_RING_SIZE);
+    return ESP_OK;
+
+_vent_data_start_fail:
+    app_sampler_stop(g_sampler);
+    g_sampler = NULL;
+    vQueueDelete(g_sub_queue);
+    g_sub_queue = NULL;
+    return ESP_FAIL;
+}
+
+static bool _vent_data_compact(FileData *params)
+{
+    size_t len = strlen(APP_MANAGER_VENT_DATA_COMPACT);
+    return params && params->data.len == len && memcmp(params->data.data, APP_MANAGER_VENT_DATA_COMPACT, len) == 0;
+}
+
+static esp_err_t _vent_data_subscribe(FileData *params, VentResponse *resp)
+{
+    app_sample_t newest;
+    vent_data_sub_t sub = {
+        .interval_ms = params->file_size,
+        .decimation = params->checksum ? params->checksum : 1,
+        .cursor = params->offset,
+        .compact = _vent_data_compact(params),
+    };
+    uint32_t period_ms = app_sampler_get_period_ms(g_sampler);
+    if (sub.interval_ms && sub.interval_ms < period_ms) {
+        sub.interval_ms = period_ms;
+    }
+    if (sub.cursor == 0 && app_sample_ring_newest(app_sampler_get_ring(g_sampler), &newest)) {
+        /* From now on */
+        sub.cursor = newest.timestamp;
+    }
+    if (xQueueSend(g_sub_queue, &sub, 1000 / portTICK_RATE_MS) != pdPASS) {
+        resp->status = STATUS__Fail;
+        return app_manager_response(resp);
+    }
+    if (sub.interval_ms == 0) {
+        app_manager_push_flush();
+    }
+    ESP_LOGI(TAG, "Push every %u ms, 1 in %u samples%s", sub.interval_ms, sub.decimation,
+             sub.compact ? ", compact" : "");
+    FileData accepted = FILE_DATA__INIT;
+    accepted.offset = sub.cursor;
+    accepted.file_size = sub.interval_ms;
+    accepted.checksum = sub.decimation;
+    resp->read_file_response = &accepted;
+    resp->status = STATUS__Success;
+    return app_manager_response(resp);
+}
+
+esp_err_t app_manager_vent_data_handle(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    (void)ctx;
+    /* Only the manager task gets here, one batch at a time */
+    vent_data_buf_t *buf = &g_request_buf;
+
+    if (g_sampler == NULL) {
+        ESP_LOGE(TAG, "Sampler not started");
+        resp->status = STATUS__Fail;
+        return app_manager_response(resp);
+    }
+    FileData *params = req->read_file_request;
+    if (params && strcmp(params->file_name, APP_MANAGER_VENT_DATA_SUBSCRIBE) == 0) {
+        return _vent_data_subscribe(params, resp);
+    }
+    app_sample_ring_t *ring = app_sampler_get_ring(g_sampler);
+    bool compact = _vent_data_compact(params);
+    uint32_t since = 0;
+    size_t count;
+    if (params) {
+        since = params->offset;
+        bool lost;
+        count = app_sample_ring_read(ring, since, buf->samples, compact ? VENT_DATA_MAX_COMPACT : VENT_DATA_MAX_BATCH,
+                                     &lost);
+        if (lost) {
+            ESP_LOGD(TAG, "Samples after %u already overwritten", since);
+        }
+    } else {
+        count = app_sample_ring_newest(ring, buf->samples) ? 1 : 0;
+    }
+    /* As many as fit the frame, the client asks again for the rest */
+    FileData file_data = FILE_DATA__INIT;
+    _vent_data_fill(buf, buf->samples, count, since, compact, false, resp, &file_data);
+    resp->status = STATUS__Success;
+    return app_manager_response(resp);
+}
+
+esp_err_t app_manager_get_vent_data_stats(app_sampler_stats_t *stats)
+{
+    if (g_sampler == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    app_sampler_get_stats(g_sampler, stats);
+    return ESP_OK;
+}
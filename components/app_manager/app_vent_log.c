@@ -0,0 +1,106 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "app_manager.h"
+#include "app_record_log.h"
+static const char *TAG = "APP_VENT_LOG";
+
+#ifndef CONFIG_LOG_SEGMENT_KB
+#define CONFIG_LOG_SEGMENT_KB               64
+#endif
+#ifndef CONFIG_LOG_SEGMENTS
+#define CONFIG_LOG_SEGMENTS                 8
+#endif
+#ifndef CONFIG_LOG_BATCH_PAGES
+#define CONFIG_LOG_BATCH_PAGES              4
+#endif
+
+#define VENT_LOG_PATH                       "/spiffs/vlog"
+#define VENT_LOG_PERIOD_MS                  1000
+/* Below the BLE and push tasks, flash writes can take a while */
+#define VENT_LOG_PRIORITY                   2
+
+static app_record_log_t *g_vent_log;
+static app_history_t *g_vent_log_hist;
+
+static int16_t _centi(float v)
+{
+    float q = v * 100 + (v >= 0 ? 0.5f : -0.5f);
+    return q >= 32767 ? 32767 : q <= -32767 ? -32767 : (int16_t)q;
+}
+
+static void _centi_stat(int16_t *out, const app_history_stat_t *stat)
+{
+    out[0] = _centi(stat->min);
+    out[1] = _centi(stat->max);
+    out[2] = _centi(stat->mean);
+}
+
+static void _vent_log_task(void *arg)
+{
+    (void)arg;
+    /* Seconds, 136 years before they wrap; they go on from the last run, the uptime starts over */
+    uint32_t base = app_record_log_last_timestamp(g_vent_log) + 1;
+    TickType_t wake = xTaskGetTickCount();
+    for (;;) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(VENT_LOG_PERIOD_MS));
+        app_control_t *ctl = app_manager_get_control();
+        app_manager_vent_record_t rec = { 0 };
+        uint32_t now_s = esp_timer_get_time() / 1000000;
+        if (g_vent_log_hist) {
+            app_history_point_t pt;
+            uint32_t oldest, end;
+            app_history_span(g_vent_log_hist, &oldest, &end);
+            if (app_history_query(g_vent_log_hist, end - VENT_LOG_PERIOD_MS, end, &pt, 1)) {
+                _centi_stat(rec.pressure, &pt.pressure);
+                _centi_stat(rec.flow, &pt.flow);
+            }
+        }
+        if (ctl) {
+            app_sample_t sample;
+            app_control_sample(&sample, ctl);
+            rec.volume_ml = sample.volume > UINT16_MAX ? UINT16_MAX : sample.volume;
+            rec.frequency = sample.frequency;
+            rec.in_time_ms = sample.breath_in_time * 1000;
+            rec.mode = app_control_get_mode(ctl);
+        }
+        app_record_log_append(g_vent_log, APP_MANAGER_RECORD_VENT, base + now_s, &rec, sizeof(rec));
+    }
+}
+
+esp_err_t app_manager_telemetry_start(app_history_t *hist)
+{
+    if (g_vent_log) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    app_record_log_cfg_t cfg = {
+        .path = VENT_LOG_PATH,
+        .segment_size = CONFIG_LOG_SEGMENT_KB * 1024,
+        .max_segments = CONFIG_LOG_SEGMENTS,
+        .batch_size = CONFIG_LOG_BATCH_PAGES * APP_RECORD_LOG_PAGE,
+    };
+    g_vent_log = app_record_log_open(&cfg);
+    if (g_vent_log == NULL) {
+        return ESP_FAIL;
+    }
+    g_vent_log_hist = hist;
+    if (xTaskCreate(_vent_log_task, "vent_log_task", 3 * 1024, NULL, VENT_LOG_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "error creating log task");
+        app_record_log_close(g_vent_log);
+        g_vent_log = NULL;
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Logging every %d ms to %s, %d x %d KB", VENT_LOG_PERIOD_MS, VENT_LOG_PATH, CONFIG_LOG_SEGMENTS,
+             CONFIG_LOG_SEGMENT_KB);
+    return ESP_OK;
+}
+
+esp_err_t app_manager_get_telemetry_stats(app_record_log_stats_t *stats)
+{
+    if (g_vent_log == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    app_record_log_get_stats(g_vent_log, stats);
+    return ESP_OK;
+}
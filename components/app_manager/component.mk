@@ -1,3 +1,6 @@
 
 COMPONENT_SRCDIRS := .
 COMPONENT_ADD_INCLUDEDIRS := include
+
+# The signal path stays in single precision, the FPU has no double (see app_signal.h)
+app_control.o app_sampler.o app_vent_batch.o app_filter.o app_acquire.o app_history.o: CFLAGS += -Wdouble-promotion
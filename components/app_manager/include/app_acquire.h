@@ -0,0 +1,89 @@
+#ifndef _APP_ACQUIRE_H_
+#define _APP_ACQUIRE_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#include "app_control.h"
+#include "app_filter.h"
+
+/*
+ * Pressure and flow acquisition pipeline.
+ *
+ * Raw ADC words come in buffers as the DMA fills them, both channels
+ * interleaved and each word tagged with its channel (the ESP32 digital
+ * controller format: channel in bits 15..12, a 12 bit sample below). Per
+ * channel the samples go through
+ *
+ *   median of five de-spike -> boxcar decimation -> biquad low-pass
+ *   -> (sample - offset) * scale, the physical unit
+ *
+ * without copying the raw words: each is de-spiked and summed as it is
+ * read, every raw_rate_hz / rate_hz-th sum becomes a mean straight in the channel's
+ * array of a fixed-size block of both channels side by side, and the
+ * low-pass and scaling run in place there. A full block is handed to
+ * `on_block` by pointer, only valid during the call. The newest pair both
+ * channels have is also kept for the control loop, see
+ * app_acquire_control_read().
+ *
+ * app_acquire_process() is the whole pipeline and does no I/O, the host
+ * build runs it on recorded waveforms; app_adc_start() feeds it from the
+ * I2S DMA on the target.
+ */
+#define APP_ACQUIRE_BLOCK_SAMPLES   8
+
+typedef struct {
+    uint32_t seq;               /*!< Blocks before this one */
+    float pressure[APP_ACQUIRE_BLOCK_SAMPLES];  /*!< cmH2O */
+    float flow[APP_ACQUIRE_BLOCK_SAMPLES];      /*!< L/min */
+} app_acquire_block_t;
+
+typedef void (*app_acquire_block_fn)(const app_acquire_block_t *block, void *arg);
+
+typedef struct {
+    uint8_t channel;            /*!< As tagged in the raw words */
+    float offset;               /*!< Counts at zero */
+    float scale;                /*!< Unit per count */
+} app_acquire_channel_t;
+
+typedef struct {
+    uint32_t raw_rate_hz;       /*!< Per channel */
+    uint32_t rate_hz;           /*!< Output rate, raw_rate_hz must be a multiple of it */
+    float cutoff_hz;            /*!< Of the low-pass, at the output rate */
+    size_t max_raw;             /*!< Most words passed to one app_acquire_process() */
+    app_acquire_channel_t pressure;
+    app_acquire_channel_t flow;
+    app_acquire_block_fn on_block;  /*!< NULL = only the newest pair is kept */
+    void *arg;
+} app_acquire_cfg_t;
+
+typedef struct {
+    uint32_t raw;               /*!< Words taken */
+    uint32_t outputs;           /*!< Filtered pairs */
+    uint32_t blocks;
+    uint32_t unknown;           /*!< Words of another channel */
+    uint32_t dropped;           /*!< Raw samples dropped while the other channel lagged a block behind */
+    uint32_t overflows;         /*!< DMA buffers the driver lost */
+    int64_t process_time_us;    /*!< In app_acquire_process() */
+} app_acquire_stats_t;
+
+typedef struct app_acquire app_acquire_t;
+
+app_acquire_t *app_acquire_new(const app_acquire_cfg_t *config);
+void app_acquire_delete(app_acquire_t *acq);
+/* Run `n` raw words (at most max_raw) through the pipeline, from one task only */
+esp_err_t app_acquire_process(app_acquire_t *acq, const uint16_t *raw, size_t n);
+/* Newest filtered pressure and flow, from any task; an app_control_read_fn with `arg` the pipeline */
+void app_acquire_control_read(app_control_input_t *in, void *arg);
+void app_acquire_get_stats(app_acquire_t *acq, app_acquire_stats_t *stats);
+/* For the driver: count a DMA buffer that was overwritten before it was read */
+void app_acquire_overflow(app_acquire_t *acq);
+
+/*
+ * Target only: continuous conversions of the two channels of `config` on
+ * ADC1 through the I2S0 DMA, each buffer passed to `acq` (made from the
+ * same config) by a task at `priority` on `core`.
+ */
+esp_err_t app_adc_start(app_acquire_t *acq, const app_acquire_cfg_t *config, int priority, int core);
+
+#endif
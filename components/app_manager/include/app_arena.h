@@ -0,0 +1,34 @@
+#ifndef _APP_ARENA_H_
+#define _APP_ARENA_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include <protobuf-c/protobuf-c.h>
+
+/*
+ * Fixed-size bump allocator for protobuf-c unpacking.
+ *
+ * Allocations are carved sequentially out of one preallocated buffer and
+ * individual frees are no-ops; the whole arena is released at once with
+ * app_arena_reset(). One arena is owned by a single task, it is not
+ * thread safe.
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t used;
+    size_t high_water;              /*!< Largest `used` seen since init */
+    uint32_t overflows;             /*!< Allocations refused because the arena was full */
+    ProtobufCAllocator allocator;   /*!< Pass to *__unpack() */
+} app_arena_t;
+
+esp_err_t app_arena_init(app_arena_t *arena, size_t size);
+void app_arena_deinit(app_arena_t *arena);
+void app_arena_reset(app_arena_t *arena);
+
+static inline ProtobufCAllocator *app_arena_allocator(app_arena_t *arena)
+{
+    return &arena->allocator;
+}
+
+#endif
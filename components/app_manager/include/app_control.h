@@ -0,0 +1,182 @@
+#ifndef _APP_CONTROL_H_
+#define _APP_CONTROL_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#include "openvent.pb-c.h"
+#include "app_sample_ring.h"
+
+/*
+ * Ventilation control loop.
+ *
+ * app_control_step() advances the state machine of the selected
+ * WorkingMode by one period: it takes the airway pressure and flow, and
+ * returns how far to open the inspiratory (inlet) and expiratory (outlet)
+ * valves. It has no time source of its own and never blocks, so the host
+ * build can drive it against a simulated lung faster than real time.
+ *
+ *   CMV   mandatory breaths at rate_bpm: constant flow until tidal_ml is
+ *         in (then hold) for in_time_ms, pressure above max_pressure ends
+ *         inspiration early; expiration holds peep.
+ *   VAC   CMV where inspiratory flow above trigger_lpm during expiration
+ *         starts the next breath early, rate_bpm is the backup rate.
+ *   CPAP  holds cpap throughout, spontaneous breaths are only measured.
+ *   TEST  leak test: pressurize to test_pressure, close both valves for
+ *         test_hold_ms, pass if less than test_max_leak was lost, then
+ *         vent and stay with the outlet open.
+ *
+ * app_control_start() runs it in a task at a fixed rate, pinned to a core,
+ * with histograms of the wake-up jitter and of the time a period takes.
+ */
+typedef struct {
+    float pressure;             /*!< Airway pressure, cmH2O */
+    float flow;                 /*!< Into the patient, L/min */
+} app_control_input_t;
+
+typedef struct {
+    float inlet;                /*!< Inspiratory valve, 0 closed to 1 open */
+    float outlet;               /*!< Expiratory valve, 0 closed to 1 open */
+} app_control_output_t;
+
+typedef struct {
+    uint32_t rate_bpm;          /*!< Mandatory breaths per minute, CMV and VAC */
+    uint32_t in_time_ms;        /*!< Inspiration, CMV and VAC */
+    uint32_t tidal_ml;
+    float peep;                 /*!< End-expiratory pressure, cmH2O */
+    float max_pressure;         /*!< Inspiration ends above this, cmH2O */
+    float trigger_lpm;          /*!< VAC */
+    float cpap;                 /*!< CPAP pressure, cmH2O */
+    float test_pressure;        /*!< TEST, cmH2O */
+    uint32_t test_hold_ms;
+    float test_max_leak;        /*!< cmH2O lost over the hold */
+} app_control_settings_t;
+
+#define APP_CONTROL_SETTINGS_DEFAULT { \
+    .rate_bpm = 15, \
+    .in_time_ms = 1200, \
+    .tidal_ml = 500, \
+    .peep = 5, \
+    .max_pressure = 40, \
+    .trigger_lpm = 3, \
+    .cpap = 8, \
+    .test_pressure = 30, \
+    .test_hold_ms = 2000, \
+    .test_max_leak = 2, \
+}
+
+typedef enum {
+    APP_CONTROL_PHASE_INSPIRATION,
+    APP_CONTROL_PHASE_HOLD,             /*!< Tidal volume in, valves closed */
+    APP_CONTROL_PHASE_EXPIRATION,
+    APP_CONTROL_PHASE_TEST_PRESSURIZE,
+    APP_CONTROL_PHASE_TEST_HOLD,
+    APP_CONTROL_PHASE_TEST_VENT,
+    APP_CONTROL_PHASE_TEST_DONE,
+} app_control_phase_t;
+
+typedef enum {
+    APP_CONTROL_TEST_RUNNING,
+    APP_CONTROL_TEST_PASS,
+    APP_CONTROL_TEST_FAIL,
+} app_control_test_t;
+
+typedef struct app_control_state app_control_state_t;
+
+/* The step of one mode, see app_control_step() */
+typedef void (*app_control_step_fn)(app_control_state_t *st, const app_control_input_t *in,
+                                    app_control_output_t *out);
+
+/*
+ * State of one control loop, only app_control_step() writes it.
+ *
+ * app_control_init() picks the step of the mode and works out what it
+ * needs from the settings and the period once, so a step neither branches
+ * on the mode nor recomputes its limits.
+ */
+struct app_control_state {
+    WorkingMode mode;
+    app_control_step_fn step;
+    app_control_settings_t set;
+    uint32_t period_us;
+    float flow_scale;           /*!< ml per L/min over one period */
+    float flow_ki_dt;           /*!< Integral gains times the period */
+    float pressure_ki_dt;
+    float target_lpm;           /*!< Inspiratory flow for tidal_ml in in_time_ms */
+    uint32_t in_time_us;
+    uint32_t breath_period_us;  /*!< At rate_bpm */
+    uint32_t test_end_us;       /*!< End of the test hold, counted from its start */
+    app_control_phase_t phase;
+    uint32_t phase_us;          /*!< Time in the current phase */
+    uint32_t breath_us;         /*!< Since the current breath started */
+    float volume_ml;            /*!< Net volume in since the current breath started */
+    float integral;             /*!< PI integral term (app_pi), reset with the phase */
+    float test_start;           /*!< Pressure at the start of the test hold */
+    /* Results, also read by other tasks: each one is written in one go */
+    uint32_t breaths;
+    uint32_t triggered;         /*!< VAC breaths started by the patient */
+    uint32_t last_tidal_ml;
+    uint32_t last_in_time_ms;
+    uint32_t last_breath_ms;    /*!< Length of the last complete breath */
+    app_control_test_t test;
+};
+
+/* Start `mode` from its first phase, stepped every `period_us` */
+void app_control_init(app_control_state_t *st, WorkingMode mode, const app_control_settings_t *set,
+                      uint32_t period_us);
+/* One period: sensor values in, valve openings out. Calls st->step */
+void app_control_step(app_control_state_t *st, const app_control_input_t *in, app_control_output_t *out);
+
+/* Histogram of microseconds: bins[0] counts 0, bins[k] [2^(k-1), 2^k), the last bin everything above */
+#define APP_CONTROL_HIST_BINS   16
+typedef struct {
+    uint32_t bins[APP_CONTROL_HIST_BINS];
+    uint32_t max_us;
+} app_control_hist_t;
+
+/* CPU cycles of app_control_step() alone, in one mode */
+typedef struct {
+    uint32_t steps;
+    uint64_t cycles;
+    uint32_t max_cycles;
+} app_control_cycles_t;
+
+typedef struct {
+    uint32_t periods;
+    uint32_t overruns;          /*!< Periods that ended after the next one was due */
+    uint32_t mode_changes;
+    app_control_hist_t jitter;  /*!< Wake-up later than due */
+    app_control_hist_t exec;    /*!< read + step + write */
+    app_control_cycles_t step[WORKING_MODE__TEST + 1];  /*!< By WorkingMode */
+} app_control_stats_t;
+
+/* Upper bound in us of histogram bin `bin`, for printing */
+uint32_t app_control_hist_limit(int bin);
+
+typedef struct app_control app_control_t;
+
+typedef void (*app_control_read_fn)(app_control_input_t *in, void *arg);
+typedef void (*app_control_write_fn)(const app_control_output_t *out, void *arg);
+
+typedef struct {
+    uint32_t rate_hz;           /*!< Must divide the tick rate */
+    WorkingMode mode;
+    app_control_settings_t settings;
+    app_control_read_fn read;   /*!< NULL = no sensors, inputs stay 0 */
+    app_control_write_fn write; /*!< NULL = no valves */
+    void *arg;
+    int priority;
+    int core;                   /*!< tskNO_AFFINITY or a core */
+} app_control_cfg_t;
+
+app_control_t *app_control_start(const app_control_cfg_t *config);
+void app_control_stop(app_control_t *ctl);
+/* Switch mode at the start of the next period, the new mode starts from its first phase */
+esp_err_t app_control_set_mode(app_control_t *ctl, WorkingMode mode);
+WorkingMode app_control_get_mode(app_control_t *ctl);
+void app_control_get_stats(app_control_t *ctl, app_control_stats_t *stats);
+/* An app_sampler_read_fn with `arg` the app_control_t: inspired volume, rate and inspiration time */
+void app_control_sample(app_sample_t *sample, void *arg);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _APP_CRC32_H_
+#define _APP_CRC32_H_
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * CRC-32 (IEEE 802.3, same as zlib crc32()), computed incrementally:
+ *
+ *   uint32_t crc = 0;
+ *   crc = app_crc32_update(crc, chunk1, len1);
+ *   crc = app_crc32_update(crc, chunk2, len2);
+ *
+ * Uses the ROM routine on target and slicing-by-8 tables on host.
+ */
+uint32_t app_crc32_update(uint32_t crc, const void *data, size_t len);
+
+#endif
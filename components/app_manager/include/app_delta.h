@@ -0,0 +1,38 @@
+#ifndef _APP_DELTA_H_
+#define _APP_DELTA_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include "esp_partition.h"
+
+/*
+ * Streaming bsdiff-style patch applier.
+ *
+ * The new image is rebuilt from a source partition (the running image)
+ * and a patch that is a sequence of records, each one
+ *
+ *   diff_len:varint extra_len:varint seek:zigzag-varint
+ *   diff[diff_len] extra[extra_len]
+ *
+ * meaning: output source[pos + i] + diff[i] for diff_len bytes (pos
+ * advancing), then the extra bytes as they are, then move pos by seek.
+ * Varints are LEB128. The patch may be split anywhere between calls; the
+ * only RAM used is a source read cache of `cache_size` bytes and a small
+ * output buffer. Rebuilt bytes go to the write callback.
+ */
+typedef struct app_delta app_delta_t;
+
+typedef esp_err_t (*app_delta_write_fn)(void *arg, const uint8_t *data, size_t len);
+
+app_delta_t *app_delta_new(size_t cache_size);
+void app_delta_delete(app_delta_t *delta);
+
+/*
+ * Start a patch against the first `source_size` bytes of `source`, which
+ * must have CRC-32 `source_crc` (ESP_ERR_INVALID_CRC otherwise): a patch
+ * only makes sense on the image it was made from.
+ */
+esp_err_t app_delta_reset(app_delta_t *delta, const esp_partition_t *source, uint32_t source_size, uint32_t source_crc);
+esp_err_t app_delta_apply(app_delta_t *delta, const uint8_t *in, size_t len, app_delta_write_fn write, void *arg);
+
+#endif
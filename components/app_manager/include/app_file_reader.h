@@ -0,0 +1,40 @@
+#ifndef _APP_FILE_READER_H_
+#define _APP_FILE_READER_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+/*
+ * Read-ahead file reader.
+ *
+ * Serves a file in fixed-size chunks. After each chunk the following ones
+ * are read into the remaining buffers by a background task, so a client
+ * reading sequentially finds the next chunk already in RAM. Any other
+ * offset, chunk size or file drops the read-ahead and starts over from
+ * there. All calls must come from the same task.
+ */
+typedef struct app_file_reader app_file_reader_t;
+
+typedef struct {
+    uint32_t chunks;            /*!< Chunks served */
+    uint32_t hits;              /*!< Chunks that were already read ahead */
+    uint64_t bytes_read;
+    int64_t read_time_us;       /*!< Time the reader task spent in fread() */
+    int64_t wait_time_us;       /*!< Time the caller waited for a chunk */
+} app_file_reader_stats_t;
+
+app_file_reader_t *app_file_reader_new(size_t chunk_size, int buffer_count);
+void app_file_reader_delete(app_file_reader_t *reader);
+
+/*
+ * Read up to `len` (at most the chunk size) bytes of `path` at `offset`.
+ * `data` points into a reader buffer and stays valid until the next call.
+ * `file_size` receives the size of the file, `*data_len` is 0 at the end.
+ */
+esp_err_t app_file_reader_get(app_file_reader_t *reader, const char *path, uint32_t offset, size_t len,
+                              const uint8_t **data, size_t *data_len, uint32_t *file_size);
+/* Drop the read-ahead and close the file */
+void app_file_reader_close(app_file_reader_t *reader);
+void app_file_reader_get_stats(app_file_reader_t *reader, app_file_reader_stats_t *stats);
+
+#endif
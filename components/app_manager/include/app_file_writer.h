@@ -0,0 +1,50 @@
+#ifndef _APP_FILE_WRITER_H_
+#define _APP_FILE_WRITER_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+/*
+ * Background file writer.
+ *
+ * Data is copied into one of a few fixed-size buffers and every full
+ * buffer is written by a separate task with a single fwrite(), so the
+ * file is written in buffer-sized, buffer-aligned blocks (keep the size a
+ * multiple of the SPIFFS page). The caller only blocks when all buffers
+ * are waiting to be written, and in app_file_writer_close() until the file
+ * is on flash. One file is open at a time and all calls except
+ * app_file_writer_get_stats() must come from the same task. The writer
+ * task also keeps the CRC-32 of the file, so checking it costs the caller
+ * nothing.
+ */
+typedef struct app_file_writer app_file_writer_t;
+
+typedef struct {
+    uint64_t bytes_written;
+    uint32_t writes;            /*!< fwrite() calls, one per buffer */
+    int64_t write_time_us;      /*!< Time the writer task spent in fwrite()/fclose() */
+    uint32_t stalls;            /*!< Times the caller waited for a free buffer or a close */
+    int64_t stall_time_us;
+} app_file_writer_stats_t;
+
+app_file_writer_t *app_file_writer_new(size_t buffer_size, int buffer_count);
+void app_file_writer_delete(app_file_writer_t *writer);
+
+/* Closes the current file if any, then creates `path` */
+esp_err_t app_file_writer_open(app_file_writer_t *writer, const char *path);
+/*
+ * Appends to `path`, which already holds `offset` bytes with CRC-32 `crc`.
+ * The first buffer is cut at the next block boundary to stay aligned.
+ */
+esp_err_t app_file_writer_resume(app_file_writer_t *writer, const char *path, uint32_t offset, uint32_t crc);
+esp_err_t app_file_writer_write(app_file_writer_t *writer, const void *data, size_t len);
+/*
+ * Writes out what is buffered, closes the file and returns the first error
+ * of this file. `crc` (may be NULL) receives the CRC-32 of the whole file.
+ */
+esp_err_t app_file_writer_close(app_file_writer_t *writer, uint32_t *crc);
+/* First error the writer task hit on the open file so far */
+esp_err_t app_file_writer_status(app_file_writer_t *writer);
+void app_file_writer_get_stats(app_file_writer_t *writer, app_file_writer_stats_t *stats);
+
+#endif
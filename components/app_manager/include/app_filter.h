@@ -0,0 +1,49 @@
+#ifndef _APP_FILTER_H_
+#define _APP_FILTER_H_
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Filter stages of the acquisition pipeline (app_acquire.h).
+ *
+ * Each stage works on a block of samples in place or from one array into
+ * another, with whatever it remembers from the previous block in an
+ * explicit state struct: no globals, no allocation, no I/O, so the host
+ * build runs them on recorded waveforms exactly as the target does.
+ * Integer stages take raw ADC counts, everything after decimation is
+ * float (see app_signal.h).
+ */
+
+/* Median of five de-spike filter, removes spikes of up to two samples at the cost of two samples delay */
+typedef struct {
+    int32_t prev[4];            /*!< The previous inputs, oldest first */
+} app_median5_t;
+
+/* Start as if `x` had been the input so far */
+void app_median5_init(app_median5_t *m, int32_t x);
+void app_median5(app_median5_t *m, int32_t *buf, size_t n);
+/* One sample at a time, for input that is not in one array */
+int32_t app_median5_step(app_median5_t *m, int32_t x);
+
+/*
+ * Boxcar decimation: every `factor` inputs become their mean. `n` must be
+ * a multiple of `factor`, returns the outputs written (n / factor).
+ */
+size_t app_decimate(const int32_t *in, size_t n, uint32_t factor, float *out);
+
+/* Biquad IIR section, transposed direct form II */
+typedef struct {
+    float b0, b1, b2, a1, a2;
+} app_biquad_coef_t;
+
+typedef struct {
+    float z1, z2;
+} app_biquad_t;
+
+/* Second order low-pass at `cutoff_hz` for `rate_hz` samples/s, q 0.7071 for Butterworth */
+void app_biquad_lowpass(app_biquad_coef_t *coef, float rate_hz, float cutoff_hz, float q);
+/* Start in the steady state for a constant input `x` */
+void app_biquad_init(app_biquad_t *bq, const app_biquad_coef_t *coef, float x);
+void app_biquad(app_biquad_t *bq, const app_biquad_coef_t *coef, float *buf, size_t n);
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef _APP_HISTORY_H_
+#define _APP_HISTORY_H_
+#include <stdint.h>
+#include <stddef.h>
+
+#include "app_acquire.h"
+
+/*
+ * Pressure and flow history in several resolution tiers.
+ *
+ * Tier 0 keeps raw samples, every further tier buckets of `factor` raw
+ * samples (a multiple of the tier before) with the min, max and mean of
+ * both channels. Each tier is a ring of its own size, so the coarse tiers
+ * reach back far further than the raw one in the same memory. A sample
+ * updates the open bucket of tier 1 only; a bucket that closes is stored
+ * and folded into the open bucket of the next tier, so an insert costs a
+ * little over one update on average and at most one per tier.
+ *
+ * Values are kept as 1/100 of the unit in 16 bits (+-327.67 cmH2O or
+ * L/min, saturating): 4 bytes a raw sample, 12 a bucket.
+ *
+ * Time is counted in samples from the first one, in 64 bits, and given in
+ * ms at the configured rate truncated to 32 bits: timestamps wrap every
+ * 2^32 ms (49.7 days) and compare as (int32_t)(a - b). There is one writer,
+ * app_history_add(), and readers in any other task; neither takes a lock, a
+ * reader that was lapped by the writer while copying tries again.
+ */
+#define APP_HISTORY_MAX_TIERS   4
+
+typedef struct {
+    uint32_t factor;            /*!< Raw samples per bucket: 1 for tier 0, then each a multiple of the last */
+    uint32_t capacity;          /*!< Buckets kept */
+} app_history_tier_cfg_t;
+
+typedef struct {
+    uint32_t rate_hz;           /*!< Of the samples added */
+    size_t tiers;
+    app_history_tier_cfg_t tier[APP_HISTORY_MAX_TIERS];
+} app_history_cfg_t;
+
+typedef struct {
+    float min;
+    float max;
+    float mean;
+} app_history_stat_t;
+
+typedef struct {
+    uint32_t timestamp;         /*!< ms, start of the bucket */
+    uint32_t span_ms;           /*!< Covered, one sample period in tier 0 */
+    app_history_stat_t pressure;    /*!< cmH2O */
+    app_history_stat_t flow;        /*!< L/min */
+} app_history_point_t;
+
+typedef struct app_history app_history_t;
+
+app_history_t *app_history_new(const app_history_cfg_t *config);
+void app_history_delete(app_history_t *hist);
+/* Writer side: the next sample */
+void app_history_add(app_history_t *hist, float pressure, float flow);
+/* An app_acquire_block_fn with `arg` the history: all samples of the block */
+void app_history_acquire_block(const app_acquire_block_t *block, void *arg);
+
+/*
+ * Reader side: at most `max` points covering [from_ms, to_ms), oldest
+ * first, and return how many. They come from the finest tier that still
+ * holds from_ms, with neighbouring buckets merged into one point where
+ * the range has more than `max`; a tier is passed over for the next when
+ * it would merge as many as make one bucket of that. A query reads at most
+ * `max` times the largest factor between tiers, but any number of the
+ * coarsest tier's buckets. Only closed buckets are returned, the newest up
+ * to one bucket of the chosen tier may be missing. from_ms is taken as the
+ * time within 2^31 ms of the newest sample and the range as to_ms - from_ms
+ * long, so ranges spanning the wrap work; one of 2^31 ms or more is empty.
+ */
+size_t app_history_query(app_history_t *hist, uint32_t from_ms, uint32_t to_ms, app_history_point_t *out,
+                         size_t max);
+
+/* Reader side: ms of the oldest sample held in any tier and of the one after the newest */
+void app_history_span(app_history_t *hist, uint32_t *oldest_ms, uint32_t *end_ms);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef _APP_LOG_SINK_H_
+#define _APP_LOG_SINK_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+/*
+ * Asynchronous ESP_LOG output.
+ *
+ * Installed with esp_log_set_vprintf(), the sink formats each line into a
+ * slot of a lock-free multi-producer ring and returns; a low-priority task
+ * drains the ring to the vprintf it replaced (the UART console) and/or
+ * appends to a file. A task logging costs the formatting and nothing of
+ * the UART's pace. Lines are kept whole and in the order their slots were
+ * taken; when the ring is full the line is dropped and counted instead of
+ * waiting, lines over APP_LOG_SINK_LINE_MAX are cut short.
+ *
+ * File output is collected in a buffer of whole SPIFFS pages and written
+ * when that fills or flush_ms after the first line in it, so the file
+ * grows a few pages at a time rather than by a line every pass; the lines
+ * still buffered are lost if the device resets. The file is renamed to
+ * `path`.old when it reaches max_file_size, so it takes at most twice that.
+ * There is one sink.
+ */
+#define APP_LOG_SINK_LINE_MAX   120
+
+typedef struct {
+    size_t slots;               /*!< Lines held, rounded up to a power of two */
+    bool console;               /*!< Lines go on to the vprintf replaced */
+    const char *path;           /*!< And are appended here, NULL for none (see app_log_sink_set_file) */
+    size_t max_file_size;
+    size_t file_buffer;         /*!< Bytes of file output written at once, rounded up to APP_RECORD_LOG_PAGE */
+    uint32_t flush_ms;          /*!< Buffered lines reach the file at the latest this long after the first */
+    uint32_t poll_ms;           /*!< The task looks for lines this often when idle */
+    int priority;
+    int core;                   /*!< tskNO_AFFINITY or a core */
+} app_log_sink_cfg_t;
+
+typedef struct {
+    uint32_t lines;             /*!< Taken into the ring */
+    uint32_t dropped;           /*!< Lost to a full ring */
+    uint32_t truncated;         /*!< Cut to APP_LOG_SINK_LINE_MAX */
+    uint32_t written;           /*!< Drained */
+    uint32_t file_errors;       /*!< Lines the file did not take */
+    uint32_t max_queued;        /*!< Most lines waiting at once */
+} app_log_sink_stats_t;
+
+esp_err_t app_log_sink_start(const app_log_sink_cfg_t *config);
+/* Put back the vprintf replaced, drain what is left and stop the task */
+void app_log_sink_stop(void);
+/* Append to `path` from now on, NULL to stop; e.g. once the filesystem is mounted */
+esp_err_t app_log_sink_set_file(const char *path);
+esp_err_t app_log_sink_get_stats(app_log_sink_stats_t *stats);
+
+#endif
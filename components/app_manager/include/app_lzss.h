@@ -0,0 +1,35 @@
+#ifndef _APP_LZSS_H_
+#define _APP_LZSS_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+/*
+ * Streaming LZSS decoder for the heatshrink bitstream (heatshrink -w W -l L).
+ *
+ * Bits are read MSB first: a 1 bit is followed by an 8-bit literal, a 0
+ * bit by a W-bit back-reference (distance - 1) and an L-bit length - 1.
+ * The only RAM needed is the 2^W byte window, which doubles as the output
+ * buffer: decoded bytes are handed to the write callback straight out of
+ * it whenever it wraps and at the end of every app_lzss_decode() call, so
+ * the input may be split anywhere.
+ */
+#define APP_LZSS_MIN_WINDOW_BITS    4
+#define APP_LZSS_MAX_WINDOW_BITS    14
+
+typedef struct app_lzss app_lzss_t;
+
+typedef esp_err_t (*app_lzss_write_fn)(void *arg, const uint8_t *data, size_t len);
+
+/* Room for windows of up to 2^max_window_bits bytes */
+app_lzss_t *app_lzss_new(int max_window_bits);
+void app_lzss_delete(app_lzss_t *lzss);
+
+/* Start a new stream, lookahead_bits is L */
+esp_err_t app_lzss_reset(app_lzss_t *lzss, int window_bits, int lookahead_bits);
+/* Decode `len` more bytes of the stream, stops at the first error of `write` */
+esp_err_t app_lzss_decode(app_lzss_t *lzss, const uint8_t *in, size_t len, app_lzss_write_fn write, void *arg);
+/* Bytes decoded since app_lzss_reset() */
+uint32_t app_lzss_total_out(app_lzss_t *lzss);
+
+#endif
@@ -2,8 +2,53 @@
 #define _APP_MANAGER_H_
 #include <freertos/FreeRTOS.h>
 #include <freertos/ringbuf.h>
+#include <freertos/queue.h>
 
 #include "openvent.pb-c.h"
+#include "app_file_writer.h"
+#include "app_file_reader.h"
+#include "app_ota.h"
+#include "app_sampler.h"
+#include "app_control.h"
+#include "app_history.h"
+#include "app_record_log.h"
+
+/*
+ * Sequence-tagged (pipelined) framing. A packed VentRequest never starts
+ * with 0x00 (field number 0 is invalid), so that byte marks a tagged frame:
+ *
+ *   request: 0x00 seq:u16le VentRequest
+ *   reply:   0x00 flags:u8 count:u8 { seq:u16le len:u16le VentResponse } * count
+ *
+ * Responses to tagged requests carry the request's seq, untagged requests
+ * get a bare packed VentResponse as before. Entries with seq
+ * APP_MANAGER_TAG_SEQ_PUSH were pushed by the device without a request
+ * (see app_manager_push), clients never use that seq themselves.
+ */
+#define APP_MANAGER_TAG_MARKER          0x00
+#define APP_MANAGER_TAG_REQ_HDR_LEN     3
+#define APP_MANAGER_TAG_REPLY_HDR_LEN   3
+#define APP_MANAGER_TAG_ENTRY_HDR_LEN   4
+
+#define APP_MANAGER_TAG_FLAG_BUSY       0x01    /*!< Reply flag: the request in this write was not accepted */
+#define APP_MANAGER_TAG_SEQ_PUSH        0xffff
+
+/* Largest reply the transport can carry, a GATT attribute value is at most 512 bytes */
+#define APP_MANAGER_DEFAULT_FRAME_LIMIT 512
+
+/*
+ * Item type of the output ring buffer. `data` is a heap buffer holding one
+ * packed VentResponse; whoever receives the item owns it and must free() it.
+ * This lets the BLE transport hand the buffer to protocomm as its reply
+ * without copying it. For tagged requests `data` already holds a complete
+ * one-entry tagged reply, or is NULL when the request was handled without a
+ * response of its own (the transport only needs to know it is done).
+ */
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    bool tagged;
+} app_manager_frame_t;
 
 typedef esp_err_t (*app_manager_event_handler)(void **ctx, VentRequest *req, VentResponse *resp);
 
@@ -12,14 +57,224 @@ typedef struct {
     int output_rb_size;
     const char *access_key;
     app_manager_event_handler event_handler;
+    int arena_size;             /*!< Request unpack arena, 0 = input_rb_size / 2 + 1024 */
+    int push_queue_len;         /*!< Pushed frames waiting for the transport, 0 = 4 */
 } app_manager_cfg_t;
 
+typedef struct {
+    uint32_t requests;          /*!< Requests received from the input ring buffer */
+    uint32_t unpack_errors;
+    size_t arena_size;
+    size_t arena_high_water;    /*!< Largest unpacked request, in bytes of arena */
+    uint32_t arena_overflows;   /*!< Requests too large for the arena */
+    uint32_t pushes;            /*!< Frames pushed without a request */
+    uint32_t push_drops;        /*!< Pushed frames dropped unread to make room for newer ones */
+} app_manager_stats_t;
+
 
 esp_err_t app_manager_init(app_manager_cfg_t *config);
 esp_err_t app_manager_response(VentResponse *resp);
+
+/*
+ * Queue `resp` for the client without a request, as a tagged entry with seq
+ * APP_MANAGER_TAG_SEQ_PUSH that the transport adds to its next tagged
+ * reply. When the client does not collect them fast enough the oldest
+ * pushed frame is dropped. May be called from any one task.
+ */
+esp_err_t app_manager_push(VentResponse *resp);
+/* Drop every pushed frame not collected yet */
+void app_manager_push_flush(void);
+
+/* True while handling a request that arrived in a sequence-tagged frame */
+bool app_manager_request_tagged(void);
+
+/*
+ * WriteFileRequest handler. Chunks must arrive in offset order, the
+ * response carries read_file_response with offset set to the bytes
+ * committed so far. Data is written to flash in the background by an
+ * app_file_writer; the acknowledgement of the last chunk is only sent
+ * once the file is closed. A non-zero checksum in the last chunk is
+ * checked against the CRC-32 of the file, on mismatch the file is deleted
+ * and the ack is Fail with offset 0. A chunk reaching past file_size is
+ * refused with Fail and nothing of it written.
+ *
+ * Chunks are idempotent: bytes below the committed offset are not written
+ * again, and offset 0 only restarts a file that is not already being
+ * uploaded. Once a file is complete, chunks of the same name and size are
+ * taken for retransmissions and acknowledged with its size, offset 0 only
+ * when its checksum is the file's (non-zero); any other first chunk uploads
+ * it again, as does a chunk whose checksum is not the file's. A chunk without data (and file_size > 0) is a resume query,
+ * answered with the offset to continue from: that of the upload in
+ * progress, or of one interrupted by a reboot (read back from flash), or 0.
+ *
+ * For tagged (pipelined) requests only every
+ * CONFIG_FILE_UPLOAD_ACK_INTERVAL-th chunk, the last chunk and the first
+ * chunk after a gap are answered. After a gap (status Fail) chunks are
+ * dropped, still acknowledged every interval, until the client resends
+ * from the acknowledged offset.
+ */
 esp_err_t app_manager_file_handle(void **ctx, VentRequest *req, VentResponse *resp);
 
+/*
+ * ReadFileRequest handler. Answers read_file_response with the chunk of
+ * file_name at offset, as large as the transport frame limit allows, and
+ * file_size set. Chunks are read ahead by an app_file_reader, so reading
+ * a file front to back rarely waits for flash. Data is empty at the end.
+ */
+esp_err_t app_manager_file_read_handle(void **ctx, VentRequest *req, VentResponse *resp);
+
+/*
+ * A WriteFirmwareRequest stream may be compressed: this header, then the
+ * image as a heatshrink bitstream (see app_lzss.h). file_size and offsets
+ * count the compressed bytes, the checksum is still that of the image.
+ *
+ *   magic:u32le window_bits:u8 lookahead_bits:u8 reserved:u16 image_size:u32le
+ */
+#define APP_MANAGER_FW_LZSS_MAGIC       0x315a564f  /* "OVZ1" */
+#define APP_MANAGER_FW_LZSS_HDR_LEN     12
+
+/*
+ * Or it may be a patch against the running image (see app_delta.h), made
+ * by host/tools/ota_delta. The patch is heatshrink compressed unless
+ * window_bits is 0; source_size and source_crc identify the image it
+ * applies to, anything else is refused before the first byte is written.
+ *
+ *   magic:u32le image_size:u32le source_size:u32le source_crc:u32le
+ *   window_bits:u8 lookahead_bits:u8 reserved:u16
+ */
+#define APP_MANAGER_FW_DELTA_MAGIC      0x3144564f  /* "OVD1" */
+#define APP_MANAGER_FW_DELTA_HDR_LEN    20
+
+/*
+ * WriteFirmwareRequest handler. Same sequencing and acknowledgements as
+ * WriteFileRequest (file_size is the size of the stream, acks come in
+ * read_firmware_response), but the image streams into the next OTA
+ * partition through an app_ota. The last chunk is only acknowledged once
+ * the image is verified and set to boot; nothing reboots, the new firmware
+ * runs after the next reset. An image is resumable until then, not across
+ * a reboot. A compressed or delta stream is decoded as it arrives, its
+ * first chunk must hold the whole header.
+ *
+ * Once an image is done, chunks of a stream of the same size are taken for
+ * retransmissions and acknowledged with the end offset. Offset 0 is only
+ * taken for one when it carries the (non-zero) checksum the image was
+ * completed with, any other first chunk starts a new image.
+ */
+esp_err_t app_manager_firmware_handle(void **ctx, VentRequest *req, VentResponse *resp);
+
+/*
+ * ReadFirmwareRequest handler. Reads back the app image in the partition
+ * named by file_name (the running one when empty): read_firmware_response
+ * holds the chunk at offset, as large as a frame allows, with file_size set
+ * to the image length (header, segments, checksum and appended digest, the
+ * same bytes as the .bin). Chunks come straight from a memory mapping of
+ * the partition. A request whose data is APP_MANAGER_FW_READ_SHA256 gets
+ * the SHA-256 of the whole image in data instead, to compare with
+ * `sha256sum` of the .bin without reading it all back.
+ */
+#define APP_MANAGER_FW_READ_SHA256      "sha256"
+esp_err_t app_manager_firmware_read_handle(void **ctx, VentRequest *req, VentResponse *resp);
+
+/*
+ * Start sampling VentData at CONFIG_VENT_DATA_RATE_HZ into a ring of the
+ * last CONFIG_VENT_DATA_RING_SIZE samples, `read` (see app_sampler.h)
+ * provides the values.
+ */
+esp_err_t app_manager_vent_data_start(app_sampler_read_fn read, void *arg);
+
+/*
+ * VentDataRequest handler. VentRequest has no message of its own for it,
+ * the cursor travels in read_file_request: its offset is the timestamp of
+ * the last sample the client holds (0 for the oldest one kept). The reply
+ * holds the samples after it in vent_data_response, oldest first and as
+ * many as fit a frame; the timestamp of the last one is the next cursor.
+ * Asking again with the same cursor returns the same samples, so a lost
+ * reply costs nothing. Samples are one period apart, a larger step means
+ * the client fell more than the ring behind. Without read_file_request the
+ * reply holds just the newest sample.
+ *
+ * With APP_MANAGER_VENT_DATA_COMPACT as the request data the samples come
+ * as an app_vent_batch in read_file_response instead, several times as many
+ * per frame: data is the batch, file_size the samples in it and offset the
+ * next cursor.
+ */
+#define APP_MANAGER_VENT_DATA_COMPACT   "vb1"
+
+/*
+ * A VentDataRequest whose read_file_request has this file_name subscribes
+ * instead: every file_size ms the device pushes (app_manager_push) the
+ * samples taken since, one in checksum of them (0 or 1 for all), as
+ * VentData or compact batches per the data. offset is where to start, 0
+ * for the next sample. file_size 0 unsubscribes and drops what was not
+ * collected yet. The reply echoes what was accepted, with the start
+ * cursor in offset. Pushed batches are collected with tagged polls, a bare
+ * APP_MANAGER_TAG_MARKER write; if the client falls behind the oldest ones
+ * are dropped, which shows as a step in the timestamps.
+ */
+#define APP_MANAGER_VENT_DATA_SUBSCRIBE "subscribe"
+esp_err_t app_manager_vent_data_handle(void **ctx, VentRequest *req, VentResponse *resp);
+
+/*
+ * Start the control loop (see app_control.h) at CONFIG_VENT_CONTROL_RATE_HZ
+ * on core 1, in CMV until a VentConfigRequest selects another mode.
+ */
+esp_err_t app_manager_control_start(app_control_read_fn read, app_control_write_fn write, void *arg);
+/* NULL before app_manager_control_start(), the `arg` for app_control_sample() */
+app_control_t *app_manager_get_control(void);
+
+/*
+ * Telemetry in the record log (see app_record_log.h) at /spiffs/vlog, one
+ * APP_MANAGER_RECORD_VENT record a second: mode, the last breath and the
+ * min, max and mean pressure and flow over the second from `hist` (zero
+ * without). Records are stamped in seconds, counted on from the newest one
+ * logged before the reset. Start once SPIFFS is mounted, after
+ * app_manager_control_start().
+ */
+#define APP_MANAGER_RECORD_VENT         1
+
+typedef struct {
+    int16_t pressure[3];        /*!< min, max, mean, 1/100 cmH2O */
+    int16_t flow[3];            /*!< min, max, mean, 1/100 L/min */
+    uint16_t volume_ml;
+    uint16_t frequency;         /*!< Breaths per minute */
+    uint16_t in_time_ms;
+    uint8_t mode;               /*!< WorkingMode */
+    uint8_t reserved;
+} app_manager_vent_record_t;
+
+esp_err_t app_manager_telemetry_start(app_history_t *hist);
+
+/*
+ * VentConfigRequest handler. The control loop switches to
+ * vent_config_request's mode at its next period, starting the mode's
+ * first phase; Fail for a mode it does not know.
+ */
+esp_err_t app_manager_vent_config_handle(void **ctx, VentRequest *req, VentResponse *resp);
+
+/* Largest reply frame the transport accepts, packed responses are sized to fit it */
+void app_manager_set_frame_limit(size_t limit);
+size_t app_manager_get_frame_limit(void);
+/* Largest bytes field that can still be added to `resp` with the reply fitting one frame */
+size_t app_manager_response_room(VentResponse *resp);
+/* Same for a frame passed to app_manager_push() */
+size_t app_manager_push_room(VentResponse *resp);
+
 RingbufHandle_t app_manager_get_input_rb();
 RingbufHandle_t app_manager_get_output_rb();
+/* app_manager_frame_t items from app_manager_push(), NULL before app_manager_init() */
+QueueHandle_t app_manager_get_push_queue(void);
+esp_err_t app_manager_get_stats(app_manager_stats_t *stats);
+/* Counters of the background file writer, ESP_ERR_INVALID_STATE before the first upload */
+esp_err_t app_manager_get_file_stats(app_file_writer_stats_t *stats);
+/* Counters of the read-ahead file reader, ESP_ERR_INVALID_STATE before the first read */
+esp_err_t app_manager_get_file_read_stats(app_file_reader_stats_t *stats);
+/* Counters of the last firmware update, ESP_ERR_INVALID_STATE before the first one */
+esp_err_t app_manager_get_ota_stats(app_ota_stats_t *stats);
+/* Counters of the VentData sampler, ESP_ERR_INVALID_STATE before it is started */
+esp_err_t app_manager_get_vent_data_stats(app_sampler_stats_t *stats);
+/* Jitter and execution time of the control loop, ESP_ERR_INVALID_STATE before it is started */
+esp_err_t app_manager_get_control_stats(app_control_stats_t *stats);
+/* Counters of the telemetry log, ESP_ERR_INVALID_STATE before it is started */
+esp_err_t app_manager_get_telemetry_stats(app_record_log_stats_t *stats);
 
 #endif
@@ -0,0 +1,52 @@
+#ifndef _APP_OTA_H_
+#define _APP_OTA_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+/*
+ * Streaming OTA into the inactive app partition.
+ *
+ * Same shape as app_file_writer: the caller copies the image into
+ * sector-sized buffers and a background task writes each full buffer.
+ * Instead of erasing the whole partition up front like esp_ota_begin(),
+ * the task erases sector by sector while it is idle, up to `erase_ahead`
+ * sectors ahead of the write pointer. The SHA-256 of the image is updated
+ * as each buffer is written; app_ota_end() checks it against the digest
+ * appended to the image and only then marks the partition for the next
+ * boot. All calls except app_ota_get_stats() must come from the same task.
+ */
+typedef struct app_ota app_ota_t;
+
+typedef struct {
+    uint32_t image_size;
+    uint64_t bytes_written;
+    int64_t image_time_us;      /*!< app_ota_begin() to the end of app_ota_end() */
+    int64_t erase_time_us;
+    int64_t write_time_us;
+    int64_t hash_time_us;
+    uint32_t erased_ahead;      /*!< Sectors erased before they were needed */
+    uint32_t erased_inline;     /*!< Sectors a write had to wait for */
+    uint32_t stalls;            /*!< Times the caller waited for a free buffer or the end */
+    int64_t stall_time_us;
+} app_ota_stats_t;
+
+app_ota_t *app_ota_new(int buffer_count, int erase_ahead);
+void app_ota_delete(app_ota_t *ota);
+
+/* Start writing an image of `image_size` bytes to the next update partition */
+esp_err_t app_ota_begin(app_ota_t *ota, uint32_t image_size);
+esp_err_t app_ota_write(app_ota_t *ota, const void *data, size_t len);
+/*
+ * Writes out what is buffered and verifies the image against `crc`, its
+ * expected CRC-32 (0 = not checked), and the appended SHA-256. On success
+ * the new partition boots next time.
+ */
+esp_err_t app_ota_end(app_ota_t *ota, uint32_t crc);
+/* Drop the image being written, the boot partition is left alone */
+void app_ota_abort(app_ota_t *ota);
+/* First error hit on the current image so far */
+esp_err_t app_ota_status(app_ota_t *ota);
+void app_ota_get_stats(app_ota_t *ota, app_ota_stats_t *stats);
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef _APP_RECORD_LOG_H_
+#define _APP_RECORD_LOG_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+/*
+ * Append-only binary record log in segment files.
+ *
+ * Records are appended to the newest segment, `path`.<8 hex digits of the
+ * segment number>, and collected in RAM until `batch_size` bytes are due
+ * (a multiple of the SPIFFS page payload, APP_RECORD_LOG_PAGE), so SPIFFS
+ * only ever programs whole pages and updates a file's index once a batch
+ * instead of once a record. A record does not span segments: the one
+ * that does not fit closes the segment and starts the next, and beyond
+ * `max_segments` the oldest is deleted, so the log never takes more than
+ * max_segments * segment_size of the partition.
+ *
+ * On flash a segment is a 12 byte header (magic, segment number, newest
+ * timestamp before the segment), written when it is started, followed by
+ * records of
+ *
+ *   len (1) | type (1) | timestamp (4) | payload (len) | CRC-32 of all before (4)
+ *
+ * The log keeps a sparse time index in RAM, the timestamp and place of
+ * every `index_every`-th record of each segment, so a reader seeks to a
+ * time reading no more than that many records. A segment's entries are
+ * saved next to it, `path`.<segment>.i, when the next one is started;
+ * open loads those and scans only segments that have none (the tail, or
+ * one whose index a reset interrupted).
+ *
+ * Only the newest segment can end in a torn record, so opening the log
+ * reads nothing but that one: up to its first bad record. A clean tail is
+ * appended to, a torn one is left as it is and a new segment started;
+ * readers stop at the first bad record of a segment either way.
+ *
+ * Timestamps are the caller's, in a unit of its choosing, and must not
+ * decrease: append() refuses one that does. 32 bits of ms run out after
+ * 49.7 days of logging, a log meant to outlast that counts in coarser
+ * units (the telemetry log in seconds). Timestamps survive a reset while
+ * the uptime does not: app_record_log_last_timestamp() after open gives
+ * the newest one logged, to count on from.
+ *
+ * Records still in the batch are lost if the device resets, flush() puts
+ * them on flash. A log and its readers are used from one task.
+ */
+#define APP_RECORD_LOG_MAX_PAYLOAD  255
+/* Data in one SPIFFS page: the 256 byte page less its 5 byte header */
+#define APP_RECORD_LOG_PAGE         251
+/* Bytes of a record besides the payload */
+#define APP_RECORD_LOG_OVERHEAD     10
+/* Records per index entry when not configured */
+#define APP_RECORD_LOG_INDEX_EVERY  32
+
+typedef struct {
+    const char *path;           /*!< Segments are named `path`.00000000 and up */
+    size_t segment_size;        /*!< Bytes a segment grows to at most */
+    uint32_t max_segments;      /*!< Oldest ones deleted beyond this, at least 2 */
+    size_t batch_size;          /*!< Bytes written at once */
+    uint32_t index_every;       /*!< Records per index entry, 0 for APP_RECORD_LOG_INDEX_EVERY */
+} app_record_log_cfg_t;
+
+typedef struct {
+    uint32_t timestamp;         /*!< As appended */
+    uint8_t type;
+    uint8_t len;
+    uint8_t payload[APP_RECORD_LOG_MAX_PAYLOAD];
+} app_record_t;
+
+typedef struct {
+    uint32_t records;           /*!< Appended since open */
+    uint64_t bytes;             /*!< Written to segments, headers included */
+    uint32_t writes;            /*!< fwrite() calls */
+    uint32_t segments;          /*!< Started since open */
+    uint32_t deleted;           /*!< Segments deleted to stay within max_segments */
+    uint32_t dropped;           /*!< Records lost to write errors */
+    int64_t write_time_us;
+    uint32_t index_entries;     /*!< Held now, 12 bytes each */
+    /* The tail segment at open */
+    uint32_t recovered;         /*!< Records found intact */
+    uint32_t recovery_bytes;    /*!< Read to find them */
+    uint32_t torn;              /*!< Bytes after the last intact record */
+    uint32_t index_scanned;     /*!< Older segments scanned for want of an index file */
+    int64_t recovery_time_us;
+} app_record_log_stats_t;
+
+typedef struct app_record_log app_record_log_t;
+
+/* Open the log at config->path, recovering the tail segment, or start one */
+app_record_log_t *app_record_log_open(const app_record_log_cfg_t *config);
+/* Flush and close */
+void app_record_log_close(app_record_log_t *log);
+esp_err_t app_record_log_append(app_record_log_t *log, uint8_t type, uint32_t timestamp, const void *payload,
+                                size_t len);
+/* Write out the batch so far, even if it is not a whole one */
+esp_err_t app_record_log_flush(app_record_log_t *log);
+void app_record_log_get_stats(app_record_log_t *log, app_record_log_stats_t *stats);
+/* Newest timestamp appended, or found at open; 0 for a new log */
+uint32_t app_record_log_last_timestamp(app_record_log_t *log);
+
+/* Sequential reader over the flushed records, oldest first */
+typedef struct app_record_reader app_record_reader_t;
+
+app_record_reader_t *app_record_reader_new(app_record_log_t *log);
+void app_record_reader_delete(app_record_reader_t *reader);
+/* The next record; ESP_ERR_NOT_FOUND past the newest flushed one */
+esp_err_t app_record_reader_next(app_record_reader_t *reader, app_record_t *record);
+/*
+ * Go to the oldest record at or after `timestamp`, for next() to return;
+ * ESP_ERR_NOT_FOUND if there is none yet, the reader is then at the end.
+ */
+esp_err_t app_record_reader_seek(app_record_reader_t *reader, uint32_t timestamp);
+/* Bytes read from the segments so far */
+uint32_t app_record_reader_bytes(app_record_reader_t *reader);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _APP_SAMPLE_RING_H_
+#define _APP_SAMPLE_RING_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* One ventilation sample, the fields of a VentData */
+typedef struct {
+    uint32_t timestamp;         /*!< ms since boot, wrapping at 2^32: each later than the last as (int32_t)(a - b) > 0 */
+    uint32_t volume;            /*!< breath_circulating_volumn */
+    uint32_t frequency;         /*!< breathing_frequency */
+    float breath_in_time;
+} app_sample_t;
+
+/*
+ * Lock-free single-producer ring of samples.
+ *
+ * The producer never waits: when the ring is full the oldest sample is
+ * overwritten. Readers do not remove anything, they copy out the samples
+ * newer than a timestamp, so the same range can be read again (a reply
+ * that got lost). Every slot carries the index of the sample it holds,
+ * written before and after the sample like a seqlock, which lets a reader
+ * notice a slot that was overwritten while it copied it. There is one
+ * producer task and any number of readers: a reader keeps no state in the
+ * ring, so the manager task answering requests and the push task can read
+ * it at once. None of them takes a lock.
+ */
+typedef struct app_sample_ring app_sample_ring_t;
+
+/* `size` is rounded up to a power of two */
+app_sample_ring_t *app_sample_ring_new(size_t size);
+void app_sample_ring_delete(app_sample_ring_t *ring);
+
+/* Producer side: append a sample, overwriting the oldest one when full */
+void app_sample_ring_push(app_sample_ring_t *ring, const app_sample_t *sample);
+
+/*
+ * Reader side: copy up to `max` samples with a timestamp after `since`,
+ * oldest first, and return how many. `since` compares the same way as the
+ * timestamps, so a cursor keeps working across the wrap; with `since` 0 it
+ * starts at the oldest sample held (a cursor that is 0 itself, once every
+ * 49.7 days, reads those again). `lost` is set when samples after `since`
+ * have already been overwritten, the first one returned is then the oldest
+ * held.
+ */
+size_t app_sample_ring_read(app_sample_ring_t *ring, uint32_t since, app_sample_t *out, size_t max, bool *lost);
+
+/* Reader side: the newest sample, false while the ring is empty */
+bool app_sample_ring_newest(app_sample_ring_t *ring, app_sample_t *out);
+
+/* Samples pushed so far (wraps at 2^32) */
+uint32_t app_sample_ring_count(app_sample_ring_t *ring);
+
+#endif
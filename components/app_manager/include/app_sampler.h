@@ -0,0 +1,45 @@
+#ifndef _APP_SAMPLER_H_
+#define _APP_SAMPLER_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#include "app_sample_ring.h"
+
+/*
+ * Fixed-rate sampling task.
+ *
+ * Calls `read` once per period and pushes the result into an
+ * app_sample_ring, stamped with the tick the period started at: samples
+ * are exactly one period apart even when the task runs late, and a late
+ * period is counted rather than skipped. The rate must divide the tick
+ * rate (CONFIG_FREERTOS_HZ).
+ */
+typedef struct app_sampler app_sampler_t;
+
+/* Fill in everything but the timestamp */
+typedef void (*app_sampler_read_fn)(app_sample_t *sample, void *arg);
+
+typedef struct {
+    uint32_t rate_hz;
+    size_t ring_size;           /*!< Samples kept for readers */
+    app_sampler_read_fn read;   /*!< NULL = samples hold only their timestamp */
+    void *arg;
+    int priority;
+    int core;                   /*!< tskNO_AFFINITY or a core */
+} app_sampler_cfg_t;
+
+typedef struct {
+    uint32_t samples;
+    uint32_t late;              /*!< Periods that ended before their sample was pushed */
+    int64_t read_time_us;       /*!< Time spent in `read` */
+} app_sampler_stats_t;
+
+app_sampler_t *app_sampler_start(const app_sampler_cfg_t *config);
+/* Stop the task and free the ring */
+void app_sampler_stop(app_sampler_t *sampler);
+app_sample_ring_t *app_sampler_get_ring(app_sampler_t *sampler);
+uint32_t app_sampler_get_period_ms(app_sampler_t *sampler);
+void app_sampler_get_stats(app_sampler_t *sampler, app_sampler_stats_t *stats);
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef _APP_SIGNAL_H_
+#define _APP_SIGNAL_H_
+#include <stdint.h>
+
+/*
+ * Signal path kernels: filtering, integration and control, per sample.
+ *
+ * The ESP32 FPU is single precision, `double` arithmetic is done in
+ * software and costs many times as much. Everything between the sensors
+ * and the protocol is therefore `float`, or Q16.16 fixed point where the
+ * input is an integer anyway (ADC counts); the sources of the signal path
+ * are built with -Wdouble-promotion so a stray double literal or
+ * promotion shows up. VentData.breath_in_time is the only double, filled
+ * in where the reply is built. Constants are written as float literals
+ * (1e-3f) and converted to Q16 with APP_Q16() at compile time.
+ */
+
+/* Q16.16: 16 integer bits with sign, steps of 1/65536. Range +-32768 */
+typedef int32_t app_q16_t;
+#define APP_Q16_SHIFT       16
+#define APP_Q16_ONE         ((app_q16_t)1 << APP_Q16_SHIFT)
+#define APP_Q16(x)          ((app_q16_t)((x) * 65536.0f + ((x) >= 0 ? 0.5f : -0.5f)))
+
+static inline app_q16_t app_q16_mul(app_q16_t a, app_q16_t b)
+{
+    return (app_q16_t)(((int64_t)a * b) >> APP_Q16_SHIFT);
+}
+
+static inline app_q16_t app_q16_from_float(float x)
+{
+    return APP_Q16(x);
+}
+
+static inline float app_q16_to_float(app_q16_t x)
+{
+    return x * (1.0f / 65536);
+}
+
+/* One-pole low-pass, y += alpha * (x - y) with alpha in (0, 1] */
+static inline float app_lowpass(float *y, float x, float alpha)
+{
+    *y += alpha * (x - *y);
+    return *y;
+}
+
+static inline app_q16_t app_lowpass_q16(app_q16_t *y, app_q16_t x, app_q16_t alpha)
+{
+    *y += app_q16_mul(alpha, x - *y);
+    return *y;
+}
+
+/*
+ * PI controller: kp * error plus the integral term, limited to [lo, hi].
+ * `integral` holds the integral term itself (ki * dt per step already
+ * applied), it only moves while that does not push the output further
+ * past a limit, so it never winds up.
+ */
+static inline float app_pi(float *integral, float error, float kp, float ki_dt, float lo, float hi)
+{
+    float i = *integral + ki_dt * error;
+    float u = kp * error + i;
+    if ((u < hi || error < 0) && (u > lo || error > 0)) {
+        *integral = i;
+    } else {
+        u = kp * error + *integral;
+    }
+    return u < lo ? lo : u > hi ? hi : u;
+}
+
+static inline app_q16_t app_pi_q16(app_q16_t *integral, app_q16_t error, app_q16_t kp, app_q16_t ki_dt,
+                                   app_q16_t lo, app_q16_t hi)
+{
+    app_q16_t i = *integral + app_q16_mul(ki_dt, error);
+    app_q16_t u = app_q16_mul(kp, error) + i;
+    if ((u < hi || error < 0) && (u > lo || error > 0)) {
+        *integral = i;
+    } else {
+        u = app_q16_mul(kp, error) + *integral;
+    }
+    return u < lo ? lo : u > hi ? hi : u;
+}
+
+/* Running sum of `rate` * `scale`, e.g. a flow into a volume */
+static inline float app_integrate(float *sum, float rate, float scale)
+{
+    *sum += rate * scale;
+    return *sum;
+}
+
+static inline app_q16_t app_integrate_q16(app_q16_t *sum, app_q16_t rate, app_q16_t scale)
+{
+    *sum += app_q16_mul(rate, scale);
+    return *sum;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef _APP_VENT_BATCH_H_
+#define _APP_VENT_BATCH_H_
+#include <stdint.h>
+#include <stddef.h>
+
+#include "app_sample_ring.h"
+
+/*
+ * Compact batch of samples, the alternative to a repeated VentData.
+ *
+ * Column by column rather than sample by sample, each column as its first
+ * value followed by the differences from one sample to the next, all LEB128
+ * varints. Consecutive samples barely differ, so most differences take one
+ * byte. breath_in_time is carried in whole milliseconds.
+ *
+ *   version:u8 count:varint constant:u8
+ *   timestamp: first:varint { delta:varint } * (count - 1)
+ *   volume, frequency, breath_in_time_ms, each:
+ *       first:varint { zigzag delta:varint } * (count - 1)
+ *
+ * A column whose bit is set in `constant` (bit 0 volume, 1 frequency,
+ * 2 breath_in_time_ms) has the same value in every sample and is only its
+ * first value. host/tools/vent_batch_decode.c is the reference decoder.
+ */
+#define APP_VENT_BATCH_VERSION          1
+#define APP_VENT_BATCH_CONST_VOLUME     0x01
+#define APP_VENT_BATCH_CONST_FREQUENCY  0x02
+#define APP_VENT_BATCH_CONST_IN_TIME    0x04
+
+/*
+ * Encode as many of the `count` samples as fit in `out_len` bytes, oldest
+ * first. Returns the bytes written and sets `encoded` to the samples in
+ * them, both 0 when not even one fits.
+ */
+size_t app_vent_batch_encode(const app_sample_t *samples, size_t count, uint8_t *out, size_t out_len,
+                             size_t *encoded);
+
+#endif
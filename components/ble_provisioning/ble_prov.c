@@ -28,6 +28,7 @@ struct ble_prov_data {
     wifi_prov_sta_fail_reason_t wifi_disconnect_reason;
     RingbufHandle_t receive_rb;
     RingbufHandle_t send_rb;
+    ble_prov_custom_data_t *custom_data;  /*!< State of the "custom-data" endpoint */
 };
 
 
@@ -104,7 +105,7 @@ static esp_err_t ble_prov_start_service(void)
 
     if (protocomm_add_endpoint(g_prov->pc, "custom-data",
                                ble_prov_custom_data_handler,
-                               (void *) g_prov) != ESP_OK) {
+                               (void *) g_prov->custom_data) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to set custom provisioning endpoint");
         protocomm_ble_stop(g_prov->pc);
         return ESP_FAIL;
@@ -136,6 +137,8 @@ static void stop_prov_task(void *arg)
     esp_timer_delete(timer);
     g_prov->timer = NULL;
 
+    ble_prov_custom_data_delete(g_prov->custom_data);
+
     /* Free provisioning process data */
     free(g_prov);
     g_prov = NULL;
@@ -338,12 +341,6 @@ esp_err_t ble_provisioning_start(int security,
         return ESP_FAIL;
     }
 
-    /* Start provisioning service through BLE */
-    err = ble_prov_start_service();
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Provisioning failed to start");
-        return ESP_FAIL;
-    }
     g_prov->receive_rb = receive_rb;
     if (g_prov->receive_rb == NULL) {
         ESP_LOGE(TAG, "Exhaused memory");
@@ -356,36 +353,19 @@ esp_err_t ble_provisioning_start(int security,
         return ESP_FAIL;
     }
 
-    ESP_LOGI(TAG, "BLE Provisioning started");
-    return ESP_OK;
-}
-
-
-int ble_prov_custom_data_handler(uint32_t session_id, const uint8_t *inbuf, ssize_t inlen, uint8_t **outbuf, ssize_t *outlen, void *priv_data)
-{
-    if (g_prov->receive_rb == NULL || g_prov->send_rb == NULL) {
-        ESP_LOGE(TAG, "No buffer for send/receive data");
+    g_prov->custom_data = ble_prov_custom_data_new(send_rb, receive_rb);
+    if (g_prov->custom_data == NULL) {
+        ESP_LOGE(TAG, "Exhaused memory");
         return ESP_FAIL;
     }
 
-    if (xRingbufferSend(g_prov->receive_rb, inbuf, inlen, 10000 / portTICK_RATE_MS) != pdPASS) {
-        ESP_LOGE(TAG, "Error receiving data");
-        return ESP_FAIL;
-    }
-    size_t send_size = 0;
-    uint8_t *send_data = xRingbufferReceive(g_prov->send_rb, &send_size, 10000 / portTICK_RATE_MS);
-    if (send_data == NULL) {
-        ESP_LOGE(TAG, "Error get sending data");
-        *outlen = 0;
-        return ESP_OK;
-    }
-    *outlen = send_size;
-    *outbuf = (uint8_t *) malloc(*outlen);
-    if (outbuf == NULL) {
-        ESP_LOGE(TAG, "Memory exhaused");
+    /* Start provisioning service through BLE */
+    err = ble_prov_start_service();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Provisioning failed to start");
         return ESP_FAIL;
     }
-    memcpy(*outbuf, send_data, send_size);
-    vRingbufferReturnItem(g_prov->send_rb, send_data);
+
+    ESP_LOGI(TAG, "BLE Provisioning started");
     return ESP_OK;
 }
@@ -0,0 +1,203 @@
+#include <string.h>
+#include <esp_log.h>
+#include <esp_err.h>
+
+#include "ble_prov_custom_data.h"
+#include "app_manager.h"
+
+static const char *TAG = "ble_prov_data";
+
+#ifndef CONFIG_CUSTOM_DATA_PIPELINE_DEPTH
+#define CONFIG_CUSTOM_DATA_PIPELINE_DEPTH   8
+#endif
+#ifndef CONFIG_CUSTOM_DATA_MAX_REPLY
+#define CONFIG_CUSTOM_DATA_MAX_REPLY        512
+#endif
+
+struct ble_prov_custom_data {
+    RingbufHandle_t receive_rb;
+    RingbufHandle_t send_rb;
+    int outstanding;                      /*!< Tagged requests queued and not handled by the manager yet */
+    int held_count;                       /*!< Tagged responses waiting for the next reply */
+    app_manager_frame_t held[CONFIG_CUSTOM_DATA_PIPELINE_DEPTH];
+};
+
+ble_prov_custom_data_t *ble_prov_custom_data_new(RingbufHandle_t send_rb, RingbufHandle_t receive_rb)
+{
+    ble_prov_custom_data_t *cd = calloc(1, sizeof(ble_prov_custom_data_t));
+    if (cd == NULL) {
+        return NULL;
+    }
+    cd->send_rb = send_rb;
+    cd->receive_rb = receive_rb;
+    /* Lock-step replies and batched tagged replies are both bounded by this */
+    app_manager_set_frame_limit(CONFIG_CUSTOM_DATA_MAX_REPLY);
+    return cd;
+}
+
+void ble_prov_custom_data_delete(ble_prov_custom_data_t *cd)
+{
+    if (cd == NULL) {
+        return;
+    }
+    for (int i = 0; i < cd->held_count; i++) {
+        free(cd->held[i].data);
+    }
+    free(cd);
+}
+
+/* Bytes of the reply the held responses make, and how many of them fit */
+static size_t ble_prov_tagged_reply_len(ble_prov_custom_data_t *cd, int *count)
+{
+    size_t len = APP_MANAGER_TAG_REPLY_HDR_LEN;
+    *count = 0;
+    while (*count < cd->held_count) {
+        size_t entry_len = cd->held[*count].len - APP_MANAGER_TAG_REPLY_HDR_LEN;
+        if (*count > 0 && len + entry_len > CONFIG_CUSTOM_DATA_MAX_REPLY) {
+            break;
+        }
+        len += entry_len;
+        (*count)++;
+    }
+    return len;
+}
+
+/*
+ * Fill what room the responses leave in the reply with pushed frames.
+ * Those are only taken when they fit, so they never hold up the window.
+ */
+static void ble_prov_take_pushed(ble_prov_custom_data_t *cd)
+{
+    QueueHandle_t push_queue = app_manager_get_push_queue();
+    int count;
+    size_t len = ble_prov_tagged_reply_len(cd, &count);
+    app_manager_frame_t frame;
+    while (push_queue && count == cd->held_count && cd->held_count < CONFIG_CUSTOM_DATA_PIPELINE_DEPTH &&
+            xQueuePeek(push_queue, &frame, 0) == pdTRUE) {
+        size_t entry_len = frame.len - APP_MANAGER_TAG_REPLY_HDR_LEN;
+        if (count > 0 && len + entry_len > CONFIG_CUSTOM_DATA_MAX_REPLY) {
+            break;
+        }
+        if (xQueueReceive(push_queue, &frame, 0) != pdTRUE) {
+            break;
+        }
+        cd->held[cd->held_count++] = frame;
+        len += entry_len;
+        count++;
+    }
+}
+
+/* Build the reply to a tagged write from the held responses, oldest first */
+static esp_err_t ble_prov_tagged_reply(ble_prov_custom_data_t *cd, uint8_t flags, uint8_t **outbuf, ssize_t *outlen)
+{
+    const size_t entries_off = APP_MANAGER_TAG_REPLY_HDR_LEN;
+    int count;
+    size_t len = ble_prov_tagged_reply_len(cd, &count);
+
+    uint8_t *reply;
+    if (count == 1) {
+        /* A tagged frame is already a one-entry reply, hand it over without copying */
+        reply = cd->held[0].data;
+    } else {
+        reply = (uint8_t *) malloc(len);
+        if (reply == NULL) {
+            ESP_LOGE(TAG, "Memory exhaused");
+            return ESP_ERR_NO_MEM;
+        }
+        size_t offset = entries_off;
+        for (int i = 0; i < count; i++) {
+            size_t entry_len = cd->held[i].len - entries_off;
+            memcpy(reply + offset, cd->held[i].data + entries_off, entry_len);
+            offset += entry_len;
+            free(cd->held[i].data);
+        }
+    }
+    reply[0] = APP_MANAGER_TAG_MARKER;
+    reply[1] = flags;
+    reply[2] = count;
+
+    cd->held_count -= count;
+    memmove(&cd->held[0], &cd->held[count], cd->held_count * sizeof(app_manager_frame_t));
+
+    *outbuf = reply;
+    *outlen = len;
+    return ESP_OK;
+}
+
+/*
+ * Pipelined mode: queue the request if the client still has window left,
+ * then return whatever responses are ready without waiting for this one.
+ * A write of the bare marker byte only polls for responses, and for
+ * frames the device pushed.
+ */
+static esp_err_t ble_prov_custom_data_tagged(ble_prov_custom_data_t *cd, const uint8_t *inbuf, ssize_t inlen,
+                                             uint8_t **outbuf, ssize_t *outlen)
+{
+    uint8_t flags = 0;
+    if (inlen >= APP_MANAGER_TAG_REQ_HDR_LEN) {
+        /* Responses not picked up yet count against the window too, they are bounded by `held` */
+        if (cd->outstanding + cd->held_count >= CONFIG_CUSTOM_DATA_PIPELINE_DEPTH ||
+                xRingbufferSend(cd->receive_rb, inbuf, inlen, 0) != pdPASS) {
+            flags |= APP_MANAGER_TAG_FLAG_BUSY;
+        } else {
+            cd->outstanding++;
+        }
+    }
+
+    while (cd->held_count < CONFIG_CUSTOM_DATA_PIPELINE_DEPTH) {
+        app_manager_frame_t *frame = xRingbufferReceive(cd->send_rb, NULL, 0);
+        if (frame == NULL) {
+            break;
+        }
+        app_manager_frame_t held = *frame;
+        vRingbufferReturnItem(cd->send_rb, frame);
+        if (!held.tagged) {
+            ESP_LOGW(TAG, "Dropping untagged response in pipelined mode");
+            free(held.data);
+            continue;
+        }
+        cd->outstanding--;
+        if (held.data == NULL) {
+            /* Handled without a response of its own, e.g. a file chunk acknowledged later */
+            continue;
+        }
+        cd->held[cd->held_count++] = held;
+    }
+    ble_prov_take_pushed(cd);
+    return ble_prov_tagged_reply(cd, flags, outbuf, outlen);
+}
+
+esp_err_t ble_prov_custom_data_handler(uint32_t session_id, const uint8_t *inbuf, ssize_t inlen,
+                                       uint8_t **outbuf, ssize_t *outlen, void *priv_data)
+{
+    (void)session_id;
+    ble_prov_custom_data_t *cd = priv_data;
+    if (cd == NULL || cd->receive_rb == NULL || cd->send_rb == NULL) {
+        ESP_LOGE(TAG, "No buffer for send/receive data");
+        return ESP_FAIL;
+    }
+
+    if (inlen > 0 && inbuf[0] == APP_MANAGER_TAG_MARKER) {
+        return ble_prov_custom_data_tagged(cd, inbuf, inlen, outbuf, outlen);
+    }
+
+    if (xRingbufferSend(cd->receive_rb, inbuf, inlen, 10000 / portTICK_RATE_MS) != pdPASS) {
+        ESP_LOGE(TAG, "Error receiving data");
+        return ESP_FAIL;
+    }
+    size_t send_size = 0;
+    app_manager_frame_t *frame = xRingbufferReceive(cd->send_rb, &send_size, 10000 / portTICK_RATE_MS);
+    if (frame == NULL || frame->data == NULL) {
+        ESP_LOGE(TAG, "Error get sending data");
+        if (frame) {
+            vRingbufferReturnItem(cd->send_rb, frame);
+        }
+        *outlen = 0;
+        return ESP_OK;
+    }
+    /* protocomm frees outbuf after sending it, which is exactly the ownership the frame carries */
+    *outbuf = frame->data;
+    *outlen = frame->len;
+    vRingbufferReturnItem(cd->send_rb, frame);
+    return ESP_OK;
+}
@@ -6,6 +6,8 @@
 #include "protocomm_security.h"
 #include <wifi_provisioning/wifi_config.h>
 
+#include "ble_prov_custom_data.h"
+
 esp_err_t ble_prov_get_wifi_state(wifi_prov_sta_state_t *state);
 
 
@@ -24,6 +26,3 @@ esp_err_t ble_provisioning_start(int security,
                                  const protocomm_security_pop_t *pop,
                                  RingbufHandle_t send_rb,
                                  RingbufHandle_t receive_rb);
-
-esp_err_t ble_prov_custom_data_handler(uint32_t session_id, const uint8_t *inbuf, ssize_t inlen,
-                                       uint8_t **outbuf, ssize_t *outlen, void *priv_data);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <sys/types.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+
+/*
+ * "custom-data" endpoint: bridges protocomm writes to the app_manager ring
+ * buffers. Kept free of protocomm/BLE dependencies so it also builds on host.
+ */
+typedef struct ble_prov_custom_data ble_prov_custom_data_t;
+
+ble_prov_custom_data_t *ble_prov_custom_data_new(RingbufHandle_t send_rb, RingbufHandle_t receive_rb);
+void ble_prov_custom_data_delete(ble_prov_custom_data_t *custom_data);
+
+/*
+ * protocomm handler, priv_data is the ble_prov_custom_data_t. A plain write
+ * carries one packed VentRequest and blocks until its response is available.
+ * A write starting with APP_MANAGER_TAG_MARKER uses the sequence-tagged
+ * framing from app_manager.h: up to CONFIG_CUSTOM_DATA_PIPELINE_DEPTH
+ * requests may be in flight, and each reply carries the responses that are
+ * ready at that point, followed by frames the device pushed on its own
+ * (app_manager_push) as far as they fit. Clients should not mix both modes
+ * while tagged requests are outstanding.
+ */
+esp_err_t ble_prov_custom_data_handler(uint32_t session_id, const uint8_t *inbuf, ssize_t inlen,
+                                       uint8_t **outbuf, ssize_t *outlen, void *priv_data);
@@ -0,0 +1,289 @@
+/*
+ * Request pipeline throughput on host.
+ *
+ * Drives app_manager exactly the way ble_prov_custom_data_handler does:
+ * push one packed VentRequest into the input ring buffer, wait for the
+ * packed VentResponse on the output ring buffer, and time the round trip.
+ * Reports requests/sec and p50/p99 latency per Command.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include "esp_log.h"
+#include "app_manager.h"
+#include "openvent.pb-c.h"
+#include "bench_common.h"
+
+#define BENCH_ACCESS_KEY        "0000"
+#define BENCH_MAX_PACKED        1024
+
+static esp_err_t _bench_event_handler(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    /* Same dispatch as _app_manager_event_handler in main/app_main.c */
+    switch ((uint32_t)req->cmd) {
+        case COMMAND__DeviceInfoRequest: {
+            DeviceInfo info = DEVICE_INFO__INIT;
+            info.fw_version = "1.0.0";
+            info.hw_version = "1.0.1";
+            info.device_model = 1;
+            info.device_name = "device_name";
+            resp->device_info_response = &info;
+            resp->status = STATUS__Success;
+            return app_manager_response(resp);
+        }
+        case COMMAND__WriteFileRequest:
+            return app_manager_file_handle(ctx, req, resp);
+    }
+    return app_manager_response(resp);
+}
+
+/* Fill req for iteration i, return false when the scenario is done */
+typedef bool (*bench_build_fn)(VentRequest *req, int i, void *arg);
+
+typedef struct {
+    char file_name[256];
+    uint8_t chunk[BENCH_MAX_PACKED / 2];
+    size_t chunk_size;
+    uint32_t file_size;
+    FileData file_data;
+} bench_file_arg_t;
+
+static bool _build_cmd_none(VentRequest *req, int i, void *arg)
+{
+    (void)i;
+    (void)arg;
+    req->cmd = COMMAND__CmdNone;
+    return true;
+}
+
+static bool _build_device_info(VentRequest *req, int i, void *arg)
+{
+    (void)i;
+    (void)arg;
+    req->cmd = COMMAND__DeviceInfoRequest;
+    return true;
+}
+
+static bool _build_bad_key(VentRequest *req, int i, void *arg)
+{
+    (void)i;
+    (void)arg;
+    req->cmd = COMMAND__DeviceInfoRequest;
+    req->access_key = "ffff";
+    return true;
+}
+
+static bool _build_write_file(VentRequest *req, int i, void *arg)
+{
+    bench_file_arg_t *file = arg;
+    uint32_t chunks_per_file = file->file_size / file->chunk_size;
+    file_data__init(&file->file_data);
+    file->file_data.file_name = file->file_name;
+    file->file_data.file_size = file->file_size;
+    file->file_data.offset = (i % chunks_per_file) * file->chunk_size;
+    file->file_data.data.data = file->chunk;
+    file->file_data.data.len = file->chunk_size;
+    req->cmd = COMMAND__WriteFileRequest;
+    req->write_file_request = &file->file_data;
+    return true;
+}
+
+static void _run_scenario(const char *name, bench_build_fn build, void *arg, int iterations)
+{
+    RingbufHandle_t input_rb = app_manager_get_input_rb();
+    RingbufHandle_t output_rb = app_manager_get_output_rb();
+    uint8_t packed[BENCH_MAX_PACKED];
+    bench_samples_t samples;
+    uint64_t busy_ns = 0;
+
+    if (bench_samples_init(&samples, iterations) != 0) {
+        fprintf(stderr, "%s: out of memory\n", name);
+        return;
+    }
+    for (int i = 0; i < iterations; i++) {
+        VentRequest req = VENT_REQUEST__INIT;
+        req.access_key = BENCH_ACCESS_KEY;
+        if (!build(&req, i, arg)) {
+            break;
+        }
+        size_t len = vent_request__pack(&req, packed);
+
+        uint64_t start = bench_now_ns();
+        if (xRingbufferSend(input_rb, packed, len, 10000 / portTICK_RATE_MS) != pdPASS) {
+            fprintf(stderr, "%s: input ring buffer full\n", name);
+            break;
+        }
+        app_manager_frame_t *frame = xRingbufferReceive(output_rb, NULL, 10000 / portTICK_RATE_MS);
+        if (frame == NULL) {
+            fprintf(stderr, "%s: no response for request %d\n", name, i);
+            break;
+        }
+        uint8_t *resp = frame->data;
+        vRingbufferReturnItem(output_rb, frame);
+        free(resp);
+        uint64_t elapsed = bench_now_ns() - start;
+        busy_ns += elapsed;
+        bench_samples_add(&samples, elapsed);
+    }
+    bench_report(name, &samples, busy_ns);
+    bench_samples_free(&samples);
+}
+
+/*
+ * Same requests in sequence-tagged frames with up to `depth` in flight,
+ * latency is from queueing a request to receiving its response.
+ */
+static void _run_pipelined(const char *name, bench_build_fn build, void *arg, int iterations, int depth)
+{
+    RingbufHandle_t input_rb = app_manager_get_input_rb();
+    RingbufHandle_t output_rb = app_manager_get_output_rb();
+    uint8_t packed[BENCH_MAX_PACKED];
+    static uint64_t sent_at[UINT16_MAX + 1];
+    bench_samples_t samples;
+    int sent = 0, received = 0;
+
+    if (bench_samples_init(&samples, iterations) != 0) {
+        fprintf(stderr, "%s: out of memory\n", name);
+        return;
+    }
+    uint64_t start = bench_now_ns();
+    while (received < iterations) {
+        while (sent < iterations && sent - received < depth) {
+            VentRequest req = VENT_REQUEST__INIT;
+            req.access_key = BENCH_ACCESS_KEY;
+            build(&req, sent, arg);
+            uint16_t seq = sent;
+            packed[0] = APP_MANAGER_TAG_MARKER;
+            packed[1] = seq & 0xff;
+            packed[2] = seq >> 8;
+            size_t len = APP_MANAGER_TAG_REQ_HDR_LEN + vent_request__pack(&req, packed + APP_MANAGER_TAG_REQ_HDR_LEN);
+            sent_at[seq] = bench_now_ns();
+            if (xRingbufferSend(input_rb, packed, len, 10000 / portTICK_RATE_MS) != pdPASS) {
+                fprintf(stderr, "%s: input ring buffer full\n", name);
+                goto done;
+            }
+            sent++;
+        }
+        app_manager_frame_t *frame = xRingbufferReceive(output_rb, NULL, 10000 / portTICK_RATE_MS);
+        if (frame == NULL) {
+            fprintf(stderr, "%s: no response after %d\n", name, received);
+            break;
+        }
+        uint8_t *resp = frame->data;
+        vRingbufferReturnItem(output_rb, frame);
+        received++;
+        if (resp == NULL) {
+            /* Handled without a response, e.g. a file chunk acknowledged cumulatively */
+            continue;
+        }
+        uint16_t seq = resp[APP_MANAGER_TAG_REPLY_HDR_LEN] | (resp[APP_MANAGER_TAG_REPLY_HDR_LEN + 1] << 8);
+        bench_samples_add(&samples, bench_now_ns() - sent_at[seq]);
+        free(resp);
+    }
+done:
+    bench_report(name, &samples, bench_now_ns() - start);
+    bench_samples_free(&samples);
+}
+
+static void _usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-n iterations] [-c chunk_size] [-p pipeline_depth] [-d work_dir] [-v]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 20000;
+    size_t chunk_size = 256;
+    int depth = 4;
+    const char *work_dir = NULL;
+    char tmp_dir[] = "/tmp/openvent-bench-XXXXXX";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:p:d:v")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 'c':
+                chunk_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                depth = atoi(optarg);
+                break;
+            case 'd':
+                work_dir = optarg;
+                break;
+            case 'v':
+                esp_log_level_set("*", ESP_LOG_INFO);
+                break;
+            default:
+                _usage(argv[0]);
+                return 1;
+        }
+    }
+    if (iterations <= 0 || depth <= 0 || chunk_size == 0 || chunk_size > BENCH_MAX_PACKED / 2) {
+        _usage(argv[0]);
+        return 1;
+    }
+    if (work_dir == NULL) {
+        work_dir = mkdtemp(tmp_dir);
+        if (work_dir == NULL) {
+            perror("mkdtemp");
+            return 1;
+        }
+    }
+
+    app_manager_cfg_t app_man_cfg = {
+        .input_rb_size = 8 * 1024,
+        .output_rb_size = 2 * 1024,
+        .access_key = BENCH_ACCESS_KEY,
+        .event_handler = _bench_event_handler,
+    };
+    if (app_manager_init(&app_man_cfg) != ESP_OK) {
+        fprintf(stderr, "app_manager_init failed\n");
+        return 1;
+    }
+
+    bench_file_arg_t file_arg = {
+        .chunk_size = chunk_size,
+        .file_size = chunk_size * 64,
+    };
+    snprintf(file_arg.file_name, sizeof(file_arg.file_name), "%s/bench.bin", work_dir);
+    for (size_t i = 0; i < chunk_size; i++) {
+        file_arg.chunk[i] = (uint8_t)i;
+    }
+
+    printf("app_manager pipeline: %d requests per command, %zu byte file chunks\n", iterations, chunk_size);
+    _run_scenario("CmdNone", _build_cmd_none, NULL, iterations);
+    _run_scenario("DeviceInfoRequest", _build_device_info, NULL, iterations);
+    _run_scenario("InvalidAccessKey", _build_bad_key, NULL, iterations);
+    _run_scenario("WriteFileRequest", _build_write_file, &file_arg, iterations);
+
+    printf("sequence-tagged, %d in flight\n", depth);
+    _run_pipelined("DeviceInfoRequest", _build_device_info, NULL, iterations, depth);
+    _run_pipelined("WriteFileRequest", _build_write_file, &file_arg, iterations, depth);
+
+    app_manager_stats_t stats;
+    if (app_manager_get_stats(&stats) == ESP_OK) {
+        printf("requests=%u unpack_errors=%u arena high-water=%zu/%zu bytes overflows=%u\n",
+               stats.requests, stats.unpack_errors, stats.arena_high_water, stats.arena_size,
+               stats.arena_overflows);
+    }
+    app_file_writer_stats_t file_stats;
+    if (app_manager_get_file_stats(&file_stats) == ESP_OK) {
+        printf("file writer: %llu bytes in %u writes, %.1f MB/s, %u stalls %.1f ms\n",
+               (unsigned long long)file_stats.bytes_written, file_stats.writes,
+               file_stats.write_time_us ? (double)file_stats.bytes_written / file_stats.write_time_us : 0.0,
+               file_stats.stalls, file_stats.stall_time_us / 1000.0);
+    }
+
+    unlink(file_arg.file_name);
+    if (work_dir == tmp_dir) {
+        rmdir(tmp_dir);
+    }
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Per-frame cost of handing a packed VentResponse from app_manager to the
+ * BLE custom-data endpoint, for the three schemes the output path has used:
+ *
+ *   malloc+copy  pack into a scratch buffer, xRingbufferSend copies it into
+ *                the ring, the endpoint mallocs the protocomm reply and
+ *                copies it out again (original code)
+ *   ring-pack    pack straight into ring memory (xRingbufferSendAcquire),
+ *                the endpoint still mallocs and copies the reply out
+ *   handoff      pack once into a heap frame and pass the pointer through
+ *                the ring, the endpoint gives it to protocomm as is (current)
+ *
+ * Every scheme ends with the free() protocomm does after sending.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include "app_manager.h"
+#include "openvent.pb-c.h"
+#include "bench_common.h"
+
+typedef void (*bench_frame_fn)(RingbufHandle_t rb, const VentResponse *resp);
+
+static void _protocomm_send(uint8_t *outbuf, size_t outlen)
+{
+    (void)outlen;
+    /* Keep the compiler from dropping the copy, then free like protocomm does */
+    __asm__ volatile("" : : "r"(outbuf) : "memory");
+    free(outbuf);
+}
+
+static void _frame_malloc_copy(RingbufHandle_t rb, const VentResponse *resp)
+{
+    size_t len = vent_response__get_packed_size(resp);
+    uint8_t *buf = malloc(len);
+    vent_response__pack(resp, buf);
+    xRingbufferSend(rb, buf, len, portMAX_DELAY);
+    free(buf);
+
+    size_t item_len;
+    uint8_t *item = xRingbufferReceive(rb, &item_len, portMAX_DELAY);
+    uint8_t *outbuf = malloc(item_len);
+    memcpy(outbuf, item, item_len);
+    vRingbufferReturnItem(rb, item);
+    _protocomm_send(outbuf, item_len);
+}
+
+static void _frame_ring_pack(RingbufHandle_t rb, const VentResponse *resp)
+{
+    size_t len = vent_response__get_packed_size(resp);
+    void *buf;
+    xRingbufferSendAcquire(rb, &buf, len, portMAX_DELAY);
+    vent_response__pack(resp, buf);
+    xRingbufferSendComplete(rb, buf);
+
+    size_t item_len;
+    uint8_t *item = xRingbufferReceive(rb, &item_len, portMAX_DELAY);
+    uint8_t *outbuf = malloc(item_len);
+    memcpy(outbuf, item, item_len);
+    vRingbufferReturnItem(rb, item);
+    _protocomm_send(outbuf, item_len);
+}
+
+static void _frame_handoff(RingbufHandle_t rb, const VentResponse *resp)
+{
+    app_manager_frame_t frame;
+    frame.len = vent_response__get_packed_size(resp);
+    frame.data = malloc(frame.len);
+    vent_response__pack(resp, frame.data);
+    xRingbufferSend(rb, &frame, sizeof(frame), portMAX_DELAY);
+
+    app_manager_frame_t *item = xRingbufferReceive(rb, NULL, portMAX_DELAY);
+    uint8_t *outbuf = item->data;
+    size_t outlen = item->len;
+    vRingbufferReturnItem(rb, item);
+    _protocomm_send(outbuf, outlen);
+}
+
+static double _ns_per_frame(bench_frame_fn fn, const VentResponse *resp, int iterations)
+{
+    RingbufHandle_t rb = xRingbufferCreate(8 * 1024, RINGBUF_TYPE_NOSPLIT);
+    for (int i = 0; i < iterations / 10; i++) {
+        fn(rb, resp);
+    }
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        fn(rb, resp);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    vRingbufferDelete(rb);
+    return (double)elapsed / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t payload_sizes[] = { 0, 64, 256, 512, 1024, 2048 };
+    static uint8_t payload[2048];
+    int iterations = 200000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations]\n", argv[0]);
+                return 1;
+        }
+    }
+    memset(payload, 0xa5, sizeof(payload));
+
+    printf("ns per response frame, app_manager -> custom-data endpoint (%d frames)\n", iterations);
+    printf("%8s %8s %12s %12s %12s\n", "payload", "packed", "malloc+copy", "ring-pack", "handoff");
+    for (size_t i = 0; i < sizeof(payload_sizes) / sizeof(payload_sizes[0]); i++) {
+        FileData file_data = FILE_DATA__INIT;
+        VentResponse resp = VENT_RESPONSE__INIT;
+        resp.status = STATUS__Success;
+        if (payload_sizes[i] > 0) {
+            file_data.file_name = "/spiffs/log.bin";
+            file_data.file_size = 64 * 1024;
+            file_data.offset = 4096;
+            file_data.data.data = payload;
+            file_data.data.len = payload_sizes[i];
+            resp.read_file_response = &file_data;
+        }
+        printf("%8zu %8zu %12.1f %12.1f %12.1f\n", payload_sizes[i], vent_response__get_packed_size(&resp),
+               _ns_per_frame(_frame_malloc_copy, &resp, iterations),
+               _ns_per_frame(_frame_ring_pack, &resp, iterations),
+               _ns_per_frame(_frame_handoff, &resp, iterations));
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench_common.h"
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int bench_samples_init(bench_samples_t *s, size_t cap)
+{
+    s->samples = calloc(cap, sizeof(uint64_t));
+    s->count = 0;
+    s->cap = s->samples ? cap : 0;
+    return s->samples ? 0 : -1;
+}
+
+void bench_samples_add(bench_samples_t *s, uint64_t ns)
+{
+    if (s->count < s->cap) {
+        s->samples[s->count++] = ns;
+    }
+}
+
+void bench_samples_free(bench_samples_t *s)
+{
+    free(s->samples);
+    s->samples = NULL;
+    s->count = s->cap = 0;
+}
+
+static int _cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+uint64_t bench_percentile(bench_samples_t *s, double p)
+{
+    if (s->count == 0) {
+        return 0;
+    }
+    qsort(s->samples, s->count, sizeof(uint64_t), _cmp_u64);
+    size_t idx = (size_t)(p / 100.0 * (s->count - 1) + 0.5);
+    return s->samples[idx];
+}
+
+void bench_report(const char *name, bench_samples_t *s, uint64_t elapsed_ns)
+{
+    double rate = elapsed_ns ? s->count * 1e9 / elapsed_ns : 0;
+    uint64_t p50 = bench_percentile(s, 50);
+    uint64_t p99 = bench_percentile(s, 99);
+    printf("%-24s n=%-8zu %10.0f op/s   p50=%8.2f us   p99=%8.2f us\n",
+           name, s->count, rate, p50 / 1000.0, p99 / 1000.0);
+}
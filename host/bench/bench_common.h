@@ -0,0 +1,35 @@
+/*
+ * Timing and percentile helpers shared by the host benchmarks.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint64_t *samples;      /*!< Per-operation latency, nanoseconds */
+    size_t count;
+    size_t cap;
+} bench_samples_t;
+
+uint64_t bench_now_ns(void);
+
+/* Time stamp counter where the host has one (x86), else 0 */
+static inline uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+int bench_samples_init(bench_samples_t *s, size_t cap);
+void bench_samples_add(bench_samples_t *s, uint64_t ns);
+void bench_samples_free(bench_samples_t *s);
+
+/* Sorts the samples in place, p in [0, 100] */
+uint64_t bench_percentile(bench_samples_t *s, double p);
+
+/* One line: name, count, ops/s over elapsed_ns, p50 and p99 latency */
+void bench_report(const char *name, bench_samples_t *s, uint64_t elapsed_ns);
@@ -0,0 +1,318 @@
+/*
+ * The ventilation control loop against a simulated lung.
+ *
+ * First app_control_step() is driven directly, one simulated millisecond
+ * per call, as fast as the host goes: per WorkingMode it prints how much
+ * faster than real time that runs, the cost of a step and what the
+ * patient got (rate, tidal volume, peak and end-expiratory pressure, or
+ * how well CPAP held), and checks it against the settings. The cost of a
+ * step is taken from replaying the recorded inputs through the mode's
+ * step in a loop (ns and time stamp counter cycles), its p99 and max from
+ * timing every step of the simulation. Then the real control task runs
+ * for a while against the same lung in real time and prints its wake-up
+ * jitter and execution time histograms, and the cycles of a step per
+ * mode as the task counts them on the target.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include "app_control.h"
+#include "bench_common.h"
+#include "bench_lung.h"
+
+#define BENCH_PERIOD_US     1000
+
+typedef struct {
+    double secs;
+    uint64_t wall_ns;
+    bench_samples_t step;
+    bench_samples_t cycles;     /*!< Of each step, time stamp counter */
+    app_control_input_t *inputs;    /*!< What the lung gave each step, replayed by _replay() */
+    size_t n_inputs;
+    double replay_ns;           /*!< Per step, in a loop without the lung or timers */
+    double replay_cycles;
+    uint32_t breaths;
+    double first_ms;            /*!< Start of the first and the last breath counted */
+    double last_ms;
+    double tidal_sum;
+    double peak;                /*!< Highest airway pressure */
+    double peep_sum;            /*!< Airway pressure at the end of each expiration */
+    double error_max;           /*!< CPAP: furthest from the set pressure */
+} bench_run_t;
+
+static void _simulate(bench_run_t *run, app_control_state_t *st, bench_lung_t *lung, double secs)
+{
+    uint32_t steps = secs * 1e6 / BENCH_PERIOD_US;
+    uint32_t breaths = st->breaths;
+    app_control_input_t in;
+    app_control_output_t out;
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < steps; i++) {
+        bench_lung_read(lung, &in);
+        if (run->n_inputs < run->step.cap) {
+            run->inputs[run->n_inputs++] = in;
+        }
+        uint64_t t0 = bench_now_ns(), c0 = bench_cycles();
+        app_control_step(st, &in, &out);
+        bench_samples_add(&run->cycles, bench_cycles() - c0);
+        bench_samples_add(&run->step, bench_now_ns() - t0);
+        bench_lung_step(lung, &out, BENCH_PERIOD_US / 1000.0);
+
+        if (in.pressure > run->peak) {
+            run->peak = in.pressure;
+        }
+        if (st->mode == WORKING_MODE__CPAP && lung->t_ms > 2000 && fabs(in.pressure - st->set.cpap) > run->error_max) {
+            run->error_max = fabs(in.pressure - st->set.cpap);
+        }
+        if (st->breaths != breaths) {
+            /* Skip the first breath, it started from rest */
+            if (breaths > 1) {
+                if (run->breaths++ == 0) {
+                    run->first_ms = lung->t_ms;
+                }
+                run->last_ms = lung->t_ms;
+                run->tidal_sum += st->last_tidal_ml;
+                run->peep_sum += in.pressure;
+            }
+            breaths = st->breaths;
+        }
+    }
+    run->wall_ns += bench_now_ns() - start;
+    run->secs += secs;
+}
+
+/* Time stamp counter read twice with nothing between */
+static uint64_t s_cycles_overhead;
+
+static void _calibrate_cycles(void)
+{
+    bench_samples_t empty;
+    bench_samples_init(&empty, 10000);
+    for (int i = 0; i < 10000; i++) {
+        uint64_t c0 = bench_cycles();
+        bench_samples_add(&empty, bench_cycles() - c0);
+    }
+    s_cycles_overhead = bench_percentile(&empty, 50);
+    bench_samples_free(&empty);
+}
+
+static unsigned long long _step_cycles(bench_samples_t *cycles, double p)
+{
+    uint64_t c = bench_percentile(cycles, p);
+    return c > s_cycles_overhead ? c - s_cycles_overhead : 0;
+}
+
+/*
+ * The recorded inputs again, through the step alone: what a tick costs
+ * without measuring each one. The inputs are split evenly over `modes`,
+ * switched to in order as they were recorded.
+ */
+static void _replay(bench_run_t *run, const WorkingMode *modes, size_t n_modes, const app_control_settings_t *set)
+{
+    app_control_state_t st;
+    app_control_output_t out;
+    float sink = 0;
+    /* The fastest of a few, the host is not quiet */
+    run->replay_ns = INFINITY;
+    for (int r = 0; r < 20; r++) {
+        uint64_t t0 = bench_now_ns(), c0 = bench_cycles();
+        for (size_t i = 0; i < run->n_inputs; i++) {
+            if (i % (run->n_inputs / n_modes) == 0 && i / (run->n_inputs / n_modes) < n_modes) {
+                app_control_init(&st, modes[i / (run->n_inputs / n_modes)], set, BENCH_PERIOD_US);
+            }
+            app_control_step(&st, &run->inputs[i], &out);
+            sink += out.inlet;
+        }
+        uint64_t cycles = bench_cycles() - c0, ns = bench_now_ns() - t0;
+        if ((double)ns / run->n_inputs < run->replay_ns) {
+            run->replay_ns = (double)ns / run->n_inputs;
+            run->replay_cycles = (double)cycles / run->n_inputs;
+        }
+    }
+    if (sink < 0) {
+        printf("%f", (double)sink);
+    }
+}
+
+static void _report(const char *name, bench_run_t *run, bool ok, const char *result)
+{
+    printf("%-12s %s %4.0f s in %6.3f s (%5.0fx)  step %5.1f ns %4.0f cycles, p99 %4llu max %6llu cycles  | %s\n",
+           name, ok ? "ok  " : "FAIL", run->secs, run->wall_ns / 1e9, run->secs * 1e9 / run->wall_ns, run->replay_ns,
+           run->replay_cycles, _step_cycles(&run->cycles, 99), _step_cycles(&run->cycles, 100), result);
+}
+
+static void _run_mode(const char *name, WorkingMode mode, bench_lung_t lung, double secs)
+{
+    app_control_settings_t set = APP_CONTROL_SETTINGS_DEFAULT;
+    app_control_state_t st;
+    bench_run_t run = { 0 };
+    char result[160];
+    bool ok;
+
+    bench_samples_init(&run.step, secs * 1e6 / BENCH_PERIOD_US);
+    bench_samples_init(&run.cycles, secs * 1e6 / BENCH_PERIOD_US);
+    run.inputs = malloc(run.step.cap * sizeof(app_control_input_t));
+    app_control_init(&st, mode, &set, BENCH_PERIOD_US);
+    _simulate(&run, &st, &lung, secs);
+    _replay(&run, &mode, 1, &set);
+
+    /* The tidal volume and peep counted at a breath's start are those of the one before */
+    double bpm = run.breaths > 1 ? (run.breaths - 1) * 60000 / (run.last_ms - run.first_ms) : 0;
+    double tidal = run.breaths ? run.tidal_sum / run.breaths : 0;
+    double peep = run.breaths ? run.peep_sum / run.breaths : 0;
+    switch (mode) {
+        case WORKING_MODE__CMV:
+            ok = fabs(bpm - set.rate_bpm) < 0.5 && fabs(tidal - set.tidal_ml) < set.tidal_ml * 0.05 &&
+                 fabs(peep - set.peep) < 0.5 && run.peak < set.max_pressure;
+            snprintf(result, sizeof(result), "%4.1f bpm, tidal %3.0f ml, peak %4.1f, peep %4.1f cmH2O", bpm, tidal,
+                     run.peak, peep);
+            break;
+        case WORKING_MODE__VAC:
+            /* Every effort of the patient is a breath */
+            ok = st.triggered > 0 && fabs(bpm - lung.effort_bpm) < 1 && fabs(tidal - set.tidal_ml) < set.tidal_ml * 0.1;
+            snprintf(result, sizeof(result), "%4.1f bpm, %u of %u breaths triggered, tidal %3.0f ml, peep %4.1f",
+                     bpm, st.triggered, st.breaths, tidal, peep);
+            break;
+        case WORKING_MODE__CPAP:
+            ok = run.error_max < 2 && fabs(bpm - lung.effort_bpm) < 1;
+            snprintf(result, sizeof(result), "%4.1f bpm measured, tidal %3.0f ml, within %.2f cmH2O of %.0f", bpm,
+                     tidal, run.error_max, set.cpap);
+            break;
+        default: {
+            bool leaky = lung.leak_g > 0;
+            ok = st.phase == APP_CONTROL_PHASE_TEST_DONE &&
+                 st.test == (leaky ? APP_CONTROL_TEST_FAIL : APP_CONTROL_TEST_PASS);
+            snprintf(result, sizeof(result), "%s circuit: %s", leaky ? "leaky" : "sealed",
+                     st.test == APP_CONTROL_TEST_PASS ? "pass" : st.test == APP_CONTROL_TEST_FAIL ? "fail" : "running");
+            break;
+        }
+    }
+    _report(name, &run, ok, result);
+    bench_samples_free(&run.step);
+    bench_samples_free(&run.cycles);
+    free(run.inputs);
+}
+
+/* Switch modes every few seconds on the same lung, the way a VentConfigRequest does */
+static void _run_switching(bench_lung_t lung, double secs)
+{
+    app_control_settings_t set = APP_CONTROL_SETTINGS_DEFAULT;
+    app_control_state_t st;
+    bench_run_t run = { 0 };
+    const WorkingMode modes[] = { WORKING_MODE__CMV, WORKING_MODE__CPAP, WORKING_MODE__VAC, WORKING_MODE__CMV };
+    char result[160];
+
+    bench_samples_init(&run.step, secs * 1e6 / BENCH_PERIOD_US);
+    bench_samples_init(&run.cycles, secs * 1e6 / BENCH_PERIOD_US);
+    run.inputs = malloc(run.step.cap * sizeof(app_control_input_t));
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        app_control_init(&st, modes[i], &set, BENCH_PERIOD_US);
+        _simulate(&run, &st, &lung, secs / 4);
+    }
+    _replay(&run, modes, sizeof(modes) / sizeof(modes[0]), &set);
+    /* Back in CMV: the last breaths have to be what CMV delivers */
+    bool ok = st.mode == WORKING_MODE__CMV && fabs((double)st.last_tidal_ml - set.tidal_ml) < set.tidal_ml * 0.05 &&
+              run.peak < set.max_pressure;
+    snprintf(result, sizeof(result), "CMV, CPAP, VAC, CMV: last tidal %u ml, peak %4.1f cmH2O", st.last_tidal_ml,
+             run.peak);
+    _report("switching", &run, ok, result);
+    bench_samples_free(&run.step);
+    bench_samples_free(&run.cycles);
+    free(run.inputs);
+}
+
+static void _print_hist(const char *name, const app_control_hist_t *hist, uint32_t periods)
+{
+    printf("  %-7s", name);
+    int last = APP_CONTROL_HIST_BINS - 1;
+    while (last > 0 && hist->bins[last] == 0) {
+        last--;
+    }
+    for (int bin = 0; bin <= last; bin++) {
+        printf(" <=%uus:%.3f%%", app_control_hist_limit(bin), 100.0 * hist->bins[bin] / periods);
+    }
+    printf("  max %u us\n", hist->max_us);
+}
+
+static void _run_task(bench_lung_t lung, double secs)
+{
+    app_control_cfg_t cfg = {
+        .rate_hz = 1000,
+        .mode = WORKING_MODE__CMV,
+        .settings = APP_CONTROL_SETTINGS_DEFAULT,
+        .read = bench_lung_read_fn,
+        .write = bench_lung_write_fn,
+        .arg = &lung,
+        .priority = 10,
+        .core = 1,
+    };
+    app_control_t *ctl = app_control_start(&cfg);
+    if (ctl == NULL) {
+        fprintf(stderr, "control start failed\n");
+        return;
+    }
+    usleep(secs * 1e6 / 2);
+    app_control_set_mode(ctl, WORKING_MODE__VAC);
+    usleep(secs * 1e6 / 2);
+    app_control_stats_t stats;
+    app_control_get_stats(ctl, &stats);
+    app_control_stop(ctl);
+
+    printf("control task, 1 kHz for %.0f s: %u periods, %u overruns, %u mode changes\n", secs, stats.periods,
+           stats.overruns, stats.mode_changes);
+    _print_hist("jitter", &stats.jitter, stats.periods);
+    _print_hist("exec", &stats.exec, stats.periods);
+    const char *names[] = { "CMV", "CPAP", "VAC", "TEST" };
+    for (int mode = WORKING_MODE__CMV; mode <= WORKING_MODE__TEST; mode++) {
+        const app_control_cycles_t *c = &stats.step[mode];
+        if (c->steps) {
+            printf("  %-7s %u steps, %llu cycles mean, %u max\n", names[mode], c->steps,
+                   (unsigned long long)(c->cycles / c->steps), c->max_cycles);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double secs = 120;
+    double task_secs = 4;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:r:")) != -1) {
+        switch (opt) {
+            case 't':
+                secs = atof(optarg);
+                break;
+            case 'r':
+                task_secs = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t simulated_seconds] [-r real_time_seconds]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    bench_lung_t passive = BENCH_LUNG_ADULT;
+    bench_lung_t breathing = BENCH_LUNG_ADULT;
+    breathing.effort = 4;
+    breathing.effort_bpm = 20;
+    bench_lung_t leaky = BENCH_LUNG_ADULT;
+    leaky.leak_g = 0.005;
+
+    _calibrate_cycles();
+    printf("Simulated adult lung, R 10 cmH2O/L/s, C 50 ml/cmH2O, 1 kHz steps\n");
+    _run_mode("CMV", WORKING_MODE__CMV, passive, secs);
+    _run_mode("VAC", WORKING_MODE__VAC, breathing, secs);
+    _run_mode("CPAP", WORKING_MODE__CPAP, breathing, secs);
+    _run_mode("TEST", WORKING_MODE__TEST, passive, 10);
+    _run_mode("TEST leak", WORKING_MODE__TEST, leaky, 10);
+    _run_switching(passive, secs);
+    if (task_secs > 0) {
+        _run_task(passive, task_secs);
+    }
+    return 0;
+}
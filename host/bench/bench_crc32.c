@@ -0,0 +1,84 @@
+/*
+ * Cost of the streaming CRC-32 used to verify uploads, in ns per KB for
+ * the update sizes the file writer sees, next to a bitwise reference.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "app_crc32.h"
+#include "bench_common.h"
+
+static uint32_t _crc32_bitwise(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+typedef uint32_t (*bench_crc_fn)(uint32_t crc, const void *data, size_t len);
+
+static double _ns_per_kb(bench_crc_fn fn, const uint8_t *data, size_t total, size_t update_size)
+{
+    volatile uint32_t sink;
+    uint32_t crc = 0;
+    size_t pos = 0;
+    uint64_t start = bench_now_ns();
+    /* Whole updates only, the tail of `total` that does not fill one is left out */
+    for (; pos + update_size <= total; pos += update_size) {
+        crc = fn(crc, data + pos, update_size);
+    }
+    sink = crc;
+    (void)sink;
+    return pos ? (double)(bench_now_ns() - start) / (pos / 1024.0) : 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t update_sizes[] = { 64, 256, 480, 2048, 4096 };
+    size_t total = 16 * 1024 * 1024;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        switch (opt) {
+            case 's':
+                total = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s bytes]\n", argv[0]);
+                return 1;
+        }
+    }
+    total = total / 4096 * 4096;
+    if (total == 0) {
+        fprintf(stderr, "need at least 4096 bytes\n");
+        return 1;
+    }
+    uint8_t *data = malloc(total);
+    for (size_t i = 0; i < total; i++) {
+        data[i] = (uint8_t)(i * 131 + (i >> 9));
+    }
+
+    if (app_crc32_update(0, "123456789", 9) != 0xcbf43926 ||
+            app_crc32_update(app_crc32_update(0, data, 1001), data + 1001, 3095) != _crc32_bitwise(0, data, 4096)) {
+        fprintf(stderr, "app_crc32_update: wrong result\n");
+        return 1;
+    }
+
+    printf("CRC-32 over %zu bytes, ns per KB\n", total);
+    printf("%8s %12s %12s\n", "update", "app_crc32", "bitwise");
+    for (size_t i = 0; i < sizeof(update_sizes) / sizeof(update_sizes[0]); i++) {
+        printf("%8zu %12.1f %12.1f\n", update_sizes[i],
+               _ns_per_kb(app_crc32_update, data, total, update_sizes[i]),
+               _ns_per_kb(_crc32_bitwise, data, total / 16, update_sizes[i]));
+    }
+    free(data);
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * Delta firmware updates: transfer size and apply time.
+ *
+ * Takes an old and a new image (-a openvent-v1.bin -b openvent-v2.bin).
+ * Without them the bench's own executable is the old image and the new one
+ * is made from it the way a small code change looks in a linked binary: a
+ * few hundred bytes inserted, a function rewritten, and every 64th word
+ * after the insertion shifted like a relocated address. Prints what goes
+ * over the link for the full, compressed and delta images, how fast
+ * app_delta rebuilds the image from the running partition, then sends the
+ * delta through WriteFirmwareRequest and checks the partition it wrote.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "app_manager.h"
+#include "app_delta.h"
+#include "app_lzss.h"
+#include "app_crc32.h"
+#include "ble_prov_custom_data.h"
+#include "bench_common.h"
+#include "bench_link.h"
+#include "lzss_encode.h"
+#include "ota_diff.h"
+
+#define BENCH_WINDOW_BITS       12
+#define BENCH_LOOKAHEAD_BITS    5
+
+typedef struct {
+    const uint8_t *image;
+    uint32_t pos;
+    bool mismatch;
+    app_delta_t *delta;
+} bench_sink_t;
+
+static esp_err_t _bench_event_handler(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    if (req->cmd == COMMAND__WriteFirmwareRequest) {
+        return app_manager_firmware_handle(ctx, req, resp);
+    }
+    return app_manager_response(resp);
+}
+
+static esp_err_t _sink(void *arg, const uint8_t *data, size_t len)
+{
+    bench_sink_t *sink = arg;
+    if (memcmp(sink->image + sink->pos, data, len) != 0) {
+        sink->mismatch = true;
+    }
+    sink->pos += len;
+    return ESP_OK;
+}
+
+static esp_err_t _sink_patch(void *arg, const uint8_t *data, size_t len)
+{
+    bench_sink_t *sink = arg;
+    return app_delta_apply(sink->delta, data, len, _sink, sink);
+}
+
+static uint8_t *_load(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size + 1024);
+    if (fread(data, 1, *size, f) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+/* A small change to old, as the linker would lay it out */
+static uint8_t *_make_new(const uint8_t *old, size_t old_size, size_t *new_size)
+{
+    size_t insert_at = old_size / 3 & ~3, inserted = 300;
+    uint8_t *new = malloc(old_size + inserted);
+    memcpy(new, old, insert_at);
+    for (size_t i = 0; i < inserted; i++) {
+        new[insert_at + i] = (uint8_t)(i * 7 + 1);
+    }
+    memcpy(new + insert_at + inserted, old + insert_at, old_size - insert_at);
+    *new_size = old_size + inserted;
+    for (size_t i = 0; i < 96 && 2 * old_size / 3 + i < *new_size; i++) {
+        new[2 * old_size / 3 + i] ^= 0x5a;
+    }
+    for (size_t i = insert_at + inserted; i + 4 <= *new_size; i += 256) {
+        uint32_t word;
+        memcpy(&word, new + i, 4);
+        word += inserted;
+        memcpy(new + i, &word, 4);
+    }
+    return new;
+}
+
+static void _put_u32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, 4);
+}
+
+int main(int argc, char **argv)
+{
+    const char *old_path = "/proc/self/exe";
+    const char *new_path = NULL;
+    uint32_t chunk_size = 480;
+    double kbps = 40;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:b:c:r:")) != -1) {
+        switch (opt) {
+            case 'a':
+                old_path = optarg;
+                break;
+            case 'b':
+                new_path = optarg;
+                break;
+            case 'c':
+                chunk_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                kbps = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-a old.bin -b new.bin] [-c chunk_size] [-r link_KB_per_s]\n", argv[0]);
+                return 1;
+        }
+    }
+    size_t old_size, new_size;
+    uint8_t *old = _load(old_path, &old_size);
+    if (old && new_path == NULL) {
+        /* Passes for an app image as far as app_ota checks */
+        old[0] = 0xe9;
+    }
+    uint8_t *new = new_path ? _load(new_path, &new_size) : old ? _make_new(old, old_size, &new_size) : NULL;
+    if (old == NULL || new == NULL || chunk_size == 0) {
+        fprintf(stderr, "cannot read the images\n");
+        return 1;
+    }
+
+    char tmp_dir[] = "/tmp/openvent-delta-XXXXXX";
+    if (mkdtemp(tmp_dir) == NULL || host_partition_init(tmp_dir) != ESP_OK) {
+        perror("partitions");
+        return 1;
+    }
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *update = esp_ota_get_next_update_partition(NULL);
+    if (old_size > running->size || new_size > update->size) {
+        fprintf(stderr, "images larger than the partitions\n");
+        return 1;
+    }
+    esp_partition_erase_range(running, 0, running->size);
+    esp_partition_write(running, 0, old, old_size);
+
+    uint64_t start = bench_now_ns();
+    size_t patch_len;
+    uint8_t *patch = ota_diff(old, old_size, new, new_size, &patch_len);
+    double diff_ms = (bench_now_ns() - start) / 1e6;
+    uint8_t *packed = malloc(APP_MANAGER_FW_DELTA_HDR_LEN + LZSS_ENCODE_BOUND(new_size > patch_len ? new_size : patch_len));
+    size_t full_lzss = lzss_encode(new, new_size, BENCH_WINDOW_BITS, BENCH_LOOKAHEAD_BITS, packed, LZSS_ENCODE_BOUND(new_size));
+    size_t patch_lzss = lzss_encode(patch, patch_len, BENCH_WINDOW_BITS, BENCH_LOOKAHEAD_BITS,
+                                    packed + APP_MANAGER_FW_DELTA_HDR_LEN, LZSS_ENCODE_BOUND(patch_len));
+
+    printf("%s (%zu bytes) -> %s (%zu bytes), diff took %.0f ms\n", old_path, old_size,
+           new_path ? new_path : "synthetic edit", new_size, diff_ms);
+    printf("  sent                 bytes   of image   at %.0f KB/s\n", kbps);
+    printf("  full image       %9zu   %6.1f%%   %7.1f s\n", new_size, 100.0, new_size / 1024.0 / kbps);
+    printf("  compressed       %9zu   %6.1f%%   %7.1f s\n", full_lzss + APP_MANAGER_FW_LZSS_HDR_LEN,
+           100.0 * full_lzss / new_size, full_lzss / 1024.0 / kbps);
+    printf("  delta            %9zu   %6.1f%%   %7.1f s\n", patch_len + APP_MANAGER_FW_DELTA_HDR_LEN,
+           100.0 * patch_len / new_size, patch_len / 1024.0 / kbps);
+    printf("  delta compressed %9zu   %6.1f%%   %7.1f s\n", patch_lzss + APP_MANAGER_FW_DELTA_HDR_LEN,
+           100.0 * patch_lzss / new_size, patch_lzss / 1024.0 / kbps);
+
+    /* Rebuild from the running partition, in WriteFirmwareRequest sized pieces */
+    uint32_t old_crc = app_crc32_update(0, old, old_size);
+    app_delta_t *delta = app_delta_new(4096);
+    app_lzss_t *lzss = app_lzss_new(BENCH_WINDOW_BITS);
+    for (int compressed = 0; compressed <= 1; compressed++) {
+        bench_sink_t sink = { .image = new, .delta = delta };
+        const uint8_t *in = compressed ? packed + APP_MANAGER_FW_DELTA_HDR_LEN : patch;
+        size_t in_len = compressed ? patch_lzss : patch_len;
+        start = bench_now_ns();
+        esp_err_t err = app_delta_reset(delta, running, old_size, old_crc);
+        uint64_t reset_ns = bench_now_ns() - start;
+        app_lzss_reset(lzss, BENCH_WINDOW_BITS, BENCH_LOOKAHEAD_BITS);
+        for (size_t pos = 0; err == ESP_OK && pos < in_len; pos += chunk_size) {
+            size_t n = in_len - pos < chunk_size ? in_len - pos : chunk_size;
+            err = compressed ? app_lzss_decode(lzss, in + pos, n, _sink_patch, &sink) :
+                  app_delta_apply(delta, in + pos, n, _sink, &sink);
+        }
+        uint64_t elapsed = bench_now_ns() - start;
+        bool ok = err == ESP_OK && !sink.mismatch && sink.pos == new_size;
+        printf("  apply%s: %s %6.1f ms (source check %.1f ms), %.1f MB/s of image\n",
+               compressed ? ", compressed" : "            ", ok ? "ok  " : "FAIL", elapsed / 1e6,
+               reset_ns / 1e6, new_size / 1e6 / (elapsed / 1e9));
+    }
+    app_lzss_delete(lzss);
+    app_delta_delete(delta);
+
+    app_manager_cfg_t app_man_cfg = {
+        .input_rb_size = 8 * 1024,
+        .output_rb_size = 2 * 1024,
+        .access_key = "0000",
+        .event_handler = _bench_event_handler,
+    };
+    if (app_manager_init(&app_man_cfg) != ESP_OK) {
+        fprintf(stderr, "app_manager_init failed\n");
+        return 1;
+    }
+    bench_link_t link = {
+        .endpoint = ble_prov_custom_data_new(app_manager_get_output_rb(), app_manager_get_input_rb()),
+    };
+    _put_u32(packed, APP_MANAGER_FW_DELTA_MAGIC);
+    _put_u32(packed + 4, new_size);
+    _put_u32(packed + 8, old_size);
+    packed[16] = BENCH_WINDOW_BITS;
+    packed[17] = BENCH_LOOKAHEAD_BITS;
+    packed[18] = packed[19] = 0;
+    uint32_t stream_size = APP_MANAGER_FW_DELTA_HDR_LEN + patch_lzss;
+    uint32_t new_crc = app_crc32_update(0, new, new_size);
+
+    /*
+     * Made for another image: refused on the first chunk. Sent first, once
+     * the image is done the same checksum would make it a resend.
+     */
+    _put_u32(packed + 12, old_crc ^ 1);
+    Status status = bench_link_upload_firmware(&link, packed, stream_size, new_crc, chunk_size);
+    bool ok = status == STATUS__Fail && link.writes == 1 && esp_ota_get_boot_partition() == running;
+    printf("WriteFirmwareRequest, wrong source:   %s\n", ok ? "ok" : "FAIL");
+
+    _put_u32(packed + 12, old_crc);
+    status = bench_link_upload_firmware(&link, packed, stream_size, new_crc, chunk_size);
+    uint8_t *written = malloc(new_size);
+    ok = status == STATUS__Success && esp_ota_get_boot_partition() == update &&
+         esp_partition_read(update, 0, written, new_size) == ESP_OK && memcmp(written, new, new_size) == 0;
+    printf("WriteFirmwareRequest, delta:          %s\n", ok ? "ok" : "FAIL");
+
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%s.bin", tmp_dir, running->label);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s.bin", tmp_dir, update->label);
+    unlink(path);
+    rmdir(tmp_dir);
+    free(written);
+    free(packed);
+    free(patch);
+    free(new);
+    free(old);
+    return 0;
+}
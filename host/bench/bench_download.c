@@ -0,0 +1,248 @@
+/*
+ * ReadFileRequest throughput: reads a file back through the real
+ * custom-data endpoint and app_manager, lock-step (one write + one read
+ * per chunk) and pipelined (tagged requests for the next chunks, window
+ * of -w). Runs once without link delays, which measures the device side
+ * alone, and once over the simulated link. The file lives on the host
+ * filesystem, standing in for the SPIFFS partition.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include "esp_log.h"
+#include "app_manager.h"
+#include "ble_prov_custom_data.h"
+#include "openvent.pb-c.h"
+#include "bench_common.h"
+#include "bench_link.h"
+
+#define BENCH_ACCESS_KEY        "0000"
+
+typedef struct {
+    const char *file_name;
+    uint8_t *out;               /* What came back */
+    uint32_t file_size;
+    int window;
+} bench_download_t;
+
+static esp_err_t _bench_event_handler(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    if (req->cmd == COMMAND__ReadFileRequest) {
+        return app_manager_file_read_handle(ctx, req, resp);
+    }
+    return app_manager_response(resp);
+}
+
+static size_t _pack_read(bench_download_t *down, uint32_t offset, uint8_t *out)
+{
+    FileData file_data = FILE_DATA__INIT;
+    VentRequest req = VENT_REQUEST__INIT;
+    file_data.file_name = (char *)down->file_name;
+    file_data.offset = offset;
+    req.cmd = COMMAND__ReadFileRequest;
+    req.access_key = BENCH_ACCESS_KEY;
+    req.read_file_request = &file_data;
+    return vent_request__pack(&req, out);
+}
+
+/* Copy a chunk out of a response, return its length or -1 */
+static ssize_t _take_chunk(bench_download_t *down, const uint8_t *packed, size_t len)
+{
+    VentResponse *resp = vent_response__unpack(NULL, len, packed);
+    ssize_t chunk = -1;
+    if (resp && resp->status == STATUS__Success && resp->read_file_response &&
+            resp->read_file_response->file_size == down->file_size &&
+            resp->read_file_response->offset + resp->read_file_response->data.len <= down->file_size) {
+        FileData *file_data = resp->read_file_response;
+        memcpy(down->out + file_data->offset, file_data->data.data, file_data->data.len);
+        chunk = file_data->data.len;
+    }
+    vent_response__free_unpacked(resp, NULL);
+    return chunk;
+}
+
+static bool _download_lockstep(bench_link_t *link, bench_download_t *down)
+{
+    uint8_t packed[256];
+    uint32_t offset = 0;
+    while (offset < down->file_size) {
+        uint8_t *reply;
+        ssize_t reply_len;
+        bench_link_write(link, packed, _pack_read(down, offset, packed), &reply, &reply_len);
+        bench_link_read(link, reply_len);
+        ssize_t chunk = _take_chunk(down, reply, reply_len);
+        free(reply);
+        if (chunk <= 0) {
+            return false;
+        }
+        offset += chunk;
+    }
+    return true;
+}
+
+static bool _download_pipelined(bench_link_t *link, bench_download_t *down)
+{
+    uint8_t packed[256];
+    uint32_t received = 0, next = 0, chunk_size = 0;
+    int in_flight = 0;
+    uint16_t seq = 0;
+
+    while (received < down->file_size) {
+        if (next >= down->file_size && in_flight == 0) {
+            /* Everything answered and still short: chunks overlapped or went missing */
+            return false;
+        }
+        size_t len = 1;
+        packed[0] = APP_MANAGER_TAG_MARKER;
+        /* The chunk size is only known after the first response */
+        bool send = next < down->file_size && in_flight < (chunk_size ? down->window : 1);
+        if (send) {
+            packed[1] = seq & 0xff;
+            packed[2] = seq >> 8;
+            seq++;
+            len = APP_MANAGER_TAG_REQ_HDR_LEN + _pack_read(down, next, packed + APP_MANAGER_TAG_REQ_HDR_LEN);
+        }
+        uint8_t *reply;
+        ssize_t reply_len;
+        bench_link_write(link, packed, len, &reply, &reply_len);
+        if (reply_len < APP_MANAGER_TAG_REPLY_HDR_LEN || reply[0] != APP_MANAGER_TAG_MARKER) {
+            free(reply);
+            return false;
+        }
+        if (send && !(reply[1] & APP_MANAGER_TAG_FLAG_BUSY)) {
+            in_flight++;
+            next += chunk_size;
+        }
+        if (reply[2] > 0) {
+            bench_link_read(link, reply_len);
+        }
+        size_t pos = APP_MANAGER_TAG_REPLY_HDR_LEN;
+        for (int i = 0; i < reply[2]; i++) {
+            size_t entry_len = reply[pos + 2] | (reply[pos + 3] << 8);
+            pos += APP_MANAGER_TAG_ENTRY_HDR_LEN;
+            ssize_t chunk = _take_chunk(down, reply + pos, entry_len);
+            pos += entry_len;
+            if (chunk <= 0) {
+                free(reply);
+                return false;
+            }
+            if (chunk_size == 0) {
+                chunk_size = chunk;
+                next = chunk;
+            }
+            received += chunk;
+            in_flight--;
+        }
+        free(reply);
+    }
+    return true;
+}
+
+typedef bool (*bench_download_fn)(bench_link_t *link, bench_download_t *down);
+
+static void _run(const char *name, bench_download_fn fn, bench_link_t *link, bench_download_t *down,
+                 const uint8_t *data)
+{
+    link->writes = link->reads = 0;
+    memset(down->out, 0, down->file_size);
+    uint64_t start = bench_now_ns();
+    bool ok = fn(link, down);
+    double secs = (bench_now_ns() - start) / 1e9;
+    ok = ok && memcmp(down->out, data, down->file_size) == 0;
+    printf("%-10s %s %8.3f s %9.1f KB/s  writes=%u reads=%u\n", name, ok ? "ok  " : "FAIL", secs,
+           down->file_size / 1024.0 / secs, link->writes, link->reads);
+}
+
+int main(int argc, char **argv)
+{
+    double rtt_ms = 15;
+    double kbps = 40;
+    uint32_t file_size = 64 * 1024;
+    int window = 4;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:b:s:w:")) != -1) {
+        switch (opt) {
+            case 'r':
+                rtt_ms = atof(optarg);
+                break;
+            case 'b':
+                kbps = atof(optarg);
+                break;
+            case 's':
+                file_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                window = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-r rtt_ms] [-b link_KB_per_s] [-s file_size] [-w window]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    app_manager_cfg_t app_man_cfg = {
+        .input_rb_size = 8 * 1024,
+        .output_rb_size = 2 * 1024,
+        .access_key = BENCH_ACCESS_KEY,
+        .event_handler = _bench_event_handler,
+    };
+    if (app_manager_init(&app_man_cfg) != ESP_OK) {
+        fprintf(stderr, "app_manager_init failed\n");
+        return 1;
+    }
+    bench_link_t link = {
+        .endpoint = ble_prov_custom_data_new(app_manager_get_output_rb(), app_manager_get_input_rb()),
+    };
+
+    char tmp_dir[] = "/tmp/openvent-download-XXXXXX";
+    if (mkdtemp(tmp_dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char file_name[64];
+    snprintf(file_name, sizeof(file_name), "%s/log.bin", tmp_dir);
+    uint8_t *data = malloc(file_size);
+    for (uint32_t i = 0; i < file_size; i++) {
+        data[i] = (uint8_t)(i * 17 + (i >> 10));
+    }
+    FILE *f = fopen(file_name, "wb");
+    if (f == NULL || fwrite(data, 1, file_size, f) != file_size) {
+        perror(file_name);
+        return 1;
+    }
+    fclose(f);
+    bench_download_t down = {
+        .file_name = file_name,
+        .out = malloc(file_size),
+        .file_size = file_size,
+        .window = window,
+    };
+
+    printf("download %u bytes, frame limit %zu, window %d\n", file_size, app_manager_get_frame_limit(), window);
+    printf("no link delay\n");
+    _run("lock-step", _download_lockstep, &link, &down, data);
+    _run("pipelined", _download_pipelined, &link, &down, data);
+    link.rtt_us = rtt_ms * 1000;
+    link.bytes_per_us = kbps * 1024 / 1e6;
+    printf("rtt %.1f ms, link %.1f KB/s\n", rtt_ms, kbps);
+    _run("lock-step", _download_lockstep, &link, &down, data);
+    _run("pipelined", _download_pipelined, &link, &down, data);
+
+    app_file_reader_stats_t stats;
+    if (app_manager_get_file_read_stats(&stats) == ESP_OK) {
+        printf("file reader: %u chunks, %u read ahead, %llu bytes in %.1f ms, waited %.1f ms\n",
+               stats.chunks, stats.hits, (unsigned long long)stats.bytes_read,
+               stats.read_time_us / 1000.0, stats.wait_time_us / 1000.0);
+    }
+
+    unlink(file_name);
+    rmdir(tmp_dir);
+    free(down.out);
+    free(data);
+    return 0;
+}
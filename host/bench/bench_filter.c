@@ -0,0 +1,465 @@
+/*
+ * Acquisition pipeline stages on recorded pressure and flow waveforms.
+ *
+ * Checks each filter stage of app_filter.h against its definition (median
+ * against sorting, decimation against the mean, the biquad's gain at DC,
+ * at the cutoff and above it), then feeds a waveform through
+ * app_acquire_process() the way the ADC DMA does: both channels as tagged
+ * 12 bit words, one DMA buffer at a time. The waveform is a CSV of
+ * "pressure,flow" lines in cmH2O and L/min at the raw rate (-i), or else
+ * CMV on the simulated lung sampled at the raw rate; sensor noise and
+ * spikes are added (-n, -s). Prints the error of the pipeline output
+ * against the clean signal, with and without the median stage, and the
+ * cost per raw sample of every stage and of the whole pipeline.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "app_acquire.h"
+#include "app_filter.h"
+#include "bench_common.h"
+#include "bench_lung.h"
+
+#define BENCH_RAW_RATE_HZ       8000
+#define BENCH_DECIMATION        8
+#define BENCH_CUTOFF_HZ         50
+#define BENCH_DMA_WORDS         32      /* Two outputs of both channels, as app_adc */
+#define BENCH_PRESSURE_CHANNEL  6
+#define BENCH_FLOW_CHANNEL      7
+#define BENCH_MAX_LAG           40
+
+static const app_acquire_channel_t s_pressure = { BENCH_PRESSURE_CHANNEL, 410.0f, 0.0273f };
+static const app_acquire_channel_t s_flow = { BENCH_FLOW_CHANNEL, 2048.0f, 0.0977f };
+
+typedef struct {
+    size_t n;                   /*!< Raw samples per channel */
+    double *pressure;           /*!< Clean, cmH2O */
+    double *flow;               /*!< Clean, L/min */
+    int32_t *pressure_raw;      /*!< Counts as the ADC gives them, noise and spikes included */
+    int32_t *flow_raw;
+} bench_wave_t;
+
+static void _check(const char *name, bool ok, const char *detail)
+{
+    printf("%-34s %s %s\n", name, ok ? "ok  " : "FAIL", detail);
+}
+
+static int _cmp_i32(const void *a, const void *b)
+{
+    int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void _check_stages(void)
+{
+    char detail[96];
+    enum { N = 20000 };
+    static int32_t in[N], buf[N];
+    static float out[N];
+
+    /* Median of five: against sorting every window */
+    srand(2);
+    for (int i = 0; i < N; i++) {
+        in[i] = rand() % 4096;
+    }
+    memcpy(buf, in, sizeof(in));
+    app_median5_t m;
+    app_median5_init(&m, in[0]);
+    app_median5(&m, buf, 7);
+    app_median5(&m, buf + 7, N - 7);
+    int wrong = 0;
+    for (int i = 4; i < N; i++) {
+        int32_t w[5];
+        memcpy(w, &in[i - 4], sizeof(w));
+        qsort(w, 5, sizeof(int32_t), _cmp_i32);
+        wrong += buf[i] != w[2];
+    }
+    snprintf(detail, sizeof(detail), "%d of %d windows wrong, split across calls", wrong, N - 4);
+    _check("median5 = middle of sorted window", wrong == 0, detail);
+
+    /* One sample at a time, as the pipeline runs it, the same */
+    app_median5_init(&m, in[0]);
+    wrong = 0;
+    for (int i = 0; i < N; i++) {
+        wrong += app_median5_step(&m, in[i]) != buf[i];
+    }
+    snprintf(detail, sizeof(detail), "%d of %d samples differ from the block filter", wrong, N);
+    _check("median5 step = median5 block", wrong == 0, detail);
+
+    /* Spikes of one and two samples vanish from a ramp */
+    for (int i = 0; i < N; i++) {
+        in[i] = 1000 + i / 16;
+        buf[i] = in[i] + (i % 97 == 50 ? 3000 : 0) + (i % 89 == 40 || i % 89 == 41 ? -900 : 0);
+    }
+    app_median5_init(&m, buf[0]);
+    app_median5(&m, buf, N);
+    int off = 0;
+    for (int i = 4; i < N; i++) {
+        off += abs(buf[i] - in[i - 2]) > 1;
+    }
+    snprintf(detail, sizeof(detail), "%d samples off the ramp after despiking", off);
+    _check("median5 removes 1-2 sample spikes", off == 0, detail);
+
+    /* Decimation is the mean */
+    for (int i = 0; i < N; i++) {
+        in[i] = rand() % 4096;
+    }
+    size_t outputs = app_decimate(in, N, BENCH_DECIMATION, out);
+    double err = 0;
+    for (size_t k = 0; k < outputs; k++) {
+        double sum = 0;
+        for (int j = 0; j < BENCH_DECIMATION; j++) {
+            sum += in[k * BENCH_DECIMATION + j];
+        }
+        err = fmax(err, fabs(out[k] - sum / BENCH_DECIMATION));
+    }
+    snprintf(detail, sizeof(detail), "%zu outputs, max error %.1e", outputs, err);
+    _check("decimate = boxcar mean", outputs == N / BENCH_DECIMATION && err < 1e-3, detail);
+
+    /* Biquad low-pass: steady at DC from the first sample, then its gain against the design's */
+    const float rate = BENCH_RAW_RATE_HZ / BENCH_DECIMATION;
+    app_biquad_coef_t coef;
+    app_biquad_t bq;
+    app_biquad_lowpass(&coef, rate, BENCH_CUTOFF_HZ, 0.7071f);
+    for (int i = 0; i < N; i++) {
+        out[i] = 1234.5f;
+    }
+    app_biquad_init(&bq, &coef, 1234.5f);
+    app_biquad(&bq, &coef, out, N);
+    err = 0;
+    for (int i = 0; i < N; i++) {
+        err = fmax(err, fabs(out[i] - 1234.5));
+    }
+    snprintf(detail, sizeof(detail), "max deviation %.1e", err);
+    _check("biquad starts steady at DC", err < 1e-2, detail);
+
+    double gains[3], design[3];
+    const float freqs[3] = { BENCH_CUTOFF_HZ / 4.0f, BENCH_CUTOFF_HZ, BENCH_CUTOFF_HZ * 4.0f };
+    for (int f = 0; f < 3; f++) {
+        for (int i = 0; i < N; i++) {
+            out[i] = sinf(2 * 3.14159265f * freqs[f] * i / rate);
+        }
+        app_biquad_init(&bq, &coef, 0);
+        app_biquad(&bq, &coef, out, N);
+        double peak = 0;
+        for (int i = N / 2; i < N; i++) {
+            peak = fmax(peak, fabs(out[i]));
+        }
+        gains[f] = 20 * log10(peak);
+        /* |H(e^jw)| of the coefficients: flat, -3 dB at the cutoff, bilinear warped beyond */
+        double w = 2 * M_PI * freqs[f] / rate;
+        double nr = coef.b0 + coef.b1 * cos(w) + coef.b2 * cos(2 * w), ni = -coef.b1 * sin(w) - coef.b2 * sin(2 * w);
+        double dr = 1 + coef.a1 * cos(w) + coef.a2 * cos(2 * w), di = -coef.a1 * sin(w) - coef.a2 * sin(2 * w);
+        design[f] = 10 * log10((nr * nr + ni * ni) / (dr * dr + di * di));
+    }
+    snprintf(detail, sizeof(detail), "%.1f dB at %.1f Hz, %.1f dB at %d Hz, %.1f dB at %d Hz", gains[0], freqs[0],
+             gains[1], BENCH_CUTOFF_HZ, gains[2], BENCH_CUTOFF_HZ * 4);
+    _check("biquad Butterworth response", fabs(gains[0] - design[0]) < 0.1 && fabs(gains[1] + 3.01) < 0.1 &&
+           fabs(gains[2] - design[2]) < 0.2 && design[2] < -24, detail);
+}
+
+static int32_t _counts(const app_acquire_channel_t *ch, double value)
+{
+    double c = value / ch->scale + ch->offset;
+    return c < 0 ? 0 : c > 4095 ? 4095 : (int32_t)lround(c);
+}
+
+/* Noise of up to +-noise counts, and one spike in `spike_every` samples to the rail */
+static void _corrupt(bench_wave_t *w, int noise, int spike_every)
+{
+    srand(3);
+    for (size_t i = 0; i < w->n; i++) {
+        int32_t *raw[2] = { &w->pressure_raw[i], &w->flow_raw[i] };
+        for (int c = 0; c < 2; c++) {
+            int32_t v = *raw[c] + (noise ? rand() % (2 * noise + 1) - noise : 0);
+            if (spike_every && rand() % spike_every == 0) {
+                v = rand() % 2 ? 4095 : 0;
+            }
+            *raw[c] = v < 0 ? 0 : v > 4095 ? 4095 : v;
+        }
+    }
+}
+
+/* Also of a wave zeroed or partly allocated */
+static void _wave_free(bench_wave_t *w)
+{
+    free(w->pressure);
+    free(w->flow);
+    free(w->pressure_raw);
+    free(w->flow_raw);
+    *w = (bench_wave_t) { 0 };
+}
+
+static int _wave_alloc(bench_wave_t *w, size_t n)
+{
+    w->n = n;
+    w->pressure = malloc(n * sizeof(double));
+    w->flow = malloc(n * sizeof(double));
+    w->pressure_raw = malloc(n * sizeof(int32_t));
+    w->flow_raw = malloc(n * sizeof(int32_t));
+    if (w->pressure == NULL || w->flow == NULL || w->pressure_raw == NULL || w->flow_raw == NULL) {
+        _wave_free(w);
+        return -1;
+    }
+    return 0;
+}
+
+/* CMV on the simulated lung, the control loop at the output rate and the lung at the raw rate */
+static int _wave_lung(bench_wave_t *w, double secs)
+{
+    if (_wave_alloc(w, secs * BENCH_RAW_RATE_HZ) != 0) {
+        return -1;
+    }
+    app_control_settings_t set = APP_CONTROL_SETTINGS_DEFAULT;
+    app_control_state_t st;
+    bench_lung_t lung = BENCH_LUNG_ADULT;
+    app_control_input_t in;
+    app_control_output_t out = { 0 };
+    app_control_init(&st, WORKING_MODE__CMV, &set, 1000000 / (BENCH_RAW_RATE_HZ / BENCH_DECIMATION));
+    for (size_t i = 0; i < w->n; i++) {
+        if (i % BENCH_DECIMATION == 0) {
+            bench_lung_read(&lung, &in);
+            app_control_step(&st, &in, &out);
+        }
+        bench_lung_step(&lung, &out, 1000.0 / BENCH_RAW_RATE_HZ);
+        bench_lung_read(&lung, &in);
+        w->pressure[i] = in.pressure;
+        w->flow[i] = in.flow;
+    }
+    return 0;
+}
+
+static int _wave_csv(bench_wave_t *w, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    size_t cap = 1 << 16, n = 0;
+    double *p = malloc(cap * sizeof(double)), *q = malloc(cap * sizeof(double));
+    char line[128];
+    while (p && q && fgets(line, sizeof(line), f)) {
+        if (n == cap) {
+            cap *= 2;
+            p = realloc(p, cap * sizeof(double));
+            q = realloc(q, cap * sizeof(double));
+        }
+        if (p && q && sscanf(line, "%lf,%lf", &p[n], &q[n]) == 2) {
+            n++;
+        }
+    }
+    fclose(f);
+    if (p == NULL || q == NULL || n < BENCH_RAW_RATE_HZ || _wave_alloc(w, n) != 0) {
+        fprintf(stderr, "%s: less than a second of pressure,flow lines\n", path);
+        free(p);
+        free(q);
+        return -1;
+    }
+    memcpy(w->pressure, p, n * sizeof(double));
+    memcpy(w->flow, q, n * sizeof(double));
+    free(p);
+    free(q);
+    return 0;
+}
+
+typedef struct {
+    float *pressure;
+    float *flow;
+    size_t n;
+} bench_out_t;
+
+static void _collect(const app_acquire_block_t *block, void *arg)
+{
+    bench_out_t *out = arg;
+    memcpy(out->pressure + out->n, block->pressure, sizeof(block->pressure));
+    memcpy(out->flow + out->n, block->flow, sizeof(block->flow));
+    out->n += APP_ACQUIRE_BLOCK_SAMPLES;
+}
+
+/* Interleave both channels as tagged words, two pairs swapped in each 32 bit word like the I2S DMA */
+static uint16_t *_dma_words(const bench_wave_t *w)
+{
+    uint16_t *words = malloc(2 * w->n * sizeof(uint16_t));
+    for (size_t i = 0; words && i < w->n; i++) {
+        uint16_t p = BENCH_PRESSURE_CHANNEL << 12 | w->pressure_raw[i];
+        uint16_t q = BENCH_FLOW_CHANNEL << 12 | w->flow_raw[i];
+        words[2 * i] = i % 2 ? p : q;
+        words[2 * i + 1] = i % 2 ? q : p;
+    }
+    return words;
+}
+
+static double _rms_error(const float *out, size_t n, const double *clean, size_t clean_n, int lag, double *max)
+{
+    double sum = 0;
+    size_t count = 0;
+    *max = 0;
+    /* Output k is the mean of raw samples k*D .. k*D+D-1, delayed by `lag` outputs */
+    for (size_t k = lag + 16; k < n && (k - lag) * BENCH_DECIMATION + BENCH_DECIMATION <= clean_n; k++) {
+        double ref = 0;
+        for (int j = 0; j < BENCH_DECIMATION; j++) {
+            ref += clean[(k - lag) * BENCH_DECIMATION + j];
+        }
+        double e = out[k] - ref / BENCH_DECIMATION;
+        sum += e * e;
+        *max = fmax(*max, fabs(e));
+        count++;
+    }
+    return count ? sqrt(sum / count) : 0;
+}
+
+/* Best aligned error of one channel */
+static void _report_error(const char *name, const float *out, size_t n, const double *clean, size_t clean_n,
+                          const char *unit)
+{
+    int best_lag = 0;
+    double best = INFINITY, best_max = 0;
+    for (int lag = 0; lag <= BENCH_MAX_LAG; lag++) {
+        double max;
+        double rms = _rms_error(out, n, clean, clean_n, lag, &max);
+        if (rms < best) {
+            best = rms;
+            best_max = max;
+            best_lag = lag;
+        }
+    }
+    printf("  %-26s rms %.3f, max %.3f %s, delay %d ms\n", name, best, best_max, unit,
+           best_lag * 1000 * BENCH_DECIMATION / BENCH_RAW_RATE_HZ);
+}
+
+/* Decimation and biquad only, composed from the stages, to show what the median takes out */
+static void _without_median(const int32_t *raw, size_t n, const app_acquire_channel_t *ch, float *out)
+{
+    app_biquad_coef_t coef;
+    app_biquad_t bq;
+    app_biquad_lowpass(&coef, BENCH_RAW_RATE_HZ / BENCH_DECIMATION, BENCH_CUTOFF_HZ, 0.7071f);
+    size_t outputs = app_decimate(raw, n - n % BENCH_DECIMATION, BENCH_DECIMATION, out);
+    app_biquad_init(&bq, &coef, out[0]);
+    app_biquad(&bq, &coef, out, outputs);
+    for (size_t i = 0; i < outputs; i++) {
+        out[i] = (out[i] - ch->offset) * ch->scale;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL;
+    double secs = 60;
+    int noise = 6;
+    int spike_every = 500;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:t:n:s:")) != -1) {
+        switch (opt) {
+            case 'i':
+                path = optarg;
+                break;
+            case 't':
+                secs = atof(optarg) < 1 ? 1 : atof(optarg);
+                break;
+            case 'n':
+                noise = atoi(optarg);
+                break;
+            case 's':
+                spike_every = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-i pressure_flow.csv] [-t seconds] [-n noise_counts] "
+                        "[-s samples_per_spike]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    _check_stages();
+
+    bench_wave_t wave = { 0 };
+    if (path ? _wave_csv(&wave, path) != 0 : _wave_lung(&wave, secs) != 0) {
+        _wave_free(&wave);
+        return 1;
+    }
+    for (size_t i = 0; i < wave.n; i++) {
+        wave.pressure_raw[i] = _counts(&s_pressure, wave.pressure[i]);
+        wave.flow_raw[i] = _counts(&s_flow, wave.flow[i]);
+    }
+    _corrupt(&wave, noise, spike_every);
+    uint16_t *words = _dma_words(&wave);
+    size_t n_words = 2 * wave.n;
+    size_t max_out = wave.n / BENCH_DECIMATION + APP_ACQUIRE_BLOCK_SAMPLES;
+    bench_out_t out = { malloc(max_out * sizeof(float)), malloc(max_out * sizeof(float)), 0 };
+
+    app_acquire_cfg_t cfg = {
+        .raw_rate_hz = BENCH_RAW_RATE_HZ,
+        .rate_hz = BENCH_RAW_RATE_HZ / BENCH_DECIMATION,
+        .cutoff_hz = BENCH_CUTOFF_HZ,
+        .max_raw = BENCH_DMA_WORDS,
+        .pressure = s_pressure,
+        .flow = s_flow,
+        .on_block = _collect,
+        .arg = &out,
+    };
+    app_acquire_cfg_t uneven = cfg;
+    uneven.rate_hz = 3000;
+    app_acquire_t *acq = app_acquire_new(&uneven);
+    _check("raw rate not a multiple refused", acq == NULL, "3000 Hz out of 8000 Hz");
+    acq = app_acquire_new(&cfg);
+    uint64_t start = bench_now_ns();
+    for (size_t pos = 0; pos < n_words; pos += BENCH_DMA_WORDS) {
+        size_t len = n_words - pos < BENCH_DMA_WORDS ? n_words - pos : BENCH_DMA_WORDS;
+        app_acquire_process(acq, words + pos, len);
+    }
+    uint64_t pipeline_ns = bench_now_ns() - start;
+    app_acquire_stats_t stats;
+    app_acquire_get_stats(acq, &stats);
+    app_acquire_delete(acq);
+
+    printf("%s: %.1f s at %d Hz per channel, noise +-%d counts, 1 spike in %d samples\n",
+           path ? path : "CMV on the simulated lung", (double)wave.n / BENCH_RAW_RATE_HZ, BENCH_RAW_RATE_HZ, noise,
+           spike_every);
+    printf("  %u words, %u outputs in %u blocks, %u dropped, %u unknown\n", stats.raw, stats.outputs, stats.blocks,
+           stats.dropped, stats.unknown);
+    _report_error("pressure", out.pressure, out.n, wave.pressure, wave.n, "cmH2O");
+    _report_error("flow", out.flow, out.n, wave.flow, wave.n, "L/min");
+    float *plain = malloc(max_out * sizeof(float));
+    _without_median(wave.pressure_raw, wave.n, &s_pressure, plain);
+    _report_error("pressure without median", plain, wave.n / BENCH_DECIMATION, wave.pressure, wave.n, "cmH2O");
+    _without_median(wave.flow_raw, wave.n, &s_flow, plain);
+    _report_error("flow without median", plain, wave.n / BENCH_DECIMATION, wave.flow, wave.n, "L/min");
+
+    /* Cost per raw sample of one channel, the pipeline per word of both */
+    int32_t *scratch = malloc(wave.n * sizeof(int32_t));
+    app_median5_t m;
+    app_biquad_coef_t coef;
+    app_biquad_t bq;
+    app_biquad_lowpass(&coef, BENCH_RAW_RATE_HZ / BENCH_DECIMATION, BENCH_CUTOFF_HZ, 0.7071f);
+    memcpy(scratch, wave.pressure_raw, wave.n * sizeof(int32_t));
+    app_median5_init(&m, scratch[0]);
+    start = bench_now_ns();
+    app_median5(&m, scratch, wave.n);
+    uint64_t median_ns = bench_now_ns() - start;
+    start = bench_now_ns();
+    size_t outputs = app_decimate(scratch, wave.n - wave.n % BENCH_DECIMATION, BENCH_DECIMATION, plain);
+    uint64_t decimate_ns = bench_now_ns() - start;
+    app_biquad_init(&bq, &coef, plain[0]);
+    start = bench_now_ns();
+    app_biquad(&bq, &coef, plain, outputs);
+    uint64_t biquad_ns = bench_now_ns() - start;
+
+    double pipeline_per_word = (double)pipeline_ns / n_words;
+    printf("per raw sample: median5 %.2f ns, decimate %.2f ns, biquad %.2f ns (%.2f ns per output), "
+           "pipeline %.2f ns per word\n", (double)median_ns / wave.n, (double)decimate_ns / wave.n,
+           (double)biquad_ns / wave.n, (double)biquad_ns / outputs, pipeline_per_word);
+    printf("at %d Hz x 2 channels: %.3f%% of one host core\n", BENCH_RAW_RATE_HZ,
+           pipeline_per_word * 2 * BENCH_RAW_RATE_HZ / 1e7);
+
+    free(scratch);
+    free(plain);
+    free(out.pressure);
+    free(out.flow);
+    free(words);
+    _wave_free(&wave);
+    return 0;
+}
@@ -0,0 +1,211 @@
+/*
+ * ReadFirmwareRequest: reading the running image back, and asking for its
+ * SHA-256 instead.
+ *
+ * A synthetic app image (header, segments, checksum, appended SHA-256) is
+ * put into the file-backed running partition. It is then read back
+ * lock-step through the real custom-data endpoint, once without link
+ * delays (the device side alone) and once over the simulated link, and
+ * compared with the image. Last, the hash-only request is timed and its
+ * digest checked against the image's.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "mbedtls/sha256.h"
+#include "app_manager.h"
+#include "ble_prov_custom_data.h"
+#include "openvent.pb-c.h"
+#include "bench_common.h"
+#include "bench_link.h"
+
+#define BENCH_ACCESS_KEY        "0000"
+#define BENCH_SEGMENTS          5
+
+static esp_err_t _bench_event_handler(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    if (req->cmd == COMMAND__ReadFirmwareRequest) {
+        return app_manager_firmware_read_handle(ctx, req, resp);
+    }
+    return app_manager_response(resp);
+}
+
+/* Laid out like esptool's output, the partition holds erased flash past it */
+static uint8_t *_make_image(uint32_t payload, uint32_t *size)
+{
+    uint32_t len = 24 + BENCH_SEGMENTS * 8 + payload + 16 + 32;
+    uint8_t *image = calloc(1, len);
+    image[0] = 0xe9;
+    image[1] = BENCH_SEGMENTS;
+    image[23] = 1;
+    uint32_t pos = 24;
+    for (int s = 0; s < BENCH_SEGMENTS; s++) {
+        uint32_t seg = s < BENCH_SEGMENTS - 1 ? payload / BENCH_SEGMENTS & ~3 : payload - pos + 24 + s * 8;
+        uint32_t load = 0x3f400020 + s * 0x100000;
+        memcpy(image + pos, &load, 4);
+        memcpy(image + pos + 4, &seg, 4);
+        pos += 8;
+        for (uint32_t i = 0; i < seg; i++) {
+            image[pos + i] = (uint8_t)(i * 13 + s);
+        }
+        pos += seg;
+    }
+    pos = (pos + 1 + 15) & ~15;
+    image[pos - 1] = 0xef;      /* checksum byte, unchecked here */
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    mbedtls_sha256_update_ret(&sha, image, pos);
+    mbedtls_sha256_finish_ret(&sha, image + pos);
+    mbedtls_sha256_free(&sha);
+    *size = pos + 32;
+    return image;
+}
+
+static VentResponse *_request(bench_link_t *link, uint32_t offset, const char *data)
+{
+    uint8_t packed[256];
+    FileData fw = FILE_DATA__INIT;
+    VentRequest req = VENT_REQUEST__INIT;
+    fw.offset = offset;
+    if (data) {
+        fw.data.data = (uint8_t *)data;
+        fw.data.len = strlen(data);
+    }
+    req.cmd = COMMAND__ReadFirmwareRequest;
+    req.access_key = BENCH_ACCESS_KEY;
+    req.read_firmware_request = &fw;
+    uint8_t *reply;
+    ssize_t reply_len;
+    bench_link_write(link, packed, vent_request__pack(&req, packed), &reply, &reply_len);
+    bench_link_read(link, reply_len);
+    VentResponse *resp = vent_response__unpack(NULL, reply_len, reply);
+    free(reply);
+    if (resp && (resp->status != STATUS__Success || resp->read_firmware_response == NULL)) {
+        vent_response__free_unpacked(resp, NULL);
+        resp = NULL;
+    }
+    return resp;
+}
+
+static double _run_readback(const char *name, bench_link_t *link, const uint8_t *image, uint32_t size)
+{
+    uint8_t *out = malloc(size);
+    uint32_t offset = 0;
+    bool ok = true;
+    link->writes = link->reads = 0;
+    uint64_t start = bench_now_ns();
+    while (ok && offset < size) {
+        VentResponse *resp = _request(link, offset, NULL);
+        FileData *chunk = resp ? resp->read_firmware_response : NULL;
+        ok = chunk && chunk->file_size == size && chunk->offset == offset && chunk->data.len > 0 &&
+             offset + chunk->data.len <= size;
+        if (ok) {
+            memcpy(out + offset, chunk->data.data, chunk->data.len);
+            offset += chunk->data.len;
+        }
+        vent_response__free_unpacked(resp, NULL);
+    }
+    double secs = (bench_now_ns() - start) / 1e9;
+    ok = ok && memcmp(out, image, size) == 0;
+    printf("%-10s %s %7.2f s %9.1f KB/s  %6.1f us/chunk  chunks=%u\n", name, ok ? "ok  " : "FAIL", secs,
+           size / 1024.0 / secs, secs * 1e6 / link->writes, link->writes);
+    free(out);
+    return secs;
+}
+
+int main(int argc, char **argv)
+{
+    double rtt_ms = 15;
+    double kbps = 40;
+    uint32_t payload = 256 * 1024;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:b:s:")) != -1) {
+        switch (opt) {
+            case 'r':
+                rtt_ms = atof(optarg);
+                break;
+            case 'b':
+                kbps = atof(optarg);
+                break;
+            case 's':
+                payload = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-r rtt_ms] [-b link_KB_per_s] [-s image_size]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    char tmp_dir[] = "/tmp/openvent-fwread-XXXXXX";
+    if (mkdtemp(tmp_dir) == NULL || host_partition_init(tmp_dir) != ESP_OK) {
+        perror("partitions");
+        return 1;
+    }
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    uint32_t size;
+    uint8_t *image = _make_image(payload, &size);
+    if (size > running->size) {
+        fprintf(stderr, "image larger than %s\n", running->label);
+        return 1;
+    }
+    esp_partition_erase_range(running, 0, running->size);
+    esp_partition_write(running, 0, image, size);
+
+    app_manager_cfg_t app_man_cfg = {
+        .input_rb_size = 8 * 1024,
+        .output_rb_size = 2 * 1024,
+        .access_key = BENCH_ACCESS_KEY,
+        .event_handler = _bench_event_handler,
+    };
+    if (app_manager_init(&app_man_cfg) != ESP_OK) {
+        fprintf(stderr, "app_manager_init failed\n");
+        return 1;
+    }
+    bench_link_t link = {
+        .endpoint = ble_prov_custom_data_new(app_manager_get_output_rb(), app_manager_get_input_rb()),
+    };
+
+    printf("read back %u byte image from %s (partition %u bytes), rtt %.1f ms, link %.1f KB/s\n",
+           size, running->label, running->size, rtt_ms, kbps);
+    _run_readback("device", &link, image, size);
+    link.rtt_us = rtt_ms * 1000;
+    link.bytes_per_us = kbps * 1024 / 1e6;
+    double readback = _run_readback("link", &link, image, size);
+
+    {
+        uint64_t start = bench_now_ns();
+        VentResponse *resp = _request(&link, 0, APP_MANAGER_FW_READ_SHA256);
+        double ms = (bench_now_ns() - start) / 1e6;
+        FileData *digest = resp ? resp->read_firmware_response : NULL;
+        uint8_t sha[32];
+        mbedtls_sha256_context ctx;
+        mbedtls_sha256_init(&ctx);
+        mbedtls_sha256_starts_ret(&ctx, 0);
+        mbedtls_sha256_update_ret(&ctx, image, size);
+        mbedtls_sha256_finish_ret(&ctx, sha);
+        mbedtls_sha256_free(&ctx);
+        bool ok = digest && digest->file_size == size && digest->data.len == 32 &&
+                  memcmp(digest->data.data, sha, 32) == 0;
+        printf("%-10s %s %7.1f ms  over the link, %.0fx less than reading it back\n", "sha256", ok ? "ok  " : "FAIL",
+               ms, readback * 1000 / ms);
+        vent_response__free_unpacked(resp, NULL);
+    }
+
+    char path[64];
+    for (int i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "%s/ota_%d.bin", tmp_dir, i);
+        unlink(path);
+    }
+    rmdir(tmp_dir);
+    free(image);
+    return 0;
+}
@@ -0,0 +1,300 @@
+/*
+ * Multi-tier pressure and flow history.
+ *
+ * Records CMV on the simulated lung at 1 kHz for an hour (-t) into a
+ * history of raw samples, 10x and 100x buckets, sized to hold 10 s, 5 min
+ * and the hour, timing every insert. Then asks for the newest second up to
+ * the whole hour at a fixed number of points and for random ranges, checks
+ * every point against min, max and mean worked out from the recorded
+ * samples, and prints which tier answered and how long a query took. Last
+ * a writer task fills a small history flat out while this thread queries
+ * the oldest data held, where the writer overwrites it, and checks that
+ * no point was torn. And a history at 1 Hz is queried across the point
+ * where its ms timestamps wrap.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "app_history.h"
+#include "bench_common.h"
+#include "bench_lung.h"
+
+#define BENCH_RATE_HZ       1000
+#define BENCH_POINTS        500
+
+/* Values as the history stores them, 1/100 of the unit */
+typedef int32_t (*bench_value_fn)(uint32_t sample, int channel, void *ctx);
+
+typedef struct {
+    float *pressure;
+    float *flow;
+} bench_wave_t;
+
+static int32_t _centi(float v)
+{
+    return (int32_t)lroundf(v * 100);
+}
+
+static int32_t _wave_value(uint32_t sample, int channel, void *ctx)
+{
+    bench_wave_t *w = ctx;
+    return _centi(channel ? w->flow[sample] : w->pressure[sample]);
+}
+
+/* Writer stress: every value follows from the sample number, a torn point shows */
+static int32_t _synthetic_value(uint32_t sample, int channel, void *ctx)
+{
+    (void)ctx;
+    int32_t v = (int32_t)(sample % 20011) - 10000;
+    return channel ? -v : v;
+}
+
+static bool _check_stat(const app_history_stat_t *stat, uint32_t s0, uint32_t s1, int channel, bench_value_fn value,
+                        void *ctx)
+{
+    int32_t min = INT32_MAX, max = INT32_MIN;
+    int64_t sum = 0;
+    for (uint32_t s = s0; s < s1; s++) {
+        int32_t v = value(s, channel, ctx);
+        min = v < min ? v : min;
+        max = v > max ? v : max;
+        sum += v;
+    }
+    /* Means are of rounded bucket means, a unit off at most */
+    return _centi(stat->min) == min && _centi(stat->max) == max &&
+           fabs(stat->mean * 100 - (double)sum / (s1 - s0)) <= 1;
+}
+
+/* Points in order, no more than asked for, each what the samples it covers say */
+static bool _check_points(const app_history_point_t *pts, size_t n, size_t max, bench_value_fn value, void *ctx)
+{
+    if (n > max) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint32_t s0 = pts[i].timestamp, s1 = pts[i].timestamp + pts[i].span_ms;
+        if (pts[i].span_ms == 0 || (i && pts[i].timestamp < pts[i - 1].timestamp + pts[i - 1].span_ms) ||
+                !_check_stat(&pts[i].pressure, s0, s1, 0, value, ctx) ||
+                !_check_stat(&pts[i].flow, s0, s1, 1, value, ctx)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static app_history_cfg_t _cfg_hour(void)
+{
+    return (app_history_cfg_t) {
+        .rate_hz = BENCH_RATE_HZ,
+        .tiers = 3,
+        .tier = {
+            { .factor = 1, .capacity = 10 * BENCH_RATE_HZ },
+            { .factor = 10, .capacity = 300 * BENCH_RATE_HZ / 10 },
+            { .factor = 100, .capacity = 3600 * BENCH_RATE_HZ / 100 },
+        },
+    };
+}
+
+static void _record(bench_wave_t *w, uint32_t n)
+{
+    app_control_settings_t set = APP_CONTROL_SETTINGS_DEFAULT;
+    app_control_state_t st;
+    bench_lung_t lung = BENCH_LUNG_ADULT;
+    app_control_input_t in;
+    app_control_output_t out;
+    app_control_init(&st, WORKING_MODE__CMV, &set, 1000000 / BENCH_RATE_HZ);
+    for (uint32_t i = 0; i < n; i++) {
+        bench_lung_read(&lung, &in);
+        app_control_step(&st, &in, &out);
+        bench_lung_step(&lung, &out, 1000.0 / BENCH_RATE_HZ);
+        w->pressure[i] = in.pressure;
+        w->flow[i] = in.flow;
+    }
+}
+
+static void _run_zoom(app_history_t *hist, bench_wave_t *w, uint32_t end_ms, double window_s)
+{
+    app_history_point_t pts[BENCH_POINTS];
+    uint32_t window_ms = window_s * 1000;
+    uint32_t from = end_ms > window_ms ? end_ms - window_ms : 0;
+    const int reps = 200;
+    size_t n = 0;
+    uint64_t start = bench_now_ns();
+    for (int r = 0; r < reps; r++) {
+        n = app_history_query(hist, from, end_ms, pts, BENCH_POINTS);
+    }
+    double ns = (double)(bench_now_ns() - start) / reps;
+    bool ok = n > 0 && _check_points(pts, n, BENCH_POINTS, _wave_value, w);
+    printf("last %6.0f s  %s %3zu points of %5u ms from %6.3f s, %8.0f ns per query\n", window_s, ok ? "ok  " : "FAIL",
+           n, n ? pts[0].span_ms : 0, n ? pts[0].timestamp / 1000.0 : 0, ns);
+}
+
+static void _run_random(app_history_t *hist, bench_wave_t *w, uint32_t oldest, uint32_t end_ms, int queries)
+{
+    app_history_point_t *pts = malloc(2000 * sizeof(app_history_point_t));
+    int bad = 0, empty = 0;
+    uint64_t ns = 0;
+    srand(4);
+    for (int q = 0; q < queries; q++) {
+        uint32_t a = oldest + (uint32_t)((double)rand() / RAND_MAX * (end_ms - oldest));
+        uint32_t b = oldest + (uint32_t)((double)rand() / RAND_MAX * (end_ms - oldest));
+        size_t max = 1 + rand() % 2000;
+        if (a > b) {
+            uint32_t t = a;
+            a = b;
+            b = t;
+        }
+        uint64_t t0 = bench_now_ns();
+        size_t n = app_history_query(hist, a, b + 1, pts, max);
+        ns += bench_now_ns() - t0;
+        empty += n == 0;
+        bad += !_check_points(pts, n, max, _wave_value, w);
+    }
+    printf("random        %s %d queries of 1..2000 points, %d empty, %d wrong, %.0f ns per query\n",
+           bad ? "FAIL" : "ok  ", queries, empty, bad, (double)ns / queries);
+    free(pts);
+}
+
+typedef struct {
+    app_history_t *hist;
+    uint32_t count;
+    volatile uint32_t added;
+    volatile bool done;
+} bench_writer_t;
+
+static void _writer_task(void *arg)
+{
+    bench_writer_t *wr = arg;
+    for (uint32_t k = 0; k < wr->count; k++) {
+        app_history_add(wr->hist, _synthetic_value(k, 0, NULL) / 100.0f, _synthetic_value(k, 1, NULL) / 100.0f);
+        wr->added = k + 1;
+    }
+    wr->done = true;
+    vTaskDelete(NULL);
+}
+
+static void _run_stress(uint32_t count)
+{
+    app_history_cfg_t cfg = {
+        .rate_hz = BENCH_RATE_HZ,
+        .tiers = 3,
+        .tier = { { 1, 512 }, { 10, 256 }, { 100, 64 } },
+    };
+    bench_writer_t wr = { .hist = app_history_new(&cfg), .count = count };
+    app_history_point_t pts[64];
+    uint32_t queries = 0, answered = 0, bad = 0;
+    xTaskCreate(_writer_task, "writer", 4096, &wr, 5, NULL);
+    while (!wr.done) {
+        uint32_t oldest, end;
+        app_history_span(wr.hist, &oldest, &end);
+        /* The oldest few buckets of a tier, the ones the writer is about to overwrite */
+        uint32_t from = oldest + rand() % 64, to = from + 1 + rand() % 6400;
+        size_t n = app_history_query(wr.hist, from, to, pts, 1 + rand() % 64);
+        queries++;
+        answered += n > 0;
+        bad += !_check_points(pts, n, 64, _synthetic_value, NULL);
+    }
+    printf("concurrent    %s %u samples written while %u queries read the oldest data, %u answered, %u torn\n",
+           bad ? "FAIL" : "ok  ", count, queries, answered, bad);
+    app_history_delete(wr.hist);
+}
+
+/* At 1 Hz the ms timestamps wrap after 4.3 million samples: the newest 200 s, across the wrap */
+static void _run_wrap(void)
+{
+    app_history_cfg_t cfg = {
+        .rate_hz = 1,
+        .tiers = 3,
+        .tier = { { 1, 256 }, { 10, 256 }, { 100, 64 } },
+    };
+    app_history_t *hist = app_history_new(&cfg);
+    uint32_t count = (uint32_t)((1ull << 32) / 1000) + 100;
+    for (uint32_t k = 0; k < count; k++) {
+        app_history_add(hist, _synthetic_value(k, 0, NULL) / 100.0f, _synthetic_value(k, 1, NULL) / 100.0f);
+    }
+    uint32_t oldest, end;
+    app_history_span(hist, &oldest, &end);
+    app_history_point_t pts[64];
+    size_t n = app_history_query(hist, end - 200 * 1000, end, pts, 64);
+    bool ok = n > 0 && end == (uint32_t)((uint64_t)count * 1000) && pts[0].timestamp > pts[n - 1].timestamp;
+    for (size_t i = 0; ok && i < n; i++) {
+        /* Samples back from the newest, the timestamps alone no longer tell */
+        uint32_t s0 = count - (end - pts[i].timestamp) / 1000;
+        ok = (int32_t)(pts[i].timestamp - (i ? pts[i - 1].timestamp + pts[i - 1].span_ms : pts[i].timestamp)) >= 0 &&
+             _check_stat(&pts[i].pressure, s0, s0 + pts[i].span_ms / 1000, 0, _synthetic_value, NULL) &&
+             _check_stat(&pts[i].flow, s0, s0 + pts[i].span_ms / 1000, 1, _synthetic_value, NULL);
+    }
+    printf("ms wrap       %s %zu points of the newest 200 s, from %u to %u ms\n", ok ? "ok  " : "FAIL", n,
+           n ? pts[0].timestamp : 0, n ? pts[n - 1].timestamp : 0);
+    app_history_delete(hist);
+}
+
+int main(int argc, char **argv)
+{
+    double secs = 3600;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        switch (opt) {
+            case 't':
+                secs = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t simulated_seconds]\n", argv[0]);
+                return 1;
+        }
+    }
+    uint32_t n = secs * BENCH_RATE_HZ;
+    bench_wave_t w = { malloc(n * sizeof(float)), malloc(n * sizeof(float)) };
+    bench_samples_t insert;
+    if (n < BENCH_RATE_HZ || w.pressure == NULL || w.flow == NULL || bench_samples_init(&insert, n) != 0) {
+        fprintf(stderr, "Need at least a second, and the memory for it\n");
+        return 1;
+    }
+    _record(&w, n);
+
+    app_history_cfg_t cfg = _cfg_hour();
+    app_history_t *hist = app_history_new(&cfg);
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < n; i++) {
+        app_history_add(hist, w.pressure[i], w.flow[i]);
+    }
+    double insert_ns = (double)(bench_now_ns() - start) / n;
+    /* Again, timing each: the insert that closes a bucket in every tier is the slowest */
+    app_history_delete(hist);
+    hist = app_history_new(&cfg);
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t c0 = bench_cycles();
+        app_history_add(hist, w.pressure[i], w.flow[i]);
+        bench_samples_add(&insert, bench_cycles() - c0);
+    }
+    uint32_t oldest, end;
+    app_history_span(hist, &oldest, &end);
+    size_t bytes = cfg.tier[0].capacity * 4 + (cfg.tier[1].capacity + cfg.tier[2].capacity) * 12;
+    printf("CMV on the simulated lung, %.0f s at %d Hz into raw 10 s, 10x 5 min, 100x 1 h (%zu KB): holds %.1f .. %.1f s\n",
+           secs, BENCH_RATE_HZ, bytes / 1024, oldest / 1000.0, end / 1000.0);
+    printf("insert %.1f ns per sample, cycles p50 %llu p99 %llu p99.99 %llu max %llu\n", insert_ns,
+           (unsigned long long)bench_percentile(&insert, 50), (unsigned long long)bench_percentile(&insert, 99),
+           (unsigned long long)bench_percentile(&insert, 99.99), (unsigned long long)bench_percentile(&insert, 100));
+
+    const double windows[] = { 1, 10, 60, 300, 600, 3600 };
+    for (size_t i = 0; i < sizeof(windows) / sizeof(windows[0]); i++) {
+        if (windows[i] <= secs) {
+            _run_zoom(hist, &w, end, windows[i]);
+        }
+    }
+    _run_random(hist, &w, oldest, end, 2000);
+    _run_stress(20 * 1000 * 1000);
+    _run_wrap();
+
+    app_history_delete(hist);
+    bench_samples_free(&insert);
+    free(w.pressure);
+    free(w.flow);
+    return 0;
+}
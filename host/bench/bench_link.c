@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench_link.h"
+
+static void _sleep_us(double us)
+{
+    if (us <= 0) {
+        return;
+    }
+    struct timespec ts = {
+        .tv_sec = (time_t)(us / 1e6),
+        .tv_nsec = (long)((us - (time_t)(us / 1e6) * 1e6) * 1000),
+    };
+    nanosleep(&ts, NULL);
+}
+
+static double _airtime_us(bench_link_t *link, size_t len)
+{
+    return link->bytes_per_us > 0 ? len / link->bytes_per_us : 0;
+}
+
+void bench_link_write(bench_link_t *link, const uint8_t *buf, size_t len, uint8_t **reply, ssize_t *reply_len)
+{
+    _sleep_us(link->rtt_us / 2 + _airtime_us(link, len));
+    *reply = NULL;
+    *reply_len = 0;
+    ble_prov_custom_data_handler(0, buf, len, reply, reply_len, link->endpoint);
+    _sleep_us(link->rtt_us / 2);
+    link->writes++;
+}
+
+void bench_link_read(bench_link_t *link, ssize_t reply_len)
+{
+    _sleep_us(link->rtt_us + _airtime_us(link, reply_len));
+    link->reads++;
+}
+
+Status bench_link_upload_firmware(bench_link_t *link, const uint8_t *stream, uint32_t size, uint32_t crc,
+                                  uint32_t chunk_size)
+{
+    uint8_t *packed = malloc(chunk_size + 256);
+    uint32_t offset = 0;
+    Status status = STATUS__Success;
+    while (status == STATUS__Success && offset < size) {
+        FileData fw = FILE_DATA__INIT;
+        VentRequest req = VENT_REQUEST__INIT;
+        fw.file_name = "firmware.bin";
+        fw.file_size = size;
+        fw.offset = offset;
+        fw.data.data = (uint8_t *)stream + offset;
+        fw.data.len = size - offset < chunk_size ? size - offset : chunk_size;
+        /* Checked with the last chunk, with the first it restarts an image of the same size already done */
+        fw.checksum = crc;
+        req.cmd = COMMAND__WriteFirmwareRequest;
+        req.access_key = "0000";
+        req.write_firmware_request = &fw;
+        uint8_t *reply;
+        ssize_t reply_len;
+        bench_link_write(link, packed, vent_request__pack(&req, packed), &reply, &reply_len);
+        bench_link_read(link, reply_len);
+        VentResponse *resp = vent_response__unpack(NULL, reply_len, reply);
+        status = resp && resp->read_firmware_response ? resp->status : STATUS__Fail;
+        if (status == STATUS__Success) {
+            offset = resp->read_firmware_response->offset;
+        }
+        vent_response__free_unpacked(resp, NULL);
+        free(reply);
+    }
+    free(packed);
+    return status;
+}
@@ -0,0 +1,33 @@
+/*
+ * Simulated BLE link to the custom-data endpoint, shared by the transfer
+ * benchmarks. Every GATT write costs one round trip plus its airtime, and
+ * fetching the reply of a write (a GATT read) costs another.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "ble_prov_custom_data.h"
+#include "openvent.pb-c.h"
+
+typedef struct {
+    double rtt_us;
+    double bytes_per_us;        /*!< 0 = no airtime */
+    ble_prov_custom_data_t *endpoint;
+    uint32_t writes;
+    uint32_t reads;
+} bench_link_t;
+
+/* GATT write to custom-data: airtime, endpoint handler, write response */
+void bench_link_write(bench_link_t *link, const uint8_t *buf, size_t len, uint8_t **reply, ssize_t *reply_len);
+
+/* GATT read of the reply */
+void bench_link_read(bench_link_t *link, ssize_t reply_len);
+
+/*
+ * Lock-step WriteFirmwareRequests of `stream` (access key "0000"), with
+ * checksum `crc` on the last chunk. Returns the status of the last ack.
+ */
+Status bench_link_upload_firmware(bench_link_t *link, const uint8_t *stream, uint32_t size, uint32_t crc,
+                                  uint32_t chunk_size);
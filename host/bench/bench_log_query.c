@@ -0,0 +1,171 @@
+/*
+ * Time range queries on the record log.
+ *
+ * Fills logs of 1 to 16 segments of 64 KB (up to most of the 1200K
+ * storage partition) with one telemetry record a second, in a scratch
+ * directory (-d, /tmp by default), and pulls the last 10 minutes and
+ * random 10 minute windows out of each: seeking through the sparse time
+ * index, and reading from the oldest record as without one. Prints the
+ * host latency, the bytes read and what reading them would take on the
+ * device at FLASH_PAGE_READ_US a SPIFFS page, checking that both return
+ * the same records. Also times opening each log with its index files and
+ * with them deleted, when every segment has to be scanned.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "app_manager.h"
+#include "app_record_log.h"
+#include "bench_common.h"
+
+#define BENCH_SEGMENT_SIZE      (64 * 1024)
+#define BENCH_WINDOW_MS         (10 * 60 * 1000)
+#define BENCH_QUERIES           100
+/* Reading a 256 byte page through SPIFFS, lookup included, assumed */
+#define FLASH_PAGE_READ_US      30.0
+
+typedef struct {
+    uint32_t records;
+    uint32_t bytes;
+    uint64_t ns;
+    bool ok;
+} bench_query_t;
+
+static char g_dir[256];
+
+static app_record_log_cfg_t _cfg(const char *path, uint32_t segments)
+{
+    return (app_record_log_cfg_t) {
+        .path = path,
+        .segment_size = BENCH_SEGMENT_SIZE,
+        .max_segments = segments,
+        .batch_size = 4 * APP_RECORD_LOG_PAGE,
+    };
+}
+
+/* Records of [from, to) through a fresh reader, seeking or reading from the start */
+static bench_query_t _query(app_record_log_t *log, uint32_t from, uint32_t to, bool seek)
+{
+    bench_query_t q = { .ok = true };
+    app_record_t rec;
+    uint64_t start = bench_now_ns();
+    app_record_reader_t *reader = app_record_reader_new(log);
+    esp_err_t ret = seek ? app_record_reader_seek(reader, from) : ESP_OK;
+    uint32_t expect = (from + 999) / 1000 * 1000;
+    while (ret == ESP_OK && (ret = app_record_reader_next(reader, &rec)) == ESP_OK && rec.timestamp < to) {
+        if (rec.timestamp < from) {
+            continue;
+        }
+        q.ok = q.ok && rec.timestamp == expect;
+        expect += 1000;
+        q.records++;
+    }
+    q.bytes = app_record_reader_bytes(reader);
+    app_record_reader_delete(reader);
+    q.ns = bench_now_ns() - start;
+    return q;
+}
+
+static double _flash_ms(double bytes)
+{
+    return bytes / APP_RECORD_LOG_PAGE * FLASH_PAGE_READ_US / 1000;
+}
+
+static void _run(uint32_t segments)
+{
+    char path[300], cmd[700];
+    snprintf(path, sizeof(path), "%s/%u", g_dir, segments);
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s' && mkdir -p '%s'", path, path);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "Cannot create %s\n", path);
+        exit(1);
+    }
+    strncat(path, "/vlog", sizeof(path) - strlen(path) - 1);
+
+    /* Whole segments and not one more, so none is deleted */
+    app_record_log_cfg_t cfg = _cfg(path, segments < 2 ? 2 : segments);
+    uint32_t per_segment = (BENCH_SEGMENT_SIZE - 12) / (APP_RECORD_LOG_OVERHEAD + sizeof(app_manager_vent_record_t));
+    uint32_t n = segments * per_segment;
+    app_record_log_t *log = app_record_log_open(&cfg);
+    for (uint32_t i = 0; i < n; i++) {
+        app_manager_vent_record_t rec = { .volume_ml = i };
+        app_record_log_append(log, APP_MANAGER_RECORD_VENT, i * 1000, &rec, sizeof(rec));
+    }
+    app_record_log_close(log);
+
+    /* Mount with and without the index files */
+    app_record_log_stats_t stats;
+    log = app_record_log_open(&cfg);
+    app_record_log_get_stats(log, &stats);
+    int64_t open_us = stats.recovery_time_us;
+    uint32_t entries = stats.index_entries;
+    app_record_log_close(log);
+    snprintf(cmd, sizeof(cmd), "rm -f '%s'.*.i", path);
+    if (system(cmd) != 0) {
+        exit(1);
+    }
+    log = app_record_log_open(&cfg);
+    app_record_log_get_stats(log, &stats);
+    bool ok = stats.index_entries == entries && stats.index_scanned == segments - 1 && stats.recovered;
+
+    /* The last 10 minutes */
+    uint32_t end = (n - 1) * 1000 + 1;
+    bench_query_t seek = _query(log, end - BENCH_WINDOW_MS, end, true);
+    bench_query_t scan = _query(log, end - BENCH_WINDOW_MS, end, false);
+    ok = ok && seek.ok && scan.ok && seek.records == BENCH_WINDOW_MS / 1000 && seek.records == scan.records;
+
+    /* Random 10 minute windows */
+    uint64_t seek_ns = 0, scan_ns = 0, seek_bytes = 0, scan_bytes = 0;
+    srand(segments);
+    for (int i = 0; i < BENCH_QUERIES; i++) {
+        uint32_t from = (uint32_t)((double)rand() / RAND_MAX * (end - BENCH_WINDOW_MS));
+        bench_query_t a = _query(log, from, from + BENCH_WINDOW_MS, true);
+        bench_query_t b = _query(log, from, from + BENCH_WINDOW_MS, false);
+        ok = ok && a.ok && b.ok && a.records == b.records && a.records >= BENCH_WINDOW_MS / 1000 - 1;
+        seek_ns += a.ns;
+        scan_ns += b.ns;
+        seek_bytes += a.bytes;
+        scan_bytes += b.bytes;
+    }
+    app_record_log_close(log);
+
+    printf("%5u KB %6u rec %s %4u entries, open %5lld us (%6lld us scanning)  last 10 min: seek %6.1f us %6u B %6.1f ms,"
+           " scan %7.1f us %7u B %7.1f ms  random: seek %6.1f us %6.1f ms, scan %7.1f us %7.1f ms\n",
+           segments * BENCH_SEGMENT_SIZE / 1024, n, ok ? "ok  " : "FAIL", entries, (long long)open_us,
+           (long long)stats.recovery_time_us, seek.ns / 1e3, seek.bytes, _flash_ms(seek.bytes), scan.ns / 1e3,
+           scan.bytes, _flash_ms(scan.bytes), seek_ns / 1e3 / BENCH_QUERIES,
+           _flash_ms((double)seek_bytes / BENCH_QUERIES), scan_ns / 1e3 / BENCH_QUERIES,
+           _flash_ms((double)scan_bytes / BENCH_QUERIES));
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = "/tmp";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        switch (opt) {
+            case 'd':
+                dir = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-d scratch_dir]\n", argv[0]);
+                return 1;
+        }
+    }
+    snprintf(g_dir, sizeof(g_dir), "%s/bench_log_query.%d", dir, (int)getpid());
+
+    printf("One %zu byte record a second, an index entry every %d records, SPIFFS page read %.0f us\n",
+           APP_RECORD_LOG_OVERHEAD + sizeof(app_manager_vent_record_t), APP_RECORD_LOG_INDEX_EVERY,
+           FLASH_PAGE_READ_US);
+    const uint32_t sizes[] = { 1, 2, 4, 8, 16 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        _run(sizes[i]);
+    }
+
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", g_dir);
+    return system(cmd);
+}
@@ -0,0 +1,250 @@
+/*
+ * Asynchronous ESP_LOG sink.
+ *
+ * Logging goes to a simulated UART console that takes 10 bits a character
+ * at -b baud (115200 by default). Times ESP_LOGI calls like the per-chunk
+ * "Writing %d/%d, memfree=%d" line straight to the console, then with the
+ * sink installed: a burst from four tasks that fits the ring, and the same
+ * tasks logging flat out for far longer than the console keeps up with.
+ * Every line that reaches the console and the log file is checked to be
+ * whole and in order per task, and lines taken plus dropped to add up to
+ * the lines logged.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "esp_log.h"
+#include "app_log_sink.h"
+#include "app_record_log.h"
+#include "bench_common.h"
+
+#define BENCH_PRODUCERS         4
+#define BENCH_SLOTS             64
+#define BENCH_CAPTURE_SIZE      (4 * 1024 * 1024)
+
+static const char *TAG = "BENCH";
+
+static uint32_t g_baud = 115200;
+static char *g_capture;
+static size_t g_capture_len;
+
+/* The console: keeps what it printed and takes as long as the UART would */
+static int _uart_vprintf(const char *format, va_list args)
+{
+    char line[256];
+    int len = vsnprintf(line, sizeof(line), format, args);
+    len = len < (int)sizeof(line) ? len : (int)sizeof(line) - 1;
+    if (g_capture_len + len < BENCH_CAPTURE_SIZE) {
+        memcpy(g_capture + g_capture_len, line, len);
+        g_capture_len += len;
+    }
+    uint64_t until = bench_now_ns() + (uint64_t)len * 10 * 1000000000ull / g_baud;
+    while (bench_now_ns() < until) {
+    }
+    return len;
+}
+
+static uint32_t _check(uint32_t producer, uint32_t i)
+{
+    return (producer * 2654435761u) ^ (i * 40503u);
+}
+
+typedef struct {
+    uint32_t id;
+    uint32_t first;             /* Numbers lines on from the last run */
+    uint32_t lines;
+    bench_samples_t ns;
+    QueueHandle_t done;
+} bench_producer_t;
+
+static void _producer_task(void *arg)
+{
+    bench_producer_t *p = arg;
+    for (uint32_t i = p->first; i < p->first + p->lines; i++) {
+        uint64_t start = bench_now_ns();
+        ESP_LOGI(TAG, "P%u #%u %08x", p->id, i, _check(p->id, i));
+        bench_samples_add(&p->ns, bench_now_ns() - start);
+    }
+    bool done = true;
+    xQueueSend(p->done, &done, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+/* Lines of `text` from the producers: whole, each producer's in order; how many */
+static uint32_t _verify(const char *text, size_t len, bool *ok)
+{
+    uint32_t next[BENCH_PRODUCERS] = { 0 }, count = 0;
+    const char *end = text + len;
+    *ok = true;
+    while (text < end) {
+        const char *nl = memchr(text, '\n', end - text);
+        if (nl == NULL) {
+            *ok = false;
+            break;
+        }
+        const char *at = strstr(text, "BENCH: P");
+        unsigned id, i, chk;
+        if (at && at < nl) {
+            if (sscanf(at, "BENCH: P%u #%u %x", &id, &i, &chk) != 3 || id >= BENCH_PRODUCERS || i < next[id] ||
+                    chk != _check(id, i)) {
+                *ok = false;
+            } else {
+                next[id] = i + 1;
+                count++;
+            }
+        }
+        text = nl + 1;
+    }
+    return count;
+}
+
+/* Producers logging lines `first` on, `lines` each at once, per call latency into `all` */
+static void _run_producers(uint32_t first, uint32_t lines, bench_samples_t *all)
+{
+    bench_producer_t p[BENCH_PRODUCERS];
+    QueueHandle_t done = xQueueCreate(BENCH_PRODUCERS, sizeof(bool));
+    for (uint32_t k = 0; k < BENCH_PRODUCERS; k++) {
+        p[k] = (bench_producer_t) { .id = k, .first = first, .lines = lines, .done = done };
+        bench_samples_init(&p[k].ns, lines);
+        xTaskCreate(_producer_task, "producer", 4096, &p[k], 5, NULL);
+    }
+    for (uint32_t k = 0; k < BENCH_PRODUCERS; k++) {
+        bool d;
+        xQueueReceive(done, &d, portMAX_DELAY);
+    }
+    for (uint32_t k = 0; k < BENCH_PRODUCERS; k++) {
+        for (size_t i = 0; i < p[k].ns.count; i++) {
+            bench_samples_add(all, p[k].ns.samples[i]);
+        }
+        bench_samples_free(&p[k].ns);
+    }
+    vQueueDelete(done);
+}
+
+static void _print_latency(const char *name, bench_samples_t *s)
+{
+    printf("%-28s p50 %8.2f us  p99 %8.2f us  max %8.2f us per call\n", name, bench_percentile(s, 50) / 1e3,
+           bench_percentile(s, 99) / 1e3, bench_percentile(s, 100) / 1e3);
+}
+
+static size_t _file_read(const char *path, char **text)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        *text = NULL;
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    size_t len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    *text = malloc(len + 1);
+    len = fread(*text, 1, len, f);
+    fclose(f);
+    return len;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t flood = 5000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:n:")) != -1) {
+        switch (opt) {
+            case 'b':
+                g_baud = atoi(optarg);
+                break;
+            case 'n':
+                flood = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-b baud] [-n lines_per_task]\n", argv[0]);
+                return 1;
+        }
+    }
+    g_capture = malloc(BENCH_CAPTURE_SIZE);
+    if (g_baud == 0 || flood == 0 || g_capture == NULL) {
+        fprintf(stderr, "Need a baud rate, lines and memory\n");
+        return 1;
+    }
+    esp_log_level_set("*", ESP_LOG_INFO);
+    vprintf_like_t orig = esp_log_set_vprintf(_uart_vprintf);
+    printf("Console at %u baud, %d tasks logging, %d line ring\n", g_baud, BENCH_PRODUCERS, BENCH_SLOTS);
+
+    /* As it was: every line out of the UART before the call returns */
+    bench_samples_t direct;
+    bench_samples_init(&direct, 200);
+    for (int i = 0; i < 200; i++) {
+        uint64_t start = bench_now_ns();
+        ESP_LOGI(TAG, "Writing %d/%d, memfree=%d", (i + 1) * 4096, 200 * 4096, 180000 - i);
+        bench_samples_add(&direct, bench_now_ns() - start);
+    }
+    _print_latency("direct to the console", &direct);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/bench_log_sink.%d", (int)getpid());
+    remove(path);
+    app_log_sink_cfg_t cfg = {
+        .slots = BENCH_SLOTS,
+        .console = true,
+        .path = path,
+        .max_file_size = BENCH_CAPTURE_SIZE,
+        .file_buffer = 4 * APP_RECORD_LOG_PAGE,
+        .flush_ms = 5000,
+        .poll_ms = 10,
+        .priority = 1,
+        .core = tskNO_AFFINITY,
+    };
+    app_log_sink_start(&cfg);
+    vTaskDelay(pdMS_TO_TICKS(50));
+    g_capture_len = 0;
+    app_log_sink_stats_t before, stats;
+    app_log_sink_get_stats(&before);
+
+    /* A burst the ring holds */
+    bench_samples_t burst;
+    bench_samples_init(&burst, BENCH_SLOTS);
+    _run_producers(0, BENCH_SLOTS / BENCH_PRODUCERS, &burst);
+    do {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        app_log_sink_get_stats(&stats);
+    } while (stats.written < stats.lines);
+    bool ok;
+    uint32_t shown = _verify(g_capture, g_capture_len, &ok);
+    printf("burst  %s ", ok && shown == BENCH_SLOTS && stats.dropped == before.dropped ? "ok  " : "FAIL");
+    _print_latency("", &burst);
+
+    /* Far more than the console keeps up with */
+    bench_samples_t all;
+    bench_samples_init(&all, flood * BENCH_PRODUCERS);
+    _run_producers(BENCH_SLOTS / BENCH_PRODUCERS, flood, &all);
+    do {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        app_log_sink_get_stats(&stats);
+    } while (stats.written < stats.lines);
+    app_log_sink_stop();
+    esp_log_set_vprintf(orig);
+    uint32_t total = BENCH_SLOTS + flood * BENCH_PRODUCERS;
+    uint32_t taken = stats.lines - before.lines, dropped = stats.dropped - before.dropped;
+    shown = _verify(g_capture, g_capture_len, &ok);
+    char *text;
+    size_t len = _file_read(path, &text);
+    bool file_ok = false;
+    uint32_t filed = text ? _verify(text, len, &file_ok) : 0;
+    printf("flood  %s ", ok && file_ok && taken + dropped == total && shown == taken && filed == taken ? "ok  " : "FAIL");
+    _print_latency("", &all);
+    printf("       %u lines logged, %u taken and all on the console and in the file, %u dropped, at most %u waiting\n",
+           total, taken, dropped, stats.max_queued);
+
+    bench_samples_free(&direct);
+    bench_samples_free(&burst);
+    bench_samples_free(&all);
+    free(text);
+    free(g_capture);
+    remove(path);
+    return 0;
+}
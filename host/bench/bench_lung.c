@@ -0,0 +1,51 @@
+#include <math.h>
+
+#include "bench_lung.h"
+
+/* Muscle pressure of the patient's breathing effort at `t_ms` */
+static double _effort(bench_lung_t *lung)
+{
+    if (lung->effort <= 0 || lung->effort_bpm <= 0) {
+        return 0;
+    }
+    double cycle_ms = 60000 / lung->effort_bpm;
+    double t = fmod(lung->t_ms, cycle_ms);
+    return t < lung->effort_ms ? lung->effort * sin(M_PI * t / lung->effort_ms) : 0;
+}
+
+void bench_lung_step(bench_lung_t *lung, const app_control_output_t *out, double dt_ms)
+{
+    double k = lung->valve_tau_ms > 0 ? 1 - exp(-dt_ms / lung->valve_tau_ms) : 1;
+    lung->inlet += (out->inlet - lung->inlet) * k;
+    lung->outlet += (out->outlet - lung->outlet) * k;
+
+    double cycle_ms = lung->effort_bpm > 0 ? 60000 / lung->effort_bpm : 0;
+    if (lung->effort > 0 && cycle_ms > 0 && fmod(lung->t_ms, cycle_ms) < dt_ms) {
+        lung->efforts++;
+    }
+    /* Alveolar pressure, then the airway pressure where inflow, outflow and the flow into the lung balance */
+    double alveolar = lung->volume / lung->compliance - _effort(lung);
+    double a = lung->inlet_g * lung->inlet;
+    double b = lung->outlet_g * lung->outlet + lung->leak_g;
+    double r = lung->resistance;
+    lung->pressure = (alveolar + r * a * lung->supply) / (1 + r * (a + b));
+    lung->flow = (lung->pressure - alveolar) / r;
+    lung->volume += lung->flow * dt_ms / 1000;
+    lung->t_ms += dt_ms;
+}
+
+void bench_lung_read(const bench_lung_t *lung, app_control_input_t *in)
+{
+    in->pressure = lung->pressure;
+    in->flow = lung->flow * 60;
+}
+
+void bench_lung_read_fn(app_control_input_t *in, void *arg)
+{
+    bench_lung_read(arg, in);
+}
+
+void bench_lung_write_fn(const app_control_output_t *out, void *arg)
+{
+    bench_lung_step(arg, out, 1);
+}
@@ -0,0 +1,51 @@
+/*
+ * Simulated patient circuit for the control loop benchmarks: a single
+ * compartment lung (airway resistance, compliance and an optional
+ * breathing effort) between an inlet valve from a pressure supply and an
+ * outlet valve to the room. Both valves follow their command with a first
+ * order lag. Pressures in cmH2O, volume in L, flow in L/s.
+ */
+#pragma once
+
+#include "app_control.h"
+
+typedef struct {
+    double resistance;          /*!< Airways, cmH2O per L/s */
+    double compliance;          /*!< L per cmH2O */
+    double supply;              /*!< Behind the inlet valve */
+    double inlet_g;             /*!< Fully open inlet valve, L/s per cmH2O */
+    double outlet_g;            /*!< Fully open outlet valve */
+    double leak_g;              /*!< Circuit leak to the room */
+    double valve_tau_ms;
+    double effort;              /*!< Peak inspiratory muscle pressure, 0 = passive patient */
+    double effort_bpm;
+    double effort_ms;           /*!< Length of one inspiratory effort */
+    /* State */
+    double t_ms;
+    double volume;              /*!< Above the relaxed volume */
+    double inlet;               /*!< Valve openings */
+    double outlet;
+    double pressure;            /*!< Airway */
+    double flow;                /*!< Into the lung */
+    uint32_t efforts;           /*!< Breathing efforts started so far */
+} bench_lung_t;
+
+/* Passive adult: R 10 cmH2O/L/s, C 50 ml/cmH2O, 50 cmH2O supply */
+#define BENCH_LUNG_ADULT { \
+    .resistance = 10, \
+    .compliance = 0.05, \
+    .supply = 50, \
+    .inlet_g = 0.04, \
+    .outlet_g = 0.1, \
+    .valve_tau_ms = 5, \
+    .effort_ms = 1000, \
+}
+
+/* Valves move towards `out` for `dt_ms`, the lung follows */
+void bench_lung_step(bench_lung_t *lung, const app_control_output_t *out, double dt_ms);
+/* What the pressure and flow sensors show */
+void bench_lung_read(const bench_lung_t *lung, app_control_input_t *in);
+
+/* app_control_read_fn / app_control_write_fn with `arg` the lung, one write is one 1 ms step */
+void bench_lung_read_fn(app_control_input_t *in, void *arg);
+void bench_lung_write_fn(const app_control_output_t *out, void *arg);
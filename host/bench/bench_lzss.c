@@ -0,0 +1,117 @@
+/*
+ * Compressed firmware images: ratio and decode speed of app_lzss.
+ *
+ * Compresses an image (-i, e.g. build/openvent-fw.bin; without one the
+ * bench's own executable stands in as machine code) with a range of
+ * window/lookahead sizes, then inflates it with app_lzss fed in chunks the
+ * size of a WriteFirmwareRequest payload, checking every byte. Prints the
+ * ratio, decode MB/s, the RAM the device needs and the transfer time at
+ * the given link rate with and without compression.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "app_lzss.h"
+#include "lzss_encode.h"
+#include "bench_common.h"
+
+typedef struct {
+    const uint8_t *image;
+    uint32_t pos;
+    bool mismatch;
+} bench_sink_t;
+
+static esp_err_t _sink(void *arg, const uint8_t *data, size_t len)
+{
+    bench_sink_t *sink = arg;
+    if (memcmp(sink->image + sink->pos, data, len) != 0) {
+        sink->mismatch = true;
+    }
+    sink->pos += len;
+    return ESP_OK;
+}
+
+static uint8_t *_load(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size);
+    if (fread(data, 1, *size, f) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    static const int params[][2] = { { 8, 4 }, { 10, 4 }, { 11, 4 }, { 12, 4 }, { 12, 5 }, { 13, 5 }, { 14, 6 } };
+    const char *path = "/proc/self/exe";
+    size_t chunk_size = 480;
+    double kbps = 40;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:c:b:")) != -1) {
+        switch (opt) {
+            case 'i':
+                path = optarg;
+                break;
+            case 'c':
+                chunk_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                kbps = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-i image] [-c chunk_size] [-b link_KB_per_s]\n", argv[0]);
+                return 1;
+        }
+    }
+    size_t size;
+    uint8_t *image = _load(path, &size);
+    if (image == NULL || size == 0 || chunk_size == 0) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        return 1;
+    }
+    uint8_t *packed = malloc(LZSS_ENCODE_BOUND(size));
+    app_lzss_t *lzss = app_lzss_new(APP_LZSS_MAX_WINDOW_BITS);
+
+    printf("%s: %zu bytes, %zu byte chunks, link %.1f KB/s: %.1f s uncompressed\n",
+           path, size, chunk_size, kbps, size / 1024.0 / kbps);
+    printf("  -w -l    ratio   window   decode MB/s   link time\n");
+    for (size_t p = 0; p < sizeof(params) / sizeof(params[0]); p++) {
+        int w = params[p][0], l = params[p][1];
+        size_t len = lzss_encode(image, size, w, l, packed, LZSS_ENCODE_BOUND(size));
+
+        /* Decode a few times, the fastest run counts */
+        uint64_t best = UINT64_MAX;
+        bool ok = true;
+        for (int run = 0; run < 5; run++) {
+            bench_sink_t sink = { .image = image };
+            uint64_t start = bench_now_ns();
+            app_lzss_reset(lzss, w, l);
+            for (size_t pos = 0; pos < len; pos += chunk_size) {
+                app_lzss_decode(lzss, packed + pos, len - pos < chunk_size ? len - pos : chunk_size, _sink, &sink);
+            }
+            uint64_t elapsed = bench_now_ns() - start;
+            best = elapsed < best ? elapsed : best;
+            ok = ok && !sink.mismatch && sink.pos == size;
+        }
+        printf("  %2d %2d  %6.1f%%  %6u B  %10.1f   %7.1f s  %s\n", w, l, 100.0 * len / size, 1U << w,
+               size / 1e6 / (best / 1e9), len / 1024.0 / kbps, ok ? "ok" : "FAIL");
+    }
+
+    app_lzss_delete(lzss);
+    free(packed);
+    free(image);
+    return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Streaming OTA into a file-backed partition.
+ *
+ * First app_ota on its own, with the image arriving at link speed and the
+ * partition timed like SPI flash (-E us per sector erase, -W us per KB
+ * written). Compares erasing each sector when it is needed with erasing
+ * ahead while idle, and prints what erasing the whole image up front, as
+ * esp_ota_begin() does, would cost before the first byte is accepted.
+ * Then the same image goes through the custom-data endpoint as
+ * WriteFirmwareRequests; the partition content and the boot partition are
+ * checked, the first chunk resent must not restart the finished image,
+ * and a corrupted image must be refused. Last the image goes
+ * compressed (host/tools/ota_compress format).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "mbedtls/sha256.h"
+#include "app_manager.h"
+#include "app_ota.h"
+#include "app_crc32.h"
+#include "ble_prov_custom_data.h"
+#include "openvent.pb-c.h"
+#include "bench_common.h"
+#include "bench_link.h"
+#include "lzss_encode.h"
+
+#define BENCH_ACCESS_KEY        "0000"
+
+static esp_err_t _bench_event_handler(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    if (req->cmd == COMMAND__WriteFirmwareRequest) {
+        return app_manager_firmware_handle(ctx, req, resp);
+    }
+    return app_manager_response(resp);
+}
+
+/* Enough of an app image for app_ota: magic, hash_appended and the SHA-256 at the end */
+static uint8_t *_make_image(uint32_t size)
+{
+    uint8_t *image = malloc(size);
+    for (uint32_t i = 0; i < size; i++) {
+        image[i] = (uint8_t)(i * 131 + (i >> 9));
+    }
+    image[0] = 0xe9;
+    image[23] = 1;
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    mbedtls_sha256_update_ret(&sha, image, size - 32);
+    mbedtls_sha256_finish_ret(&sha, image + size - 32);
+    mbedtls_sha256_free(&sha);
+    return image;
+}
+
+static void _run_direct(int erase_ahead, const uint8_t *image, uint32_t size, uint32_t chunk_size, double bytes_per_us)
+{
+    app_ota_t *ota = app_ota_new(2, erase_ahead);
+    uint64_t start = bench_now_ns();
+    esp_err_t err = app_ota_begin(ota, size);
+    for (uint32_t off = 0; err == ESP_OK && off < size; off += chunk_size) {
+        uint32_t n = size - off < chunk_size ? size - off : chunk_size;
+        /* The chunk is not there before the link has carried it */
+        uint64_t due = start + (uint64_t)((off + n) / bytes_per_us * 1000);
+        uint64_t now = bench_now_ns();
+        if (due > now) {
+            usleep((due - now) / 1000);
+        }
+        err = app_ota_write(ota, image + off, n);
+    }
+    uint64_t last = bench_now_ns();
+    if (err == ESP_OK) {
+        err = app_ota_end(ota, app_crc32_update(0, image, size));
+    }
+    uint64_t done = bench_now_ns();
+
+    app_ota_stats_t stats;
+    app_ota_get_stats(ota, &stats);
+    printf("erase ahead %2d: %s %7.2f s  %6.1f KB/s  tail %6.1f ms  erase %6.1f ms (%u ahead, %u inline)"
+           "  write %6.1f ms  sha %5.1f ms  stalls %u %.1f ms\n",
+           erase_ahead, err == ESP_OK ? "ok  " : "FAIL", (done - start) / 1e9,
+           size / 1024.0 / ((done - start) / 1e9), (done - last) / 1e6,
+           stats.erase_time_us / 1000.0, stats.erased_ahead, stats.erased_inline,
+           stats.write_time_us / 1000.0, stats.hash_time_us / 1000.0, stats.stalls,
+           stats.stall_time_us / 1000.0);
+    app_ota_delete(ota);
+}
+
+static bool _verify(const esp_partition_t *partition, const uint8_t *image, uint32_t size)
+{
+    uint8_t *buf = malloc(size);
+    bool ok = esp_partition_read(partition, 0, buf, size) == ESP_OK && memcmp(buf, image, size) == 0;
+    free(buf);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t size = 256 * 1024;
+    uint32_t chunk_size = 480;
+    double kbps = 100;
+    int erase_ahead = 4;
+    uint32_t erase_us = 30000;
+    uint32_t write_kb_us = 1500;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:c:b:e:E:W:")) != -1) {
+        switch (opt) {
+            case 's':
+                size = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                chunk_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                kbps = atof(optarg);
+                break;
+            case 'e':
+                erase_ahead = atoi(optarg);
+                break;
+            case 'E':
+                erase_us = strtoul(optarg, NULL, 0);
+                break;
+            case 'W':
+                write_kb_us = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s image_size] [-c chunk_size] [-b link_KB_per_s] [-e erase_ahead]"
+                        " [-E erase_sector_us] [-W write_KB_us]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (size < 64 || chunk_size == 0 || kbps <= 0) {
+        fprintf(stderr, "bad arguments\n");
+        return 1;
+    }
+
+    char tmp_dir[] = "/tmp/openvent-ota-XXXXXX";
+    if (mkdtemp(tmp_dir) == NULL || host_partition_init(tmp_dir) != ESP_OK) {
+        perror("partitions");
+        return 1;
+    }
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *update = esp_ota_get_next_update_partition(NULL);
+    if (size > update->size) {
+        fprintf(stderr, "image larger than %s\n", update->label);
+        return 1;
+    }
+    uint8_t *image = _make_image(size);
+
+    host_partition_set_timing(erase_us, write_kb_us);
+    printf("OTA of %u bytes in %u byte chunks at %.1f KB/s, sector erase %u us, write %u us/KB\n",
+           size, chunk_size, kbps, erase_us, write_kb_us);
+    uint64_t start = bench_now_ns();
+    esp_partition_erase_range(update, 0, (size + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1));
+    printf("up-front erase: %.1f ms before the first chunk is accepted\n", (bench_now_ns() - start) / 1e6);
+    _run_direct(0, image, size, chunk_size, kbps * 1024 / 1e6);
+    _run_direct(erase_ahead, image, size, chunk_size, kbps * 1024 / 1e6);
+    bool ok = _verify(update, image, size) && esp_ota_get_boot_partition() == update;
+    printf("partition %s: %s\n", update->label, ok ? "ok" : "FAIL");
+
+    /* Functional run through the real endpoint, flash and link untimed */
+    host_partition_set_timing(0, 0);
+    app_manager_cfg_t app_man_cfg = {
+        .input_rb_size = 8 * 1024,
+        .output_rb_size = 2 * 1024,
+        .access_key = BENCH_ACCESS_KEY,
+        .event_handler = _bench_event_handler,
+    };
+    if (app_manager_init(&app_man_cfg) != ESP_OK) {
+        fprintf(stderr, "app_manager_init failed\n");
+        return 1;
+    }
+    bench_link_t link = {
+        .endpoint = ble_prov_custom_data_new(app_manager_get_output_rb(), app_manager_get_input_rb()),
+    };
+    esp_ota_set_boot_partition(running);
+    Status status = bench_link_upload_firmware(&link, image, size, app_crc32_update(0, image, size), chunk_size);
+    ok = status == STATUS__Success && _verify(update, image, size) && esp_ota_get_boot_partition() == update;
+    printf("WriteFirmwareRequest:           %s  writes=%u\n", ok ? "ok  " : "FAIL", link.writes);
+
+    /* The first chunk resent with its checksum once the image is done, as when an ack is lost: answered with the end */
+    link.writes = 0;
+    status = bench_link_upload_firmware(&link, image, size, app_crc32_update(0, image, size), chunk_size);
+    ok = status == STATUS__Success && link.writes == 1 && _verify(update, image, size) &&
+         esp_ota_get_boot_partition() == update;
+    printf("WriteFirmwareRequest, resent:   %s  done\n", ok ? "ok  " : "FAIL");
+
+    /* CRC-32 still matches, the SHA-256 does not: must not become the boot partition */
+    esp_ota_set_boot_partition(running);
+    image[size / 2] ^= 0x01;
+    status = bench_link_upload_firmware(&link, image, size, app_crc32_update(0, image, size), chunk_size);
+    ok = status == STATUS__Fail && esp_ota_get_boot_partition() == running;
+    printf("WriteFirmwareRequest, corrupt:  %s  refused\n", ok ? "ok  " : "FAIL");
+    image[size / 2] ^= 0x01;
+
+    esp_ota_set_boot_partition(running);
+    uint8_t *stream = malloc(APP_MANAGER_FW_LZSS_HDR_LEN + LZSS_ENCODE_BOUND(size));
+    uint32_t magic = APP_MANAGER_FW_LZSS_MAGIC;
+    memcpy(stream, &magic, 4);
+    stream[4] = 12;
+    stream[5] = 5;
+    stream[6] = stream[7] = 0;
+    memcpy(stream + 8, &size, 4);
+    uint32_t stream_size = APP_MANAGER_FW_LZSS_HDR_LEN +
+                           lzss_encode(image, size, 12, 5, stream + APP_MANAGER_FW_LZSS_HDR_LEN, LZSS_ENCODE_BOUND(size));
+    status = bench_link_upload_firmware(&link, stream, stream_size, app_crc32_update(0, image, size), chunk_size);
+    ok = status == STATUS__Success && _verify(update, image, size) && esp_ota_get_boot_partition() == update;
+    printf("WriteFirmwareRequest, compressed: %s  %u of %u bytes sent\n", ok ? "ok  " : "FAIL", stream_size, size);
+    free(stream);
+
+    app_ota_stats_t stats;
+    if (app_manager_get_ota_stats(&stats) == ESP_OK) {
+        printf("last update: %u bytes, %u sectors erased ahead, %u inline\n",
+               stats.image_size, stats.erased_ahead, stats.erased_inline);
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%s.bin", tmp_dir, running->label);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s.bin", tmp_dir, update->label);
+    unlink(path);
+    rmdir(tmp_dir);
+    free(image);
+    return 0;
+}
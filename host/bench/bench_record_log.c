@@ -0,0 +1,329 @@
+/*
+ * Segmented binary record log.
+ *
+ * Appends telemetry records (app_manager_vent_record_t, one a second on
+ * the device) flat out into a log in a scratch directory (-d, /tmp by
+ * default) with segments and retention as configured for the storage
+ * partition, so it rotates many times: as CSV lines flushed one by one,
+ * as binary records written one by one, and batched to one and four
+ * SPIFFS pages. Prints records/s, file bytes and writes per record, and
+ * the flash a record costs in a SPIFFS model: every write programs its
+ * data in 251 byte page payloads and rewrites the file's 256 byte index
+ * page, every programmed byte is erased again by the garbage collector.
+ * Each log is read back and checked for order, gaps and size on disk.
+ *
+ * Then tears the tail of a log, reopens it and checks that only the tail
+ * segment was read, that every record before the tear is still there and
+ * that new ones follow it.
+ */
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "app_manager.h"
+#include "app_record_log.h"
+#include "bench_common.h"
+
+#define BENCH_SEGMENT_SIZE      (64 * 1024)
+#define BENCH_SEGMENTS          8
+/* SPIFFS on the ESP32's flash: page program and 4 KB sector erase, typical */
+#define FLASH_PAGE              256
+#define FLASH_PAGE_PROGRAM_US   700.0
+#define FLASH_SECTOR            4096
+#define FLASH_SECTOR_ERASE_US   45000.0
+
+typedef struct {
+    const char *name;
+    size_t batch_size;          /* 0 for text */
+} bench_mode_t;
+
+typedef struct {
+    double secs;
+    uint64_t bytes;
+    uint32_t writes;
+    uint32_t records;
+} bench_result_t;
+
+static char g_dir[256];
+
+static void _record_fill(app_manager_vent_record_t *rec, uint32_t i)
+{
+    int16_t p = 500 + (int16_t)(i % 1500), f = -3000 + (int16_t)(i % 6000);
+    *rec = (app_manager_vent_record_t) {
+        .pressure = { p - 400, p, p - 200 },
+        .flow = { f - 1000, f, f - 500 },
+        .volume_ml = 450 + i % 100,
+        .frequency = 12 + i % 8,
+        .in_time_ms = 1000 + i % 500,
+        .mode = i % 4,
+    };
+}
+
+/* A fresh directory for one run, `path` the log in it */
+static void _fresh(const char *name, char *path, size_t size)
+{
+    char cmd[700];
+    snprintf(path, size, "%s/%s", g_dir, name);
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s' && mkdir -p '%s'", path, path);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "Cannot create %s\n", path);
+        exit(1);
+    }
+    strncat(path, "/vlog", size - strlen(path) - 1);
+}
+
+static uint64_t _dir_bytes(const char *path)
+{
+    char dir[300];
+    snprintf(dir, sizeof(dir), "%s", path);
+    *strrchr(dir, '/') = '\0';
+    uint64_t bytes = 0;
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    while (d && (e = readdir(d)) != NULL) {
+        char name[600];
+        struct stat st;
+        snprintf(name, sizeof(name), "%s/%s", dir, e->d_name);
+        if (stat(name, &st) == 0 && S_ISREG(st.st_mode)) {
+            bytes += st.st_size;
+        }
+    }
+    if (d) {
+        closedir(d);
+    }
+    return bytes;
+}
+
+/* Programmed flash per record and the records/s that allows, in the SPIFFS model above */
+static void _flash_model(const bench_result_t *r, double *per_record, double *flash_rps)
+{
+    double programmed = (double)r->bytes * FLASH_PAGE / APP_RECORD_LOG_PAGE + (double)r->writes * FLASH_PAGE;
+    double us = programmed / FLASH_PAGE * FLASH_PAGE_PROGRAM_US + programmed / FLASH_SECTOR * FLASH_SECTOR_ERASE_US;
+    *per_record = programmed / r->records;
+    *flash_rps = r->records / (us / 1e6);
+}
+
+static bench_result_t _run_text(uint32_t n)
+{
+    char path[300];
+    _fresh("text", path, sizeof(path));
+    bench_result_t r = { .records = n };
+    FILE *f = NULL;
+    uint32_t part = 0;
+    long size = 0;
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < n; i++) {
+        /* The same retention: a new file every segment size, the oldest removed */
+        if (f == NULL || size >= BENCH_SEGMENT_SIZE) {
+            char name[320];
+            if (f) {
+                fclose(f);
+            }
+            if (part >= BENCH_SEGMENTS) {
+                snprintf(name, sizeof(name), "%s.%08x", path, part - BENCH_SEGMENTS);
+                unlink(name);
+            }
+            snprintf(name, sizeof(name), "%s.%08x", path, part++);
+            f = fopen(name, "w");
+            size = 0;
+        }
+        app_manager_vent_record_t rec;
+        _record_fill(&rec, i);
+        int len = fprintf(f, "%u,%u,%d,%d,%d,%d,%d,%d,%u,%u,%u\n", i, rec.mode, rec.pressure[0], rec.pressure[1],
+                          rec.pressure[2], rec.flow[0], rec.flow[1], rec.flow[2], rec.volume_ml, rec.frequency,
+                          rec.in_time_ms);
+        fflush(f);
+        fsync(fileno(f));
+        size += len;
+        r.bytes += len;
+        r.writes++;
+    }
+    fclose(f);
+    r.secs = (bench_now_ns() - start) / 1e9;
+    return r;
+}
+
+/* Every record there in order with none missing up to the last, the log no larger than its limit */
+static bool _check_log(app_record_log_t *log, const char *path, uint32_t last, uint32_t *read)
+{
+    app_record_reader_t *reader = app_record_reader_new(log);
+    app_record_t rec;
+    uint32_t count = 0, expect = 0;
+    bool ok = true;
+    while (app_record_reader_next(reader, &rec) == ESP_OK) {
+        app_manager_vent_record_t want;
+        if (count == 0) {
+            expect = rec.timestamp;
+        }
+        _record_fill(&want, expect);
+        ok = ok && rec.timestamp == expect && rec.type == APP_MANAGER_RECORD_VENT && rec.len == sizeof(want) &&
+             memcmp(rec.payload, &want, sizeof(want)) == 0;
+        expect++;
+        count++;
+    }
+    app_record_reader_delete(reader);
+    *read = count;
+    return ok && count && expect == last + 1 && _dir_bytes(path) <= (uint64_t)BENCH_SEGMENTS * BENCH_SEGMENT_SIZE;
+}
+
+static bench_result_t _run_binary(const bench_mode_t *mode, uint32_t n, bool *ok, uint32_t *kept)
+{
+    char path[300];
+    _fresh(mode->name, path, sizeof(path));
+    app_record_log_cfg_t cfg = {
+        .path = path,
+        .segment_size = BENCH_SEGMENT_SIZE,
+        .max_segments = BENCH_SEGMENTS,
+        .batch_size = mode->batch_size,
+    };
+    app_record_log_t *log = app_record_log_open(&cfg);
+    bench_result_t r = { .records = n };
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < n; i++) {
+        app_manager_vent_record_t rec;
+        _record_fill(&rec, i);
+        app_record_log_append(log, APP_MANAGER_RECORD_VENT, i, &rec, sizeof(rec));
+    }
+    app_record_log_flush(log);
+    r.secs = (bench_now_ns() - start) / 1e9;
+    app_record_log_stats_t stats;
+    app_record_log_get_stats(log, &stats);
+    r.bytes = stats.bytes;
+    r.writes = stats.writes;
+    *ok = stats.dropped == 0 && _check_log(log, path, n - 1, kept);
+    app_record_log_close(log);
+    return r;
+}
+
+static void _print(const char *name, const bench_result_t *r, bool ok, uint32_t kept)
+{
+    double per_record, flash_rps;
+    _flash_model(r, &per_record, &flash_rps);
+    printf("%-14s %s %9.0f rec/s  %5.1f B/rec in files  %5.3f writes/rec  %6.1f B/rec on flash  %6.0f rec/s flash-bound",
+           name, ok ? "ok  " : "FAIL", r->records / r->secs, (double)r->bytes / r->records,
+           (double)r->writes / r->records, per_record, flash_rps);
+    if (kept) {
+        printf("  %u kept", kept);
+    }
+    printf("\n");
+}
+
+/* Tear the tail of a log of n records, reopen it and go on */
+static void _run_recovery(uint32_t n, uint32_t more)
+{
+    char path[300], name[320];
+    _fresh("recovery", path, sizeof(path));
+    app_record_log_cfg_t cfg = {
+        .path = path,
+        .segment_size = BENCH_SEGMENT_SIZE,
+        .max_segments = BENCH_SEGMENTS,
+        .batch_size = 4 * APP_RECORD_LOG_PAGE,
+    };
+    app_record_log_t *log = app_record_log_open(&cfg);
+    for (uint32_t i = 0; i < n; i++) {
+        app_manager_vent_record_t rec;
+        _record_fill(&rec, i);
+        app_record_log_append(log, APP_MANAGER_RECORD_VENT, i, &rec, sizeof(rec));
+    }
+    app_record_log_close(log);
+
+    /* What a reset in the middle of a write leaves: the start of a record */
+    uint32_t last = 0, first = UINT32_MAX;
+    snprintf(name, sizeof(name), "%s/recovery", g_dir);
+    DIR *d = opendir(name);
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, "vlog.", 5) == 0) {
+            uint32_t s = strtoul(e->d_name + 5, NULL, 16);
+            last = s > last ? s : last;
+            first = s < first ? s : first;
+        }
+    }
+    closedir(d);
+    snprintf(name, sizeof(name), "%s.%08x", path, last);
+    FILE *f = fopen(name, "ab");
+    const uint8_t torn[] = { sizeof(app_manager_vent_record_t), APP_MANAGER_RECORD_VENT, 0x12, 0x34, 0x56, 0x78, 1, 2, 3 };
+    fwrite(torn, 1, sizeof(torn), f);
+    fclose(f);
+
+    log = app_record_log_open(&cfg);
+    app_record_log_stats_t stats;
+    app_record_log_get_stats(log, &stats);
+    bool ok = stats.torn == sizeof(torn) && stats.recovered > 0 && stats.recovery_bytes <= BENCH_SEGMENT_SIZE &&
+              app_record_log_last_timestamp(log) == n - 1 && stats.segments == 1;
+    printf("recovery       %s segments %u..%u, tail %u records in %u bytes read, %u torn, open %lld us\n",
+           ok ? "ok  " : "FAIL", first, last, stats.recovered, stats.recovery_bytes, stats.torn,
+           (long long)stats.recovery_time_us);
+
+    /* Going back in time is refused, it would break the order seeks rely on */
+    app_manager_vent_record_t rec;
+    _record_fill(&rec, n - 2);
+    bool refused = app_record_log_append(log, APP_MANAGER_RECORD_VENT, n - 2, &rec, sizeof(rec)) ==
+                   ESP_ERR_INVALID_ARG;
+    for (uint32_t i = n; i < n + more; i++) {
+        _record_fill(&rec, i);
+        app_record_log_append(log, APP_MANAGER_RECORD_VENT, i, &rec, sizeof(rec));
+    }
+    app_record_log_flush(log);
+    uint32_t kept;
+    uint64_t start = bench_now_ns();
+    ok = _check_log(log, path, n + more - 1, &kept) && refused;
+    double scan_us = (bench_now_ns() - start) / 1e3;
+    printf("after          %s %u records read back in order across the tear, %.0f us to scan them all\n",
+           ok ? "ok  " : "FAIL", kept, scan_us);
+    app_record_log_close(log);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t n = 50000;
+    const char *dir = "/tmp";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:d:")) != -1) {
+        switch (opt) {
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n records] [-d scratch_dir]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (n < 1000) {
+        fprintf(stderr, "Need at least 1000 records\n");
+        return 1;
+    }
+    snprintf(g_dir, sizeof(g_dir), "%s/bench_record_log.%d", dir, (int)getpid());
+
+    size_t size = APP_RECORD_LOG_OVERHEAD + sizeof(app_manager_vent_record_t);
+    printf("%u telemetry records of %zu bytes (%zu payload), %d x %d KB segments\n", n, size,
+           sizeof(app_manager_vent_record_t), BENCH_SEGMENTS, BENCH_SEGMENT_SIZE / 1024);
+    bench_result_t r = _run_text(n);
+    _print("text lines", &r, true, 0);
+
+    const bench_mode_t modes[] = {
+        { "unbatched", 0 },
+        { "1 page", APP_RECORD_LOG_PAGE },
+        { "4 pages", 4 * APP_RECORD_LOG_PAGE },
+    };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        bench_mode_t m = modes[i];
+        bool ok;
+        uint32_t kept;
+        m.batch_size = m.batch_size ? m.batch_size : size;
+        r = _run_binary(&m, n, &ok, &kept);
+        _print(m.name, &r, ok, kept);
+    }
+    _run_recovery(n, 1000);
+
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", g_dir);
+    return system(cmd);
+}
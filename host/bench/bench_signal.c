@@ -0,0 +1,251 @@
+/*
+ * Signal path kernels in double, float and Q16.16 fixed point.
+ *
+ * Records the airway pressure and flow of the CMV control loop on the
+ * simulated lung, then runs the per-sample kernels of app_signal.h over
+ * it: low-pass both signals, integrate the flow to a volume and run the
+ * PEEP controller on the pressure, each on its own and chained as the
+ * 1 kHz path does. The double versions are the same code with every
+ * float replaced. Prints ns and cycles per sample and the largest
+ * difference of the float and fixed point results from the double ones.
+ *
+ * On the host the FPU handles double as fast as float, so this mostly
+ * shows that the float and Q16 paths are no slower and accurate enough;
+ * on the ESP32 the double column is software floating point.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "app_control.h"
+#include "app_signal.h"
+#include "bench_common.h"
+#include "bench_lung.h"
+
+#define BENCH_LOWPASS_ALPHA     0.2f
+#define BENCH_KP                0.2f
+#define BENCH_KI_DT             0.004f
+#define BENCH_PEEP              5.0f
+#define BENCH_FLOW_SCALE        (1000.0f / 60 / 1000)      /* ml per L/min over 1 ms */
+
+typedef enum {
+    BENCH_LOWPASS,
+    BENCH_INTEGRATE,
+    BENCH_PI,
+    BENCH_CHAIN,
+} bench_kernel_t;
+
+static const char *s_kernel_names[] = { "low-pass", "integrate", "PI", "chain" };
+
+static inline double _lowpass_d(double *y, double x, double alpha)
+{
+    *y += alpha * (x - *y);
+    return *y;
+}
+
+static inline double _pi_d(double *integral, double error, double kp, double ki_dt, double lo, double hi)
+{
+    double i = *integral + ki_dt * error;
+    double u = kp * error + i;
+    if ((u < hi || error < 0) && (u > lo || error > 0)) {
+        *integral = i;
+    } else {
+        u = kp * error + *integral;
+    }
+    return u < lo ? lo : u > hi ? hi : u;
+}
+
+static inline double _integrate_d(double *sum, double rate, double scale)
+{
+    *sum += rate * scale;
+    return *sum;
+}
+
+/* The same loops for every type, out gets one result per sample */
+static void _run_d(bench_kernel_t kernel, const double *p, const double *q, double *out, size_t n)
+{
+    double pf = 0, qf = 0, vol = 0, integral = 0;
+    switch (kernel) {
+        case BENCH_LOWPASS:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = _lowpass_d(&pf, p[i], BENCH_LOWPASS_ALPHA);
+            }
+            break;
+        case BENCH_INTEGRATE:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = _integrate_d(&vol, q[i], BENCH_FLOW_SCALE);
+            }
+            break;
+        case BENCH_PI:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = _pi_d(&integral, p[i] - BENCH_PEEP, BENCH_KP, BENCH_KI_DT, 0, 1);
+            }
+            break;
+        case BENCH_CHAIN:
+            for (size_t i = 0; i < n; i++) {
+                double pv = _lowpass_d(&pf, p[i], BENCH_LOWPASS_ALPHA);
+                double qv = _lowpass_d(&qf, q[i], BENCH_LOWPASS_ALPHA);
+                _integrate_d(&vol, qv, BENCH_FLOW_SCALE);
+                out[i] = _pi_d(&integral, pv - BENCH_PEEP, BENCH_KP, BENCH_KI_DT, 0, 1) + vol;
+            }
+            break;
+    }
+}
+
+static void _run_f(bench_kernel_t kernel, const float *p, const float *q, float *out, size_t n)
+{
+    float pf = 0, qf = 0, vol = 0, integral = 0;
+    switch (kernel) {
+        case BENCH_LOWPASS:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = app_lowpass(&pf, p[i], BENCH_LOWPASS_ALPHA);
+            }
+            break;
+        case BENCH_INTEGRATE:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = app_integrate(&vol, q[i], BENCH_FLOW_SCALE);
+            }
+            break;
+        case BENCH_PI:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = app_pi(&integral, p[i] - BENCH_PEEP, BENCH_KP, BENCH_KI_DT, 0, 1);
+            }
+            break;
+        case BENCH_CHAIN:
+            for (size_t i = 0; i < n; i++) {
+                float pv = app_lowpass(&pf, p[i], BENCH_LOWPASS_ALPHA);
+                float qv = app_lowpass(&qf, q[i], BENCH_LOWPASS_ALPHA);
+                app_integrate(&vol, qv, BENCH_FLOW_SCALE);
+                out[i] = app_pi(&integral, pv - BENCH_PEEP, BENCH_KP, BENCH_KI_DT, 0, 1) + vol;
+            }
+            break;
+    }
+}
+
+static void _run_q16(bench_kernel_t kernel, const app_q16_t *p, const app_q16_t *q, app_q16_t *out, size_t n)
+{
+    app_q16_t pf = 0, qf = 0, vol = 0, integral = 0;
+    switch (kernel) {
+        case BENCH_LOWPASS:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = app_lowpass_q16(&pf, p[i], APP_Q16(BENCH_LOWPASS_ALPHA));
+            }
+            break;
+        case BENCH_INTEGRATE:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = app_integrate_q16(&vol, q[i], APP_Q16(BENCH_FLOW_SCALE));
+            }
+            break;
+        case BENCH_PI:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = app_pi_q16(&integral, p[i] - APP_Q16(BENCH_PEEP), APP_Q16(BENCH_KP), APP_Q16(BENCH_KI_DT), 0,
+                                    APP_Q16_ONE);
+            }
+            break;
+        case BENCH_CHAIN:
+            for (size_t i = 0; i < n; i++) {
+                app_q16_t pv = app_lowpass_q16(&pf, p[i], APP_Q16(BENCH_LOWPASS_ALPHA));
+                app_q16_t qv = app_lowpass_q16(&qf, q[i], APP_Q16(BENCH_LOWPASS_ALPHA));
+                app_integrate_q16(&vol, qv, APP_Q16(BENCH_FLOW_SCALE));
+                out[i] = app_pi_q16(&integral, pv - APP_Q16(BENCH_PEEP), APP_Q16(BENCH_KP), APP_Q16(BENCH_KI_DT), 0,
+                                    APP_Q16_ONE) + vol;
+            }
+            break;
+    }
+}
+
+typedef struct {
+    double ns;
+    double cycles;
+} bench_cost_t;
+
+#define BENCH_TIME(cost, reps, n, call) do { \
+    uint64_t _t0 = bench_now_ns(), _c0 = bench_cycles(); \
+    for (int _r = 0; _r < (reps); _r++) { \
+        call; \
+    } \
+    (cost).cycles = (double)(bench_cycles() - _c0) / ((reps) * (double)(n)); \
+    (cost).ns = (double)(bench_now_ns() - _t0) / ((reps) * (double)(n)); \
+} while (0)
+
+/* CMV on the simulated lung, what the pressure and flow sensors show */
+static void _record(double *p, double *q, size_t n)
+{
+    app_control_settings_t set = APP_CONTROL_SETTINGS_DEFAULT;
+    app_control_state_t st;
+    bench_lung_t lung = BENCH_LUNG_ADULT;
+    app_control_input_t in;
+    app_control_output_t out;
+    app_control_init(&st, WORKING_MODE__CMV, &set, 1000);
+    srand(1);
+    for (size_t i = 0; i < n; i++) {
+        bench_lung_read(&lung, &in);
+        app_control_step(&st, &in, &out);
+        bench_lung_step(&lung, &out, 1);
+        /* A little sensor noise */
+        p[i] = in.pressure + (rand() % 201 - 100) / 1000.0;
+        q[i] = in.flow + (rand() % 201 - 100) / 100.0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = 60000;
+    int reps = 50;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:r:")) != -1) {
+        switch (opt) {
+            case 's':
+                n = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                reps = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s samples] [-r repeats]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    double *pd = malloc(n * sizeof(double)), *qd = malloc(n * sizeof(double)), *outd = malloc(n * sizeof(double));
+    float *pf = malloc(n * sizeof(float)), *qf = malloc(n * sizeof(float)), *outf = malloc(n * sizeof(float));
+    app_q16_t *pq = malloc(n * sizeof(app_q16_t)), *qq = malloc(n * sizeof(app_q16_t));
+    app_q16_t *outq = malloc(n * sizeof(app_q16_t));
+    _record(pd, qd, n);
+    for (size_t i = 0; i < n; i++) {
+        pf[i] = pd[i];
+        qf[i] = qd[i];
+        pq[i] = app_q16_from_float(pf[i]);
+        qq[i] = app_q16_from_float(qf[i]);
+    }
+
+    printf("%zu samples of CMV pressure and flow, per sample:\n", n);
+    for (bench_kernel_t kernel = BENCH_LOWPASS; kernel <= BENCH_CHAIN; kernel++) {
+        bench_cost_t d, f, q;
+        BENCH_TIME(d, reps, n, _run_d(kernel, pd, qd, outd, n));
+        BENCH_TIME(f, reps, n, _run_f(kernel, pf, qf, outf, n));
+        BENCH_TIME(q, reps, n, _run_q16(kernel, pq, qq, outq, n));
+        double err_f = 0, err_q = 0, range = 0;
+        for (size_t i = 0; i < n; i++) {
+            err_f = fmax(err_f, fabs(outf[i] - outd[i]));
+            err_q = fmax(err_q, fabs(app_q16_to_float(outq[i]) - outd[i]));
+            range = fmax(range, fabs(outd[i]));
+        }
+        printf("%-10s double %5.2f ns %5.1f cyc | float %5.2f ns %5.1f cyc, max err %.1e | "
+               "q16 %5.2f ns %5.1f cyc, max err %.1e | of %.1f\n",
+               s_kernel_names[kernel], d.ns, d.cycles, f.ns, f.cycles, err_f, q.ns, q.cycles, err_q, range);
+    }
+    free(pd);
+    free(qd);
+    free(outd);
+    free(pf);
+    free(qf);
+    free(outf);
+    free(pq);
+    free(qq);
+    free(outq);
+    return 0;
+}
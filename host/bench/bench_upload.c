@@ -0,0 +1,336 @@
+/*
+ * File upload throughput over a simulated BLE link.
+ *
+ * The device side is the real custom-data endpoint and app_manager behind
+ * the bench_link simulation. Compares the lock-step upload (one write + one
+ * read per chunk) with the pipelined upload (tagged chunks, cumulative acks
+ * read every CONFIG_FILE_UPLOAD_ACK_INTERVAL chunks, go-back-N on a gap). With -x the link drops every that many
+ * bytes; the client then asks where to resume (a chunk without data) and
+ * carries on from there. Between the two the first chunk is sent again
+ * with the file's checksum, which must not start the finished file over.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include "esp_log.h"
+#include "app_manager.h"
+#include "ble_prov_custom_data.h"
+#include "openvent.pb-c.h"
+#include "app_crc32.h"
+#include "bench_common.h"
+#include "bench_link.h"
+
+#define BENCH_ACCESS_KEY        "0000"
+#define BENCH_ACK_INTERVAL      4
+
+typedef struct {
+    const char *file_name;
+    const uint8_t *data;
+    uint32_t file_size;
+    uint32_t chunk_size;
+    int window;
+    uint32_t drop_every;        /* Bytes sent per connection, 0 = never drop */
+    uint32_t start;             /* Offset this connection starts at */
+    bool dropped;
+} bench_upload_t;
+
+static esp_err_t _bench_event_handler(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    if (req->cmd == COMMAND__WriteFileRequest) {
+        return app_manager_file_handle(ctx, req, resp);
+    }
+    return app_manager_response(resp);
+}
+
+/* The last chunk carries the file's CRC-32, others too with `checksum` */
+static size_t _pack_chunk(bench_upload_t *up, uint32_t offset, bool checksum, uint8_t *out)
+{
+    FileData file_data = FILE_DATA__INIT;
+    VentRequest req = VENT_REQUEST__INIT;
+    file_data.file_name = (char *)up->file_name;
+    file_data.file_size = up->file_size;
+    file_data.offset = offset;
+    file_data.data.data = (uint8_t *)up->data + offset;
+    file_data.data.len = up->file_size - offset < up->chunk_size ? up->file_size - offset : up->chunk_size;
+    if (checksum || offset + file_data.data.len == up->file_size) {
+        file_data.checksum = app_crc32_update(0, up->data, up->file_size);
+    }
+    req.cmd = COMMAND__WriteFileRequest;
+    req.access_key = BENCH_ACCESS_KEY;
+    req.write_file_request = &file_data;
+    return vent_request__pack(&req, out);
+}
+
+static bool _link_dropped(bench_upload_t *up, uint32_t sent_to)
+{
+    up->dropped = up->drop_every && sent_to - up->start >= up->drop_every;
+    return up->dropped;
+}
+
+/* Ask the device where to continue, after reconnecting */
+static bool _resume_query(bench_link_t *link, bench_upload_t *up)
+{
+    uint8_t packed[256];
+    FileData file_data = FILE_DATA__INIT;
+    VentRequest req = VENT_REQUEST__INIT;
+    file_data.file_name = (char *)up->file_name;
+    file_data.file_size = up->file_size;
+    req.cmd = COMMAND__WriteFileRequest;
+    req.access_key = BENCH_ACCESS_KEY;
+    req.write_file_request = &file_data;
+    uint8_t *reply;
+    ssize_t reply_len;
+    bench_link_write(link, packed, vent_request__pack(&req, packed), &reply, &reply_len);
+    bench_link_read(link, reply_len);
+    VentResponse *resp = vent_response__unpack(NULL, reply_len, reply);
+    bool ok = resp && resp->status == STATUS__Success && resp->read_file_response;
+    if (ok) {
+        up->start = resp->read_file_response->offset;
+    }
+    vent_response__free_unpacked(resp, NULL);
+    free(reply);
+    return ok;
+}
+
+static bool _upload_lockstep(bench_link_t *link, bench_upload_t *up)
+{
+    uint8_t *packed = malloc(up->chunk_size + 256);
+    uint32_t offset = up->start;
+    bool ok = true;
+    while (ok && offset < up->file_size && !_link_dropped(up, offset)) {
+        size_t len = _pack_chunk(up, offset, false, packed);
+        uint8_t *reply;
+        ssize_t reply_len;
+        bench_link_write(link, packed, len, &reply, &reply_len);
+        bench_link_read(link, reply_len);
+        VentResponse *resp = vent_response__unpack(NULL, reply_len, reply);
+        ok = resp && resp->status == STATUS__Success && resp->read_file_response;
+        if (ok) {
+            offset = resp->read_file_response->offset;
+        }
+        vent_response__free_unpacked(resp, NULL);
+        free(reply);
+    }
+    free(packed);
+    return ok;
+}
+
+static bool _upload_pipelined(bench_link_t *link, bench_upload_t *up)
+{
+    uint8_t *packed = malloc(up->chunk_size + 256);
+    uint32_t acked = up->start, next = up->start, last_sent = up->start;
+    int since_read = 0;
+    uint16_t seq = 0;
+    bool ok = true;
+
+    while (ok && acked < up->file_size) {
+        size_t len;
+        if (_link_dropped(up, next)) {
+            /* Let the device finish what it got, then collect the leftovers like a reconnect would */
+            usleep(10000);
+            uint8_t poll = APP_MANAGER_TAG_MARKER;
+            uint8_t *reply;
+            ssize_t reply_len;
+            do {
+                bench_link_write(link, &poll, 1, &reply, &reply_len);
+                free(reply);
+            } while (reply_len > APP_MANAGER_TAG_REPLY_HDR_LEN);
+            break;
+        }
+        bool window_open = next < up->file_size && (next - acked) / up->chunk_size < (uint32_t)up->window;
+        if (window_open) {
+            packed[0] = APP_MANAGER_TAG_MARKER;
+            packed[1] = seq & 0xff;
+            packed[2] = seq >> 8;
+            seq++;
+            len = APP_MANAGER_TAG_REQ_HDR_LEN + _pack_chunk(up, next, false, packed + APP_MANAGER_TAG_REQ_HDR_LEN);
+            last_sent = next;
+            next = next + up->chunk_size < up->file_size ? next + up->chunk_size : up->file_size;
+            since_read++;
+        } else {
+            /* Window full or everything sent: poll */
+            packed[0] = APP_MANAGER_TAG_MARKER;
+            len = 1;
+        }
+        uint8_t *reply;
+        ssize_t reply_len;
+        bench_link_write(link, packed, len, &reply, &reply_len);
+        if (window_open && since_read < BENCH_ACK_INTERVAL && next < up->file_size) {
+            /* Acks are cumulative, skipping this reply loses nothing */
+            free(reply);
+            continue;
+        }
+        bench_link_read(link, reply_len);
+        since_read = 0;
+
+        if (reply_len < APP_MANAGER_TAG_REPLY_HDR_LEN || reply[0] != APP_MANAGER_TAG_MARKER) {
+            ok = false;
+        } else if (reply[1] & APP_MANAGER_TAG_FLAG_BUSY && window_open) {
+            next = last_sent;
+        }
+        size_t pos = APP_MANAGER_TAG_REPLY_HDR_LEN;
+        for (int i = 0; ok && i < reply[2]; i++) {
+            size_t entry_len = reply[pos + 2] | (reply[pos + 3] << 8);
+            pos += APP_MANAGER_TAG_ENTRY_HDR_LEN;
+            VentResponse *resp = vent_response__unpack(NULL, entry_len, reply + pos);
+            pos += entry_len;
+            if (resp == NULL || resp->read_file_response == NULL) {
+                ok = false;
+            } else if (resp->status == STATUS__Success) {
+                if (resp->read_file_response->offset > acked) {
+                    acked = resp->read_file_response->offset;
+                }
+            } else if (resp->read_file_response->offset >= acked) {
+                /* Gap: go back to the first byte the device is missing */
+                acked = resp->read_file_response->offset;
+                next = acked;
+            }
+            vent_response__free_unpacked(resp, NULL);
+        }
+        free(reply);
+    }
+    free(packed);
+    return ok;
+}
+
+static bool _verify(const char *file_name, const uint8_t *data, uint32_t size)
+{
+    FILE *f = fopen(file_name, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    uint8_t *buf = malloc(size + 1);
+    size_t n = fread(buf, 1, size + 1, f);
+    fclose(f);
+    bool ok = n == size && memcmp(buf, data, size) == 0;
+    free(buf);
+    return ok;
+}
+
+/* The first chunk again once the file is complete, as when its ack was lost: acknowledged, the file kept */
+static void _resend_first(bench_link_t *link, bench_upload_t *up)
+{
+    uint8_t *packed = malloc(up->chunk_size + 256);
+    uint8_t *reply;
+    ssize_t reply_len;
+    bench_link_write(link, packed, _pack_chunk(up, 0, true, packed), &reply, &reply_len);
+    bench_link_read(link, reply_len);
+    VentResponse *resp = vent_response__unpack(NULL, reply_len, reply);
+    uint32_t offset = resp && resp->status == STATUS__Success && resp->read_file_response ?
+                      resp->read_file_response->offset : 0;
+    bool ok = offset == up->file_size && _verify(up->file_name, up->data, up->file_size);
+    printf("%-10s %s first chunk acknowledged at %u, file kept\n", "resent", ok ? "ok  " : "FAIL", offset);
+    vent_response__free_unpacked(resp, NULL);
+    free(reply);
+    free(packed);
+}
+
+typedef bool (*bench_upload_fn)(bench_link_t *link, bench_upload_t *up);
+
+static void _run(const char *name, bench_upload_fn fn, bench_link_t *link, bench_upload_t *up)
+{
+    int drops = 0;
+    link->writes = link->reads = 0;
+    up->start = 0;
+    unlink(up->file_name);
+    uint64_t start = bench_now_ns();
+    bool ok = fn(link, up);
+    while (ok && up->dropped) {
+        drops++;
+        ok = _resume_query(link, up) && fn(link, up);
+    }
+    double secs = (bench_now_ns() - start) / 1e9;
+    ok = ok && _verify(up->file_name, up->data, up->file_size);
+    double raw_secs = up->file_size / link->bytes_per_us / 1e6;
+    printf("%-10s %s %8.2f s %9.1f KB/s  %5.1f%% of link  writes=%u reads=%u drops=%d\n",
+           name, ok ? "ok  " : "FAIL", secs, up->file_size / 1024.0 / secs,
+           100.0 * raw_secs / secs, link->writes, link->reads, drops);
+}
+
+int main(int argc, char **argv)
+{
+    double rtt_ms = 15;
+    double kbps = 40;
+    uint32_t file_size = 32 * 1024;
+    uint32_t chunk_size = 480;
+    int window = 8;
+    uint32_t drop_every = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:b:s:c:w:x:")) != -1) {
+        switch (opt) {
+            case 'r':
+                rtt_ms = atof(optarg);
+                break;
+            case 'b':
+                kbps = atof(optarg);
+                break;
+            case 's':
+                file_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                chunk_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                window = atoi(optarg);
+                break;
+            case 'x':
+                drop_every = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-r rtt_ms] [-b link_KB_per_s] [-s file_size] [-c chunk_size] [-w window] [-x drop_every_bytes]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    app_manager_cfg_t app_man_cfg = {
+        .input_rb_size = 8 * 1024,
+        .output_rb_size = 2 * 1024,
+        .access_key = BENCH_ACCESS_KEY,
+        .event_handler = _bench_event_handler,
+    };
+    if (app_manager_init(&app_man_cfg) != ESP_OK) {
+        fprintf(stderr, "app_manager_init failed\n");
+        return 1;
+    }
+    bench_link_t link = {
+        .rtt_us = rtt_ms * 1000,
+        .bytes_per_us = kbps * 1024 / 1e6,
+        .endpoint = ble_prov_custom_data_new(app_manager_get_output_rb(), app_manager_get_input_rb()),
+    };
+
+    char tmp_dir[] = "/tmp/openvent-upload-XXXXXX";
+    if (mkdtemp(tmp_dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char file_name[64];
+    snprintf(file_name, sizeof(file_name), "%s/upload.bin", tmp_dir);
+    uint8_t *data = malloc(file_size);
+    for (uint32_t i = 0; i < file_size; i++) {
+        data[i] = (uint8_t)(i * 31 + (i >> 8));
+    }
+    bench_upload_t up = {
+        .file_name = file_name,
+        .data = data,
+        .file_size = file_size,
+        .chunk_size = chunk_size,
+        .window = window,
+        .drop_every = drop_every,
+    };
+
+    printf("upload %u bytes in %u byte chunks, rtt %.1f ms, link %.1f KB/s, window %d, drop every %u bytes\n",
+           file_size, chunk_size, rtt_ms, kbps, window, drop_every);
+    _run("lock-step", _upload_lockstep, &link, &up);
+    _resend_first(&link, &up);
+    _run("pipelined", _upload_pipelined, &link, &up);
+
+    unlink(file_name);
+    rmdir(tmp_dir);
+    free(data);
+    return 0;
+}
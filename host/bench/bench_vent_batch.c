@@ -0,0 +1,171 @@
+/*
+ * Compact VentData batches against repeated VentData.
+ *
+ * Encodes a synthetic 1 kHz recording (15 breaths/min, 500 ml tidal volume
+ * with a little sensor noise) in batches of several sizes, as a packed
+ * VentResponse with vent_data_response the way VentDataRequest answered so
+ * far, and as an app_vent_batch. Prints bytes and encode ns per sample,
+ * the decode cost of the reference decoder and how many samples fit one
+ * frame, and checks that every batch decodes back to what went in.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "app_sample_ring.h"
+#include "app_vent_batch.h"
+#include "openvent.pb-c.h"
+#include "vent_batch_decode.h"
+#include "bench_common.h"
+
+#define BENCH_FRAME_ROOM        500     /* A 512 byte frame less the VentResponse around it */
+
+static void _recording(app_sample_t *samples, size_t count, int noise_ml)
+{
+    const double cycle_ms = 4000, in_ms = 1200, tidal_ml = 500;
+    srand(1);
+    for (size_t i = 0; i < count; i++) {
+        double t = fmod((double)i, cycle_ms);
+        double v = t < in_ms ? tidal_ml * sin(M_PI / 2 * t / in_ms) : tidal_ml * exp(-(t - in_ms) / 400);
+        int jitter = noise_ml ? rand() % (2 * noise_ml + 1) - noise_ml : 0;
+        samples[i].timestamp = 1000 + (uint32_t)i;
+        samples[i].volume = v + jitter > 0 ? (uint32_t)(v + jitter) : 0;
+        samples[i].frequency = 15 + (uint32_t)(i / 60000);
+        samples[i].breath_in_time = in_ms / 1000;
+    }
+}
+
+static size_t _pack_protobuf(const app_sample_t *samples, size_t count, VentData *data, VentData **ptrs,
+                             uint8_t *out)
+{
+    VentResponse resp = VENT_RESPONSE__INIT;
+    for (size_t i = 0; i < count; i++) {
+        vent_data__init(&data[i]);
+        data[i].timestamp = samples[i].timestamp;
+        data[i].breath_circulating_volumn = samples[i].volume;
+        data[i].breathing_frequency = samples[i].frequency;
+        data[i].breath_in_time = samples[i].breath_in_time;
+        ptrs[i] = &data[i];
+    }
+    resp.status = STATUS__Success;
+    resp.n_vent_data_response = count;
+    resp.vent_data_response = ptrs;
+    return vent_response__pack(&resp, out);
+}
+
+/* Samples of the recording that fit one frame as repeated VentData */
+static size_t _protobuf_per_frame(const app_sample_t *samples, size_t count)
+{
+    size_t len = 2, n = 0;
+    for (; n < count; n++) {
+        VentData data = VENT_DATA__INIT;
+        data.timestamp = samples[n].timestamp;
+        data.breath_circulating_volumn = samples[n].volume;
+        data.breathing_frequency = samples[n].frequency;
+        data.breath_in_time = samples[n].breath_in_time;
+        len += vent_data__get_packed_size(&data) + 2;
+        if (len > BENCH_FRAME_ROOM) {
+            break;
+        }
+    }
+    return n;
+}
+
+static bool _same(const app_sample_t *s, const vent_batch_sample_t *d)
+{
+    return s->timestamp == d->timestamp && s->volume == d->volume && s->frequency == d->frequency &&
+           fabs(s->breath_in_time * 1000 - d->breath_in_time_ms) <= 0.5;
+}
+
+static void _run(const app_sample_t *samples, size_t total, size_t batch)
+{
+    size_t out_size = batch * 64 + 64;
+    uint8_t *out = malloc(out_size);
+    VentData *data = malloc(batch * sizeof(VentData));
+    VentData **ptrs = malloc(batch * sizeof(VentData *));
+    vent_batch_sample_t *decoded = malloc(batch * sizeof(vent_batch_sample_t));
+    size_t batches = total / batch;
+    uint64_t pb_bytes = 0, vb_bytes = 0;
+    bool ok = true;
+
+    uint64_t start = bench_now_ns();
+    for (size_t b = 0; b < batches; b++) {
+        pb_bytes += _pack_protobuf(samples + b * batch, batch, data, ptrs, out);
+    }
+    uint64_t pb_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (size_t b = 0; b < batches; b++) {
+        size_t encoded;
+        vb_bytes += app_vent_batch_encode(samples + b * batch, batch, out, out_size, &encoded);
+        ok = ok && encoded == batch;
+    }
+    uint64_t vb_ns = bench_now_ns() - start;
+
+    uint64_t dec_ns = 0;
+    for (size_t b = 0; b < batches; b++) {
+        size_t encoded;
+        size_t len = app_vent_batch_encode(samples + b * batch, batch, out, out_size, &encoded);
+        start = bench_now_ns();
+        int n = vent_batch_decode(out, len, decoded, batch);
+        dec_ns += bench_now_ns() - start;
+        ok = ok && n == (int)batch;
+        for (int i = 0; ok && i < n; i++) {
+            ok = _same(&samples[b * batch + i], &decoded[i]);
+        }
+    }
+
+    size_t n = batches * batch;
+    printf("batch %4zu  VentData %5.2f B %6.1f ns  |  compact %s %5.2f B %6.1f ns, decode %5.1f ns  |  %4.1fx smaller\n",
+           batch, (double)pb_bytes / n, (double)pb_ns / n, ok ? "ok  " : "FAIL", (double)vb_bytes / n,
+           (double)vb_ns / n, (double)dec_ns / n, (double)pb_bytes / vb_bytes);
+    free(out);
+    free(data);
+    free(ptrs);
+    free(decoded);
+}
+
+int main(int argc, char **argv)
+{
+    size_t total = 240000;
+    int noise_ml = 2;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+        switch (opt) {
+            case 's':
+                total = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                noise_ml = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s samples] [-n noise_ml]\n", argv[0]);
+                return 1;
+        }
+    }
+    app_sample_t *samples = malloc(total * sizeof(app_sample_t));
+    _recording(samples, total, noise_ml);
+
+    printf("%zu samples at 1 kHz, volume noise +-%d ml, per sample:\n", total, noise_ml);
+    size_t batches[] = { 16, 64, 256, 1024 };
+    for (size_t i = 0; i < sizeof(batches) / sizeof(batches[0]); i++) {
+        _run(samples, total, batches[i]);
+    }
+
+    /* Per frame, averaged over the recording */
+    uint8_t frame[BENCH_FRAME_ROOM];
+    size_t pb_total = 0, vb_total = 0, frames = 0;
+    for (size_t pos = 0; pos + 2048 <= total; pos += 997, frames++) {
+        size_t encoded;
+        pb_total += _protobuf_per_frame(samples + pos, 2048);
+        app_vent_batch_encode(samples + pos, 2048, frame, sizeof(frame), &encoded);
+        vb_total += encoded;
+    }
+    printf("samples per %d byte frame: VentData %.1f, compact %.1f\n", BENCH_FRAME_ROOM,
+           (double)pb_total / frames, (double)vb_total / frames);
+    free(samples);
+    return 0;
+}
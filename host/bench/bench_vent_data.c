@@ -0,0 +1,313 @@
+/*
+ * VentDataRequest: sample ring and batched reads.
+ *
+ * First hammers an app_sample_ring with a producer task pushing as fast as
+ * it can while this thread reads it by cursor, checking that no sample comes
+ * out torn, twice or out of order, and that every skipped one was reported
+ * lost. Then runs the real sampler at CONFIG_VENT_DATA_RATE_HZ with a
+ * synthetic source and polls VentDataRequest through the custom-data
+ * endpoint, without a link delay and over a simulated BLE link, dropping
+ * every -l-th reply to check a retry with the same cursor loses nothing.
+ * Each poll is run with repeated VentData and with compact batches.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_log.h"
+#include "app_manager.h"
+#include "app_sample_ring.h"
+#include "ble_prov_custom_data.h"
+#include "openvent.pb-c.h"
+#include "bench_common.h"
+#include "bench_link.h"
+#include "vent_batch_decode.h"
+
+#define BENCH_ACCESS_KEY        "0000"
+
+/* Every field follows from the sample number, so a torn sample shows */
+static void _synthetic_fill(app_sample_t *sample, uint32_t k)
+{
+    sample->volume = k;
+    sample->frequency = k * 7 + 3;
+    sample->breath_in_time = (float)(k & 0xffff) / 8;
+}
+
+static bool _synthetic_check(uint32_t volume, uint32_t frequency, double breath_in_time)
+{
+    return frequency == volume * 7 + 3 && breath_in_time == (float)(volume & 0xffff) / 8;
+}
+
+static void _synthetic_read(app_sample_t *sample, void *arg)
+{
+    uint32_t *k = arg;
+    _synthetic_fill(sample, (*k)++);
+}
+
+/* Ring stress: producer task against this thread */
+
+typedef struct {
+    app_sample_ring_t *ring;
+    uint32_t count;
+    volatile bool done;
+} bench_producer_t;
+
+static void _producer_task(void *arg)
+{
+    bench_producer_t *prod = arg;
+    for (uint32_t k = 0; k < prod->count; k++) {
+        app_sample_t sample;
+        _synthetic_fill(&sample, k);
+        sample.timestamp = k + 1;
+        app_sample_ring_push(prod->ring, &sample);
+    }
+    prod->done = true;
+    vTaskDelete(NULL);
+}
+
+static void _run_stress(size_t ring_size, uint32_t count, size_t batch)
+{
+    bench_producer_t prod = {
+        .ring = app_sample_ring_new(ring_size),
+        .count = count,
+    };
+    app_sample_t *out = malloc(batch * sizeof(app_sample_t));
+    uint32_t cursor = 0, first = 0, received = 0, skipped = 0, unreported = 0, bad = 0, reads = 0;
+
+    uint64_t start = bench_now_ns();
+    xTaskCreate(_producer_task, "producer", 4096, &prod, 5, NULL);
+    while (true) {
+        bool done = prod.done;
+        bool lost;
+        size_t n = app_sample_ring_read(prod.ring, cursor, out, batch, &lost);
+        reads++;
+        for (size_t i = 0; i < n; i++) {
+            app_sample_t *s = &out[i];
+            if (!_synthetic_check(s->volume, s->frequency, s->breath_in_time) || s->volume + 1 != s->timestamp ||
+                    (int32_t)(s->timestamp - cursor) <= 0) {
+                bad++;
+                continue;
+            }
+            uint32_t gap = s->timestamp - cursor - 1;
+            if (cursor == 0) {
+                /* Started at the oldest sample held */
+                first = s->timestamp;
+            } else if (gap) {
+                skipped += gap;
+                unreported += i == 0 && lost ? 0 : gap;
+            }
+            cursor = s->timestamp;
+            received++;
+        }
+        if (done && n == 0) {
+            break;
+        }
+    }
+    double secs = (bench_now_ns() - start) / 1e9;
+    bool ok = first && first - 1 + received + skipped == count && bad == 0 && unreported == 0;
+    printf("ring %5zu batch %3zu: %s %u pushed %.1f M/s, %u read in %u reads, %u overwritten (%u unreported), %u bad\n",
+           ring_size, batch, ok ? "ok  " : "FAIL", count, count / secs / 1e6, received, reads, skipped, unreported, bad);
+    free(out);
+    app_sample_ring_delete(prod.ring);
+}
+
+/* VentDataRequest polling */
+
+static esp_err_t _bench_event_handler(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    if (req->cmd == COMMAND__VentDataRequest) {
+        return app_manager_vent_data_handle(ctx, req, resp);
+    }
+    return app_manager_response(resp);
+}
+
+typedef struct {
+    uint32_t cursor;
+    uint32_t last_volume;
+    uint32_t received;
+    uint32_t missed;
+    uint32_t dups;
+    uint32_t bad;
+} bench_poll_t;
+
+static void _poll_sample(bench_poll_t *poll, uint32_t period_ms, uint32_t timestamp, uint32_t volume, bool valid)
+{
+    if (!valid) {
+        poll->bad++;
+    } else if (poll->cursor && (int32_t)(timestamp - poll->cursor) <= 0) {
+        poll->dups++;
+    } else {
+        if (poll->cursor) {
+            uint32_t gap = (timestamp - poll->cursor) / period_ms - 1;
+            poll->missed += gap;
+            if (volume - poll->last_volume != gap + 1) {
+                poll->bad++;
+            }
+        }
+        poll->cursor = timestamp;
+        poll->last_volume = volume;
+        poll->received++;
+    }
+}
+
+/* Samples in the reply, or -1 if it is malformed */
+static int _poll_reply(bench_poll_t *poll, uint32_t period_ms, bool compact, VentResponse *resp)
+{
+    static vent_batch_sample_t decoded[1024];
+    if (resp == NULL || resp->status != STATUS__Success) {
+        return -1;
+    }
+    if (compact) {
+        FileData *batch = resp->read_file_response;
+        if (batch == NULL) {
+            return -1;
+        }
+        if (batch->data.len == 0) {
+            return 0;
+        }
+        int n = vent_batch_decode(batch->data.data, batch->data.len, decoded, 1024);
+        if (n < 0 || (uint32_t)n != batch->file_size || batch->offset != decoded[n - 1].timestamp) {
+            return -1;
+        }
+        for (int i = 0; i < n; i++) {
+            vent_batch_sample_t *d = &decoded[i];
+            bool valid = d->frequency == d->volume * 7 + 3 && d->breath_in_time_ms == (d->volume & 0xffff) * 125;
+            _poll_sample(poll, period_ms, d->timestamp, d->volume, valid);
+        }
+        return n;
+    }
+    for (size_t i = 0; i < resp->n_vent_data_response; i++) {
+        VentData *d = resp->vent_data_response[i];
+        bool valid = _synthetic_check(d->breath_circulating_volumn, d->breathing_frequency, d->breath_in_time);
+        _poll_sample(poll, period_ms, d->timestamp, d->breath_circulating_volumn, valid);
+    }
+    return resp->n_vent_data_response;
+}
+
+static void _run_poll(const char *name, bench_link_t *link, double secs, uint32_t period_ms, int drop_every,
+                      bool compact)
+{
+    uint8_t packed[64];
+    bench_poll_t poll = { 0 };
+    uint32_t polls = 0, drops = 0;
+    link->writes = link->reads = 0;
+
+    uint64_t start = bench_now_ns();
+    uint64_t end = start + (uint64_t)(secs * 1e9);
+    while (bench_now_ns() < end) {
+        FileData cursor_data = FILE_DATA__INIT;
+        VentRequest req = VENT_REQUEST__INIT;
+        cursor_data.offset = poll.cursor;
+        if (compact) {
+            cursor_data.data.data = (uint8_t *)APP_MANAGER_VENT_DATA_COMPACT;
+            cursor_data.data.len = strlen(APP_MANAGER_VENT_DATA_COMPACT);
+        }
+        req.cmd = COMMAND__VentDataRequest;
+        req.access_key = BENCH_ACCESS_KEY;
+        req.read_file_request = &cursor_data;
+        uint8_t *reply;
+        ssize_t reply_len;
+        bench_link_write(link, packed, vent_request__pack(&req, packed), &reply, &reply_len);
+        bench_link_read(link, reply_len);
+        polls++;
+        if (drop_every && polls % drop_every == 0) {
+            /* Reply lost on the way, ask again with the same cursor */
+            drops++;
+            free(reply);
+            continue;
+        }
+        VentResponse *resp = vent_response__unpack(NULL, reply_len, reply);
+        free(reply);
+        int n = _poll_reply(&poll, period_ms, compact, resp);
+        vent_response__free_unpacked(resp, NULL);
+        if (n < 0) {
+            poll.bad++;
+        } else if (n == 0 && link->rtt_us == 0) {
+            /* Caught up, wait for the next sample like a client would */
+            usleep(period_ms * 1000);
+        }
+    }
+    double elapsed = (bench_now_ns() - start) / 1e9;
+    uint32_t now_ms = esp_log_timestamp();
+    /* Missed samples are the client falling behind, not an error of the ring */
+    printf("%-14s %s %6.0f samples/s  %5.1f per reply  %5.0f polls/s  missed=%u dups=%u bad=%u dropped=%u"
+           "  behind %u ms\n",
+           name, poll.dups == 0 && poll.bad == 0 ? "ok  " : "FAIL", poll.received / elapsed,
+           polls > drops ? (double)poll.received / (polls - drops) : 0.0, polls / elapsed, poll.missed, poll.dups,
+           poll.bad, drops, now_ms - poll.cursor);
+}
+
+int main(int argc, char **argv)
+{
+    double rtt_ms = 15;
+    double kbps = 40;
+    double secs = 2;
+    int drop_every = 7;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:b:t:l:")) != -1) {
+        switch (opt) {
+            case 'r':
+                rtt_ms = atof(optarg);
+                break;
+            case 'b':
+                kbps = atof(optarg);
+                break;
+            case 't':
+                secs = atof(optarg);
+                break;
+            case 'l':
+                drop_every = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-r rtt_ms] [-b link_KB_per_s] [-t seconds] [-l drop_every_nth_reply]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    printf("sample ring, producer as fast as it goes against a cursor reader\n");
+    _run_stress(1024, 20 * 1000 * 1000, 64);
+    _run_stress(64, 20 * 1000 * 1000, 64);
+    _run_stress(1024, 20 * 1000 * 1000, 1);
+
+    app_manager_cfg_t app_man_cfg = {
+        .input_rb_size = 8 * 1024,
+        .output_rb_size = 2 * 1024,
+        .access_key = BENCH_ACCESS_KEY,
+        .event_handler = _bench_event_handler,
+    };
+    if (app_manager_init(&app_man_cfg) != ESP_OK) {
+        fprintf(stderr, "app_manager_init failed\n");
+        return 1;
+    }
+    static uint32_t synthetic_k;
+    if (app_manager_vent_data_start(_synthetic_read, &synthetic_k) != ESP_OK) {
+        fprintf(stderr, "app_manager_vent_data_start failed\n");
+        return 1;
+    }
+    /* Let the ring fill */
+    usleep(200 * 1000);
+
+    printf("VentDataRequest polling, %.1f s each, every %d-th reply lost\n", secs, drop_every);
+    bench_link_t link = {
+        .endpoint = ble_prov_custom_data_new(app_manager_get_output_rb(), app_manager_get_input_rb()),
+    };
+    _run_poll("local", &link, secs, 1, drop_every, false);
+    _run_poll("local compact", &link, secs, 1, drop_every, true);
+    link.rtt_us = rtt_ms * 1000;
+    link.bytes_per_us = kbps * 1024 / 1e6;
+    printf("rtt %.1f ms, link %.1f KB/s\n", rtt_ms, kbps);
+    _run_poll("ble", &link, secs, 1, drop_every, false);
+    _run_poll("ble compact", &link, secs, 1, drop_every, true);
+
+    app_sampler_stats_t stats;
+    if (app_manager_get_vent_data_stats(&stats) == ESP_OK) {
+        printf("sampler: %u samples, %u late, read %.2f us/sample\n", stats.samples, stats.late,
+               stats.samples ? (double)stats.read_time_us / stats.samples : 0.0);
+    }
+    return 0;
+}
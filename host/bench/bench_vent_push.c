@@ -0,0 +1,316 @@
+/*
+ * Pushed telemetry against polling, over a simulated BLE link.
+ *
+ * The sampler runs at CONFIG_VENT_DATA_RATE_HZ with a synthetic source. A
+ * client that wants to see the waveform every -i ms either polls
+ * VentDataRequest with its cursor (compact batches, asking again at once
+ * while a reply is full), or subscribes once and collects what the device
+ * pushed with bare tagged polls. Prints samples/s, link bytes and GATT
+ * operations per second and how old samples are when they arrive. A last
+ * run collects far slower than the device pushes, to show the oldest
+ * batches being dropped while the age stays bounded.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include "esp_log.h"
+#include "app_manager.h"
+#include "ble_prov_custom_data.h"
+#include "openvent.pb-c.h"
+#include "bench_common.h"
+#include "bench_link.h"
+#include "vent_batch_decode.h"
+
+#define BENCH_ACCESS_KEY        "0000"
+#define BENCH_MAX_SAMPLES       1024
+
+typedef struct {
+    bench_link_t *link;
+    uint32_t cursor;
+    uint32_t received;
+    uint32_t missed;
+    uint32_t bad;
+    uint64_t link_bytes;
+    bench_samples_t age;        /* ms * 1e6, so bench_percentile() reports it in "ns" */
+} bench_client_t;
+
+static esp_err_t _bench_event_handler(void **ctx, VentRequest *req, VentResponse *resp)
+{
+    if (req->cmd == COMMAND__VentDataRequest) {
+        return app_manager_vent_data_handle(ctx, req, resp);
+    }
+    return app_manager_response(resp);
+}
+
+static void _synthetic_read(app_sample_t *sample, void *arg)
+{
+    uint32_t *k = arg;
+    sample->volume = (*k)++;
+    sample->frequency = 15;
+    sample->breath_in_time = 1.2f;
+}
+
+static void _exchange(bench_client_t *client, const uint8_t *req, size_t len, uint8_t **reply, ssize_t *reply_len)
+{
+    bench_link_write(client->link, req, len, reply, reply_len);
+    bench_link_read(client->link, *reply_len);
+    client->link_bytes += len + (*reply_len > 0 ? *reply_len : 0);
+}
+
+/* Account for a compact batch, returns the samples in it or -1 */
+static int _take_batch(bench_client_t *client, FileData *batch, uint32_t step_ms)
+{
+    static vent_batch_sample_t decoded[BENCH_MAX_SAMPLES];
+    if (batch == NULL) {
+        return -1;
+    }
+    if (batch->data.len == 0) {
+        return 0;
+    }
+    int n = vent_batch_decode(batch->data.data, batch->data.len, decoded, BENCH_MAX_SAMPLES);
+    uint32_t now = esp_log_timestamp();
+    for (int i = 0; i < n; i++) {
+        if (client->cursor && (int32_t)(decoded[i].timestamp - client->cursor) <= 0) {
+            client->bad++;
+            continue;
+        }
+        uint32_t steps = (decoded[i].timestamp - client->cursor) / step_ms;
+        if (client->cursor && steps > 1) {
+            client->missed += steps - 1;
+        }
+        client->cursor = decoded[i].timestamp;
+        client->received++;
+        bench_samples_add(&client->age, (uint64_t)(now - decoded[i].timestamp) * 1000000);
+    }
+    return n;
+}
+
+static size_t _pack_vent_data(uint8_t *out, const char *file_name, uint32_t offset, uint32_t interval_ms,
+                              uint32_t decimation)
+{
+    FileData params = FILE_DATA__INIT;
+    VentRequest req = VENT_REQUEST__INIT;
+    params.file_name = (char *)file_name;
+    params.offset = offset;
+    params.file_size = interval_ms;
+    params.checksum = decimation;
+    params.data.data = (uint8_t *)APP_MANAGER_VENT_DATA_COMPACT;
+    params.data.len = strlen(APP_MANAGER_VENT_DATA_COMPACT);
+    req.cmd = COMMAND__VentDataRequest;
+    req.access_key = BENCH_ACCESS_KEY;
+    req.read_file_request = &params;
+    return vent_request__pack(&req, out);
+}
+
+static void _run_poll(bench_client_t *client, double secs, uint32_t every_ms)
+{
+    uint8_t packed[64];
+    uint64_t end = bench_now_ns() + (uint64_t)(secs * 1e9);
+    uint64_t next = bench_now_ns();
+    while (bench_now_ns() < end) {
+        uint64_t now = bench_now_ns();
+        if (now < next) {
+            usleep((next - now) / 1000);
+        }
+        next += every_ms * 1000000ULL;
+        bool full;
+        do {
+            uint8_t *reply;
+            ssize_t reply_len;
+            _exchange(client, packed, _pack_vent_data(packed, "", client->cursor, 0, 0), &reply, &reply_len);
+            VentResponse *resp = vent_response__unpack(NULL, reply_len, reply);
+            free(reply);
+            int n = resp ? _take_batch(client, resp->read_file_response, 1) : -1;
+            if (n < 0) {
+                client->bad++;
+            }
+            /* A full frame means there is more waiting */
+            full = n > 0 && resp->read_file_response->data.len > 400;
+            vent_response__free_unpacked(resp, NULL);
+        } while (full && bench_now_ns() < end);
+    }
+}
+
+/* Entries of a tagged reply: pushed batches are taken, anything else returned as its seq */
+static int _take_tagged(bench_client_t *client, const uint8_t *reply, ssize_t reply_len, uint32_t step_ms)
+{
+    int other = -1;
+    if (reply_len < APP_MANAGER_TAG_REPLY_HDR_LEN || reply[0] != APP_MANAGER_TAG_MARKER) {
+        client->bad++;
+        return other;
+    }
+    size_t pos = APP_MANAGER_TAG_REPLY_HDR_LEN;
+    for (int i = 0; i < reply[2]; i++) {
+        uint16_t seq = reply[pos] | (reply[pos + 1] << 8);
+        size_t entry_len = reply[pos + 2] | (reply[pos + 3] << 8);
+        pos += APP_MANAGER_TAG_ENTRY_HDR_LEN;
+        VentResponse *resp = vent_response__unpack(NULL, entry_len, reply + pos);
+        pos += entry_len;
+        if (resp == NULL || resp->status != STATUS__Success) {
+            client->bad++;
+        } else if (seq == APP_MANAGER_TAG_SEQ_PUSH) {
+            if (_take_batch(client, resp->read_file_response, step_ms) < 0) {
+                client->bad++;
+            }
+        } else {
+            other = seq;
+            if (client->cursor == 0 && resp->read_file_response) {
+                client->cursor = resp->read_file_response->offset;
+            }
+        }
+        vent_response__free_unpacked(resp, NULL);
+    }
+    return other;
+}
+
+static void _subscribe(bench_client_t *client, uint16_t seq, uint32_t interval_ms, uint32_t decimation)
+{
+    uint8_t packed[64];
+    packed[0] = APP_MANAGER_TAG_MARKER;
+    packed[1] = seq & 0xff;
+    packed[2] = seq >> 8;
+    size_t len = APP_MANAGER_TAG_REQ_HDR_LEN +
+                 _pack_vent_data(packed + APP_MANAGER_TAG_REQ_HDR_LEN, APP_MANAGER_VENT_DATA_SUBSCRIBE, 0,
+                                 interval_ms, decimation);
+    /* Poll until the answer to this one is in */
+    while (true) {
+        uint8_t *reply;
+        ssize_t reply_len;
+        _exchange(client, packed, len, &reply, &reply_len);
+        int answered = _take_tagged(client, reply, reply_len, decimation ? decimation : 1);
+        free(reply);
+        if (answered == seq) {
+            break;
+        }
+        len = 1;
+        usleep(1000);
+    }
+}
+
+static void _run_push(bench_client_t *client, double secs, uint32_t every_ms, uint32_t push_ms, uint32_t decimation)
+{
+    uint8_t poll = APP_MANAGER_TAG_MARKER;
+    _subscribe(client, 1, push_ms, decimation);
+    /* Counted from the subscription on */
+    client->link_bytes = 0;
+    client->link->writes = client->link->reads = 0;
+
+    uint64_t end = bench_now_ns() + (uint64_t)(secs * 1e9);
+    uint64_t next = bench_now_ns();
+    while (bench_now_ns() < end) {
+        uint64_t now = bench_now_ns();
+        if (now < next) {
+            usleep((next - now) / 1000);
+        }
+        next += every_ms * 1000000ULL;
+        uint8_t *reply;
+        ssize_t reply_len;
+        _exchange(client, &poll, 1, &reply, &reply_len);
+        _take_tagged(client, reply, reply_len, decimation);
+        free(reply);
+    }
+    _subscribe(client, 2, 0, 0);
+}
+
+typedef void (*bench_client_fn)(bench_client_t *client, double secs, uint32_t every_ms);
+
+static void _report(const char *name, bench_client_t *client, double secs)
+{
+    app_manager_stats_t stats;
+    app_manager_get_stats(&stats);
+    printf("%-22s %s %6.0f samples/s  %6.0f B/s %5.1f GATT ops/s  age p50 %3llu ms p99 %3llu ms max %4llu ms"
+           "  missed=%u pushes dropped=%u\n",
+           name, client->bad == 0 ? "ok  " : "FAIL", client->received / secs, client->link_bytes / secs,
+           (client->link->writes + client->link->reads) / secs,
+           (unsigned long long)(bench_percentile(&client->age, 50) / 1000000),
+           (unsigned long long)(bench_percentile(&client->age, 99) / 1000000),
+           (unsigned long long)(bench_percentile(&client->age, 100) / 1000000), client->missed, stats.push_drops);
+}
+
+static void _client_init(bench_client_t *client, bench_link_t *link)
+{
+    memset(client, 0, sizeof(*client));
+    client->link = link;
+    link->writes = link->reads = 0;
+    bench_samples_init(&client->age, 1 << 20);
+}
+
+int main(int argc, char **argv)
+{
+    double rtt_ms = 15;
+    double kbps = 40;
+    double secs = 3;
+    uint32_t every_ms = 50;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:b:t:i:")) != -1) {
+        switch (opt) {
+            case 'r':
+                rtt_ms = atof(optarg);
+                break;
+            case 'b':
+                kbps = atof(optarg);
+                break;
+            case 't':
+                secs = atof(optarg);
+                break;
+            case 'i':
+                every_ms = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-r rtt_ms] [-b link_KB_per_s] [-t seconds] [-i display_interval_ms]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    app_manager_cfg_t app_man_cfg = {
+        .input_rb_size = 8 * 1024,
+        .output_rb_size = 2 * 1024,
+        .access_key = BENCH_ACCESS_KEY,
+        .event_handler = _bench_event_handler,
+    };
+    static uint32_t synthetic_k;
+    if (app_manager_init(&app_man_cfg) != ESP_OK ||
+            app_manager_vent_data_start(_synthetic_read, &synthetic_k) != ESP_OK) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    bench_link_t link = {
+        .rtt_us = rtt_ms * 1000,
+        .bytes_per_us = kbps * 1024 / 1e6,
+        .endpoint = ble_prov_custom_data_new(app_manager_get_output_rb(), app_manager_get_input_rb()),
+    };
+    usleep(100 * 1000);
+
+    printf("1 kHz samples, compact batches, rtt %.1f ms, link %.1f KB/s, client looks every %u ms\n", rtt_ms, kbps,
+           every_ms);
+    bench_client_t client;
+    char name[64];
+
+    _client_init(&client, &link);
+    _run_poll(&client, secs, every_ms);
+    _report("poll", &client, secs);
+    bench_samples_free(&client.age);
+
+    _client_init(&client, &link);
+    _run_push(&client, secs, every_ms, every_ms, 1);
+    _report("push", &client, secs);
+    bench_samples_free(&client.age);
+
+    _client_init(&client, &link);
+    _run_push(&client, secs, every_ms, every_ms, 10);
+    _report("push, 1 in 10", &client, secs);
+    bench_samples_free(&client.age);
+
+    /* Collecting every 500 ms what is pushed every 20 ms: the push queue overflows */
+    _client_init(&client, &link);
+    _run_push(&client, secs, 500, 20, 1);
+    snprintf(name, sizeof(name), "push 20 ms, look 500");
+    _report(name, &client, secs);
+    bench_samples_free(&client.age);
+    return 0;
+}
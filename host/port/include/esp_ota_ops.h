@@ -0,0 +1,13 @@
+/*
+ * Host port of esp_ota_ops.h on top of the file-backed partitions. The
+ * boot partition is only remembered, nothing checks the image.
+ */
+#pragma once
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+const esp_partition_t *esp_ota_get_running_partition(void);
+const esp_partition_t *esp_ota_get_boot_partition(void);
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
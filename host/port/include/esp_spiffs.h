@@ -0,0 +1,8 @@
+/*
+ * Host port: /spiffs paths are plain host paths, nothing to mount.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
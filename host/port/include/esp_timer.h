@@ -0,0 +1,8 @@
+/*
+ * Host port of esp_timer.h, only the microsecond clock.
+ */
+#pragma once
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
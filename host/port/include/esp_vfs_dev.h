@@ -0,0 +1,4 @@
+/*
+ * Host port: the VFS is the host file system, nothing to register.
+ */
+#pragma once
@@ -0,0 +1,32 @@
+/*
+ * Host port of the FreeRTOS types and macros used by the firmware
+ * components. Tasks are POSIX threads, one tick is one millisecond
+ * (CONFIG_FREERTOS_HZ=1000 on target).
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "esp_err.h"
+#include "esp_system.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE             ((BaseType_t) 0)
+#define pdTRUE              ((BaseType_t) 1)
+#define pdPASS              (pdTRUE)
+#define pdFAIL              (pdFALSE)
+
+#define configTICK_RATE_HZ  1000
+#define portMAX_DELAY       ((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS  ((TickType_t) 1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS    portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms)   ((TickType_t) (ms) * configTICK_RATE_HZ / 1000)
+
+#define tskIDLE_PRIORITY    ((UBaseType_t) 0)
+#define tskNO_AFFINITY      0x7FFFFFFF
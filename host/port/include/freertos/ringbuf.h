@@ -0,0 +1,31 @@
+/*
+ * Host port of the ESP-IDF no-split ring buffer (freertos/ringbuf.h).
+ * Only RINGBUF_TYPE_NOSPLIT is implemented, which is the only type the
+ * firmware uses. Items are 8-byte aligned and returned in any order, as on
+ * target.
+ */
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct host_ringbuf *RingbufHandle_t;
+
+typedef enum {
+    RINGBUF_TYPE_NOSPLIT = 0,
+    RINGBUF_TYPE_ALLOWSPLIT,
+    RINGBUF_TYPE_BYTEBUF,
+    RINGBUF_TYPE_MAX,
+} RingbufferType_t;
+
+RingbufHandle_t xRingbufferCreate(size_t xBufferSize, RingbufferType_t xBufferType);
+void vRingbufferDelete(RingbufHandle_t xRingbuffer);
+
+BaseType_t xRingbufferSend(RingbufHandle_t xRingbuffer, const void *pvItem, size_t xItemSize, TickType_t xTicksToWait);
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t xRingbuffer, void **ppvItem, size_t xItemSize, TickType_t xTicksToWait);
+BaseType_t xRingbufferSendComplete(RingbufHandle_t xRingbuffer, void *pvItem);
+
+void *xRingbufferReceive(RingbufHandle_t xRingbuffer, size_t *pxItemSize, TickType_t xTicksToWait);
+void vRingbufferReturnItem(RingbufHandle_t xRingbuffer, void *pvItem);
+
+size_t xRingbufferGetMaxItemSize(RingbufHandle_t xRingbuffer);
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t xRingbuffer);
@@ -0,0 +1,197 @@
+/*
+ * ota_0/ota_1 from partitions.csv as files with NOR flash semantics, plus
+ * the bit of esp_ota_ops that picks and records the boot partition.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+
+#define HOST_PARTITION_COUNT    2
+#define HOST_MMAP_COUNT         8
+
+static esp_partition_t s_partitions[HOST_PARTITION_COUNT] = {
+    { ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x10000, 1400 * 1024, "ota_0", false },
+    { ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x170000, 1400 * 1024, "ota_1", false },
+};
+static FILE *s_files[HOST_PARTITION_COUNT];
+static const esp_partition_t *s_boot = &s_partitions[0];
+static struct {
+    void *addr;
+    size_t len;
+} s_maps[HOST_MMAP_COUNT];
+static uint32_t s_erase_sector_us;
+static uint32_t s_write_kb_us;
+
+static void _busy_us(uint64_t us)
+{
+    if (us == 0) {
+        return;
+    }
+    struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+static FILE *_file(const esp_partition_t *partition)
+{
+    return s_files[partition - s_partitions];
+}
+
+esp_err_t host_partition_init(const char *dir)
+{
+    char path[256];
+    for (int i = 0; i < HOST_PARTITION_COUNT; i++) {
+        snprintf(path, sizeof(path), "%s/%s.bin", dir, s_partitions[i].label);
+        s_files[i] = fopen(path, "r+b");
+        if (s_files[i] == NULL) {
+            s_files[i] = fopen(path, "w+b");
+            if (s_files[i] == NULL) {
+                return ESP_FAIL;
+            }
+            esp_partition_erase_range(&s_partitions[i], 0, s_partitions[i].size);
+        }
+    }
+    return ESP_OK;
+}
+
+void host_partition_set_timing(uint32_t erase_sector_us, uint32_t write_kb_us)
+{
+    s_erase_sector_us = erase_sector_us;
+    s_write_kb_us = write_kb_us;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    for (int i = 0; i < HOST_PARTITION_COUNT; i++) {
+        esp_partition_t *p = &s_partitions[i];
+        if (p->type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || p->subtype == subtype) &&
+                (label == NULL || strcmp(label, p->label) == 0)) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    FILE *f = _file(partition);
+    if (f == NULL || src_offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (fseek(f, src_offset, SEEK_SET) != 0 || fread(dst, 1, size, f) != size) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    FILE *f = _file(partition);
+    if (f == NULL || dst_offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint8_t *cur = malloc(size);
+    if (cur == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = esp_partition_read(partition, dst_offset, cur, size);
+    if (err == ESP_OK) {
+        /* Programming can only clear bits */
+        for (size_t i = 0; i < size; i++) {
+            cur[i] &= ((const uint8_t *)src)[i];
+        }
+        if (fseek(f, dst_offset, SEEK_SET) != 0 || fwrite(cur, 1, size, f) != size || fflush(f) != 0) {
+            err = ESP_FAIL;
+        }
+    }
+    free(cur);
+    _busy_us((uint64_t)size * s_write_kb_us / 1024);
+    return err;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    static uint8_t erased[SPI_FLASH_SEC_SIZE];
+    FILE *f = _file(partition);
+    if (f == NULL || offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE || offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(erased, 0xff, sizeof(erased));
+    if (fseek(f, offset, SEEK_SET) != 0) {
+        return ESP_FAIL;
+    }
+    for (size_t done = 0; done < size; done += SPI_FLASH_SEC_SIZE) {
+        if (fwrite(erased, 1, SPI_FLASH_SEC_SIZE, f) != SPI_FLASH_SEC_SIZE) {
+            return ESP_FAIL;
+        }
+    }
+    fflush(f);
+    _busy_us((uint64_t)size / SPI_FLASH_SEC_SIZE * s_erase_sector_us);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t memory, const void **out_ptr, spi_flash_mmap_handle_t *out_handle)
+{
+    (void)memory;
+    FILE *f = _file(partition);
+    if (f == NULL || offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* Like the MMU, map whole pages and point into them */
+    size_t region_offset = offset % SPI_FLASH_SEC_SIZE;
+    for (int i = 0; i < HOST_MMAP_COUNT; i++) {
+        if (s_maps[i].addr == NULL) {
+            void *addr = mmap(NULL, size + region_offset, PROT_READ, MAP_SHARED, fileno(f), offset - region_offset);
+            if (addr == MAP_FAILED) {
+                return ESP_FAIL;
+            }
+            s_maps[i].addr = addr;
+            s_maps[i].len = size + region_offset;
+            *out_ptr = (uint8_t *)addr + region_offset;
+            *out_handle = i + 1;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle)
+{
+    if (handle == 0 || handle > HOST_MMAP_COUNT || s_maps[handle - 1].addr == NULL) {
+        return;
+    }
+    munmap(s_maps[handle - 1].addr, s_maps[handle - 1].len);
+    s_maps[handle - 1].addr = NULL;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    return &s_partitions[0];
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void)
+{
+    return s_boot;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+    if (start_from == NULL) {
+        start_from = esp_ota_get_running_partition();
+    }
+    return &s_partitions[(start_from - s_partitions + 1) % HOST_PARTITION_COUNT];
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    if (partition == NULL || partition->type != ESP_PARTITION_TYPE_APP) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_boot = partition;
+    return ESP_OK;
+}
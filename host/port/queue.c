@@ -0,0 +1,136 @@
+/*
+ * FreeRTOS queue on top of a mutex/condvar protected circular array.
+ */
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+typedef struct host_queue {
+    uint8_t *items;
+    size_t item_size;
+    size_t length;
+    size_t head;
+    size_t count;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} host_queue_t;
+
+static int _wait(host_queue_t *q, TickType_t ticks, const struct timespec *deadline)
+{
+    if (ticks == 0) {
+        return ETIMEDOUT;
+    }
+    if (ticks == portMAX_DELAY) {
+        return pthread_cond_wait(&q->cond, &q->lock);
+    }
+    return pthread_cond_timedwait(&q->cond, &q->lock, deadline);
+}
+
+static void _deadline(struct timespec *ts, TickType_t ticks)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    uint64_t ns = (uint64_t)ticks * (1000000000ULL / configTICK_RATE_HZ) + ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+    host_queue_t *q = calloc(1, sizeof(host_queue_t));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->items = calloc(uxQueueLength, uxItemSize);
+    if (q->items == NULL) {
+        free(q);
+        return NULL;
+    }
+    q->item_size = uxItemSize;
+    q->length = uxQueueLength;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&q->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&q->lock, NULL);
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t xQueue)
+{
+    if (xQueue == NULL) {
+        return;
+    }
+    pthread_cond_destroy(&xQueue->cond);
+    pthread_mutex_destroy(&xQueue->lock);
+    free(xQueue->items);
+    free(xQueue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    host_queue_t *q = xQueue;
+    struct timespec deadline;
+    _deadline(&deadline, xTicksToWait);
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->length) {
+        if (_wait(q, xTicksToWait, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFALSE;
+        }
+    }
+    memcpy(q->items + ((q->head + q->count) % q->length) * q->item_size, pvItemToQueue, q->item_size);
+    q->count++;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    host_queue_t *q = xQueue;
+    struct timespec deadline;
+    _deadline(&deadline, xTicksToWait);
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) {
+        if (_wait(q, xTicksToWait, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFALSE;
+        }
+    }
+    memcpy(pvBuffer, q->items + q->head * q->item_size, q->item_size);
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    host_queue_t *q = xQueue;
+    struct timespec deadline;
+    _deadline(&deadline, xTicksToWait);
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) {
+        if (_wait(q, xTicksToWait, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFALSE;
+        }
+    }
+    memcpy(pvBuffer, q->items + q->head * q->item_size, q->item_size);
+    pthread_mutex_unlock(&q->lock);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+    pthread_mutex_lock(&xQueue->lock);
+    UBaseType_t count = xQueue->count;
+    pthread_mutex_unlock(&xQueue->lock);
+    return count;
+}
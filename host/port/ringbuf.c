@@ -0,0 +1,273 @@
+/*
+ * No-split ring buffer with the same semantics as the ESP-IDF one:
+ * every item is stored contiguously behind an 8-byte header, items are
+ * received in FIFO order, may be returned in any order, and space is only
+ * reclaimed once the oldest item has been returned.
+ */
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+
+#define RB_ALIGN                8
+#define RB_ALIGN_UP(x)          (((x) + RB_ALIGN - 1) & ~(size_t)(RB_ALIGN - 1))
+
+#define RB_FLAG_ACQUIRED        0x01    /* Space reserved, data not complete yet */
+#define RB_FLAG_WRITTEN         0x02    /* Ready to be received */
+#define RB_FLAG_READ            0x04    /* Handed to a receiver */
+#define RB_FLAG_RETURNED        0x08    /* Space can be reclaimed */
+#define RB_FLAG_WRAP            0x10    /* Dummy item, continue at offset 0 */
+
+typedef struct {
+    uint32_t len;
+    uint32_t flags;
+} rb_item_hdr_t;
+
+typedef struct host_ringbuf {
+    uint8_t *buf;
+    size_t size;
+    size_t write;       /* Next free byte */
+    size_t read;        /* Next item to receive */
+    size_t free;        /* Oldest item not yet returned */
+    size_t used;        /* Bytes between free and write, wrap padding included */
+    size_t n_items;     /* Items acquired/written and not yet received */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} host_ringbuf_t;
+
+static size_t _item_span(size_t len)
+{
+    return sizeof(rb_item_hdr_t) + RB_ALIGN_UP(len);
+}
+
+static void _deadline(struct timespec *ts, TickType_t ticks)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    uint64_t ns = (uint64_t)ticks * (1000000000ULL / configTICK_RATE_HZ) + ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+}
+
+static int _wait(host_ringbuf_t *rb, TickType_t ticks, const struct timespec *deadline)
+{
+    if (ticks == 0) {
+        return ETIMEDOUT;
+    }
+    if (ticks == portMAX_DELAY) {
+        return pthread_cond_wait(&rb->cond, &rb->lock);
+    }
+    return pthread_cond_timedwait(&rb->cond, &rb->lock, deadline);
+}
+
+/* Reserve contiguous space for an item, return the header or NULL when full */
+static rb_item_hdr_t *_reserve(host_ringbuf_t *rb, size_t span)
+{
+    if (rb->used == 0) {
+        rb->write = rb->read = rb->free = 0;
+    }
+    size_t tail_space;
+    if (rb->write > rb->free || rb->used == 0) {
+        tail_space = rb->size - rb->write;
+        if (tail_space < span) {
+            /* Does not fit before the end: pad and try from the start */
+            if (rb->free < span) {
+                return NULL;
+            }
+            if (tail_space >= sizeof(rb_item_hdr_t)) {
+                rb_item_hdr_t *wrap = (rb_item_hdr_t *)(rb->buf + rb->write);
+                wrap->len = 0;
+                wrap->flags = RB_FLAG_WRAP;
+            }
+            rb->used += tail_space;
+            rb->write = 0;
+        }
+    } else if (rb->free - rb->write < span) {
+        return NULL;
+    }
+    rb_item_hdr_t *hdr = (rb_item_hdr_t *)(rb->buf + rb->write);
+    rb->write += span;
+    rb->used += span;
+    if (rb->write == rb->size) {
+        rb->write = 0;
+    }
+    return hdr;
+}
+
+/* Skip wrap padding in front of an offset */
+static size_t _skip_wrap(host_ringbuf_t *rb, size_t offset)
+{
+    if (rb->size - offset < sizeof(rb_item_hdr_t)) {
+        return 0;
+    }
+    rb_item_hdr_t *hdr = (rb_item_hdr_t *)(rb->buf + offset);
+    if (hdr->flags & RB_FLAG_WRAP) {
+        return 0;
+    }
+    return offset;
+}
+
+RingbufHandle_t xRingbufferCreate(size_t xBufferSize, RingbufferType_t xBufferType)
+{
+    if (xBufferType != RINGBUF_TYPE_NOSPLIT || xBufferSize < 2 * RB_ALIGN) {
+        return NULL;
+    }
+    host_ringbuf_t *rb = calloc(1, sizeof(host_ringbuf_t));
+    if (rb == NULL) {
+        return NULL;
+    }
+    rb->size = xBufferSize & ~(size_t)(RB_ALIGN - 1);
+    rb->buf = malloc(rb->size);
+    if (rb->buf == NULL) {
+        free(rb);
+        return NULL;
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&rb->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&rb->lock, NULL);
+    return rb;
+}
+
+void vRingbufferDelete(RingbufHandle_t xRingbuffer)
+{
+    if (xRingbuffer == NULL) {
+        return;
+    }
+    pthread_cond_destroy(&xRingbuffer->cond);
+    pthread_mutex_destroy(&xRingbuffer->lock);
+    free(xRingbuffer->buf);
+    free(xRingbuffer);
+}
+
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t xRingbuffer, void **ppvItem, size_t xItemSize, TickType_t xTicksToWait)
+{
+    host_ringbuf_t *rb = xRingbuffer;
+    size_t span = _item_span(xItemSize);
+    if (span > rb->size / 2) {
+        return pdFALSE;
+    }
+    struct timespec deadline;
+    _deadline(&deadline, xTicksToWait);
+
+    pthread_mutex_lock(&rb->lock);
+    rb_item_hdr_t *hdr;
+    while ((hdr = _reserve(rb, span)) == NULL) {
+        if (_wait(rb, xTicksToWait, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&rb->lock);
+            return pdFALSE;
+        }
+    }
+    hdr->len = xItemSize;
+    hdr->flags = RB_FLAG_ACQUIRED;
+    rb->n_items++;
+    pthread_mutex_unlock(&rb->lock);
+    *ppvItem = hdr + 1;
+    return pdTRUE;
+}
+
+BaseType_t xRingbufferSendComplete(RingbufHandle_t xRingbuffer, void *pvItem)
+{
+    host_ringbuf_t *rb = xRingbuffer;
+    rb_item_hdr_t *hdr = (rb_item_hdr_t *)pvItem - 1;
+    pthread_mutex_lock(&rb->lock);
+    hdr->flags = RB_FLAG_WRITTEN;
+    pthread_cond_broadcast(&rb->cond);
+    pthread_mutex_unlock(&rb->lock);
+    return pdTRUE;
+}
+
+BaseType_t xRingbufferSend(RingbufHandle_t xRingbuffer, const void *pvItem, size_t xItemSize, TickType_t xTicksToWait)
+{
+    void *item;
+    if (xRingbufferSendAcquire(xRingbuffer, &item, xItemSize, xTicksToWait) != pdTRUE) {
+        return pdFALSE;
+    }
+    memcpy(item, pvItem, xItemSize);
+    return xRingbufferSendComplete(xRingbuffer, item);
+}
+
+void *xRingbufferReceive(RingbufHandle_t xRingbuffer, size_t *pxItemSize, TickType_t xTicksToWait)
+{
+    host_ringbuf_t *rb = xRingbuffer;
+    struct timespec deadline;
+    _deadline(&deadline, xTicksToWait);
+
+    pthread_mutex_lock(&rb->lock);
+    rb_item_hdr_t *hdr;
+    for (;;) {
+        if (rb->n_items > 0) {
+            rb->read = _skip_wrap(rb, rb->read);
+            hdr = (rb_item_hdr_t *)(rb->buf + rb->read);
+            if (hdr->flags & RB_FLAG_WRITTEN) {
+                break;
+            }
+        }
+        if (_wait(rb, xTicksToWait, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&rb->lock);
+            return NULL;
+        }
+    }
+    hdr->flags = RB_FLAG_READ;
+    rb->n_items--;
+    rb->read += _item_span(hdr->len);
+    if (rb->read == rb->size) {
+        rb->read = 0;
+    }
+    pthread_mutex_unlock(&rb->lock);
+    if (pxItemSize) {
+        *pxItemSize = hdr->len;
+    }
+    return hdr + 1;
+}
+
+void vRingbufferReturnItem(RingbufHandle_t xRingbuffer, void *pvItem)
+{
+    host_ringbuf_t *rb = xRingbuffer;
+    rb_item_hdr_t *hdr = (rb_item_hdr_t *)pvItem - 1;
+    pthread_mutex_lock(&rb->lock);
+    hdr->flags = RB_FLAG_RETURNED;
+    /* Reclaim every returned item from the oldest one on */
+    while (rb->used > 0) {
+        size_t offset = _skip_wrap(rb, rb->free);
+        if (offset != rb->free) {
+            if (rb->read == rb->free) {
+                /* Reader has not stepped over the padding yet, it is about to be reused */
+                rb->read = 0;
+            }
+            rb->used -= rb->size - rb->free;
+            rb->free = 0;
+            continue;
+        }
+        rb_item_hdr_t *oldest = (rb_item_hdr_t *)(rb->buf + rb->free);
+        if (!(oldest->flags & RB_FLAG_RETURNED)) {
+            break;
+        }
+        size_t span = _item_span(oldest->len);
+        rb->used -= span;
+        rb->free += span;
+        if (rb->free == rb->size) {
+            rb->free = 0;
+        }
+    }
+    pthread_cond_broadcast(&rb->cond);
+    pthread_mutex_unlock(&rb->lock);
+}
+
+size_t xRingbufferGetMaxItemSize(RingbufHandle_t xRingbuffer)
+{
+    return xRingbuffer->size / 2 - sizeof(rb_item_hdr_t);
+}
+
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t xRingbuffer)
+{
+    host_ringbuf_t *rb = xRingbuffer;
+    pthread_mutex_lock(&rb->lock);
+    size_t free_size = rb->size - rb->used;
+    pthread_mutex_unlock(&rb->lock);
+    return free_size > sizeof(rb_item_hdr_t) ? free_size - sizeof(rb_item_hdr_t) : 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * FreeRTOS task API on top of detached pthreads.
+ */
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+static const char *TAG = "HOST_TASK";
+
+typedef struct host_task {
+    pthread_t thread;
+    TaskFunction_t func;
+    void *arg;
+} host_task_t;
+
+static void *_task_entry(void *pv)
+{
+    host_task_t *task = pv;
+    task->func(task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode,
+                                   const char *const pcName,
+                                   const uint32_t usStackDepth,
+                                   void *const pvParameters,
+                                   UBaseType_t uxPriority,
+                                   TaskHandle_t *const pvCreatedTask,
+                                   const BaseType_t xCoreID)
+{
+    (void)usStackDepth;
+    (void)uxPriority;
+    (void)xCoreID;
+    host_task_t *task = calloc(1, sizeof(host_task_t));
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->func = pvTaskCode;
+    task->arg = pvParameters;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&task->thread, &attr, _task_entry, task);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        ESP_LOGE(TAG, "Error creating task %s (%d)", pcName, err);
+        free(task);
+        return pdFAIL;
+    }
+    if (pvCreatedTask) {
+        *pvCreatedTask = task;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+    /* Only self-deletion is used by the firmware */
+    if (xTaskToDelete == NULL) {
+        pthread_exit(NULL);
+    }
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+    struct timespec ts = {
+        .tv_sec = xTicksToDelay / configTICK_RATE_HZ,
+        .tv_nsec = (long)(xTicksToDelay % configTICK_RATE_HZ) * (1000000000L / configTICK_RATE_HZ),
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+void vTaskDelayUntil(TickType_t *const pxPreviousWakeTime, const TickType_t xTimeIncrement)
+{
+    /* Ticks are CLOCK_MONOTONIC milliseconds (see xTaskGetTickCount), sleep until the absolute time */
+    *pxPreviousWakeTime += xTimeIncrement;
+    TickType_t now = xTaskGetTickCount();
+    if ((int32_t)(*pxPreviousWakeTime - now) <= 0) {
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t wake_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + (TickType_t)(*pxPreviousWakeTime - now) * portTICK_PERIOD_MS;
+    ts.tv_sec = wake_ms / 1000;
+    ts.tv_nsec = (long)(wake_ms % 1000) * 1000000L;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)((uint64_t)ts.tv_sec * configTICK_RATE_HZ + ts.tv_nsec / (1000000000L / configTICK_RATE_HZ));
+}
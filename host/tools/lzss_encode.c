@@ -0,0 +1,101 @@
+/*
+ * Greedy LZSS with hash chains over 3-byte prefixes. Good enough to pick
+ * window parameters; the heatshrink CLI produces the same bitstream.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "lzss_encode.h"
+
+#define LZSS_HASH_BITS      15
+#define LZSS_MAX_CHAIN      256
+
+typedef struct {
+    uint8_t *out;
+    size_t size;
+    size_t pos;
+    uint32_t bits;
+    int nbits;
+    int overflow;
+} lzss_bits_t;
+
+static void _put(lzss_bits_t *b, uint32_t value, int count)
+{
+    b->bits = (b->bits << count) | (value & ((1U << count) - 1));
+    b->nbits += count;
+    while (b->nbits >= 8) {
+        b->nbits -= 8;
+        if (b->pos < b->size) {
+            b->out[b->pos++] = b->bits >> b->nbits;
+        } else {
+            b->overflow = 1;
+        }
+    }
+}
+
+static uint32_t _hash(const uint8_t *p)
+{
+    return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761U) >> (32 - LZSS_HASH_BITS);
+}
+
+size_t lzss_encode(const uint8_t *in, size_t len, int window_bits, int lookahead_bits, uint8_t *out, size_t out_size)
+{
+    size_t window = (size_t)1 << window_bits;
+    size_t max_match = (size_t)1 << lookahead_bits;
+    /* A reference only pays off once it is shorter than the literals it replaces */
+    size_t min_match = (1 + window_bits + lookahead_bits) / 9 + 1;
+    int32_t *head = malloc(sizeof(int32_t) << LZSS_HASH_BITS);
+    int32_t *prev = malloc(sizeof(int32_t) * (len ? len : 1));
+    lzss_bits_t b = { .out = out, .size = out_size };
+
+    if (head == NULL || prev == NULL) {
+        free(head);
+        free(prev);
+        return 0;
+    }
+    memset(head, 0xff, sizeof(int32_t) << LZSS_HASH_BITS);
+
+    size_t i = 0;
+    while (i < len) {
+        size_t best_len = 0, best_dist = 0;
+        if (i + 3 <= len) {
+            int chain = LZSS_MAX_CHAIN;
+            for (int32_t j = head[_hash(in + i)]; j >= 0 && i - j <= window && chain-- > 0; j = prev[j]) {
+                size_t n = 0;
+                while (n < max_match && i + n < len && in[j + n] == in[i + n]) {
+                    n++;
+                }
+                if (n > best_len) {
+                    best_len = n;
+                    best_dist = i - j;
+                    if (n == max_match) {
+                        break;
+                    }
+                }
+            }
+        }
+        size_t step = 1;
+        if (best_len >= min_match) {
+            _put(&b, 0, 1);
+            _put(&b, best_dist - 1, window_bits);
+            _put(&b, best_len - 1, lookahead_bits);
+            step = best_len;
+        } else {
+            _put(&b, 1, 1);
+            _put(&b, in[i], 8);
+        }
+        for (size_t k = 0; k < step; k++, i++) {
+            if (i + 3 <= len) {
+                uint32_t h = _hash(in + i);
+                prev[i] = head[h];
+                head[h] = i;
+            }
+        }
+    }
+    if (b.nbits > 0) {
+        _put(&b, 0, 8 - b.nbits);
+    }
+    free(head);
+    free(prev);
+    return b.overflow ? 0 : b.pos;
+}
@@ -0,0 +1,18 @@
+/*
+ * heatshrink-compatible LZSS encoder for the host tools, the device side
+ * only ever decodes (components/app_manager/app_lzss.c).
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Largest output for `len` input bytes: every byte a 9-bit literal */
+#define LZSS_ENCODE_BOUND(len)  ((len) + (len) / 8 + 2)
+
+/*
+ * Compresses `in` with a 2^window_bits window and matches of up to
+ * 2^lookahead_bits bytes. Returns the output length, 0 if `out_size` is
+ * too small.
+ */
+size_t lzss_encode(const uint8_t *in, size_t len, int window_bits, int lookahead_bits, uint8_t *out, size_t out_size);
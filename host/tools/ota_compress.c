@@ -0,0 +1,86 @@
+/*
+ * Compresses an app image for WriteFirmwareRequest:
+ *
+ *   ota_compress [-w window_bits] [-l lookahead_bits] build/openvent-fw.bin openvent-fw.ovz
+ *
+ * The output is the header from app_manager.h followed by the heatshrink
+ * bitstream. Keep -w at or below CONFIG_OTA_LZSS_MAX_WINDOW_BITS.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "app_manager.h"
+#include "lzss_encode.h"
+
+static void _put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+int main(int argc, char **argv)
+{
+    int window_bits = 12;
+    int lookahead_bits = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:l:")) != -1) {
+        switch (opt) {
+            case 'w':
+                window_bits = atoi(optarg);
+                break;
+            case 'l':
+                lookahead_bits = atoi(optarg);
+                break;
+            default:
+                goto usage;
+        }
+    }
+    if (argc - optind != 2 || window_bits < 4 || window_bits > 14 || lookahead_bits < 3 ||
+            lookahead_bits >= window_bits) {
+        goto usage;
+    }
+
+    FILE *f = fopen(argv[optind], "rb");
+    if (f == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *image = malloc(size);
+    uint8_t *out = malloc(APP_MANAGER_FW_LZSS_HDR_LEN + LZSS_ENCODE_BOUND(size));
+    if (fread(image, 1, size, f) != (size_t)size) {
+        perror(argv[optind]);
+        return 1;
+    }
+    fclose(f);
+
+    _put_u32(out, APP_MANAGER_FW_LZSS_MAGIC);
+    out[4] = window_bits;
+    out[5] = lookahead_bits;
+    out[6] = out[7] = 0;
+    _put_u32(out + 8, size);
+    size_t len = APP_MANAGER_FW_LZSS_HDR_LEN +
+                 lzss_encode(image, size, window_bits, lookahead_bits, out + APP_MANAGER_FW_LZSS_HDR_LEN,
+                             LZSS_ENCODE_BOUND(size));
+
+    f = fopen(argv[optind + 1], "wb");
+    if (f == NULL || fwrite(out, 1, len, f) != len || fclose(f) != 0) {
+        perror(argv[optind + 1]);
+        return 1;
+    }
+    printf("%ld -> %zu bytes (%.1f%%), window %d, lookahead %d\n", size, len, 100.0 * len / size,
+           window_bits, lookahead_bits);
+    free(image);
+    free(out);
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage: %s [-w window_bits] [-l lookahead_bits] image.bin image.ovz\n", argv[0]);
+    return 1;
+}
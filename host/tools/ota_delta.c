@@ -0,0 +1,114 @@
+/*
+ * Makes a delta firmware image for WriteFirmwareRequest:
+ *
+ *   ota_delta [-w window_bits] [-l lookahead_bits] openvent-v1.bin openvent-v2.bin v1-v2.ovd
+ *
+ * The device must be running exactly the old image. The patch is
+ * compressed like ota_compress output unless -w is 0.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "app_manager.h"
+#include "app_crc32.h"
+#include "lzss_encode.h"
+#include "ota_diff.h"
+
+static void _put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint8_t *_load(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size ? *size : 1);
+    if (fread(data, 1, *size, f) != *size) {
+        perror(path);
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    int window_bits = 12;
+    int lookahead_bits = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:l:")) != -1) {
+        switch (opt) {
+            case 'w':
+                window_bits = atoi(optarg);
+                break;
+            case 'l':
+                lookahead_bits = atoi(optarg);
+                break;
+            default:
+                goto usage;
+        }
+    }
+    if (argc - optind != 3 || (window_bits != 0 && (window_bits < 4 || window_bits > 14 ||
+                               lookahead_bits < 3 || lookahead_bits >= window_bits))) {
+        goto usage;
+    }
+
+    size_t old_size, new_size, patch_len;
+    uint8_t *old = _load(argv[optind], &old_size);
+    uint8_t *new = _load(argv[optind + 1], &new_size);
+    if (old == NULL || new == NULL) {
+        return 1;
+    }
+    uint8_t *patch = ota_diff(old, old_size, new, new_size, &patch_len);
+    uint8_t *out = malloc(APP_MANAGER_FW_DELTA_HDR_LEN + LZSS_ENCODE_BOUND(patch_len));
+    if (patch == NULL || out == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    _put_u32(out, APP_MANAGER_FW_DELTA_MAGIC);
+    _put_u32(out + 4, new_size);
+    _put_u32(out + 8, old_size);
+    _put_u32(out + 12, app_crc32_update(0, old, old_size));
+    out[16] = window_bits;
+    out[17] = window_bits ? lookahead_bits : 0;
+    out[18] = out[19] = 0;
+    size_t len = APP_MANAGER_FW_DELTA_HDR_LEN;
+    if (window_bits) {
+        len += lzss_encode(patch, patch_len, window_bits, lookahead_bits, out + len, LZSS_ENCODE_BOUND(patch_len));
+    } else {
+        memcpy(out + len, patch, patch_len);
+        len += patch_len;
+    }
+
+    FILE *f = fopen(argv[optind + 2], "wb");
+    if (f == NULL || fwrite(out, 1, len, f) != len || fclose(f) != 0) {
+        perror(argv[optind + 2]);
+        return 1;
+    }
+    printf("%zu -> %zu bytes: patch %zu bytes, %zu sent (%.1f%% of the image)\n", old_size, new_size,
+           patch_len, len, 100.0 * len / new_size);
+    free(old);
+    free(new);
+    free(patch);
+    free(out);
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage: %s [-w window_bits] [-l lookahead_bits] old.bin new.bin delta.ovd\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,342 @@
+/*
+ * Adapted from bsdiff 4.3 by Colin Percival (BSD-2-Clause): qsufsort() is
+ * the Larsson-Sadakane suffix sort, the scan loop picks the same records.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "ota_diff.h"
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t size;
+    int failed;
+} ota_diff_buf_t;
+
+static void _put(ota_diff_buf_t *b, const void *data, size_t len)
+{
+    if (b->len + len > b->size) {
+        size_t size = b->size ? b->size : 4096;
+        while (size < b->len + len) {
+            size *= 2;
+        }
+        uint8_t *grown = realloc(b->data, size);
+        if (grown == NULL) {
+            b->failed = 1;
+            return;
+        }
+        b->data = grown;
+        b->size = size;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void _put_varint(ota_diff_buf_t *b, uint32_t v)
+{
+    uint8_t buf[5];
+    size_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    buf[n++] = v;
+    _put(b, buf, n);
+}
+
+static void _split(int64_t *I, int64_t *V, int64_t start, int64_t len, int64_t h)
+{
+    int64_t i, j, k, x, tmp, jj, kk;
+
+    if (len < 16) {
+        for (k = start; k < start + len; k += j) {
+            j = 1;
+            x = V[I[k] + h];
+            for (i = 1; k + i < start + len; i++) {
+                if (V[I[k + i] + h] < x) {
+                    x = V[I[k + i] + h];
+                    j = 0;
+                }
+                if (V[I[k + i] + h] == x) {
+                    tmp = I[k + j];
+                    I[k + j] = I[k + i];
+                    I[k + i] = tmp;
+                    j++;
+                }
+            }
+            for (i = 0; i < j; i++) {
+                V[I[k + i]] = k + j - 1;
+            }
+            if (j == 1) {
+                I[k] = -1;
+            }
+        }
+        return;
+    }
+
+    x = V[I[start + len / 2] + h];
+    jj = 0;
+    kk = 0;
+    for (i = start; i < start + len; i++) {
+        if (V[I[i] + h] < x) {
+            jj++;
+        }
+        if (V[I[i] + h] == x) {
+            kk++;
+        }
+    }
+    jj += start;
+    kk += jj;
+
+    i = start;
+    j = 0;
+    k = 0;
+    while (i < jj) {
+        if (V[I[i] + h] < x) {
+            i++;
+        } else if (V[I[i] + h] == x) {
+            tmp = I[i];
+            I[i] = I[jj + j];
+            I[jj + j] = tmp;
+            j++;
+        } else {
+            tmp = I[i];
+            I[i] = I[kk + k];
+            I[kk + k] = tmp;
+            k++;
+        }
+    }
+    while (jj + j < kk) {
+        if (V[I[jj + j] + h] == x) {
+            j++;
+        } else {
+            tmp = I[jj + j];
+            I[jj + j] = I[kk + k];
+            I[kk + k] = tmp;
+            k++;
+        }
+    }
+
+    if (jj > start) {
+        _split(I, V, start, jj - start, h);
+    }
+    for (i = 0; i < kk - jj; i++) {
+        V[I[jj + i]] = kk - 1;
+    }
+    if (jj == kk - 1) {
+        I[jj] = -1;
+    }
+    if (start + len > kk) {
+        _split(I, V, kk, start + len - kk, h);
+    }
+}
+
+static void _qsufsort(int64_t *I, int64_t *V, const uint8_t *old, int64_t old_size)
+{
+    int64_t buckets[256];
+    int64_t i, h, len;
+
+    memset(buckets, 0, sizeof(buckets));
+    for (i = 0; i < old_size; i++) {
+        buckets[old[i]]++;
+    }
+    for (i = 1; i < 256; i++) {
+        buckets[i] += buckets[i - 1];
+    }
+    for (i = 255; i > 0; i--) {
+        buckets[i] = buckets[i - 1];
+    }
+    buckets[0] = 0;
+
+    for (i = 0; i < old_size; i++) {
+        I[++buckets[old[i]]] = i;
+    }
+    I[0] = old_size;
+    for (i = 0; i < old_size; i++) {
+        V[i] = buckets[old[i]];
+    }
+    V[old_size] = 0;
+    for (i = 1; i < 256; i++) {
+        if (buckets[i] == buckets[i - 1] + 1) {
+            I[buckets[i]] = -1;
+        }
+    }
+    I[0] = -1;
+
+    for (h = 1; I[0] != -(old_size + 1); h += h) {
+        len = 0;
+        for (i = 0; i < old_size + 1;) {
+            if (I[i] < 0) {
+                len -= I[i];
+                i -= I[i];
+            } else {
+                if (len) {
+                    I[i - len] = -len;
+                }
+                len = V[I[i]] + 1 - i;
+                _split(I, V, i, len, h);
+                i += len;
+                len = 0;
+            }
+        }
+        if (len) {
+            I[i - len] = -len;
+        }
+    }
+
+    for (i = 0; i < old_size + 1; i++) {
+        I[V[i]] = i;
+    }
+}
+
+static int64_t _matchlen(const uint8_t *old, int64_t old_size, const uint8_t *new, int64_t new_size)
+{
+    int64_t i;
+    for (i = 0; i < old_size && i < new_size; i++) {
+        if (old[i] != new[i]) {
+            break;
+        }
+    }
+    return i;
+}
+
+static int64_t _search(const int64_t *I, const uint8_t *old, int64_t old_size,
+                       const uint8_t *new, int64_t new_size, int64_t st, int64_t en, int64_t *pos)
+{
+    while (en - st >= 2) {
+        int64_t x = st + (en - st) / 2;
+        int64_t n = old_size - I[x] < new_size ? old_size - I[x] : new_size;
+        if (memcmp(old + I[x], new, n) < 0) {
+            st = x;
+        } else {
+            en = x;
+        }
+    }
+    int64_t x = _matchlen(old + I[st], old_size - I[st], new, new_size);
+    int64_t y = _matchlen(old + I[en], old_size - I[en], new, new_size);
+    if (x > y) {
+        *pos = I[st];
+        return x;
+    }
+    *pos = I[en];
+    return y;
+}
+
+static void _record(ota_diff_buf_t *b, const uint8_t *old, const uint8_t *new, int64_t lastscan, int64_t lastpos,
+                    int64_t lenf, int64_t extra, int64_t seek)
+{
+    uint8_t diff[256];
+    _put_varint(b, lenf);
+    _put_varint(b, extra);
+    /* Zigzag, shifted unsigned: a left shift of a negative value is undefined */
+    _put_varint(b, (uint32_t)(((uint64_t)seek << 1) ^ (uint64_t)(seek >> 63)));
+    for (int64_t i = 0; i < lenf;) {
+        int64_t n = lenf - i < (int64_t)sizeof(diff) ? lenf - i : (int64_t)sizeof(diff);
+        for (int64_t k = 0; k < n; k++) {
+            diff[k] = new[lastscan + i + k] - old[lastpos + i + k];
+        }
+        _put(b, diff, n);
+        i += n;
+    }
+    _put(b, new + lastscan + lenf, extra);
+}
+
+uint8_t *ota_diff(const uint8_t *old, size_t old_size_, const uint8_t *new, size_t new_size_, size_t *patch_len)
+{
+    int64_t old_size = old_size_, new_size = new_size_;
+    int64_t *I = malloc((old_size + 1) * sizeof(int64_t));
+    int64_t *V = malloc((old_size + 1) * sizeof(int64_t));
+    ota_diff_buf_t b = { 0 };
+
+    if (I == NULL || V == NULL) {
+        free(I);
+        free(V);
+        return NULL;
+    }
+    _qsufsort(I, V, old, old_size);
+    free(V);
+
+    int64_t scan = 0, len = 0, pos = 0;
+    int64_t lastscan = 0, lastpos = 0, lastoffset = 0;
+    while (scan < new_size) {
+        int64_t oldscore = 0;
+        int64_t scsc;
+        for (scsc = scan += len; scan < new_size; scan++) {
+            len = _search(I, old, old_size, new + scan, new_size - scan, 0, old_size, &pos);
+            for (; scsc < scan + len; scsc++) {
+                if (scsc + lastoffset < old_size && old[scsc + lastoffset] == new[scsc]) {
+                    oldscore++;
+                }
+            }
+            if ((len == oldscore && len != 0) || len > oldscore + 8) {
+                break;
+            }
+            if (scan + lastoffset < old_size && old[scan + lastoffset] == new[scan]) {
+                oldscore--;
+            }
+        }
+
+        if (len != oldscore || scan == new_size) {
+            int64_t s = 0, Sf = 0, lenf = 0, i;
+            for (i = 0; lastscan + i < scan && lastpos + i < old_size;) {
+                if (old[lastpos + i] == new[lastscan + i]) {
+                    s++;
+                }
+                i++;
+                if (s * 2 - i > Sf * 2 - lenf) {
+                    Sf = s;
+                    lenf = i;
+                }
+            }
+
+            int64_t lenb = 0;
+            if (scan < new_size) {
+                int64_t Sb = 0;
+                s = 0;
+                for (i = 1; scan >= lastscan + i && pos >= i; i++) {
+                    if (old[pos - i] == new[scan - i]) {
+                        s++;
+                    }
+                    if (s * 2 - i > Sb * 2 - lenb) {
+                        Sb = s;
+                        lenb = i;
+                    }
+                }
+            }
+
+            if (lastscan + lenf > scan - lenb) {
+                int64_t overlap = (lastscan + lenf) - (scan - lenb);
+                int64_t Ss = 0, lens = 0;
+                s = 0;
+                for (i = 0; i < overlap; i++) {
+                    if (new[lastscan + lenf - overlap + i] == old[lastpos + lenf - overlap + i]) {
+                        s++;
+                    }
+                    if (new[scan - lenb + i] == old[pos - lenb + i]) {
+                        s--;
+                    }
+                    if (s > Ss) {
+                        Ss = s;
+                        lens = i + 1;
+                    }
+                }
+                lenf += lens - overlap;
+                lenb -= lens;
+            }
+
+            _record(&b, old, new, lastscan, lastpos, lenf, (scan - lenb) - (lastscan + lenf),
+                    (pos - lenb) - (lastpos + lenf));
+            lastscan = scan - lenb;
+            lastpos = pos - lenb;
+            lastoffset = pos - scan;
+        }
+    }
+    free(I);
+    if (b.failed) {
+        free(b.data);
+        return NULL;
+    }
+    *patch_len = b.len;
+    return b.data ? b.data : malloc(1);
+}
@@ -0,0 +1,13 @@
+/*
+ * bsdiff for the delta firmware format of app_delta.h: the same suffix
+ * sort and approximate-match scan, but records are written one after the
+ * other with their diff and extra bytes inline, so the device can apply
+ * the patch as it streams in.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Returns the patch (free() it) and its length in *patch_len, NULL if out of memory */
+uint8_t *ota_diff(const uint8_t *old, size_t old_size, const uint8_t *new, size_t new_size, size_t *patch_len);
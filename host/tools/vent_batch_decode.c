@@ -0,0 +1,102 @@
+#include <stdbool.h>
+
+#include "vent_batch_decode.h"
+
+#define VENT_BATCH_VERSION      1
+#define VENT_BATCH_COLUMNS      3
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool error;
+} reader_t;
+
+static uint32_t _varint(reader_t *r)
+{
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (r->p == r->end) {
+            break;
+        }
+        uint8_t b = *r->p++;
+        v |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+    r->error = true;
+    return 0;
+}
+
+static uint32_t _unzigzag(uint32_t zz)
+{
+    return (zz >> 1) ^ -(zz & 1);
+}
+
+static uint32_t *_field(vent_batch_sample_t *s, int col)
+{
+    switch (col) {
+        case 0:
+            return &s->volume;
+        case 1:
+            return &s->frequency;
+        default:
+            return &s->breath_in_time_ms;
+    }
+}
+
+static bool _header(reader_t *r, uint32_t *count, uint8_t *constant)
+{
+    if (r->p + 1 > r->end || *r->p++ != VENT_BATCH_VERSION) {
+        return false;
+    }
+    *count = _varint(r);
+    if (r->error || r->p == r->end) {
+        return false;
+    }
+    *constant = *r->p++;
+    return true;
+}
+
+int vent_batch_count(const uint8_t *in, size_t len)
+{
+    reader_t r = { .p = in, .end = in + len };
+    uint32_t count;
+    uint8_t constant;
+    return _header(&r, &count, &constant) ? (int)count : -1;
+}
+
+int vent_batch_decode(const uint8_t *in, size_t len, vent_batch_sample_t *out, size_t max)
+{
+    reader_t r = { .p = in, .end = in + len };
+    uint32_t count;
+    uint8_t constant;
+    if (!_header(&r, &count, &constant) || count == 0) {
+        return -1;
+    }
+    /* Columns come one after the other, all of each has to be read to reach the next */
+    uint32_t ts = _varint(&r);
+    for (uint32_t i = 0; i < count; i++) {
+        if (i) {
+            ts += _varint(&r);
+        }
+        if (i < max) {
+            out[i].timestamp = ts;
+        }
+    }
+    for (int col = 0; col < VENT_BATCH_COLUMNS; col++) {
+        uint32_t v = _varint(&r);
+        for (uint32_t i = 0; i < count; i++) {
+            if (i && !(constant & (1 << col))) {
+                v += _unzigzag(_varint(&r));
+            }
+            if (i < max) {
+                *_field(&out[i], col) = v;
+            }
+        }
+    }
+    if (r.error || r.p != r.end) {
+        return -1;
+    }
+    return count < max ? (int)count : (int)max;
+}
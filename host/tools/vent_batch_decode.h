@@ -0,0 +1,21 @@
+/*
+ * Reference decoder of the compact VentData batch (see
+ * components/app_manager/include/app_vent_batch.h), for clients and tests.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    uint32_t timestamp;
+    uint32_t volume;
+    uint32_t frequency;
+    uint32_t breath_in_time_ms;
+} vent_batch_sample_t;
+
+/* Samples in the batch, -1 if it is malformed */
+int vent_batch_count(const uint8_t *in, size_t len);
+
+/* Decodes up to `max` samples, returns how many or -1 if the batch is malformed */
+int vent_batch_decode(const uint8_t *in, size_t len, vent_batch_sample_t *out, size_t max);
@@ -17,9 +17,34 @@
 
 #include "ble_prov.h"
 #include "app_manager.h"
+#include "app_acquire.h"
+#include "app_history.h"
+#include "app_log_sink.h"
 
 static const char *TAG = "OPENVENT";
 
+/* Placeholder sensor transfer functions (12 bit counts), until the fitted sensors are calibrated */
+#define ACQUIRE_PRESSURE_OFFSET     410.0f      /* cmH2O */
+#define ACQUIRE_PRESSURE_SCALE      0.0273f
+#define ACQUIRE_FLOW_OFFSET         2048.0f     /* L/min, bidirectional */
+#define ACQUIRE_FLOW_SCALE          0.0977f
+/* The acquisition task runs right above the control loop, on the same core */
+#define ACQUIRE_PRIORITY            11
+#if CONFIG_FREERTOS_UNICORE
+#define ACQUIRE_CORE                0
+#else
+#define ACQUIRE_CORE                1
+#endif
+#if CONFIG_ACQUIRE_RAW_RATE_HZ % CONFIG_VENT_CONTROL_RATE_HZ
+#error "CONFIG_ACQUIRE_RAW_RATE_HZ must be a multiple of CONFIG_VENT_CONTROL_RATE_HZ"
+#endif
+/* Log lines reach the UART and file from just above idle */
+#define LOG_SINK_PRIORITY           1
+#define LOG_SINK_POLL_MS            20
+#define LOG_SINK_FILE               "/spiffs/log.txt"
+/* Four SPIFFS pages of lines written to the file at once */
+#define LOG_SINK_FILE_BUFFER        (4 * APP_RECORD_LOG_PAGE)
+
 
 static esp_err_t _app_manager_event_handler(void **ctx, VentRequest *req, VentResponse *resp)
 {
@@ -45,6 +70,16 @@ static esp_err_t _app_manager_event_handler(void **ctx, VentRequest *req, VentRe
             }
             return ret;
         }
+        case COMMAND__ReadFileRequest:
+            return app_manager_file_read_handle(ctx, req, resp);
+        case COMMAND__WriteFirmwareRequest:
+            return app_manager_firmware_handle(ctx, req, resp);
+        case COMMAND__ReadFirmwareRequest:
+            return app_manager_firmware_read_handle(ctx, req, resp);
+        case COMMAND__VentDataRequest:
+            return app_manager_vent_data_handle(ctx, req, resp);
+        case COMMAND__VentConfigRequest:
+            return app_manager_vent_config_handle(ctx, req, resp);
     }
     return app_manager_response(resp);
 }
@@ -53,6 +88,17 @@ void app_main(void)
 {
     esp_log_level_set("*", ESP_LOG_INFO);
     esp_log_level_set(TAG, ESP_LOG_DEBUG);
+    app_log_sink_cfg_t log_cfg = {
+        .slots = CONFIG_LOG_SINK_SLOTS,
+        .console = true,
+        .max_file_size = CONFIG_LOG_SINK_FILE_KB * 1024,
+        .file_buffer = LOG_SINK_FILE_BUFFER,
+        .flush_ms = CONFIG_LOG_SINK_FILE_FLUSH_S * 1000,
+        .poll_ms = LOG_SINK_POLL_MS,
+        .priority = LOG_SINK_PRIORITY,
+        .core = tskNO_AFFINITY,
+    };
+    app_log_sink_start(&log_cfg);
 
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES) {
@@ -70,6 +116,42 @@ void app_main(void)
     };
 
     app_manager_init(&app_man_cfg);
+    app_history_cfg_t hist_cfg = {
+        .rate_hz = CONFIG_VENT_CONTROL_RATE_HZ,
+        .tiers = 3,
+        .tier = {
+            { .factor = 1, .capacity = CONFIG_HISTORY_RAW_SECONDS * CONFIG_VENT_CONTROL_RATE_HZ },
+            { .factor = 10, .capacity = CONFIG_HISTORY_10X_SECONDS * CONFIG_VENT_CONTROL_RATE_HZ / 10 },
+            { .factor = 100, .capacity = CONFIG_HISTORY_100X_MINUTES * 60 * CONFIG_VENT_CONTROL_RATE_HZ / 100 },
+        },
+    };
+    app_history_t *hist = app_history_new(&hist_cfg);
+    app_acquire_cfg_t acq_cfg = {
+        .raw_rate_hz = CONFIG_ACQUIRE_RAW_RATE_HZ,
+        .rate_hz = CONFIG_VENT_CONTROL_RATE_HZ,
+        .cutoff_hz = CONFIG_ACQUIRE_CUTOFF_HZ,
+        .max_raw = 256,
+        .pressure = {
+            .channel = CONFIG_ACQUIRE_PRESSURE_CHANNEL,
+            .offset = ACQUIRE_PRESSURE_OFFSET,
+            .scale = ACQUIRE_PRESSURE_SCALE,
+        },
+        .flow = {
+            .channel = CONFIG_ACQUIRE_FLOW_CHANNEL,
+            .offset = ACQUIRE_FLOW_OFFSET,
+            .scale = ACQUIRE_FLOW_SCALE,
+        },
+        .on_block = hist ? app_history_acquire_block : NULL,
+        .arg = hist,
+    };
+    app_acquire_t *acq = app_acquire_new(&acq_cfg);
+    if (acq && app_adc_start(acq, &acq_cfg, ACQUIRE_PRIORITY, ACQUIRE_CORE) != ESP_OK) {
+        app_acquire_delete(acq);
+        acq = NULL;
+    }
+    /* No valve driver yet; without the sensors the state machine runs on its timing alone */
+    app_manager_control_start(acq ? app_acquire_control_read : NULL, NULL, acq);
+    app_manager_vent_data_start(app_control_sample, app_manager_get_control());
 
     const static protocomm_security_pop_t app_pop = {
         .data = (uint8_t *) CONFIG_SECURITY_POP,
@@ -114,6 +196,10 @@ void app_main(void)
     } else {
         ESP_LOGI(TAG, "Partition size: total: %d, used: %d", total, used);
     }
+    app_manager_telemetry_start(hist);
+#if CONFIG_LOG_SINK_TO_FILE
+    app_log_sink_set_file(LOG_SINK_FILE);
+#endif
 
     ESP_LOGI(TAG, "free mem=%d\n", esp_get_free_heap_size());
 }